@@ -13,12 +13,16 @@
 #include <android/asset_manager_jni.h>
 #include <assert.h>
 #include <jni.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string>
+#include <time.h>
 #include <android/log.h>
 #include <EGL/egl.h>
 
 static JavaVM* javaVm;
 static AAssetManager* asset_manager;
+static std::string cache_path;
 
 static ztr_platform_api_t g_platform;
 static ztr_hid_t hid;
@@ -39,17 +43,87 @@ PLATFORM_OPEN_FILE(openFile)
     return (result);
 }
 
+PLATFORM_READ_CACHE_FILE(readCacheFile)
+{
+    assert (fileName != NULL);
+    ztr_file_t result = {};
+
+    std::string path = cache_path + "/" + fileName;
+    FILE *file = fopen (path.c_str (), "rb");
+    if (file != NULL)
+    {
+        fseek (file, 0, SEEK_END);
+        long size = ftell (file);
+        fseek (file, 0, SEEK_SET);
+
+        void *data = malloc (size);
+        if (size > 0 && fread (data, 1, size, file) == (size_t) size)
+        {
+            result.data = data;
+            result.dataSize = (unsigned int) size;
+        }
+        else
+        {
+            free (data);
+        }
+        fclose (file);
+    }
+
+    return (result);
+}
+
+PLATFORM_WRITE_CACHE_FILE(writeCacheFile)
+{
+    assert (fileName != NULL);
+
+    // Written next to the entry and renamed so readers never see half a file
+    std::string path = cache_path + "/" + fileName;
+    std::string temporaryPath = path + ".tmp";
+    FILE *file = fopen (temporaryPath.c_str (), "wb");
+    if (file == NULL)
+    {
+        return (0);
+    }
+
+    int written = fwrite (data, 1, dataSize, file) == dataSize;
+    written = (fclose (file) == 0) && written;
+    if (!written || rename (temporaryPath.c_str (), path.c_str ()) != 0)
+    {
+        remove (temporaryPath.c_str ());
+        return (0);
+    }
+
+    return (1);
+}
+
+PLATFORM_GET_TIME(getTime)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((double) now.tv_sec + (double) now.tv_nsec*1e-9);
+}
+
 extern "C" JNIEXPORT void JNICALL
-Java_com_zozo_ztr_1android_RenderLib_init(JNIEnv* env, void *reserved, jobject assetManager)
+Java_com_zozo_ztr_1android_RenderLib_init(JNIEnv* env, void *reserved, jobject assetManager, jstring cachePath)
 {
     env->GetJavaVM(&javaVm);
     asset_manager = AAssetManager_fromJava(env, assetManager);
+
+    const char *path = env->GetStringUTFChars(cachePath, NULL);
+    cache_path = path;
+    env->ReleaseStringUTFChars(cachePath, path);
+
     g_platform.openFile = openFile;
+    g_platform.readCacheFile = readCacheFile;
+    g_platform.writeCacheFile = writeCacheFile;
+    g_platform.getTime = getTime;
 
     ztrInit (&g_platform);
 }
 
-extern "C" JNIEXPORT void JNICALL
+// GLSurfaceView swaps after every draw, so frames are only requested when
+// something may have changed and each of them is drawn in full
+extern "C" JNIEXPORT jint JNICALL
 Java_com_zozo_ztr_1android_RenderLib_draw(JNIEnv* env, jobject obj, jint mouseDown, jint mouseDownUp, jint x, jint y)
 {
     hid.mouseDown = static_cast<int> (mouseDown);
@@ -57,11 +131,14 @@ Java_com_zozo_ztr_1android_RenderLib_draw(JNIEnv* env, jobject obj, jint mouseDo
     hid.mouseX = static_cast<int> (x);
     hid.mouseY = static_cast<int> (-y);
 
-    ztrDraw (0, hid);
+    ztrInvalidate ();
+    int frame = ztrDraw (0, hid);
 
     hid.mouseTransition = 0;
     hid.doubleTap = 0;
     hid.pinchZoomTransition = 0;
+
+    return (frame);
 }
 
 extern "C" JNIEXPORT void JNICALL
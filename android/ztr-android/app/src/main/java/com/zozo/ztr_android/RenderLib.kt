@@ -16,11 +16,15 @@ public class RenderLib {
             System.loadLibrary("native-lib-renderer")
         }
 
+        // Flags returned by draw, must match ztr_platform_abstraction_layer.h
+        const val FRAME_DRAWN = 1
+        const val FRAME_ANIMATING = 2
+
         @JvmStatic
-        external fun init(assetManager: AssetManager)
+        external fun init(assetManager: AssetManager, cachePath: String)
 
         @JvmStatic
-        external fun draw(mouseDown: Int, mouseDownUp: Int, x: Int, y: Int)
+        external fun draw(mouseDown: Int, mouseDownUp: Int, x: Int, y: Int): Int
 
         @JvmStatic
         external fun resize(width: Int, height: Int)
@@ -25,12 +25,15 @@ class RenderView(context: Context, onSurfaceCreatedClosure: ((view: RenderView)
         setEGLConfigChooser(8, 8, 8, 0, 16, 0)
         setEGLContextClientVersion(3)
 
-        var renderer = Renderer(context.assets)
+        var renderer = Renderer(context.assets, context.cacheDir.absolutePath)
 
         renderer.onSurfaceCreatedClosure = onSurfaceCreatedClosure
         renderer.view = this
 
         setRenderer(renderer)
+
+        // Frames are requested on input and while the scene animates
+        renderMode = RENDERMODE_WHEN_DIRTY
     }
 
     // Pull these directly from the NDK
@@ -56,10 +59,11 @@ class RenderView(context: Context, onSurfaceCreatedClosure: ((view: RenderView)
                 _mouseDownUp = 1
             }
         }
+        requestRender()
         return true
     }
 
-    inner class Renderer(val assetManager: AssetManager) : GLSurfaceView.Renderer {
+    inner class Renderer(val assetManager: AssetManager, val cachePath: String) : GLSurfaceView.Renderer {
 
         var view: RenderView? = null
         var onSurfaceCreatedClosure: ((view: RenderView) -> Unit)? = null
@@ -67,13 +71,17 @@ class RenderView(context: Context, onSurfaceCreatedClosure: ((view: RenderView)
 
         override fun onDrawFrame(gl: GL10) {
 
-            RenderLib.draw(
+            val frame = RenderLib.draw(
                     this@RenderView._mouseDown,
                     this@RenderView._mouseDownUp,
                     this@RenderView._mouseX,
                     this@RenderView._mouseY
             )
             _mouseDownUp = 0
+
+            if (frame and RenderLib.FRAME_ANIMATING != 0) {
+                this@RenderView.requestRender()
+            }
         }
 
         override fun onSurfaceChanged(gl: GL10, width: Int, height: Int) {
@@ -81,7 +89,7 @@ class RenderView(context: Context, onSurfaceCreatedClosure: ((view: RenderView)
         }
 
         override fun onSurfaceCreated(gl: GL10, config: EGLConfig) {
-            RenderLib.init(this.assetManager)
+            RenderLib.init(this.assetManager, this.cachePath)
 
             this.view?.let {
                 onSurfaceCreatedClosure?.invoke(it)
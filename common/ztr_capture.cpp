@@ -0,0 +1,222 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_capture.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Asynchronous readback of drawn frames. glReadPixels into client memory
+// waits for the GPU to finish the frame and then copies on the render
+// thread. Here the pixels go into a pixel pack buffer instead, a fence
+// marks when the copy is done and the buffer is mapped only then, usually
+// a frame or more later. The mapping is handed out as is: hosts encode it
+// on other threads and release it when done, nothing is copied again.
+//
+
+// MARK: Constants
+
+// Captures pending or held at once, a screenshot, a few thumbnails being
+// encoded or the frames of a video waiting for the encoder
+#define CAPTURE_SLOTS 8
+
+// Longer waits are reported and the capture is handed out anyway
+#define CAPTURE_TIMEOUT 1000000000ull
+
+// MARK: Enums
+
+enum capture_state_t
+{
+    CaptureState_Free,
+
+    // The copy is queued, its fence tells when it is done
+    CaptureState_Reading,
+
+    // Handed out until released
+    CaptureState_Mapped,
+};
+
+// MARK: Structs
+
+struct capture_slot_t
+{
+    GLuint buffer;
+    GLsizeiptr size;
+    GLsync fence;
+    capture_state_t state;
+
+    // Order of the captures, the oldest is finished first
+    unsigned int sequence;
+
+    unsigned int tag;
+    int width;
+    int height;
+};
+
+struct capture_ring_t
+{
+    capture_slot_t slots[CAPTURE_SLOTS];
+    unsigned int sequence;
+};
+
+// MARK: Globals
+
+static capture_ring_t g_captureRing;
+
+// MARK: Functions
+
+static void
+InitCaptureRing (capture_ring_t *ring)
+{
+    *ring = {};
+}
+
+static void
+FreeCaptureRing (capture_ring_t *ring)
+{
+    for (int i=0 ; i<CAPTURE_SLOTS ; i++)
+    {
+        capture_slot_t *slot = ring->slots + i;
+        if (slot->state == CaptureState_Mapped)
+        {
+            glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+            glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+        }
+        if (slot->fence != 0)
+        {
+            glDeleteSync (slot->fence);
+        }
+        if (slot->buffer != 0)
+        {
+            glDeleteBuffers (1, &slot->buffer);
+        }
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+    *ring = {};
+}
+
+// Queues the copy of the bound read framebuffer, returns 0 when every slot
+// is taken
+static int
+CaptureRead (capture_ring_t *ring, unsigned int tag, int width, int height)
+{
+    capture_slot_t *slot = NULL;
+    for (int i=0 ; i<CAPTURE_SLOTS && slot == NULL ; i++)
+    {
+        if (ring->slots[i].state == CaptureState_Free)
+        {
+            slot = ring->slots + i;
+        }
+    }
+    if (slot == NULL || width <= 0 || height <= 0)
+    {
+        return (0);
+    }
+
+    if (slot->buffer == 0)
+    {
+        glGenBuffers (1, &slot->buffer);
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+
+    // Kept across captures of the same size
+    GLsizeiptr size = (GLsizeiptr) width*height*4;
+    if (slot->size != size)
+    {
+        glBufferData (GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot->size = size;
+    }
+
+    glPixelStorei (GL_PACK_ALIGNMENT, 4);
+    glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+    // Flushed so the copy starts even if no frame follows
+    slot->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush ();
+
+    slot->state = CaptureState_Reading;
+    slot->sequence = ring->sequence++;
+    slot->tag = tag;
+    slot->width = width;
+    slot->height = height;
+    return (1);
+}
+
+// Maps the oldest capture once its fence has signaled
+static int
+CaptureFinish (capture_ring_t *ring, ztr_capture_t *capture, int wait)
+{
+    capture_slot_t *slot = NULL;
+    for (int i=0 ; i<CAPTURE_SLOTS ; i++)
+    {
+        capture_slot_t *candidate = ring->slots + i;
+        if (candidate->state == CaptureState_Reading &&
+            (slot == NULL || (int) (candidate->sequence - slot->sequence) < 0))
+        {
+            slot = candidate;
+        }
+    }
+    if (slot == NULL)
+    {
+        return (0);
+    }
+
+    GLenum status = glClientWaitSync (slot->fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        if (!wait)
+        {
+            return (0);
+        }
+        status = glClientWaitSync (slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                   CAPTURE_TIMEOUT);
+    }
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+    {
+        printf ("Capture %u still being copied, mapping it anyway\n", slot->tag);
+    }
+    glDeleteSync (slot->fence);
+    slot->fence = 0;
+
+    // A mapping stays valid with the buffer unbound
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+    const unsigned char *pixels =
+        (const unsigned char *) glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, slot->size,
+                                                  GL_MAP_READ_BIT);
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+    if (pixels == NULL)
+    {
+        printf ("Could not map capture %u\n", slot->tag);
+        slot->state = CaptureState_Free;
+        return (0);
+    }
+
+    slot->state = CaptureState_Mapped;
+    capture->stride = -slot->width*4;
+    capture->pixels = pixels + (size_t) (slot->height - 1)*slot->width*4;
+    capture->width = slot->width;
+    capture->height = slot->height;
+    capture->tag = slot->tag;
+    capture->slot = (int) (slot - ring->slots);
+    return (1);
+}
+
+static void
+CaptureRelease (capture_ring_t *ring, ztr_capture_t *capture)
+{
+    if (capture->slot < 0 || capture->slot >= CAPTURE_SLOTS)
+    {
+        return;
+    }
+
+    capture_slot_t *slot = ring->slots + capture->slot;
+    if (slot->state == CaptureState_Mapped)
+    {
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+        glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+        slot->state = CaptureState_Free;
+    }
+
+    capture->pixels = NULL;
+    capture->slot = -1;
+}
@@ -0,0 +1,366 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_dynamic_resolution.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Frames are drawn into the corner of an offscreen framebuffer the size of
+// the backbuffer and stretched onto the backbuffer with a linear blit, so a
+// lower scale costs no reallocation. The scale steps along a fixed ladder
+// from the measured frame time: down after a few samples over the budget,
+// up only after many samples well under it, so a scale close to the budget
+// does not flip back and forth. GPU time comes from timer queries read a
+// few frames late. Without them, every few frames the GPU is drained with a
+// fence and the frame is timed on the CPU up to its own fence, which also
+// counts the time spent recording it. At full scale the backbuffer is drawn
+// to directly and the blit is skipped.
+//
+
+// MARK: Constants
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+// A 60 Hz frame with some margin
+#define DYNRES_BUDGET_MS 14.f
+
+// Share of the budget below which the scale may go up
+#define DYNRES_HEADROOM 0.7f
+
+// Consecutive samples needed to change the scale
+#define DYNRES_DOWN_SAMPLES 4
+#define DYNRES_UP_SAMPLES 30
+
+// Weight of a new sample in the smoothed frame time
+#define DYNRES_SMOOTHING 0.2f
+
+#define DYNRES_QUERY_COUNT 4
+
+// Without timer queries one frame in this many is timed with fences
+#define DYNRES_FENCE_INTERVAL 8
+#define DYNRES_FENCE_TIMEOUT 100000000ull
+
+#define DYNRES_LEVEL_COUNT 6
+
+// MARK: Enums
+
+enum frame_timer_t
+{
+    FrameTimer_Query,
+    FrameTimer_Fence,
+};
+
+// MARK: Structs
+
+struct dynamic_resolution_t
+{
+    frame_timer_t timer;
+    int disjointQueries;
+
+    // Color and depth of the backbuffer size, 0 until the first scaled frame
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    int storageWidth;
+    int storageHeight;
+    int complete;
+
+    // Backbuffer of the platform and the size drawn this frame
+    GLint target;
+    int width;
+    int height;
+    int scaledWidth;
+    int scaledHeight;
+
+    // Index into g_dynamicResolutionScales, and the scale actually drawn,
+    // frames that must look sharp are drawn at full scale at any level
+    int level;
+    float scale;
+
+    // Timer queries from oldest to newest, with the scale they were drawn at
+    GLuint queries[DYNRES_QUERY_COUNT];
+    float queryScales[DYNRES_QUERY_COUNT];
+    unsigned int queryFirst;
+    unsigned int queryCount;
+    int queryActive;
+
+    unsigned int fenceFrame;
+    std::chrono::high_resolution_clock::time_point fenceStart;
+
+    // Milliseconds
+    float budget;
+    float frameTime;
+    int overSamples;
+    int underSamples;
+};
+
+// MARK: Globals
+
+static dynamic_resolution_t g_dynamicResolution;
+
+static const float g_dynamicResolutionScales[DYNRES_LEVEL_COUNT] = {
+    1.f, 0.9f, 0.8f, 0.7f, 0.6f, 0.5f,
+};
+
+// MARK: Functions
+
+// Timer queries are core in desktop GL 3.3, ES needs the extension
+static void
+InitDynamicResolution (dynamic_resolution_t *dr, int coreTimerQueries)
+{
+    *dr = {};
+    dr->budget = DYNRES_BUDGET_MS;
+    dr->scale = 1.f;
+
+    GLint extensionCount = 0;
+    glGetIntegerv (GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i=0 ; i<extensionCount ; i++)
+    {
+        const char *extension = (const char *) glGetStringi (GL_EXTENSIONS, i);
+        if (extension != NULL &&
+            strcmp (extension, "GL_EXT_disjoint_timer_query") == 0)
+        {
+            dr->disjointQueries = 1;
+        }
+    }
+
+    dr->timer = (coreTimerQueries || dr->disjointQueries) ?
+        FrameTimer_Query : FrameTimer_Fence;
+    if (dr->timer == FrameTimer_Query)
+    {
+        glGenQueries (DYNRES_QUERY_COUNT, dr->queries);
+    }
+}
+
+static void
+FreeDynamicResolution (dynamic_resolution_t *dr)
+{
+    if (dr->timer == FrameTimer_Query)
+    {
+        glDeleteQueries (DYNRES_QUERY_COUNT, dr->queries);
+    }
+    if (dr->framebuffer != 0)
+    {
+        glDeleteFramebuffers (1, &dr->framebuffer);
+        glDeleteRenderbuffers (1, &dr->color);
+        glDeleteRenderbuffers (1, &dr->depth);
+    }
+    *dr = {};
+}
+
+// Leaves the offscreen framebuffer bound
+static void
+DynamicResolutionStorage (dynamic_resolution_t *dr, int width, int height)
+{
+    if (dr->framebuffer == 0)
+    {
+        glGenFramebuffers (1, &dr->framebuffer);
+        glGenRenderbuffers (1, &dr->color);
+        glGenRenderbuffers (1, &dr->depth);
+    }
+    glBindFramebuffer (GL_FRAMEBUFFER, dr->framebuffer);
+
+    if (dr->storageWidth != width || dr->storageHeight != height)
+    {
+        GLint renderbuffer = 0;
+        glGetIntegerv (GL_RENDERBUFFER_BINDING, &renderbuffer);
+
+        glBindRenderbuffer (GL_RENDERBUFFER, dr->color);
+        glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_RENDERBUFFER, dr->color);
+        glBindRenderbuffer (GL_RENDERBUFFER, dr->depth);
+        glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+        glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                   GL_RENDERBUFFER, dr->depth);
+        glBindRenderbuffer (GL_RENDERBUFFER, (GLuint) renderbuffer);
+
+        dr->storageWidth = width;
+        dr->storageHeight = height;
+        dr->complete = glCheckFramebufferStatus (GL_FRAMEBUFFER) ==
+                       GL_FRAMEBUFFER_COMPLETE;
+        if (!dr->complete)
+        {
+            printf ("Dynamic resolution framebuffer incomplete, "
+                    "drawing at full scale\n");
+        }
+    }
+}
+
+static void
+DynamicResolutionSample (dynamic_resolution_t *dr, float milliseconds, float scale)
+{
+    // Samples drawn at another scale say nothing about the current level
+    if (scale != g_dynamicResolutionScales[dr->level])
+    {
+        return;
+    }
+
+    dr->frameTime = (dr->frameTime == 0.f) ? milliseconds :
+        HMM_Lerp (dr->frameTime, DYNRES_SMOOTHING, milliseconds);
+
+    if (dr->frameTime > dr->budget)
+    {
+        dr->overSamples++;
+        dr->underSamples = 0;
+    }
+    else if (dr->frameTime < dr->budget*DYNRES_HEADROOM)
+    {
+        dr->underSamples++;
+        dr->overSamples = 0;
+    }
+    else
+    {
+        dr->overSamples = 0;
+        dr->underSamples = 0;
+    }
+
+    int level = dr->level;
+    if (dr->overSamples >= DYNRES_DOWN_SAMPLES && level < DYNRES_LEVEL_COUNT - 1)
+    {
+        level++;
+    }
+    else if (dr->underSamples >= DYNRES_UP_SAMPLES && level > 0)
+    {
+        level--;
+    }
+
+    if (level != dr->level)
+    {
+#ifdef _DEBUG
+        printf ("Dynamic resolution %.2f, frame time %.2f ms\n",
+                g_dynamicResolutionScales[level], dr->frameTime);
+#endif
+        dr->level = level;
+        dr->frameTime = 0.f;
+        dr->overSamples = 0;
+        dr->underSamples = 0;
+    }
+}
+
+// Reads finished queries without waiting on the rest
+static void
+DynamicResolutionCollect (dynamic_resolution_t *dr)
+{
+    // Reading the flag clears it, results finished since the last read are
+    // not trusted when it was set
+    GLint disjoint = 0;
+    if (dr->disjointQueries && dr->queryCount > 0)
+    {
+        glGetIntegerv (GL_GPU_DISJOINT_EXT, &disjoint);
+    }
+
+    while (dr->queryCount > 0)
+    {
+        GLuint query = dr->queries[dr->queryFirst];
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv (query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            break;
+        }
+
+        // Nanoseconds, a 32 bit result covers four seconds
+        GLuint elapsed = 0;
+        glGetQueryObjectuiv (query, GL_QUERY_RESULT, &elapsed);
+        if (!disjoint)
+        {
+            DynamicResolutionSample (dr, (float) elapsed*1e-6f,
+                                     dr->queryScales[dr->queryFirst]);
+        }
+
+        dr->queryFirst = (dr->queryFirst + 1)%DYNRES_QUERY_COUNT;
+        dr->queryCount--;
+    }
+}
+
+// Binds where the frame is drawn. Full keeps the backbuffer, for frames
+// that stay on screen
+static void
+DynamicResolutionBegin (dynamic_resolution_t *dr, int width, int height, int full)
+{
+    if (dr->timer == FrameTimer_Query)
+    {
+        DynamicResolutionCollect (dr);
+    }
+
+    dr->width = width;
+    dr->height = height;
+    dr->scale = (full || (dr->storageWidth > 0 && !dr->complete)) ?
+        1.f : g_dynamicResolutionScales[dr->level];
+    dr->scaledWidth = HMM_MAX ((int) (width*dr->scale + 0.5f), 1);
+    dr->scaledHeight = HMM_MAX ((int) (height*dr->scale + 0.5f), 1);
+
+    if (dr->scale < 1.f)
+    {
+        glGetIntegerv (GL_FRAMEBUFFER_BINDING, &dr->target);
+        DynamicResolutionStorage (dr, width, height);
+        if (!dr->complete)
+        {
+            glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) dr->target);
+            dr->scale = 1.f;
+            dr->scaledWidth = width;
+            dr->scaledHeight = height;
+        }
+    }
+    glViewport (0, 0, dr->scaledWidth, dr->scaledHeight);
+
+    dr->queryActive = 0;
+    if (dr->timer == FrameTimer_Query && dr->queryCount < DYNRES_QUERY_COUNT)
+    {
+        unsigned int slot = (dr->queryFirst + dr->queryCount)%DYNRES_QUERY_COUNT;
+        dr->queryScales[slot] = dr->scale;
+        glBeginQuery (GL_TIME_ELAPSED_EXT, dr->queries[slot]);
+        dr->queryActive = 1;
+    }
+    else if (dr->timer == FrameTimer_Fence &&
+             dr->fenceFrame++%DYNRES_FENCE_INTERVAL == 0)
+    {
+        // Earlier frames must be done or their time would be counted too
+        GLsync idle = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glClientWaitSync (idle, GL_SYNC_FLUSH_COMMANDS_BIT, DYNRES_FENCE_TIMEOUT);
+        glDeleteSync (idle);
+        dr->fenceStart = std::chrono::high_resolution_clock::now ();
+    }
+}
+
+// Stretches a scaled frame onto the backbuffer and ends its timing
+static void
+DynamicResolutionEnd (dynamic_resolution_t *dr)
+{
+    if (dr->scale < 1.f)
+    {
+        glBindFramebuffer (GL_READ_FRAMEBUFFER, dr->framebuffer);
+        glBindFramebuffer (GL_DRAW_FRAMEBUFFER, (GLuint) dr->target);
+        glBlitFramebuffer (0, 0, dr->scaledWidth, dr->scaledHeight,
+                           0, 0, dr->width, dr->height,
+                           GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) dr->target);
+        glViewport (0, 0, dr->width, dr->height);
+    }
+
+    if (dr->queryActive)
+    {
+        glEndQuery (GL_TIME_ELAPSED_EXT);
+        dr->queryCount++;
+        dr->queryActive = 0;
+    }
+    else if (dr->timer == FrameTimer_Fence &&
+             (dr->fenceFrame - 1)%DYNRES_FENCE_INTERVAL == 0)
+    {
+        GLsync done = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        GLenum waited = glClientWaitSync (done, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                          DYNRES_FENCE_TIMEOUT);
+        glDeleteSync (done);
+        if (waited != GL_TIMEOUT_EXPIRED && waited != GL_WAIT_FAILED)
+        {
+            DynamicResolutionSample (dr, ScanMeshMilliseconds (dr->fenceStart),
+                                     dr->scale);
+        }
+    }
+}
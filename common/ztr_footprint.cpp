@@ -0,0 +1,782 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_footprint.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Plantar footprint of a scan on the ground plane (model space XZ, Y up).
+// Triangles below the cut height are rasterized into a coverage grid in
+// parallel, the outline is traced with marching squares and the convex hull
+// comes from a quickhull over the per row extremes. Widths are measured
+// across the main axis of the hull.
+//
+
+// MARK: Constants
+
+#define FOOTPRINT_GRID_RESOLUTION_DEFAULT 512
+#define FOOTPRINT_WIDTH_SAMPLES 32
+#define FOOTPRINT_BOUNDS_BATCH (1 << 16)
+
+// Quickhull subsets larger than this are reduced in chunks and split with
+// ParallelFor. The hull input is four corners per covered row, about 2k
+// points on the default grid, so the first levels of the recursion do.
+// Below the first parallel split each half recurses serially, a nested
+// ParallelFor would only run inline
+#define FOOTPRINT_PARALLEL_HULL_POINTS 512
+#define FOOTPRINT_HULL_CHUNK_POINTS 256
+
+// MARK: Structs
+
+struct footprint_params_t
+{
+    // Off by default, only the footprint overlay uses it. Turned on with
+    // the overlay before loading
+    int enabled;
+
+    // Cells along the longer side of the projected bounds
+    int gridResolution;
+
+    // Only geometry below minY + cutHeight counts, zero takes everything
+    float cutHeight;
+};
+
+struct footprint_t
+{
+    // Closed outline loops, loop i is outline[loopStart[i], loopStart[i + 1])
+    hmm_vec2 *outline;
+    unsigned int outlineCount;
+    unsigned int *loopStart;
+    unsigned int loopCount;
+
+    // Counter clockwise convex hull
+    hmm_vec2 *hull;
+    unsigned int hullCount;
+
+    // Main axis (heel to toe direction is not distinguished)
+    hmm_vec2 axis;
+    float length;
+    float width;
+    float area;
+    float hullArea;
+    float widths[FOOTPRINT_WIDTH_SAMPLES];
+
+    double milliseconds;
+};
+
+struct footprint_grid_t
+{
+    int w, h;
+    hmm_vec2 origin;
+    float cellSize;
+    float invCellSize;
+    std::atomic<unsigned char> *cells;
+};
+
+// MARK: Utility Functions
+
+inline void
+InitFootprintParams (footprint_params_t *params)
+{
+    params->enabled = 0;
+    params->gridResolution = FOOTPRINT_GRID_RESOLUTION_DEFAULT;
+    params->cutHeight = 0.f;
+}
+
+static void
+FreeFootprint (footprint_t *footprint)
+{
+    free (footprint->outline);
+    free (footprint->loopStart);
+    free (footprint->hull);
+
+    *footprint = {};
+}
+
+inline float
+FootprintCross (hmm_vec2 o, hmm_vec2 a, hmm_vec2 b)
+{
+    return ((a.X - o.X)*(b.Y - o.Y) - (a.Y - o.Y)*(b.X - o.X));
+}
+
+// Grid space coordinates are never below -0.5, truncation is enough and
+// avoids the libm calls on targets without SSE4.1 rounding
+inline int
+FootprintFloor (float x)
+{
+    return ((int) (x + 1.f) - 1);
+}
+
+inline int
+FootprintCeil (float x)
+{
+    int floor = FootprintFloor (x);
+    return (floor + ((float) floor < x));
+}
+
+inline float
+FootprintPolygonArea (hmm_vec2 *points, unsigned int count)
+{
+    float area = 0.f;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        hmm_vec2 a = points[i];
+        hmm_vec2 b = points[(i + 1)%count];
+        area += a.X*b.Y - b.X*a.Y;
+    }
+    return (0.5f*area);
+}
+
+// MARK: Rasterization
+
+// Marks the cells whose centre lies inside the projected triangle
+static void
+FootprintRasterTriangle (footprint_grid_t *grid,
+                         hmm_vec2 a, hmm_vec2 b, hmm_vec2 c)
+{
+    // Grid space, cell (x, y) is sampled at integer (x, y)
+    float ox = grid->origin.X + 0.5f*grid->cellSize;
+    float oy = grid->origin.Y + 0.5f*grid->cellSize;
+    float inv = grid->invCellSize;
+    a = HMM_Vec2 ((a.X - ox)*inv, (a.Y - oy)*inv);
+    b = HMM_Vec2 ((b.X - ox)*inv, (b.Y - oy)*inv);
+    c = HMM_Vec2 ((c.X - ox)*inv, (c.Y - oy)*inv);
+
+    int x0 = FootprintCeil (HMM_MIN (a.X, HMM_MIN (b.X, c.X)));
+    int x1 = FootprintFloor (HMM_MAX (a.X, HMM_MAX (b.X, c.X)));
+    int y0 = FootprintCeil (HMM_MIN (a.Y, HMM_MIN (b.Y, c.Y)));
+    int y1 = FootprintFloor (HMM_MAX (a.Y, HMM_MAX (b.Y, c.Y)));
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 >= grid->w) ? (grid->w - 1) : x1;
+    y1 = (y1 >= grid->h) ? (grid->h - 1) : y1;
+
+    // Most scan triangles are smaller than a cell and miss every centre
+    if (x0 > x1 || y0 > y1)
+    {
+        return;
+    }
+
+    if (FootprintCross (a, b, c) < 0.f)
+    {
+        hmm_vec2 t = b; b = c; c = t;
+    }
+
+    for (int y=y0 ; y<=y1 ; y++)
+    {
+        for (int x=x0 ; x<=x1 ; x++)
+        {
+            hmm_vec2 p = HMM_Vec2 ((float) x, (float) y);
+            if (FootprintCross (a, b, p) >= 0.f &&
+                FootprintCross (b, c, p) >= 0.f &&
+                FootprintCross (c, a, p) >= 0.f)
+            {
+                grid->cells[y*grid->w + x].store (1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Clips a triangle to y <= cut and rasterizes the remaining polygon
+static void
+FootprintRasterClipped (footprint_grid_t *grid, hmm_vec3 *v, float cut)
+{
+    hmm_vec2 polygon[4];
+    int count = 0;
+
+    for (int i=0 ; i<3 ; i++)
+    {
+        hmm_vec3 a = v[i];
+        hmm_vec3 b = v[(i + 1)%3];
+
+        if (a.Y <= cut)
+        {
+            polygon[count++] = HMM_Vec2 (a.X, a.Z);
+        }
+        if ((a.Y <= cut) != (b.Y <= cut))
+        {
+            float t = (cut - a.Y)/(b.Y - a.Y);
+            polygon[count++] = HMM_Vec2 (a.X + (b.X - a.X)*t,
+                                         a.Z + (b.Z - a.Z)*t);
+        }
+    }
+
+    for (int i=2 ; i<count ; i++)
+    {
+        FootprintRasterTriangle (grid, polygon[0], polygon[i - 1], polygon[i]);
+    }
+}
+
+// MARK: Convex hull
+
+// Appends the hull points left of a->b. With parallel the pool may be used,
+// it is 0 on the halves of a parallel split
+static void
+QuickHullRecurse (hmm_vec2 *points, unsigned int count, hmm_vec2 a, hmm_vec2 b,
+                  std::vector<hmm_vec2> *hull, int parallel)
+{
+    // Farthest point left of a->b, chunked reduction for large subsets
+    if (count == 0)
+    {
+        return;
+    }
+
+    unsigned int farthest = 0;
+    if (parallel && count > FOOTPRINT_PARALLEL_HULL_POINTS)
+    {
+        unsigned int chunkCount = (count + FOOTPRINT_HULL_CHUNK_POINTS - 1)/
+            FOOTPRINT_HULL_CHUNK_POINTS;
+        std::vector<unsigned int> chunkBest (chunkCount);
+
+        ParallelFor (chunkCount, 1, [&] (unsigned int first, unsigned int last) {
+            for (unsigned int c=first ; c<last ; c++)
+            {
+                unsigned int start = c*FOOTPRINT_HULL_CHUNK_POINTS;
+                unsigned int end = HMM_MIN (start + FOOTPRINT_HULL_CHUNK_POINTS, count);
+                unsigned int best = start;
+                for (unsigned int i=start + 1 ; i<end ; i++)
+                {
+                    if (FootprintCross (a, b, points[i]) >
+                        FootprintCross (a, b, points[best]))
+                    {
+                        best = i;
+                    }
+                }
+                chunkBest[c] = best;
+            }
+        });
+
+        farthest = chunkBest[0];
+        for (unsigned int c=1 ; c<chunkCount ; c++)
+        {
+            if (FootprintCross (a, b, points[chunkBest[c]]) >
+                FootprintCross (a, b, points[farthest]))
+            {
+                farthest = chunkBest[c];
+            }
+        }
+    }
+    else
+    {
+        for (unsigned int i=1 ; i<count ; i++)
+        {
+            if (FootprintCross (a, b, points[i]) >
+                FootprintCross (a, b, points[farthest]))
+            {
+                farthest = i;
+            }
+        }
+    }
+
+    hmm_vec2 f = points[farthest];
+
+    // In place partition, points left of a->f first, then left of f->b
+    unsigned int leftCount = 0;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        if (FootprintCross (a, f, points[i]) > 0.f)
+        {
+            hmm_vec2 t = points[leftCount];
+            points[leftCount++] = points[i];
+            points[i] = t;
+        }
+    }
+
+    unsigned int rightCount = 0;
+    for (unsigned int i=leftCount ; i<count ; i++)
+    {
+        if (FootprintCross (f, b, points[i]) > 0.f)
+        {
+            hmm_vec2 t = points[leftCount + rightCount];
+            points[leftCount + rightCount++] = points[i];
+            points[i] = t;
+        }
+    }
+
+    // Both halves are independent, they run side by side while there is
+    // enough left of them
+    std::vector<hmm_vec2> rightHull;
+    if (parallel && leftCount > 0 && rightCount > 0 &&
+        leftCount + rightCount > FOOTPRINT_PARALLEL_HULL_POINTS)
+    {
+        ParallelFor (2, 1, [&] (unsigned int first, unsigned int last) {
+            for (unsigned int side=first ; side<last ; side++)
+            {
+                if (side == 0)
+                {
+                    QuickHullRecurse (points, leftCount, a, f, hull, 0);
+                }
+                else
+                {
+                    QuickHullRecurse (points + leftCount, rightCount, f, b,
+                                      &rightHull, 0);
+                }
+            }
+        });
+    }
+    else
+    {
+        QuickHullRecurse (points, leftCount, a, f, hull, parallel);
+        QuickHullRecurse (points + leftCount, rightCount, f, b, &rightHull,
+                          parallel);
+    }
+
+    hull->push_back (f);
+    hull->insert (hull->end (), rightHull.begin (), rightHull.end ());
+}
+
+// Counter clockwise hull of points, the input order is destroyed
+static void
+QuickHull (hmm_vec2 *points, unsigned int count, std::vector<hmm_vec2> *hull)
+{
+    hull->clear ();
+    if (count < 3)
+    {
+        hull->assign (points, points + count);
+        return;
+    }
+
+    unsigned int minIndex = 0, maxIndex = 0;
+    for (unsigned int i=1 ; i<count ; i++)
+    {
+        if (points[i].X < points[minIndex].X ||
+            (points[i].X == points[minIndex].X && points[i].Y < points[minIndex].Y))
+        {
+            minIndex = i;
+        }
+        if (points[i].X > points[maxIndex].X ||
+            (points[i].X == points[maxIndex].X && points[i].Y > points[maxIndex].Y))
+        {
+            maxIndex = i;
+        }
+    }
+
+    hmm_vec2 a = points[minIndex];
+    hmm_vec2 b = points[maxIndex];
+
+    std::vector<hmm_vec2> lower, upper;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        float side = FootprintCross (a, b, points[i]);
+        if (side < 0.f)
+        {
+            lower.push_back (points[i]);
+        }
+        else if (side > 0.f)
+        {
+            upper.push_back (points[i]);
+        }
+    }
+
+    // The recursion emits the chain left of the directed edge from its start
+    // to its end, both chains are walked backwards for counter clockwise
+    std::vector<hmm_vec2> lowerChain, upperChain;
+    QuickHullRecurse (lower.data (), (unsigned int) lower.size (), b, a,
+                      &lowerChain, 1);
+    QuickHullRecurse (upper.data (), (unsigned int) upper.size (), a, b,
+                      &upperChain, 1);
+
+    hull->push_back (a);
+    hull->insert (hull->end (), lowerChain.rbegin (), lowerChain.rend ());
+    hull->push_back (b);
+    hull->insert (hull->end (), upperChain.rbegin (), upperChain.rend ());
+}
+
+#ifdef _DEBUG
+// Serial monotone chain hull, the reference the parallel quickhull is
+// checked against. Returns the area
+static float
+FootprintReferenceHullArea (std::vector<hmm_vec2> points)
+{
+    std::sort (points.begin (), points.end (), [] (hmm_vec2 a, hmm_vec2 b) {
+        return (a.X < b.X || (a.X == b.X && a.Y < b.Y));
+    });
+
+    std::vector<hmm_vec2> hull (points.size ()*2);
+    unsigned int count = 0;
+    for (int pass=0 ; pass<2 ; pass++)
+    {
+        unsigned int chainStart = count;
+        for (size_t i=0 ; i<points.size () ; i++)
+        {
+            hmm_vec2 p = points[pass ? points.size () - 1 - i : i];
+            while (count >= chainStart + 2 &&
+                   FootprintCross (hull[count - 2], hull[count - 1], p) <= 0.f)
+            {
+                count--;
+            }
+            hull[count++] = p;
+        }
+        count--;
+    }
+
+    return (FootprintPolygonArea (hull.data (), count));
+}
+#endif
+
+// MARK: Outline
+
+// Oriented marching squares table, inside stays on the left. Edges are
+// 0 bottom, 1 right, 2 top, 3 left, two segments at most per case.
+static const signed char g_marchingSquares[16][4] = {
+    { -1, -1, -1, -1 }, {  0,  3, -1, -1 }, {  1,  0, -1, -1 }, {  1,  3, -1, -1 },
+    {  2,  1, -1, -1 }, {  0,  3,  2,  1 }, {  2,  0, -1, -1 }, {  2,  3, -1, -1 },
+    {  3,  2, -1, -1 }, {  0,  2, -1, -1 }, {  1,  0,  3,  2 }, {  1,  2, -1, -1 },
+    {  3,  1, -1, -1 }, {  0,  1, -1, -1 }, {  3,  0, -1, -1 }, { -1, -1, -1, -1 },
+};
+
+// Lattice edge ids, the lattice has the coverage grid plus a zero border
+inline unsigned int
+FootprintEdgeId (footprint_grid_t *grid, int x, int y, int edge)
+{
+    int stride = grid->w + 2;
+    switch (edge)
+    {
+        case 0: return ((y*stride + x)*2);
+        case 1: return ((y*stride + x + 1)*2 + 1);
+        case 2: return (((y + 1)*stride + x)*2);
+        default: return ((y*stride + x)*2 + 1);
+    }
+}
+
+inline hmm_vec2
+FootprintEdgePoint (footprint_grid_t *grid, unsigned int id)
+{
+    int stride = grid->w + 2;
+    int lattice = id/2;
+    float x = (float) (lattice%stride);
+    float y = (float) (lattice/stride);
+
+    if (id & 1)
+    {
+        y += 0.5f;
+    }
+    else
+    {
+        x += 0.5f;
+    }
+
+    // Lattice point (1, 1) is the centre of cell (0, 0)
+    return (HMM_Vec2 (grid->origin.X + (x - 0.5f)*grid->cellSize,
+                      grid->origin.Y + (y - 0.5f)*grid->cellSize));
+}
+
+inline int
+FootprintCovered (footprint_grid_t *grid, int x, int y)
+{
+    // Lattice coordinates, shifted by the border
+    x -= 1;
+    y -= 1;
+    if (x < 0 || y < 0 || x >= grid->w || y >= grid->h)
+    {
+        return (0);
+    }
+    return (grid->cells[y*grid->w + x].load (std::memory_order_relaxed));
+}
+
+static void
+FootprintTraceOutline (footprint_grid_t *grid, std::vector<hmm_vec2> *outline,
+                       std::vector<unsigned int> *loopStart)
+{
+    int squaresW = grid->w + 1;
+    int squaresH = grid->h + 1;
+    unsigned int edgeCount = (unsigned int) ((grid->w + 2)*(grid->h + 2)*2);
+
+    std::vector<unsigned int> next (edgeCount, 0xffffffffu);
+    std::vector<unsigned int> starts;
+
+    // Each square row writes disjoint start ids, safe to run in parallel
+    ParallelFor (squaresH, 16, [&] (unsigned int first, unsigned int last) {
+        for (int y=(int) first ; y<(int) last ; y++)
+        {
+            for (int x=0 ; x<squaresW ; x++)
+            {
+                int index =
+                    (FootprintCovered (grid, x, y) ? 1 : 0) |
+                    (FootprintCovered (grid, x + 1, y) ? 2 : 0) |
+                    (FootprintCovered (grid, x + 1, y + 1) ? 4 : 0) |
+                    (FootprintCovered (grid, x, y + 1) ? 8 : 0);
+
+                const signed char *segments = g_marchingSquares[index];
+                for (int s=0 ; s<4 && segments[s] >= 0 ; s+=2)
+                {
+                    unsigned int from = FootprintEdgeId (grid, x, y, segments[s]);
+                    unsigned int to = FootprintEdgeId (grid, x, y, segments[s + 1]);
+                    next[from] = to;
+                }
+            }
+        }
+    });
+
+
+    for (unsigned int i=0 ; i<edgeCount ; i++)
+    {
+        if (next[i] == 0xffffffffu)
+        {
+            continue;
+        }
+
+        loopStart->push_back ((unsigned int) outline->size ());
+
+        unsigned int id = i;
+        while (next[id] != 0xffffffffu)
+        {
+            outline->push_back (FootprintEdgePoint (grid, id));
+            unsigned int following = next[id];
+            next[id] = 0xffffffffu;
+            id = following;
+        }
+    }
+
+    loopStart->push_back ((unsigned int) outline->size ());
+}
+
+// MARK: Functions
+
+static void
+BuildFootprint (footprint_t *footprint, scan_mesh_t *mesh,
+                footprint_params_t *params)
+{
+    if (!params->enabled || mesh->triangleCount == 0)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    // Bounds per chunk, reduced afterwards (min x, min y, min z, max x, max z)
+    unsigned int chunkCount = (mesh->vertexCount + FOOTPRINT_BOUNDS_BATCH - 1)/
+        FOOTPRINT_BOUNDS_BATCH;
+    std::vector<float> chunkBounds (chunkCount*5);
+
+    ParallelFor (chunkCount, 1, [&] (unsigned int first, unsigned int last) {
+        for (unsigned int c=first ; c<last ; c++)
+        {
+            unsigned int end = HMM_MIN ((c + 1)*FOOTPRINT_BOUNDS_BATCH,
+                                        mesh->vertexCount);
+            float bounds[5] = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (unsigned int v=c*FOOTPRINT_BOUNDS_BATCH ; v<end ; v++)
+            {
+                bounds[0] = HMM_MIN (bounds[0], mesh->px[v]);
+                bounds[1] = HMM_MIN (bounds[1], mesh->py[v]);
+                bounds[2] = HMM_MIN (bounds[2], mesh->pz[v]);
+                bounds[3] = HMM_MAX (bounds[3], mesh->px[v]);
+                bounds[4] = HMM_MAX (bounds[4], mesh->pz[v]);
+            }
+            memcpy (chunkBounds.data () + c*5, bounds, sizeof (bounds));
+        }
+    });
+
+    float minY = FLT_MAX;
+    hmm_vec2 lo = HMM_Vec2 (FLT_MAX, FLT_MAX);
+    hmm_vec2 hi = HMM_Vec2 (-FLT_MAX, -FLT_MAX);
+    for (unsigned int c=0 ; c<chunkCount ; c++)
+    {
+        float *bounds = chunkBounds.data () + c*5;
+        minY = fminf (minY, bounds[1]);
+        lo = HMM_Vec2 (fminf (lo.X, bounds[0]), fminf (lo.Y, bounds[2]));
+        hi = HMM_Vec2 (fmaxf (hi.X, bounds[3]), fmaxf (hi.Y, bounds[4]));
+    }
+
+    float cut = (params->cutHeight > 0.f) ? (minY + params->cutHeight) : FLT_MAX;
+
+    footprint_grid_t grid;
+    hmm_vec2 extent = hi - lo;
+    grid.cellSize = fmaxf (extent.X, extent.Y)/(float) params->gridResolution;
+    grid.invCellSize = 1.f/grid.cellSize;
+    grid.origin = lo;
+    grid.w = (int) ceilf (extent.X/grid.cellSize) + 1;
+    grid.h = (int) ceilf (extent.Y/grid.cellSize) + 1;
+    grid.cells = new std::atomic<unsigned char>[grid.w*grid.h];
+    for (int i=0 ; i<grid.w*grid.h ; i++)
+    {
+        grid.cells[i].store (0, std::memory_order_relaxed);
+    }
+
+    ParallelFor (mesh->triangleCount, 4096,
+                 [&] (unsigned int first, unsigned int last) {
+        for (unsigned int t=first ; t<last ; t++)
+        {
+            unsigned int *tri = mesh->triangles + t*3;
+            hmm_vec3 v[3];
+            for (int k=0 ; k<3 ; k++)
+            {
+                v[k] = HMM_Vec3 (mesh->px[tri[k]], mesh->py[tri[k]], mesh->pz[tri[k]]);
+            }
+
+            if (v[0].Y <= cut && v[1].Y <= cut && v[2].Y <= cut)
+            {
+                FootprintRasterTriangle (&grid, HMM_Vec2 (v[0].X, v[0].Z),
+                                         HMM_Vec2 (v[1].X, v[1].Z),
+                                         HMM_Vec2 (v[2].X, v[2].Z));
+            }
+            else if (v[0].Y <= cut || v[1].Y <= cut || v[2].Y <= cut)
+            {
+                FootprintRasterClipped (&grid, v, cut);
+            }
+        }
+    });
+
+    // Covered area plus the outer corners of every row for the hull
+    std::vector<hmm_vec2> extremes (grid.h*4);
+    std::vector<unsigned char> rowHasCells (grid.h, 0);
+    std::atomic<unsigned int> coveredCells (0);
+
+    ParallelFor (grid.h, 16, [&] (unsigned int first, unsigned int last) {
+        unsigned int covered = 0;
+        for (int y=(int) first ; y<(int) last ; y++)
+        {
+            int left = -1, right = -1;
+            for (int x=0 ; x<grid.w ; x++)
+            {
+                if (grid.cells[y*grid.w + x].load (std::memory_order_relaxed))
+                {
+                    left = (left < 0) ? x : left;
+                    right = x;
+                    covered++;
+                }
+            }
+
+            if (left >= 0)
+            {
+                float y0 = grid.origin.Y + y*grid.cellSize;
+                float y1 = y0 + grid.cellSize;
+                float x0 = grid.origin.X + left*grid.cellSize;
+                float x1 = grid.origin.X + (right + 1)*grid.cellSize;
+
+                extremes[y*4 + 0] = HMM_Vec2 (x0, y0);
+                extremes[y*4 + 1] = HMM_Vec2 (x0, y1);
+                extremes[y*4 + 2] = HMM_Vec2 (x1, y0);
+                extremes[y*4 + 3] = HMM_Vec2 (x1, y1);
+                rowHasCells[y] = 1;
+            }
+        }
+        coveredCells.fetch_add (covered);
+    });
+
+    unsigned int pointCount = 0;
+    for (int y=0 ; y<grid.h ; y++)
+    {
+        if (rowHasCells[y])
+        {
+            for (int k=0 ; k<4 ; k++)
+            {
+                extremes[pointCount++] = extremes[y*4 + k];
+            }
+        }
+    }
+
+    std::vector<hmm_vec2> hullPoints, outlinePoints;
+    std::vector<unsigned int> loopStart;
+#ifdef _DEBUG
+    std::vector<hmm_vec2> hullInput (extremes.begin (), extremes.begin () + pointCount);
+#endif
+    QuickHull (extremes.data (), pointCount, &hullPoints);
+#ifdef _DEBUG
+    // Inputs this large go through the parallel reduction and split
+    if (pointCount > FOOTPRINT_PARALLEL_HULL_POINTS)
+    {
+        float area = FootprintPolygonArea (hullPoints.data (),
+                                           (unsigned int) hullPoints.size ());
+        float reference = FootprintReferenceHullArea (hullInput);
+        if (fabsf (area - reference) > 1e-4f*reference)
+        {
+            printf ("Footprint hull area %f, reference %f\n", area, reference);
+            assert (0);
+        }
+    }
+#endif
+    FootprintTraceOutline (&grid, &outlinePoints, &loopStart);
+
+    delete[] grid.cells;
+
+    FreeFootprint (footprint);
+    footprint->hullCount = (unsigned int) hullPoints.size ();
+    footprint->hull =
+        (hmm_vec2 *) malloc (sizeof (hmm_vec2)*(footprint->hullCount + 1));
+    memcpy (footprint->hull, hullPoints.data (),
+            sizeof (hmm_vec2)*footprint->hullCount);
+
+    footprint->outlineCount = (unsigned int) outlinePoints.size ();
+    footprint->outline =
+        (hmm_vec2 *) malloc (sizeof (hmm_vec2)*(footprint->outlineCount + 1));
+    memcpy (footprint->outline, outlinePoints.data (),
+            sizeof (hmm_vec2)*footprint->outlineCount);
+
+    footprint->loopCount = (unsigned int) loopStart.size () - 1;
+    footprint->loopStart = (unsigned int *)
+        malloc (sizeof (unsigned int)*(footprint->loopCount + 1));
+    memcpy (footprint->loopStart, loopStart.data (),
+            sizeof (unsigned int)*(footprint->loopCount + 1));
+
+    // Main axis is the hull diameter, widths are measured across it
+    hmm_vec2 *hull = footprint->hull;
+    unsigned int hullCount = footprint->hullCount;
+    float diameter = 0.f;
+    footprint->axis = HMM_Vec2 (0.f, 1.f);
+
+    for (unsigned int i=0 ; i<hullCount ; i++)
+    {
+        for (unsigned int j=i + 1 ; j<hullCount ; j++)
+        {
+            float d = HMM_LengthVec2 (hull[j] - hull[i]);
+            if (d > diameter)
+            {
+                diameter = d;
+                footprint->axis = (hull[j] - hull[i])*(1.f/d);
+            }
+        }
+    }
+
+    hmm_vec2 axis = footprint->axis;
+    hmm_vec2 side = HMM_Vec2 (-axis.Y, axis.X);
+
+    float uMin = FLT_MAX, uMax = -FLT_MAX, vMin = FLT_MAX, vMax = -FLT_MAX;
+    for (unsigned int i=0 ; i<hullCount ; i++)
+    {
+        float u = HMM_DotVec2 (hull[i], axis);
+        float v = HMM_DotVec2 (hull[i], side);
+        uMin = fminf (uMin, u); uMax = fmaxf (uMax, u);
+        vMin = fminf (vMin, v); vMax = fmaxf (vMax, v);
+    }
+
+    footprint->length = (hullCount > 0) ? (uMax - uMin) : 0.f;
+    footprint->width = (hullCount > 0) ? (vMax - vMin) : 0.f;
+    footprint->area = coveredCells.load ()*grid.cellSize*grid.cellSize;
+    footprint->hullArea = FootprintPolygonArea (hull, hullCount);
+
+    float binMin[FOOTPRINT_WIDTH_SAMPLES], binMax[FOOTPRINT_WIDTH_SAMPLES];
+    for (int i=0 ; i<FOOTPRINT_WIDTH_SAMPLES ; i++)
+    {
+        binMin[i] = FLT_MAX;
+        binMax[i] = -FLT_MAX;
+    }
+
+    float binScale = (footprint->length > 0.f) ?
+        (FOOTPRINT_WIDTH_SAMPLES/footprint->length) : 0.f;
+    for (unsigned int i=0 ; i<footprint->outlineCount ; i++)
+    {
+        hmm_vec2 p = footprint->outline[i];
+        int bin = (int) ((HMM_DotVec2 (p, axis) - uMin)*binScale);
+        bin = (bin < 0) ? 0 : (bin >= FOOTPRINT_WIDTH_SAMPLES) ?
+            (FOOTPRINT_WIDTH_SAMPLES - 1) : bin;
+
+        float v = HMM_DotVec2 (p, side);
+        binMin[bin] = fminf (binMin[bin], v);
+        binMax[bin] = fmaxf (binMax[bin], v);
+    }
+
+    for (int i=0 ; i<FOOTPRINT_WIDTH_SAMPLES ; i++)
+    {
+        footprint->widths[i] = (binMax[i] >= binMin[i]) ?
+            (binMax[i] - binMin[i]) : 0.f;
+    }
+
+    footprint->milliseconds = ScanMeshMilliseconds (start);
+
+    printf ("Footprint %dx%d grid, %u outline loops, %u hull points, "
+            "length %f width %f in %.2f ms\n",
+            grid.w, grid.h, footprint->loopCount,
+            hullCount, footprint->length, footprint->width,
+            footprint->milliseconds);
+}
@@ -0,0 +1,170 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_frame_ring.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Frames in flight. Every buffer the CPU writes per frame holds one slice
+// per context of the ring, and a context is only recorded again once the
+// fence placed after its last use has signaled. The slice is then known to
+// be idle, so it is written through an unsynchronized mapping and the
+// driver never has to stall or shadow the buffer behind our back. The time
+// spent waiting on those fences is the time the CPU was ahead of the GPU:
+// a frame that waits is GPU bound, one that never waits is CPU bound.
+//
+
+// MARK: Constants
+
+#define FRAMES_IN_FLIGHT 3
+
+// Longer waits are reported and the frame goes ahead, the GPU is lost or
+// hung at that point
+#define FRAME_RING_TIMEOUT 1000000000ull
+
+// Share of the frame spent waiting above which the GPU is the bottleneck
+#define FRAME_RING_GPU_BOUND 0.1f
+
+// MARK: Structs
+
+struct frame_context_t
+{
+    // Signaled when the GPU is done with this context's slices
+    GLsync fence;
+};
+
+struct frame_ring_t
+{
+    frame_context_t contexts[FRAMES_IN_FLIGHT];
+
+    // Context being recorded, the slice index of every ring buffer
+    unsigned int current;
+    std::chrono::high_resolution_clock::time_point frameStart;
+
+    // Milliseconds of the last frame
+    float waitMilliseconds;
+    float recordMilliseconds;
+
+    // Sums since the last report
+    float waitTotal;
+    float recordTotal;
+    unsigned int frames;
+    unsigned int waitedFrames;
+};
+
+// MARK: Globals
+
+static frame_ring_t g_frameRing;
+
+// MARK: Functions
+
+static void
+InitFrameRing (frame_ring_t *ring)
+{
+    *ring = {};
+}
+
+static void
+FreeFrameRing (frame_ring_t *ring)
+{
+    for (int i=0 ; i<FRAMES_IN_FLIGHT ; i++)
+    {
+        if (ring->contexts[i].fence != 0)
+        {
+            glDeleteSync (ring->contexts[i].fence);
+        }
+    }
+    *ring = {};
+}
+
+// Size of one slice of a ring buffer, a multiple of the binding alignment
+inline GLint
+FrameRingStride (GLsizeiptr size, GLint alignment)
+{
+    return ((GLint) ((size + alignment - 1)/alignment*alignment));
+}
+
+// Waits until the GPU is done with the context about to be recorded
+static void
+FrameRingBegin (frame_ring_t *ring)
+{
+    frame_context_t *context = ring->contexts + ring->current;
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    ring->waitMilliseconds = 0.f;
+    if (context->fence != 0)
+    {
+        // Polled first so a context that is already free costs no flush
+        GLenum status = glClientWaitSync (context->fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            status = glClientWaitSync (context->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                       FRAME_RING_TIMEOUT);
+            ring->waitMilliseconds = ScanMeshMilliseconds (start);
+            ring->waitedFrames++;
+        }
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+        {
+            printf ("Frame context %u still busy after %.2f ms\n",
+                    ring->current, ScanMeshMilliseconds (start));
+        }
+
+        glDeleteSync (context->fence);
+        context->fence = 0;
+    }
+
+    ring->frameStart = std::chrono::high_resolution_clock::now ();
+}
+
+// Fences the recorded context and moves on to the next one
+static void
+FrameRingEnd (frame_ring_t *ring)
+{
+    frame_context_t *context = ring->contexts + ring->current;
+    context->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring->current = (ring->current + 1)%FRAMES_IN_FLIGHT;
+
+    ring->recordMilliseconds = ScanMeshMilliseconds (ring->frameStart);
+    ring->waitTotal += ring->waitMilliseconds;
+    ring->recordTotal += ring->recordMilliseconds;
+    ring->frames++;
+
+#ifdef _DEBUG
+    if (ring->frames == RENDER_STATS_INTERVAL)
+    {
+        float wait = ring->waitTotal/ring->frames;
+        float record = ring->recordTotal/ring->frames;
+        printf ("%d frames in flight: %.2f ms recording, %.2f ms waiting "
+                "on the GPU in %u of %u frames, %s bound\n",
+                FRAMES_IN_FLIGHT, record, wait, ring->waitedFrames, ring->frames,
+                (wait > (wait + record)*FRAME_RING_GPU_BOUND) ? "GPU" : "CPU");
+    }
+#endif
+    if (ring->frames == RENDER_STATS_INTERVAL)
+    {
+        ring->waitTotal = 0.f;
+        ring->recordTotal = 0.f;
+        ring->frames = 0;
+        ring->waitedFrames = 0;
+    }
+}
+
+// Writes into a slice of the current context. Its fence has passed, so the
+// mapping skips the driver's own synchronization
+static void
+FrameRingWrite (GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    void *destination =
+        glMapBufferRange (target, offset, size,
+                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                          GL_MAP_UNSYNCHRONIZED_BIT);
+    if (destination != NULL)
+    {
+        memcpy (destination, data, size);
+        glUnmapBuffer (target);
+    }
+    else
+    {
+        glBufferSubData (target, offset, size, data);
+    }
+}
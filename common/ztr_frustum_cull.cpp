@@ -0,0 +1,476 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_frustum_cull.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// View frustum tests for batches of world space boxes and spheres. Bounds
+// are kept as structure of arrays so four of them are tested against a
+// plane per instruction, with SSE on x86, NEON on ARM and plain floats
+// elsewhere. Planes come from the view projection matrix, so the
+// orthographic camera and any perspective one are handled alike.
+//
+
+// MARK: Includes
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ZTR_CULL_NEON 1
+#elif defined(HANDMADE_MATH__USE_SSE)
+#define ZTR_CULL_SSE 1
+#endif
+
+// MARK: Constants
+
+#define CULL_LANES 4
+#define CULL_PLANES 6
+
+// MARK: Structs
+
+// Normalized planes, a point p is inside when dot (n, p) + d >= 0
+struct frustum_t
+{
+    hmm_vec4 planes[CULL_PLANES];
+};
+
+// Centre and half extent per box, capacity is a multiple of CULL_LANES
+struct cull_boxes_t
+{
+    float *cx, *cy, *cz;
+    float *ex, *ey, *ez;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+struct cull_spheres_t
+{
+    float *cx, *cy, *cz;
+    float *radius;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+// MARK: Lanes
+
+#if defined(ZTR_CULL_SSE)
+
+typedef __m128 cull_lane_t;
+
+inline cull_lane_t CullLoad (float *p) { return (_mm_loadu_ps (p)); }
+inline cull_lane_t CullSet (float x) { return (_mm_set1_ps (x)); }
+inline cull_lane_t
+CullMulAdd (cull_lane_t a, cull_lane_t b, cull_lane_t c)
+{
+    return (_mm_add_ps (_mm_mul_ps (a, b), c));
+}
+inline cull_lane_t
+CullNegative (cull_lane_t a)
+{
+    return (_mm_cmplt_ps (a, _mm_setzero_ps ()));
+}
+inline cull_lane_t CullOr (cull_lane_t a, cull_lane_t b) { return (_mm_or_ps (a, b)); }
+inline cull_lane_t CullZero () { return (_mm_setzero_ps ()); }
+inline cull_lane_t CullAdd (cull_lane_t a, cull_lane_t b) { return (_mm_add_ps (a, b)); }
+inline cull_lane_t CullMin (cull_lane_t a, cull_lane_t b) { return (_mm_min_ps (a, b)); }
+inline void CullStore (float *p, cull_lane_t a) { _mm_storeu_ps (p, a); }
+inline unsigned int CullMask (cull_lane_t a) { return ((unsigned int) _mm_movemask_ps (a)); }
+
+#elif defined(ZTR_CULL_NEON)
+
+typedef float32x4_t cull_lane_t;
+
+inline cull_lane_t CullLoad (float *p) { return (vld1q_f32 (p)); }
+inline cull_lane_t CullSet (float x) { return (vdupq_n_f32 (x)); }
+inline cull_lane_t
+CullMulAdd (cull_lane_t a, cull_lane_t b, cull_lane_t c)
+{
+    return (vmlaq_f32 (c, a, b));
+}
+inline cull_lane_t
+CullNegative (cull_lane_t a)
+{
+    return (vreinterpretq_f32_u32 (vcltq_f32 (a, vdupq_n_f32 (0.f))));
+}
+inline cull_lane_t
+CullOr (cull_lane_t a, cull_lane_t b)
+{
+    return (vreinterpretq_f32_u32 (vorrq_u32 (vreinterpretq_u32_f32 (a),
+                                              vreinterpretq_u32_f32 (b))));
+}
+inline cull_lane_t CullZero () { return (vdupq_n_f32 (0.f)); }
+inline cull_lane_t CullAdd (cull_lane_t a, cull_lane_t b) { return (vaddq_f32 (a, b)); }
+inline cull_lane_t CullMin (cull_lane_t a, cull_lane_t b) { return (vminq_f32 (a, b)); }
+inline void CullStore (float *p, cull_lane_t a) { vst1q_f32 (p, a); }
+inline unsigned int
+CullMask (cull_lane_t a)
+{
+    uint32x4_t bits = vreinterpretq_u32_f32 (a);
+    return (((vgetq_lane_u32 (bits, 0) >> 31) << 0) |
+            ((vgetq_lane_u32 (bits, 1) >> 31) << 1) |
+            ((vgetq_lane_u32 (bits, 2) >> 31) << 2) |
+            ((vgetq_lane_u32 (bits, 3) >> 31) << 3));
+}
+
+#else
+
+struct cull_lane_t
+{
+    float v[CULL_LANES];
+};
+
+inline cull_lane_t
+CullLoad (float *p)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = p[i];
+    return (r);
+}
+inline cull_lane_t
+CullSet (float x)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = x;
+    return (r);
+}
+inline cull_lane_t
+CullMulAdd (cull_lane_t a, cull_lane_t b, cull_lane_t c)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = a.v[i]*b.v[i] + c.v[i];
+    return (r);
+}
+inline cull_lane_t
+CullNegative (cull_lane_t a)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = (a.v[i] < 0.f) ? 1.f : 0.f;
+    return (r);
+}
+inline cull_lane_t
+CullOr (cull_lane_t a, cull_lane_t b)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = (a.v[i] != 0.f || b.v[i] != 0.f) ? 1.f : 0.f;
+    return (r);
+}
+inline cull_lane_t CullZero () { return (CullSet (0.f)); }
+inline cull_lane_t
+CullAdd (cull_lane_t a, cull_lane_t b)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = a.v[i] + b.v[i];
+    return (r);
+}
+inline cull_lane_t
+CullMin (cull_lane_t a, cull_lane_t b)
+{
+    cull_lane_t r;
+    for (int i=0 ; i<CULL_LANES ; i++) r.v[i] = (a.v[i] < b.v[i]) ? a.v[i] : b.v[i];
+    return (r);
+}
+inline void
+CullStore (float *p, cull_lane_t a)
+{
+    for (int i=0 ; i<CULL_LANES ; i++) p[i] = a.v[i];
+}
+inline unsigned int
+CullMask (cull_lane_t a)
+{
+    unsigned int mask = 0;
+    for (int i=0 ; i<CULL_LANES ; i++) mask |= (a.v[i] != 0.f) ? (1u << i) : 0;
+    return (mask);
+}
+
+#endif
+
+// MARK: Frustum
+
+// Gribb/Hartmann extraction from the clip matrix, GL clip space
+static frustum_t
+FrustumFromMatrix (hmm_mat4 m)
+{
+    frustum_t frustum;
+
+    hmm_vec4 rows[4];
+    for (int r=0 ; r<4 ; r++)
+    {
+        rows[r] = HMM_Vec4 (m.Elements[0][r], m.Elements[1][r],
+                            m.Elements[2][r], m.Elements[3][r]);
+    }
+
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+
+    for (int i=0 ; i<CULL_PLANES ; i++)
+    {
+        hmm_vec4 *p = frustum.planes + i;
+        float length = HMM_LengthVec3 (p->XYZ);
+        *p = *p*(1.f/length);
+    }
+
+    return (frustum);
+}
+
+// Planes in the local space of m, for testing model space bounds without
+// moving them. The planes are no longer normalized, which the box test
+// does not need but the sphere test does.
+static frustum_t
+FrustumToLocal (frustum_t *frustum, hmm_mat4 m)
+{
+    frustum_t local;
+    for (int i=0 ; i<CULL_PLANES ; i++)
+    {
+        hmm_vec4 p = frustum->planes[i];
+        for (int c=0 ; c<4 ; c++)
+        {
+            local.planes[i].Elements[c] = p.X*m.Elements[c][0] +
+                                          p.Y*m.Elements[c][1] +
+                                          p.Z*m.Elements[c][2] +
+                                          p.W*m.Elements[c][3];
+        }
+    }
+    return (local);
+}
+
+// MARK: Bounds
+
+// Empties the batch and makes room for count entries
+static void
+CullBoxesReset (cull_boxes_t *boxes, unsigned int count)
+{
+    unsigned int capacity = (count + CULL_LANES - 1) & ~(CULL_LANES - 1);
+    if (capacity > boxes->capacity)
+    {
+        float **arrays[6] = { &boxes->cx, &boxes->cy, &boxes->cz,
+                              &boxes->ex, &boxes->ey, &boxes->ez };
+        for (int i=0 ; i<6 ; i++)
+        {
+            *arrays[i] = (float *) realloc (*arrays[i], sizeof (float)*capacity);
+        }
+        boxes->capacity = capacity;
+    }
+    boxes->count = 0;
+}
+
+static void
+CullSpheresReset (cull_spheres_t *spheres, unsigned int count)
+{
+    unsigned int capacity = (count + CULL_LANES - 1) & ~(CULL_LANES - 1);
+    if (capacity > spheres->capacity)
+    {
+        float **arrays[4] = { &spheres->cx, &spheres->cy, &spheres->cz,
+                              &spheres->radius };
+        for (int i=0 ; i<4 ; i++)
+        {
+            *arrays[i] = (float *) realloc (*arrays[i], sizeof (float)*capacity);
+        }
+        spheres->capacity = capacity;
+    }
+    spheres->count = 0;
+}
+
+// Appends a local box moved by m, the world box encloses the rotated one
+inline void
+CullBoxesPush (cull_boxes_t *boxes, hmm_mat4 m, hmm_vec3 center, hmm_vec3 extent)
+{
+    assert (boxes->count < boxes->capacity);
+    unsigned int i = boxes->count++;
+
+    hmm_vec4 c = m*HMM_Vec4v (center, 1.f);
+    boxes->cx[i] = c.X;
+    boxes->cy[i] = c.Y;
+    boxes->cz[i] = c.Z;
+
+    float *e[3] = { boxes->ex + i, boxes->ey + i, boxes->ez + i };
+    for (int r=0 ; r<3 ; r++)
+    {
+        *e[r] = fabsf (m.Elements[0][r])*extent.X +
+                fabsf (m.Elements[1][r])*extent.Y +
+                fabsf (m.Elements[2][r])*extent.Z;
+    }
+}
+
+// The radius grows with the largest axis scale of m
+inline void
+CullSpheresPush (cull_spheres_t *spheres, hmm_mat4 m, hmm_vec3 center,
+                 float radius)
+{
+    assert (spheres->count < spheres->capacity);
+    unsigned int i = spheres->count++;
+
+    hmm_vec4 c = m*HMM_Vec4v (center, 1.f);
+    spheres->cx[i] = c.X;
+    spheres->cy[i] = c.Y;
+    spheres->cz[i] = c.Z;
+
+    float scale = 0.f;
+    for (int column=0 ; column<3 ; column++)
+    {
+        hmm_vec3 axis = HMM_Vec3 (m.Elements[column][0], m.Elements[column][1],
+                                  m.Elements[column][2]);
+        scale = HMM_MAX (scale, HMM_LengthSquaredVec3 (axis));
+    }
+    spheres->radius[i] = radius*HMM_SquareRootF (scale);
+}
+
+// Pads the last group of lanes with copies of the first entry so the tail
+// never reads garbage
+inline void
+CullPadLanes (float **arrays, int arrayCount, unsigned int count)
+{
+    unsigned int padded = (count + CULL_LANES - 1) & ~(CULL_LANES - 1);
+    for (int a=0 ; a<arrayCount ; a++)
+    {
+        for (unsigned int i=count ; i<padded ; i++)
+        {
+            arrays[a][i] = arrays[a][0];
+        }
+    }
+}
+
+// MARK: Tests
+
+// Writes 1 for boxes touching the frustum and 0 for the rest, returns the
+// number of visible boxes
+static unsigned int
+FrustumCullBoxes (frustum_t *frustum, cull_boxes_t *boxes,
+                  unsigned char *visible)
+{
+    if (boxes->count == 0)
+    {
+        return (0);
+    }
+
+    float *arrays[6] = { boxes->cx, boxes->cy, boxes->cz,
+                         boxes->ex, boxes->ey, boxes->ez };
+    CullPadLanes (arrays, 6, boxes->count);
+
+    // The box reaches furthest along the plane normal by |n|.e
+    cull_lane_t n[CULL_PLANES][4], absN[CULL_PLANES][3];
+    for (int p=0 ; p<CULL_PLANES ; p++)
+    {
+        hmm_vec4 plane = frustum->planes[p];
+        n[p][0] = CullSet (plane.X);
+        n[p][1] = CullSet (plane.Y);
+        n[p][2] = CullSet (plane.Z);
+        n[p][3] = CullSet (plane.W);
+        absN[p][0] = CullSet (fabsf (plane.X));
+        absN[p][1] = CullSet (fabsf (plane.Y));
+        absN[p][2] = CullSet (fabsf (plane.Z));
+    }
+
+    unsigned int visibleCount = 0;
+    for (unsigned int i=0 ; i<boxes->count ; i+=CULL_LANES)
+    {
+        cull_lane_t cx = CullLoad (boxes->cx + i);
+        cull_lane_t cy = CullLoad (boxes->cy + i);
+        cull_lane_t cz = CullLoad (boxes->cz + i);
+        cull_lane_t ex = CullLoad (boxes->ex + i);
+        cull_lane_t ey = CullLoad (boxes->ey + i);
+        cull_lane_t ez = CullLoad (boxes->ez + i);
+
+        cull_lane_t outside = CullZero ();
+        for (int p=0 ; p<CULL_PLANES ; p++)
+        {
+            cull_lane_t d = CullMulAdd (n[p][0], cx, n[p][3]);
+            d = CullMulAdd (n[p][1], cy, d);
+            d = CullMulAdd (n[p][2], cz, d);
+            d = CullMulAdd (absN[p][0], ex, d);
+            d = CullMulAdd (absN[p][1], ey, d);
+            d = CullMulAdd (absN[p][2], ez, d);
+            outside = CullOr (outside, CullNegative (d));
+        }
+
+        unsigned int mask = CullMask (outside);
+        unsigned int lanes = HMM_MIN (CULL_LANES, boxes->count - i);
+        for (unsigned int k=0 ; k<lanes ; k++)
+        {
+            visible[i + k] = ((mask >> k) & 1) ? 0 : 1;
+            visibleCount += visible[i + k];
+        }
+    }
+
+    return (visibleCount);
+}
+
+static unsigned int
+FrustumCullSpheres (frustum_t *frustum, cull_spheres_t *spheres,
+                    unsigned char *visible)
+{
+    if (spheres->count == 0)
+    {
+        return (0);
+    }
+
+    float *arrays[4] = { spheres->cx, spheres->cy, spheres->cz,
+                         spheres->radius };
+    CullPadLanes (arrays, 4, spheres->count);
+
+    cull_lane_t n[CULL_PLANES][4];
+    for (int p=0 ; p<CULL_PLANES ; p++)
+    {
+        hmm_vec4 plane = frustum->planes[p];
+        n[p][0] = CullSet (plane.X);
+        n[p][1] = CullSet (plane.Y);
+        n[p][2] = CullSet (plane.Z);
+        n[p][3] = CullSet (plane.W);
+    }
+
+    cull_lane_t one = CullSet (1.f);
+    unsigned int visibleCount = 0;
+    for (unsigned int i=0 ; i<spheres->count ; i+=CULL_LANES)
+    {
+        cull_lane_t cx = CullLoad (spheres->cx + i);
+        cull_lane_t cy = CullLoad (spheres->cy + i);
+        cull_lane_t cz = CullLoad (spheres->cz + i);
+        cull_lane_t r = CullLoad (spheres->radius + i);
+
+        cull_lane_t outside = CullZero ();
+        for (int p=0 ; p<CULL_PLANES ; p++)
+        {
+            cull_lane_t d = CullMulAdd (n[p][0], cx, n[p][3]);
+            d = CullMulAdd (n[p][1], cy, d);
+            d = CullMulAdd (n[p][2], cz, d);
+            d = CullMulAdd (one, r, d);
+            outside = CullOr (outside, CullNegative (d));
+        }
+
+        unsigned int mask = CullMask (outside);
+        unsigned int lanes = HMM_MIN (CULL_LANES, spheres->count - i);
+        for (unsigned int k=0 ; k<lanes ; k++)
+        {
+            visible[i + k] = ((mask >> k) & 1) ? 0 : 1;
+            visibleCount += visible[i + k];
+        }
+    }
+
+    return (visibleCount);
+}
+
+static void
+FreeCullBoxes (cull_boxes_t *boxes)
+{
+    float *arrays[6] = { boxes->cx, boxes->cy, boxes->cz,
+                         boxes->ex, boxes->ey, boxes->ez };
+    for (int i=0 ; i<6 ; i++)
+    {
+        free (arrays[i]);
+    }
+    *boxes = {};
+}
+
+static void
+FreeCullSpheres (cull_spheres_t *spheres)
+{
+    float *arrays[4] = { spheres->cx, spheres->cy, spheres->cz,
+                         spheres->radius };
+    for (int i=0 ; i<4 ; i++)
+    {
+        free (arrays[i]);
+    }
+    *spheres = {};
+}
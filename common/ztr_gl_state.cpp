@@ -0,0 +1,340 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_gl_state.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Shadow copy of the GL state the renderer touches. Binds and state changes
+// go through here and are dropped when they would not change anything.
+// Included after the GL call counting macros so the calls that do reach the
+// driver are still counted.
+//
+
+// MARK: Constants
+
+#define GL_STATE_MAX_UNIFORM_BINDINGS (1 << 3)
+#define GL_STATE_MAX_TEXTURE_UNITS (1 << 3)
+
+// Never a valid name or enum, forces the next call through
+#define GL_STATE_UNKNOWN 0xffffffffu
+
+// MARK: Enums
+
+enum gl_state_cap_t
+{
+    GLStateCap_Blend,
+    GLStateCap_DepthTest,
+    GLStateCap_CullFace,
+
+    GLStateCap_Count,
+};
+
+// MARK: Structs
+
+struct gl_buffer_range_t
+{
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+struct gl_state_t
+{
+    GLuint program;
+    GLuint vertexArray;
+
+    // Generic bindings, the element array buffer belongs to the VAO
+    GLuint arrayBuffer;
+    GLuint uniformBuffer;
+    gl_buffer_range_t uniformRanges[GL_STATE_MAX_UNIFORM_BINDINGS];
+
+    // GL_STATE_UNKNOWN, 0 or 1 per gl_state_cap_t
+    GLuint caps[GLStateCap_Count];
+    GLenum depthFunc;
+    GLuint depthMask;
+    GLenum cullFaceMode;
+    GLenum blendEquation[2];
+    GLenum blendFunc[4];
+
+    GLenum activeTexture;
+    GLuint textures[GL_STATE_MAX_TEXTURE_UNITS];
+
+    // Calls that reached the driver and calls that were dropped
+    unsigned int issued;
+    unsigned int elided;
+};
+
+// MARK: Globals
+
+static gl_state_t g_glState;
+
+static const GLenum g_glStateCaps[GLStateCap_Count] = {
+    GL_BLEND,
+    GL_DEPTH_TEST,
+    GL_CULL_FACE,
+};
+
+// MARK: Functions
+
+// Forgets everything, used whenever code outside the renderer may have
+// changed the context
+static void
+GLStateInvalidate (gl_state_t *state)
+{
+    state->program = GL_STATE_UNKNOWN;
+    state->vertexArray = GL_STATE_UNKNOWN;
+    state->arrayBuffer = GL_STATE_UNKNOWN;
+    state->uniformBuffer = GL_STATE_UNKNOWN;
+
+    for (int i=0 ; i<GL_STATE_MAX_UNIFORM_BINDINGS ; i++)
+    {
+        state->uniformRanges[i].buffer = GL_STATE_UNKNOWN;
+    }
+    for (int i=0 ; i<GLStateCap_Count ; i++)
+    {
+        state->caps[i] = GL_STATE_UNKNOWN;
+    }
+
+    state->depthFunc = GL_STATE_UNKNOWN;
+    state->depthMask = GL_STATE_UNKNOWN;
+    state->cullFaceMode = GL_STATE_UNKNOWN;
+    state->blendEquation[0] = GL_STATE_UNKNOWN;
+    state->blendFunc[0] = GL_STATE_UNKNOWN;
+
+    state->activeTexture = GL_STATE_UNKNOWN;
+    for (int i=0 ; i<GL_STATE_MAX_TEXTURE_UNITS ; i++)
+    {
+        state->textures[i] = GL_STATE_UNKNOWN;
+    }
+}
+
+inline void
+GLStateResetCounters (gl_state_t *state)
+{
+    state->issued = 0;
+    state->elided = 0;
+}
+
+// Counts the call and returns true when it has to be issued
+inline int
+GLStateChanged (gl_state_t *state, int changed)
+{
+    if (changed)
+    {
+        state->issued++;
+    }
+    else
+    {
+        state->elided++;
+    }
+    return (changed);
+}
+
+inline void
+GLStateUseProgram (gl_state_t *state, GLuint program)
+{
+    if (GLStateChanged (state, state->program != program))
+    {
+        glUseProgram (program);
+        state->program = program;
+    }
+}
+
+inline void
+GLStateBindVertexArray (gl_state_t *state, GLuint vertexArray)
+{
+    if (GLStateChanged (state, state->vertexArray != vertexArray))
+    {
+        glBindVertexArray (vertexArray);
+        state->vertexArray = vertexArray;
+    }
+}
+
+inline void
+GLStateBindBuffer (gl_state_t *state, GLenum target, GLuint buffer)
+{
+    GLuint *binding = NULL;
+    switch (target)
+    {
+        case GL_ARRAY_BUFFER: binding = &state->arrayBuffer; break;
+        case GL_UNIFORM_BUFFER: binding = &state->uniformBuffer; break;
+    }
+
+    // Untracked targets, including the VAO owned element array buffer
+    if (binding == NULL)
+    {
+        state->issued++;
+        glBindBuffer (target, buffer);
+        return;
+    }
+
+    if (GLStateChanged (state, *binding != buffer))
+    {
+        glBindBuffer (target, buffer);
+        *binding = buffer;
+    }
+}
+
+// Drops a buffer that is about to be deleted from every tracked binding,
+// GL unbinds it and a later buffer may reuse the name
+static void
+GLStateForgetBuffer (gl_state_t *state, GLuint buffer)
+{
+    if (state->arrayBuffer == buffer)
+    {
+        state->arrayBuffer = GL_STATE_UNKNOWN;
+    }
+    if (state->uniformBuffer == buffer)
+    {
+        state->uniformBuffer = GL_STATE_UNKNOWN;
+    }
+    for (int i=0 ; i<GL_STATE_MAX_UNIFORM_BINDINGS ; i++)
+    {
+        if (state->uniformRanges[i].buffer == buffer)
+        {
+            state->uniformRanges[i].buffer = GL_STATE_UNKNOWN;
+        }
+    }
+}
+
+inline void
+GLStateBindBufferRange (gl_state_t *state, GLenum target, GLuint index,
+                        GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    assert (target == GL_UNIFORM_BUFFER && index < GL_STATE_MAX_UNIFORM_BINDINGS);
+
+    gl_buffer_range_t *range = state->uniformRanges + index;
+    if (GLStateChanged (state, range->buffer != buffer ||
+                        range->offset != offset || range->size != size))
+    {
+        glBindBufferRange (target, index, buffer, offset, size);
+        range->buffer = buffer;
+        range->offset = offset;
+        range->size = size;
+
+        // Also replaces the generic binding
+        state->uniformBuffer = buffer;
+    }
+}
+
+// Whole buffer, tracked as a zero sized range
+inline void
+GLStateBindBufferBase (gl_state_t *state, GLenum target, GLuint index,
+                       GLuint buffer)
+{
+    assert (target == GL_UNIFORM_BUFFER && index < GL_STATE_MAX_UNIFORM_BINDINGS);
+
+    gl_buffer_range_t *range = state->uniformRanges + index;
+    if (GLStateChanged (state, range->buffer != buffer ||
+                        range->offset != 0 || range->size != 0))
+    {
+        glBindBufferBase (target, index, buffer);
+        range->buffer = buffer;
+        range->offset = 0;
+        range->size = 0;
+
+        state->uniformBuffer = buffer;
+    }
+}
+
+inline void
+GLStateEnable (gl_state_t *state, gl_state_cap_t cap, int enabled)
+{
+    GLuint value = enabled ? 1 : 0;
+    if (GLStateChanged (state, state->caps[cap] != value))
+    {
+        if (value)
+        {
+            glEnable (g_glStateCaps[cap]);
+        }
+        else
+        {
+            glDisable (g_glStateCaps[cap]);
+        }
+        state->caps[cap] = value;
+    }
+}
+
+inline void
+GLStateDepthFunc (gl_state_t *state, GLenum func)
+{
+    if (GLStateChanged (state, state->depthFunc != func))
+    {
+        glDepthFunc (func);
+        state->depthFunc = func;
+    }
+}
+
+inline void
+GLStateDepthMask (gl_state_t *state, GLboolean mask)
+{
+    GLuint value = mask ? 1 : 0;
+    if (GLStateChanged (state, state->depthMask != value))
+    {
+        glDepthMask (mask);
+        state->depthMask = value;
+    }
+}
+
+inline void
+GLStateCullFace (gl_state_t *state, GLenum mode)
+{
+    if (GLStateChanged (state, state->cullFaceMode != mode))
+    {
+        glCullFace (mode);
+        state->cullFaceMode = mode;
+    }
+}
+
+inline void
+GLStateBlendEquationSeparate (gl_state_t *state, GLenum rgb, GLenum alpha)
+{
+    if (GLStateChanged (state, state->blendEquation[0] != rgb ||
+                        state->blendEquation[1] != alpha))
+    {
+        glBlendEquationSeparate (rgb, alpha);
+        state->blendEquation[0] = rgb;
+        state->blendEquation[1] = alpha;
+    }
+}
+
+inline void
+GLStateBlendFuncSeparate (gl_state_t *state,
+                          GLenum srcRGB, GLenum dstRGB,
+                          GLenum srcAlpha, GLenum dstAlpha)
+{
+    if (GLStateChanged (state, state->blendFunc[0] != srcRGB ||
+                        state->blendFunc[1] != dstRGB ||
+                        state->blendFunc[2] != srcAlpha ||
+                        state->blendFunc[3] != dstAlpha))
+    {
+        glBlendFuncSeparate (srcRGB, dstRGB, srcAlpha, dstAlpha);
+        state->blendFunc[0] = srcRGB;
+        state->blendFunc[1] = dstRGB;
+        state->blendFunc[2] = srcAlpha;
+        state->blendFunc[3] = dstAlpha;
+    }
+}
+
+inline void
+GLStateBindTexture (gl_state_t *state, GLuint unit, GLenum target,
+                    GLuint texture)
+{
+    assert (target == GL_TEXTURE_2D && unit < GL_STATE_MAX_TEXTURE_UNITS);
+
+    if (state->textures[unit] == texture)
+    {
+        state->elided++;
+        return;
+    }
+
+    if (GLStateChanged (state, state->activeTexture != GL_TEXTURE0 + unit))
+    {
+        glActiveTexture (GL_TEXTURE0 + unit);
+        state->activeTexture = GL_TEXTURE0 + unit;
+    }
+
+    state->issued++;
+    glBindTexture (target, texture);
+    state->textures[unit] = texture;
+}
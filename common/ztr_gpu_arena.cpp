@@ -0,0 +1,716 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_gpu_arena.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// One vertex buffer and one index buffer shared by every mesh, sub-allocated
+// with a best fit free list. GLES 3.0 has no base vertex draws, so indices
+// are stored rebased to absolute arena positions and a CPU shadow of the
+// index buffer is kept to rebase them again when vertices move. All meshes
+// with the vertex_t layout draw through one VAO, instanced meshes through a
+// second one that also points at their instance buffer. An allocation may
+// also reserve a stream range in the index buffer that is rewritten with a
+// subset of its triangles, one slice per frame in flight so a rewrite never
+// touches indices the GPU may still read, see GpuArenaStreamRanges.
+//
+
+// MARK: Constants
+
+#define GPU_ARENA_VERTEX_CAPACITY_DEFAULT (1 << 16)
+#define GPU_ARENA_INDEX_CAPACITY_DEFAULT (1 << 18)
+
+#define GPU_ARENA_INVALID 0xffffffffu
+
+// MARK: Structs
+
+struct gpu_range_t
+{
+    unsigned int offset;
+    unsigned int count;
+};
+
+// A GL buffer handed out in elements of a fixed stride
+struct gpu_pool_t
+{
+    GLenum target;
+    GLuint buffer;
+    unsigned int stride;
+    unsigned int capacity;
+    unsigned int used;
+
+    // Sorted by offset, neighbours are always merged
+    std::vector<gpu_range_t> freeRanges;
+};
+
+struct gpu_allocation_t
+{
+    int live;
+    gpu_range_t vertices;
+    gpu_range_t indices;
+
+    // Optional, FRAMES_IN_FLIGHT slices as large as indices, the first
+    // streamCount of each are in use
+    gpu_range_t stream;
+    unsigned int streamCount;
+
+    // Slice holding the latest ranges, and the slices that are behind
+    unsigned int streamSlice;
+    unsigned char streamStale[FRAMES_IN_FLIGHT];
+};
+
+struct gpu_arena_stats_t
+{
+    float vertexOccupancy;
+    float indexOccupancy;
+
+    // 1 - largest free range/total free, 0 when the free space is one block
+    float vertexFragmentation;
+    float indexFragmentation;
+
+    unsigned int liveAllocations;
+    unsigned int growCount;
+    unsigned int defragmentCount;
+};
+
+struct gpu_arena_t
+{
+    gpu_pool_t vertices;
+    gpu_pool_t indices;
+    std::vector<GLuint> indexShadow;
+
+    std::vector<gpu_allocation_t> allocations;
+    std::vector<unsigned int> freeHandles;
+
+    // Shared VAOs per vertex layout
+    GLuint vao;
+    GLuint instancedVAO;
+    GLuint instancedSource;
+
+    unsigned int growCount;
+    unsigned int defragmentCount;
+};
+
+// MARK: Globals
+
+static gpu_arena_t g_gpuArena;
+
+// MARK: Pool
+
+static void
+InitGpuPool (gpu_pool_t *pool, GLenum target, unsigned int stride,
+             unsigned int capacity)
+{
+    pool->target = target;
+    pool->stride = stride;
+    pool->capacity = capacity;
+    pool->used = 0;
+    pool->freeRanges.clear ();
+    pool->freeRanges.push_back ({ 0, capacity });
+
+    glGenBuffers (1, &pool->buffer);
+    glBindBuffer (GL_COPY_WRITE_BUFFER, pool->buffer);
+    glBufferData (GL_COPY_WRITE_BUFFER, (GLsizeiptr) capacity*stride,
+                  NULL, GL_STATIC_DRAW);
+}
+
+// Best fit, returns GPU_ARENA_INVALID when no single range is large enough
+static unsigned int
+GpuPoolAlloc (gpu_pool_t *pool, unsigned int count)
+{
+    int best = -1;
+    for (int i=0 ; i<(int) pool->freeRanges.size () ; i++)
+    {
+        unsigned int size = pool->freeRanges[i].count;
+        if (size >= count && (best < 0 || size < pool->freeRanges[best].count))
+        {
+            best = i;
+        }
+    }
+
+    if (best < 0)
+    {
+        return (GPU_ARENA_INVALID);
+    }
+
+    gpu_range_t *range = &pool->freeRanges[best];
+    unsigned int offset = range->offset;
+    range->offset += count;
+    range->count -= count;
+    if (range->count == 0)
+    {
+        pool->freeRanges.erase (pool->freeRanges.begin () + best);
+    }
+
+    pool->used += count;
+    return (offset);
+}
+
+static void
+GpuPoolFree (gpu_pool_t *pool, gpu_range_t range)
+{
+    if (range.count == 0)
+    {
+        return;
+    }
+
+    std::vector<gpu_range_t> *ranges = &pool->freeRanges;
+    size_t at = 0;
+    while (at < ranges->size () && (*ranges)[at].offset < range.offset)
+    {
+        at++;
+    }
+    ranges->insert (ranges->begin () + at, range);
+
+    // Merge with the following and the preceding range
+    if (at + 1 < ranges->size () &&
+        (*ranges)[at].offset + (*ranges)[at].count == (*ranges)[at + 1].offset)
+    {
+        (*ranges)[at].count += (*ranges)[at + 1].count;
+        ranges->erase (ranges->begin () + at + 1);
+    }
+    if (at > 0 &&
+        (*ranges)[at - 1].offset + (*ranges)[at - 1].count == (*ranges)[at].offset)
+    {
+        (*ranges)[at - 1].count += (*ranges)[at].count;
+        ranges->erase (ranges->begin () + at);
+    }
+
+    pool->used -= range.count;
+}
+
+static float
+GpuPoolFragmentation (gpu_pool_t *pool)
+{
+    unsigned int total = 0, largest = 0;
+    for (size_t i=0 ; i<pool->freeRanges.size () ; i++)
+    {
+        total += pool->freeRanges[i].count;
+        largest = HMM_MAX (largest, pool->freeRanges[i].count);
+    }
+    return ((total > 0) ? (1.f - (float) largest/(float) total) : 0.f);
+}
+
+// Swaps in a new buffer of the given capacity, the caller fills it
+static GLuint
+GpuPoolReplaceBuffer (gpu_pool_t *pool, unsigned int capacity)
+{
+    GLuint old = pool->buffer;
+
+    glGenBuffers (1, &pool->buffer);
+    glBindBuffer (GL_COPY_WRITE_BUFFER, pool->buffer);
+    glBufferData (GL_COPY_WRITE_BUFFER, (GLsizeiptr) capacity*pool->stride,
+                  NULL, GL_STATIC_DRAW);
+
+    // The tail beyond the old capacity becomes free
+    if (capacity > pool->capacity)
+    {
+        GpuPoolFree (pool, { pool->capacity, capacity - pool->capacity });
+        pool->used += capacity - pool->capacity;
+        pool->capacity = capacity;
+    }
+
+    return (old);
+}
+
+// MARK: Arena
+
+// Points both VAOs at the current buffers
+static void
+GpuArenaBindLayout (gpu_arena_t *arena)
+{
+    GLuint vaos[2] = { arena->vao, arena->instancedVAO };
+
+    for (int i=0 ; i<2 ; i++)
+    {
+        GLStateBindVertexArray (&g_glState, vaos[i]);
+        GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, arena->vertices.buffer);
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, arena->indices.buffer);
+
+        glEnableVertexAttribArray (ATTRIB_POSITION);
+        glVertexAttribPointer (ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE,
+                               sizeof (vertex_t),
+                               (GLvoid *) offsetof (vertex_t, position));
+
+        glEnableVertexAttribArray (ATTRIB_NORMAL);
+        glVertexAttribPointer (ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE,
+                               sizeof (vertex_t),
+                               (GLvoid *) offsetof (vertex_t, normal));
+    }
+
+    // Instance attributes are attached per draw
+    for (int column=0 ; column<4 ; column++)
+    {
+        glEnableVertexAttribArray (ATTRIB_INSTANCE_MODEL + column);
+        glVertexAttribDivisor (ATTRIB_INSTANCE_MODEL + column, 1);
+    }
+    glEnableVertexAttribArray (ATTRIB_INSTANCE_COLOR);
+    glVertexAttribDivisor (ATTRIB_INSTANCE_COLOR, 1);
+    arena->instancedSource = 0;
+
+    GLStateBindVertexArray (&g_glState, 0);
+}
+
+static void
+InitGpuArena (gpu_arena_t *arena)
+{
+    InitGpuPool (&arena->vertices, GL_ARRAY_BUFFER, sizeof (vertex_t),
+                 GPU_ARENA_VERTEX_CAPACITY_DEFAULT);
+    InitGpuPool (&arena->indices, GL_ELEMENT_ARRAY_BUFFER, sizeof (GLuint),
+                 GPU_ARENA_INDEX_CAPACITY_DEFAULT);
+    arena->indexShadow.assign (GPU_ARENA_INDEX_CAPACITY_DEFAULT, 0);
+
+    arena->allocations.clear ();
+    arena->freeHandles.clear ();
+    arena->growCount = 0;
+    arena->defragmentCount = 0;
+
+    glGenVertexArrays (1, &arena->vao);
+    glGenVertexArrays (1, &arena->instancedVAO);
+    GpuArenaBindLayout (arena);
+}
+
+// Every mesh is freed first, their allocations go with the arena
+static void
+FreeGpuArena (gpu_arena_t *arena)
+{
+    GLStateBindVertexArray (&g_glState, 0);
+    GLuint vaos[2] = { arena->vao, arena->instancedVAO };
+    glDeleteVertexArrays (2, vaos);
+
+    GLuint buffers[2] = { arena->vertices.buffer, arena->indices.buffer };
+    for (int i=0 ; i<2 ; i++)
+    {
+        GLStateForgetBuffer (&g_glState, buffers[i]);
+    }
+    glDeleteBuffers (2, buffers);
+
+    // Releases the memory, clear () would keep it
+    std::vector<GLuint> ().swap (arena->indexShadow);
+    std::vector<gpu_allocation_t> ().swap (arena->allocations);
+    std::vector<unsigned int> ().swap (arena->freeHandles);
+    std::vector<gpu_range_t> ().swap (arena->vertices.freeRanges);
+    std::vector<gpu_range_t> ().swap (arena->indices.freeRanges);
+
+    arena->vertices.buffer = 0;
+    arena->indices.buffer = 0;
+    arena->vao = 0;
+    arena->instancedVAO = 0;
+    arena->instancedSource = 0;
+}
+
+// Doubles the vertex pool until count fits at the end, offsets are kept
+static void
+GpuArenaGrowVertices (gpu_arena_t *arena, unsigned int count)
+{
+    gpu_pool_t *pool = &arena->vertices;
+    unsigned int capacity = pool->capacity;
+    while (capacity - pool->capacity < count)
+    {
+        capacity *= 2;
+    }
+
+    unsigned int oldCapacity = pool->capacity;
+    GLuint old = GpuPoolReplaceBuffer (pool, capacity);
+
+    glBindBuffer (GL_COPY_READ_BUFFER, old);
+    glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                         (GLsizeiptr) oldCapacity*pool->stride);
+    GLStateForgetBuffer (&g_glState, old);
+    glDeleteBuffers (1, &old);
+
+    arena->growCount++;
+    GpuArenaBindLayout (arena);
+}
+
+static void
+GpuArenaGrowIndices (gpu_arena_t *arena, unsigned int count)
+{
+    gpu_pool_t *pool = &arena->indices;
+    unsigned int capacity = pool->capacity;
+    while (capacity - pool->capacity < count)
+    {
+        capacity *= 2;
+    }
+
+    GLuint old = GpuPoolReplaceBuffer (pool, capacity);
+    arena->indexShadow.resize (capacity, 0);
+
+    // The shadow is the source of truth for indices
+    glBufferSubData (GL_COPY_WRITE_BUFFER, 0,
+                     (GLsizeiptr) capacity*pool->stride, arena->indexShadow.data ());
+    GLStateForgetBuffer (&g_glState, old);
+    glDeleteBuffers (1, &old);
+
+    arena->growCount++;
+    GpuArenaBindLayout (arena);
+}
+
+// Packs every live allocation to the front of fresh buffers and rebases
+// the indices of moved vertex ranges
+static void
+GpuArenaDefragment (gpu_arena_t *arena)
+{
+    std::vector<unsigned int> order;
+    for (unsigned int i=0 ; i<arena->allocations.size () ; i++)
+    {
+        if (arena->allocations[i].live)
+        {
+            order.push_back (i);
+        }
+    }
+
+    // Vertices, copied on the GPU in offset order
+    gpu_pool_t *vertices = &arena->vertices;
+    std::sort (order.begin (), order.end (), [&] (unsigned int a, unsigned int b) {
+        return (arena->allocations[a].vertices.offset <
+                arena->allocations[b].vertices.offset);
+    });
+
+    GLuint oldVertices = GpuPoolReplaceBuffer (vertices, vertices->capacity);
+    glBindBuffer (GL_COPY_READ_BUFFER, oldVertices);
+
+    unsigned int cursor = 0;
+    for (size_t i=0 ; i<order.size () ; i++)
+    {
+        gpu_allocation_t *allocation = &arena->allocations[order[i]];
+        gpu_range_t *range = &allocation->vertices;
+
+        glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                             (GLintptr) range->offset*vertices->stride,
+                             (GLintptr) cursor*vertices->stride,
+                             (GLsizeiptr) range->count*vertices->stride);
+
+        // Rebase in the shadow, uploaded with the index pass below
+        GLuint delta = range->offset - cursor;
+        GLuint *index = arena->indexShadow.data () + allocation->indices.offset;
+        for (unsigned int k=0 ; k<allocation->indices.count ; k++)
+        {
+            index[k] -= delta;
+        }
+        // Stale slices are rebased too, they are only ever overwritten
+        index = arena->indexShadow.data () + allocation->stream.offset;
+        for (unsigned int k=0 ; k<allocation->stream.count ; k++)
+        {
+            index[k] -= delta;
+        }
+
+        range->offset = cursor;
+        cursor += range->count;
+    }
+
+    vertices->freeRanges.clear ();
+    vertices->freeRanges.push_back ({ cursor, vertices->capacity - cursor });
+    vertices->used = cursor;
+
+    GLStateForgetBuffer (&g_glState, oldVertices);
+    glDeleteBuffers (1, &oldVertices);
+
+    // Indices and streams, compacted in the shadow then uploaded in one go
+    gpu_pool_t *indices = &arena->indices;
+    std::vector<gpu_range_t *> ranges;
+    for (size_t i=0 ; i<order.size () ; i++)
+    {
+        gpu_allocation_t *allocation = &arena->allocations[order[i]];
+        ranges.push_back (&allocation->indices);
+        if (allocation->stream.count > 0)
+        {
+            ranges.push_back (&allocation->stream);
+        }
+    }
+    std::sort (ranges.begin (), ranges.end (), [] (gpu_range_t *a, gpu_range_t *b) {
+        return (a->offset < b->offset);
+    });
+
+    cursor = 0;
+    for (size_t i=0 ; i<ranges.size () ; i++)
+    {
+        gpu_range_t *range = ranges[i];
+        memmove (arena->indexShadow.data () + cursor,
+                 arena->indexShadow.data () + range->offset,
+                 sizeof (GLuint)*range->count);
+        range->offset = cursor;
+        cursor += range->count;
+    }
+
+    indices->freeRanges.clear ();
+    indices->freeRanges.push_back ({ cursor, indices->capacity - cursor });
+    indices->used = cursor;
+
+    GLuint oldIndices = GpuPoolReplaceBuffer (indices, indices->capacity);
+    glBufferSubData (GL_COPY_WRITE_BUFFER, 0,
+                     (GLsizeiptr) cursor*indices->stride, arena->indexShadow.data ());
+    GLStateForgetBuffer (&g_glState, oldIndices);
+    glDeleteBuffers (1, &oldIndices);
+
+    arena->defragmentCount++;
+    GpuArenaBindLayout (arena);
+}
+
+static unsigned int
+GpuArenaAllocRange (gpu_arena_t *arena, gpu_pool_t *pool, unsigned int count)
+{
+    if (count == 0)
+    {
+        return (0);
+    }
+
+    unsigned int offset = GpuPoolAlloc (pool, count);
+    if (offset != GPU_ARENA_INVALID)
+    {
+        return (offset);
+    }
+
+    // Enough space in total means holes, compact before asking the driver
+    // for more memory
+    if (pool->capacity - pool->used >= count)
+    {
+        GpuArenaDefragment (arena);
+        offset = GpuPoolAlloc (pool, count);
+    }
+
+    if (offset == GPU_ARENA_INVALID)
+    {
+        if (pool == &arena->vertices)
+        {
+            GpuArenaGrowVertices (arena, count);
+        }
+        else
+        {
+            GpuArenaGrowIndices (arena, count);
+        }
+        offset = GpuPoolAlloc (pool, count);
+    }
+
+    assert (offset != GPU_ARENA_INVALID);
+    return (offset);
+}
+
+// Copies a mesh into the arena, indices are relative to its own vertices.
+// Returns the allocation handle.
+static unsigned int
+GpuArenaUpload (gpu_arena_t *arena,
+                vertex_t *vertices, unsigned int vertexCount,
+                GLuint *indices, unsigned int indexCount)
+{
+    gpu_allocation_t allocation;
+    allocation.live = 1;
+    allocation.vertices.count = vertexCount;
+    allocation.indices.count = indexCount;
+    allocation.stream = { 0, 0 };
+    allocation.streamCount = 0;
+    allocation.streamSlice = 0;
+    memset (allocation.streamStale, 0, FRAMES_IN_FLIGHT);
+
+    // Vertices first, a defragmentation for the indices keeps the shadow
+    // consistent because this allocation is not live yet
+    allocation.vertices.offset =
+        GpuArenaAllocRange (arena, &arena->vertices, vertexCount);
+
+    unsigned int handle;
+    if (!arena->freeHandles.empty ())
+    {
+        handle = arena->freeHandles.back ();
+        arena->freeHandles.pop_back ();
+    }
+    else
+    {
+        handle = (unsigned int) arena->allocations.size ();
+        arena->allocations.push_back ({});
+    }
+
+    // Reserve the vertex range under the handle before indices may compact
+    allocation.indices = { 0, 0 };
+    arena->allocations[handle] = allocation;
+
+    unsigned int indexOffset =
+        GpuArenaAllocRange (arena, &arena->indices, indexCount);
+
+    gpu_allocation_t *stored = &arena->allocations[handle];
+    stored->indices = { indexOffset, indexCount };
+
+    GLuint base = stored->vertices.offset;
+    GLuint *shadow = arena->indexShadow.data () + indexOffset;
+    for (unsigned int i=0 ; i<indexCount ; i++)
+    {
+        shadow[i] = indices[i] + base;
+    }
+
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, arena->vertices.buffer);
+    glBufferSubData (GL_ARRAY_BUFFER,
+                     (GLintptr) base*sizeof (vertex_t),
+                     (GLsizeiptr) vertexCount*sizeof (vertex_t), vertices);
+
+    // The element binding lives in the VAO
+    GLStateBindVertexArray (&g_glState, arena->vao);
+    glBufferSubData (GL_ELEMENT_ARRAY_BUFFER,
+                     (GLintptr) indexOffset*sizeof (GLuint),
+                     (GLsizeiptr) indexCount*sizeof (GLuint), shadow);
+    GLStateBindVertexArray (&g_glState, 0);
+
+    return (handle);
+}
+
+static void
+GpuArenaRelease (gpu_arena_t *arena, unsigned int handle)
+{
+    if (handle == GPU_ARENA_INVALID)
+    {
+        return;
+    }
+
+    gpu_allocation_t *allocation = &arena->allocations[handle];
+    assert (allocation->live);
+
+    GpuPoolFree (&arena->vertices, allocation->vertices);
+    GpuPoolFree (&arena->indices, allocation->indices);
+    GpuPoolFree (&arena->indices, allocation->stream);
+    allocation->live = 0;
+    arena->freeHandles.push_back (handle);
+}
+
+// Gives an allocation room to draw any subset of its own indices, once per
+// frame in flight
+static void
+GpuArenaReserveStream (gpu_arena_t *arena, unsigned int handle)
+{
+    unsigned int count = arena->allocations[handle].indices.count;
+    unsigned int offset =
+        GpuArenaAllocRange (arena, &arena->indices, count*FRAMES_IN_FLIGHT);
+
+    gpu_allocation_t *allocation = &arena->allocations[handle];
+    allocation->stream = { offset, count*FRAMES_IN_FLIGHT };
+    allocation->streamCount = 0;
+    allocation->streamSlice = 0;
+    memset (allocation->streamStale, 0, FRAMES_IN_FLIGHT);
+}
+
+// First index of a stream slice
+inline unsigned int
+GpuArenaStreamOffset (gpu_allocation_t *allocation, unsigned int slice)
+{
+    return (allocation->stream.offset + slice*allocation->indices.count);
+}
+
+inline void
+GpuArenaStreamUpload (gpu_arena_t *arena, gpu_allocation_t *allocation,
+                      unsigned int slice)
+{
+    unsigned int offset = GpuArenaStreamOffset (allocation, slice);
+    GLStateBindVertexArray (&g_glState, arena->vao);
+    FrameRingWrite (GL_ELEMENT_ARRAY_BUFFER,
+                    (GLintptr) offset*sizeof (GLuint),
+                    (GLsizeiptr) allocation->streamCount*sizeof (GLuint),
+                    arena->indexShadow.data () + offset);
+}
+
+// Rewrites the stream slice of the current frame with the given ranges of
+// the allocation's indices, ranges are relative to its first index. The
+// other slices may still be read by frames in flight, they are brought up
+// to date by GpuArenaStreamRefresh when their frame comes around
+static void
+GpuArenaStreamRanges (gpu_arena_t *arena, unsigned int handle,
+                      unsigned int *first, unsigned int *counts,
+                      unsigned int rangeCount)
+{
+    gpu_allocation_t *allocation = &arena->allocations[handle];
+    assert (allocation->stream.count == allocation->indices.count*FRAMES_IN_FLIGHT);
+
+    unsigned int slice = g_frameRing.current;
+    GLuint *source = arena->indexShadow.data () + allocation->indices.offset;
+    GLuint *dest = arena->indexShadow.data () + GpuArenaStreamOffset (allocation, slice);
+
+    unsigned int count = 0;
+    for (unsigned int i=0 ; i<rangeCount ; i++)
+    {
+        memcpy (dest + count, source + first[i], sizeof (GLuint)*counts[i]);
+        count += counts[i];
+    }
+    allocation->streamCount = count;
+    allocation->streamSlice = slice;
+    memset (allocation->streamStale, 1, FRAMES_IN_FLIGHT);
+    allocation->streamStale[slice] = 0;
+
+    if (count > 0)
+    {
+        GpuArenaStreamUpload (arena, allocation, slice);
+    }
+}
+
+// Copies the latest ranges into the slice of the current frame if it is
+// behind. Call every frame the stream is drawn without being rewritten
+static void
+GpuArenaStreamRefresh (gpu_arena_t *arena, unsigned int handle)
+{
+    gpu_allocation_t *allocation = &arena->allocations[handle];
+    unsigned int slice = g_frameRing.current;
+    if (!allocation->streamStale[slice])
+    {
+        return;
+    }
+
+    GLuint *shadow = arena->indexShadow.data ();
+    memcpy (shadow + GpuArenaStreamOffset (allocation, slice),
+            shadow + GpuArenaStreamOffset (allocation, allocation->streamSlice),
+            sizeof (GLuint)*allocation->streamCount);
+    allocation->streamSlice = slice;
+    allocation->streamStale[slice] = 0;
+
+    if (allocation->streamCount > 0)
+    {
+        GpuArenaStreamUpload (arena, allocation, slice);
+    }
+}
+
+// Binds the instanced VAO with its instance attributes reading from buffer
+static void
+GpuArenaBindInstances (gpu_arena_t *arena, GLuint buffer)
+{
+    GLStateBindVertexArray (&g_glState, arena->instancedVAO);
+    if (arena->instancedSource == buffer)
+    {
+        return;
+    }
+
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, buffer);
+    for (int column=0 ; column<4 ; column++)
+    {
+        glVertexAttribPointer (ATTRIB_INSTANCE_MODEL + column, 4, GL_FLOAT,
+                               GL_FALSE, sizeof (instance_t),
+                               (GLvoid *) (offsetof (instance_t, model) +
+                                           sizeof (hmm_vec4)*column));
+    }
+    glVertexAttribPointer (ATTRIB_INSTANCE_COLOR, 4, GL_FLOAT, GL_FALSE,
+                           sizeof (instance_t),
+                           (GLvoid *) offsetof (instance_t, color));
+    arena->instancedSource = buffer;
+}
+
+static gpu_arena_stats_t
+GpuArenaStats (gpu_arena_t *arena)
+{
+    gpu_arena_stats_t stats;
+    stats.vertexOccupancy =
+        (float) arena->vertices.used/(float) arena->vertices.capacity;
+    stats.indexOccupancy =
+        (float) arena->indices.used/(float) arena->indices.capacity;
+    stats.vertexFragmentation = GpuPoolFragmentation (&arena->vertices);
+    stats.indexFragmentation = GpuPoolFragmentation (&arena->indices);
+    stats.liveAllocations =
+        (unsigned int) (arena->allocations.size () - arena->freeHandles.size ());
+    stats.growCount = arena->growCount;
+    stats.defragmentCount = arena->defragmentCount;
+    return (stats);
+}
+
+static void
+PrintGpuArenaStats (gpu_arena_t *arena)
+{
+    gpu_arena_stats_t stats = GpuArenaStats (arena);
+    printf ("GPU arena: %u allocations, vertices %.1f%% used %.1f%% fragmented, "
+            "indices %.1f%% used %.1f%% fragmented, %u grows, %u defragments\n",
+            stats.liveAllocations,
+            stats.vertexOccupancy*100.f, stats.vertexFragmentation*100.f,
+            stats.indexOccupancy*100.f, stats.indexFragmentation*100.f,
+            stats.growCount, stats.defragmentCount);
+}
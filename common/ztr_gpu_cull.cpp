@@ -0,0 +1,287 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_gpu_cull.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Cluster culling on the GPU for ES 3.1 contexts. Mesh and cluster bounds
+// live in shader storage buffers, a compute shader tests every cluster,
+// copies the indices of visible ones into the stream range of their mesh
+// and counts them into one DrawElementsIndirectCommand per mesh. The draw
+// loop then issues glDrawElementsIndirect and the CPU never sees which
+// clusters were visible. The mesh and command buffers hold a slice per
+// frame in flight, written without waiting on the GPU, and each frame
+// compacts into its own stream slice like the CPU path does. Without
+// ES 3.1 headers or context, or when the program fails to build, enabled
+// stays 0 and the CPU path in ztr_mesh_clusters.cpp is used.
+//
+
+// MARK: Constants
+
+#define GPU_CULL_BINDING_MESHES 0
+#define GPU_CULL_BINDING_CLUSTERS 1
+#define GPU_CULL_BINDING_COMMANDS 2
+#define GPU_CULL_BINDING_INDICES 3
+
+// Words of a DrawElementsIndirectCommand
+#define GPU_CULL_COMMAND_WORDS 5
+
+// Work groups per row of the dispatch, ES 3.1 only guarantees 65535
+#define GPU_CULL_GROUPS_X (1 << 15)
+
+// MARK: Structs
+
+// std430 layouts of CullMesh and CullCluster in cluster_cull_comp.glsl
+struct gpu_cull_mesh_t
+{
+    hmm_vec4 planes[CULL_PLANES];
+    hmm_vec4 forward;
+    hmm_vec4 boxCenter;
+    hmm_vec4 boxExtent;
+    GLuint ranges[4];
+};
+
+struct gpu_cull_cluster_t
+{
+    hmm_vec4 center;
+    hmm_vec4 extent;
+    hmm_vec4 cone;
+    GLuint range[4];
+};
+
+struct gpu_cull_t
+{
+    int enabled;
+
+    GLuint program;
+    GLint clusterCountLoc;
+
+    GLuint meshBuffer;
+    GLuint clusterBuffer;
+    GLuint commandBuffer;
+
+    // Slices of the mesh and command buffers, and the one of this frame
+    GLint meshStride;
+    GLint commandStride;
+    unsigned int frame;
+
+    // Clusters are uploaded again when meshes are added or replaced
+    unsigned int clusterCount;
+    int builtMeshCount;
+
+    gpu_cull_mesh_t meshes[MAX_MESHES];
+    GLuint commands[MAX_MESHES*GPU_CULL_COMMAND_WORDS];
+};
+
+// MARK: Globals
+
+static gpu_cull_t g_gpuCull;
+
+// MARK: Functions
+
+#ifdef ZTR_GL_COMPUTE
+
+// Takes ownership of a linked compute program, 0 leaves the path disabled
+static void
+InitGpuCull (gpu_cull_t *cull, GLuint program)
+{
+    cull->enabled = 0;
+    cull->program = program;
+    cull->clusterCount = 0;
+    cull->builtMeshCount = -1;
+    if (program == 0)
+    {
+        return;
+    }
+
+    cull->clusterCountLoc = glGetUniformLocation (program, "clusterCount");
+
+    GLint alignment;
+    glGetIntegerv (GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    cull->meshStride = FrameRingStride (sizeof (cull->meshes), alignment);
+    cull->commandStride = FrameRingStride (sizeof (cull->commands), alignment);
+    cull->frame = 0;
+
+    GLuint buffers[3];
+    glGenBuffers (3, buffers);
+    cull->meshBuffer = buffers[0];
+    cull->clusterBuffer = buffers[1];
+    cull->commandBuffer = buffers[2];
+
+    GLStateBindBuffer (&g_glState, GL_SHADER_STORAGE_BUFFER, cull->meshBuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, cull->meshStride*FRAMES_IN_FLIGHT,
+                  NULL, GL_DYNAMIC_DRAW);
+
+    // Written by the compute shader and read as draw commands
+    GLStateBindBuffer (&g_glState, GL_SHADER_STORAGE_BUFFER, cull->commandBuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, cull->commandStride*FRAMES_IN_FLIGHT,
+                  NULL, GL_DYNAMIC_DRAW);
+
+    cull->enabled = 1;
+}
+
+static void
+GpuCullBuildClusters (gpu_cull_t *cull, mesh_t *meshes, int meshCount)
+{
+    std::vector<gpu_cull_cluster_t> clusters;
+    for (int m=0 ; m<meshCount ; m++)
+    {
+        mesh_clusters_t *source = &meshes[m].clusters;
+        for (unsigned int c=0 ; c<source->count ; c++)
+        {
+            gpu_cull_cluster_t cluster;
+            cluster.center = HMM_Vec4 (source->boxes.cx[c], source->boxes.cy[c],
+                                       source->boxes.cz[c], 0.f);
+            cluster.extent = HMM_Vec4 (source->boxes.ex[c], source->boxes.ey[c],
+                                       source->boxes.ez[c], 0.f);
+            cluster.cone = HMM_Vec4 (source->coneX[c], source->coneY[c],
+                                     source->coneZ[c], source->coneCutoff[c]);
+            cluster.range[0] = source->firstIndex[c];
+            cluster.range[1] = source->indexCount[c];
+            cluster.range[2] = (GLuint) m;
+            cluster.range[3] = 0;
+            clusters.push_back (cluster);
+        }
+    }
+
+    cull->clusterCount = (unsigned int) clusters.size ();
+    cull->builtMeshCount = meshCount;
+
+    if (cull->clusterCount > 0)
+    {
+        GLStateBindBuffer (&g_glState, GL_SHADER_STORAGE_BUFFER, cull->clusterBuffer);
+        glBufferData (GL_SHADER_STORAGE_BUFFER,
+                      sizeof (gpu_cull_cluster_t)*clusters.size (),
+                      clusters.data (), GL_STATIC_DRAW);
+    }
+}
+
+// Culls the clusters of every visible, clustered, non instanced mesh and
+// leaves one draw command per mesh in the command buffer
+static void
+GpuCullDispatch (gpu_cull_t *cull, mesh_t *meshes, int meshCount,
+                 unsigned char *meshVisible, frustum_t *frustum,
+                 hmm_vec3 forward, unsigned int frame)
+{
+    cull->frame = frame;
+
+    if (cull->builtMeshCount != meshCount)
+    {
+        GpuCullBuildClusters (cull, meshes, meshCount);
+    }
+    if (cull->clusterCount == 0)
+    {
+        return;
+    }
+
+    for (int m=0 ; m<meshCount ; m++)
+    {
+        mesh_t *mesh = meshes + m;
+        gpu_cull_mesh_t *entry = cull->meshes + m;
+        GLuint *command = cull->commands + m*GPU_CULL_COMMAND_WORDS;
+
+        int enabled = meshVisible[m] && mesh->instanceCount == 0 &&
+                      mesh->clusters.count > 0;
+        gpu_allocation_t *allocation = &g_gpuArena.allocations[mesh->allocation];
+
+        if (enabled)
+        {
+            frustum_t local = FrustumToLocal (frustum, mesh->model);
+            memcpy (entry->planes, local.planes, sizeof (local.planes));
+
+            hmm_vec3 localForward;
+            int cone = ClusterLocalForward (mesh->model, forward, &localForward);
+            entry->forward = HMM_Vec4v (localForward, cone ? 1.f : 0.f);
+
+            entry->boxCenter = HMM_Vec4v ((mesh->bounds.min + mesh->bounds.max)*0.5f, 0.f);
+            entry->boxExtent = HMM_Vec4v ((mesh->bounds.max - mesh->bounds.min)*0.5f, 0.f);
+            entry->ranges[0] = allocation->indices.offset;
+            entry->ranges[1] = GpuArenaStreamOffset (allocation, frame);
+        }
+        entry->ranges[2] = (GLuint) enabled;
+        entry->ranges[3] = 0;
+
+        // count, instanceCount, firstIndex, baseVertex, reserved
+        command[0] = 0;
+        command[1] = 1;
+        command[2] = GpuArenaStreamOffset (allocation, frame);
+        command[3] = 0;
+        command[4] = 0;
+    }
+
+    GLintptr meshOffset = frame*cull->meshStride;
+    GLintptr commandOffset = frame*cull->commandStride;
+    GLStateBindBuffer (&g_glState, GL_SHADER_STORAGE_BUFFER, cull->meshBuffer);
+    FrameRingWrite (GL_SHADER_STORAGE_BUFFER, meshOffset,
+                    sizeof (gpu_cull_mesh_t)*meshCount, cull->meshes);
+    GLStateBindBuffer (&g_glState, GL_SHADER_STORAGE_BUFFER, cull->commandBuffer);
+    FrameRingWrite (GL_SHADER_STORAGE_BUFFER, commandOffset,
+                    sizeof (GLuint)*GPU_CULL_COMMAND_WORDS*meshCount,
+                    cull->commands);
+
+    glBindBufferRange (GL_SHADER_STORAGE_BUFFER, GPU_CULL_BINDING_MESHES,
+                       cull->meshBuffer, meshOffset, sizeof (cull->meshes));
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, GPU_CULL_BINDING_CLUSTERS,
+                      cull->clusterBuffer);
+    glBindBufferRange (GL_SHADER_STORAGE_BUFFER, GPU_CULL_BINDING_COMMANDS,
+                       cull->commandBuffer, commandOffset, sizeof (cull->commands));
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, GPU_CULL_BINDING_INDICES,
+                      g_gpuArena.indices.buffer);
+
+    GLStateUseProgram (&g_glState, cull->program);
+    glUniform1ui (cull->clusterCountLoc, cull->clusterCount);
+
+    GLuint groupsX = HMM_MIN (cull->clusterCount, GPU_CULL_GROUPS_X);
+    GLuint groupsY = (cull->clusterCount + GPU_CULL_GROUPS_X - 1)/GPU_CULL_GROUPS_X;
+    glDispatchCompute (groupsX, groupsY, 1);
+
+    // The streams are read as indices and the counts as draw commands
+    glMemoryBarrier (GL_ELEMENT_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+inline void
+GpuCullDraw (gpu_cull_t *cull, GLenum mode, int meshIndex)
+{
+    GLStateBindBuffer (&g_glState, GL_DRAW_INDIRECT_BUFFER, cull->commandBuffer);
+    glDrawElementsIndirect (mode, GL_UNSIGNED_INT,
+                            (GLvoid *) (cull->frame*cull->commandStride +
+                                        sizeof (GLuint)*GPU_CULL_COMMAND_WORDS*
+                                        meshIndex));
+}
+
+static void
+FreeGpuCull (gpu_cull_t *cull)
+{
+    if (cull->program != 0)
+    {
+        GLuint buffers[3] = { cull->meshBuffer, cull->clusterBuffer,
+                              cull->commandBuffer };
+        for (int i=0 ; i<3 ; i++)
+        {
+            GLStateForgetBuffer (&g_glState, buffers[i]);
+        }
+        glDeleteBuffers (3, buffers);
+        glDeleteProgram (cull->program);
+    }
+    cull->program = 0;
+    cull->enabled = 0;
+}
+
+#else
+
+// Without ES 3.1 headers the CPU path is the only one
+inline void InitGpuCull (gpu_cull_t *cull, GLuint program) { cull->enabled = 0; }
+inline void FreeGpuCull (gpu_cull_t *cull) {}
+inline void GpuCullDispatch (gpu_cull_t *, mesh_t *, int, unsigned char *,
+                             frustum_t *, hmm_vec3, unsigned int) {}
+inline void GpuCullDraw (gpu_cull_t *, GLenum, int) {}
+
+#endif
+
+// The clusters are built again on the next dispatch, for meshes that were
+// replaced while their count stayed the same
+inline void
+GpuCullInvalidate (gpu_cull_t *cull)
+{
+    cull->builtMeshCount = -1;
+}
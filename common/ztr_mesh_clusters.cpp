@@ -0,0 +1,522 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_mesh_clusters.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Splits a mesh into clusters of up to a hundred or so triangles with a
+// model space box and a cone bounding the face normals. Triangles are
+// bucketed by normal direction and ordered along a Morton curve inside each
+// bucket, so clusters are both compact and facing one way. Small meshes get
+// a coarser grid and leftovers at bucket ends join a neighbour while their
+// normals still fit in a narrow cone. Every frame the
+// clusters are tested four at a time against the frustum and, with the
+// orthographic camera, against the view direction: a cluster whose whole
+// normal cone faces away is dropped before any of its vertices are shaded.
+//
+
+// MARK: Constants
+
+#define CLUSTER_TRIANGLES_DEFAULT 128
+
+// Smaller runs are merged with a neighbour when the cone allows
+#define CLUSTER_MIN_TRIANGLES_DEFAULT 64
+
+// Merged clusters keep every normal within this dot of the cone axis, about
+// 25 degrees. Wider cones make bigger clusters that are back facing from
+// fewer views
+#define CLUSTER_MERGE_MIN_DOT 0.9f
+
+// Face normals are bucketed per cube face on a grid of up to this size,
+// finer grids give narrower cones. Meshes too small to fill the buckets
+// with minTriangles each use a coarser one
+#define CLUSTER_NORMAL_GRID_DEFAULT 6
+
+// Cutoff of a cone that can never be back facing
+#define CLUSTER_CONE_DISABLED 2.f
+
+// MARK: Structs
+
+struct cluster_params_t
+{
+    int enabled;
+    int maxTriangles;
+    int minTriangles;
+    int normalGrid;
+};
+
+struct mesh_clusters_t
+{
+    unsigned int count;
+    unsigned int triangleCount;
+
+    // Index ranges relative to the mesh, the mesh indices are reordered so
+    // clusters follow each other
+    unsigned int *firstIndex;
+    unsigned int *indexCount;
+
+    // Model space boxes and normal cones, a cluster is back facing when
+    // dot (axis, view direction) > cutoff
+    cull_boxes_t boxes;
+    float *coneX, *coneY, *coneZ;
+    float *coneCutoff;
+
+    // Result of the last cull, visible clusters merged into index runs
+    unsigned char *visible;
+    unsigned char *lastVisible;
+    unsigned int *runFirst;
+    unsigned int *runCount;
+    unsigned int runs;
+    unsigned int visibleTriangles;
+    int dirty;
+
+    // Clusters of the last cull that passed the frustum and cone tests but
+    // were hidden by the occlusion test
+    unsigned int occluded;
+    unsigned int occludedTriangles;
+
+    double milliseconds;
+};
+
+struct cluster_sort_t
+{
+    uint64_t key;
+    unsigned int triangle;
+};
+
+// MARK: Utility Functions
+
+inline void
+InitClusterParams (cluster_params_t *params)
+{
+    params->enabled = 1;
+    params->maxTriangles = CLUSTER_TRIANGLES_DEFAULT;
+    params->minTriangles = CLUSTER_MIN_TRIANGLES_DEFAULT;
+    params->normalGrid = CLUSTER_NORMAL_GRID_DEFAULT;
+}
+
+static void
+FreeMeshClusters (mesh_clusters_t *clusters)
+{
+    FreeCullBoxes (&clusters->boxes);
+
+    void *arrays[] = {
+        clusters->firstIndex, clusters->indexCount,
+        clusters->coneX, clusters->coneY, clusters->coneZ, clusters->coneCutoff,
+        clusters->visible, clusters->lastVisible,
+        clusters->runFirst, clusters->runCount,
+    };
+    for (unsigned int i=0 ; i<sizeof (arrays)/sizeof (arrays[0]) ; i++)
+    {
+        free (arrays[i]);
+    }
+    *clusters = {};
+}
+
+// Spreads the low 10 bits of x three apart
+inline uint32_t
+ClusterMortonSpread (uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return (x);
+}
+
+// Cube face and grid cell of a unit normal
+inline unsigned int
+ClusterNormalBucket (hmm_vec3 n, int grid)
+{
+    float ax = fabsf (n.X), ay = fabsf (n.Y), az = fabsf (n.Z);
+
+    int face;
+    float u, v, major;
+    if (ax >= ay && ax >= az)
+    {
+        face = (n.X > 0.f) ? 0 : 1;
+        major = ax; u = n.Y; v = n.Z;
+    }
+    else if (ay >= az)
+    {
+        face = (n.Y > 0.f) ? 2 : 3;
+        major = ay; u = n.X; v = n.Z;
+    }
+    else
+    {
+        face = (n.Z > 0.f) ? 4 : 5;
+        major = az; u = n.X; v = n.Y;
+    }
+
+    if (major == 0.f)
+    {
+        return (0);
+    }
+
+    int cu = (int) ((u/major*0.5f + 0.5f)*(float) grid);
+    int cv = (int) ((v/major*0.5f + 0.5f)*(float) grid);
+    cu = HMM_MIN (HMM_MAX (cu, 0), grid - 1);
+    cv = HMM_MIN (HMM_MAX (cv, 0), grid - 1);
+
+    return ((unsigned int) ((face*grid + cu)*grid + cv));
+}
+
+// Average normal of the sorted triangles first to last in axis. Returns the
+// smallest dot of a triangle normal with it, degenerate triangles draw
+// nothing and are ignored, or -1 when the normals cancel out
+static float
+ClusterCone (const hmm_vec3 *normals, const cluster_sort_t *order,
+             unsigned int first, unsigned int last, hmm_vec3 *axis)
+{
+    *axis = HMM_Vec3 (0.f, 0.f, 0.f);
+    for (unsigned int t=first ; t<last ; t++)
+    {
+        *axis += normals[order[t].triangle];
+    }
+
+    float axisLength = HMM_LengthVec3 (*axis);
+    if (axisLength == 0.f)
+    {
+        return (-1.f);
+    }
+    *axis = *axis*(1.f/axisLength);
+
+    float minDot = 1.f;
+    for (unsigned int t=first ; t<last ; t++)
+    {
+        hmm_vec3 n = normals[order[t].triangle];
+        if (n.X != 0.f || n.Y != 0.f || n.Z != 0.f)
+        {
+            minDot = HMM_MIN (minDot, HMM_DotVec3 (*axis, n));
+        }
+    }
+    return (minDot);
+}
+
+// MARK: Build
+
+// Reorders the triangles of indices in place and fills clusters. Meshes too
+// small for two clusters are left alone with a cluster count of zero.
+static void
+BuildMeshClusters (mesh_clusters_t *clusters, cluster_params_t *params,
+                   float *positions, unsigned int strideFloats,
+                   GLuint *indices, unsigned int indexCount)
+{
+    *clusters = {};
+
+    unsigned int triangleCount = indexCount/3;
+    unsigned int maxTriangles = (unsigned int) params->maxTriangles;
+    unsigned int minTriangles = (unsigned int) params->minTriangles;
+    if (!params->enabled || triangleCount < 2*maxTriangles)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    // Face normals and centroids
+    std::vector<hmm_vec3> normals (triangleCount);
+    std::vector<hmm_vec3> centroids (triangleCount);
+    hmm_vec3 lo = HMM_Vec3 (FLT_MAX, FLT_MAX, FLT_MAX);
+    hmm_vec3 hi = HMM_Vec3 (-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (unsigned int t=0 ; t<triangleCount ; t++)
+    {
+        hmm_vec3 p[3];
+        for (int k=0 ; k<3 ; k++)
+        {
+            float *v = positions + (size_t) indices[t*3 + k]*strideFloats;
+            p[k] = HMM_Vec3 (v[0], v[1], v[2]);
+        }
+
+        hmm_vec3 n = HMM_Cross (p[1] - p[0], p[2] - p[0]);
+        float length = HMM_LengthVec3 (n);
+        normals[t] = (length > 0.f) ? n*(1.f/length) : HMM_Vec3 (0.f, 0.f, 0.f);
+
+        hmm_vec3 c = (p[0] + p[1] + p[2])*(1.f/3.f);
+        centroids[t] = c;
+        lo = HMM_Vec3 (HMM_MIN (lo.X, c.X), HMM_MIN (lo.Y, c.Y), HMM_MIN (lo.Z, c.Z));
+        hi = HMM_Vec3 (HMM_MAX (hi.X, c.X), HMM_MAX (hi.Y, c.Y), HMM_MAX (hi.Z, c.Z));
+    }
+
+    // Enough buckets for narrow cones, few enough to fill them
+    int normalGrid = params->normalGrid;
+    while (normalGrid > 1 &&
+           6u*normalGrid*normalGrid*minTriangles > triangleCount)
+    {
+        normalGrid--;
+    }
+
+    // Normal bucket in the high bits, Morton code of the centroid below
+    hmm_vec3 size = hi - lo;
+    float extent = HMM_MAX (HMM_MAX (size.X, size.Y), size.Z);
+    float scale = (extent > 0.f) ? 1023.f/extent : 0.f;
+
+    std::vector<cluster_sort_t> order (triangleCount);
+    for (unsigned int t=0 ; t<triangleCount ; t++)
+    {
+        hmm_vec3 q = (centroids[t] - lo)*scale;
+        uint32_t morton = (ClusterMortonSpread ((uint32_t) q.X) << 2) |
+                          (ClusterMortonSpread ((uint32_t) q.Y) << 1) |
+                          ClusterMortonSpread ((uint32_t) q.Z);
+        uint64_t bucket = ClusterNormalBucket (normals[t], normalGrid);
+
+        order[t].key = (bucket << 32) | morton;
+        order[t].triangle = t;
+    }
+    std::sort (order.begin (), order.end (),
+               [] (const cluster_sort_t &a, const cluster_sort_t &b) {
+                   return (a.key < b.key);
+               });
+
+    std::vector<GLuint> sorted (triangleCount*3);
+    for (unsigned int t=0 ; t<triangleCount ; t++)
+    {
+        memcpy (sorted.data () + t*3, indices + order[t].triangle*3,
+                sizeof (GLuint)*3);
+    }
+    memcpy (indices, sorted.data (), sizeof (GLuint)*triangleCount*3);
+
+    // Cut a new run at bucket changes and every maxTriangles
+    std::vector<unsigned int> runs;
+    for (unsigned int t=0 ; t<triangleCount ; t++)
+    {
+        if (runs.empty () || t - runs.back () == maxTriangles ||
+            (order[t].key >> 32) != (order[t - 1].key >> 32))
+        {
+            runs.push_back (t);
+        }
+    }
+    runs.push_back (triangleCount);
+
+    // A run too small on either side joins the cluster before it, as long
+    // as the two fit in maxTriangles and a narrow cone. Morton order keeps
+    // the merged cluster compact
+    std::vector<unsigned int> starts;
+    for (size_t r=0 ; r + 1<runs.size () ; r++)
+    {
+        unsigned int first = runs[r];
+        unsigned int last = runs[r + 1];
+        if (!starts.empty ())
+        {
+            unsigned int current = first - starts.back ();
+            hmm_vec3 axis;
+            if ((current < minTriangles || last - first < minTriangles) &&
+                current + last - first <= maxTriangles &&
+                ClusterCone (normals.data (), order.data (), starts.back (), last,
+                             &axis) >= CLUSTER_MERGE_MIN_DOT)
+            {
+                continue;
+            }
+        }
+        starts.push_back (first);
+    }
+
+    unsigned int count = (unsigned int) starts.size ();
+    clusters->count = count;
+    clusters->triangleCount = triangleCount;
+
+    CullBoxesReset (&clusters->boxes, count);
+    unsigned int capacity = clusters->boxes.capacity;
+
+    clusters->firstIndex = (unsigned int *) malloc (sizeof (unsigned int)*count);
+    clusters->indexCount = (unsigned int *) malloc (sizeof (unsigned int)*count);
+    clusters->coneX = (float *) malloc (sizeof (float)*capacity);
+    clusters->coneY = (float *) malloc (sizeof (float)*capacity);
+    clusters->coneZ = (float *) malloc (sizeof (float)*capacity);
+    clusters->coneCutoff = (float *) malloc (sizeof (float)*capacity);
+    clusters->visible = (unsigned char *) malloc (capacity);
+    clusters->lastVisible = (unsigned char *) malloc (capacity);
+    clusters->runFirst = (unsigned int *) malloc (sizeof (unsigned int)*count);
+    clusters->runCount = (unsigned int *) malloc (sizeof (unsigned int)*count);
+
+    unsigned int smallest = triangleCount;
+    unsigned int largest = 0;
+    for (unsigned int c=0 ; c<count ; c++)
+    {
+        unsigned int first = starts[c];
+        unsigned int last = (c + 1 < count) ? starts[c + 1] : triangleCount;
+
+        clusters->firstIndex[c] = first*3;
+        clusters->indexCount[c] = (last - first)*3;
+        smallest = HMM_MIN (smallest, last - first);
+        largest = HMM_MAX (largest, last - first);
+
+        hmm_vec3 boxMin = HMM_Vec3 (FLT_MAX, FLT_MAX, FLT_MAX);
+        hmm_vec3 boxMax = HMM_Vec3 (-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+        for (unsigned int t=first ; t<last ; t++)
+        {
+            for (int k=0 ; k<3 ; k++)
+            {
+                float *v = positions + (size_t) indices[t*3 + k]*strideFloats;
+                boxMin = HMM_Vec3 (HMM_MIN (boxMin.X, v[0]),
+                                   HMM_MIN (boxMin.Y, v[1]),
+                                   HMM_MIN (boxMin.Z, v[2]));
+                boxMax = HMM_Vec3 (HMM_MAX (boxMax.X, v[0]),
+                                   HMM_MAX (boxMax.Y, v[1]),
+                                   HMM_MAX (boxMax.Z, v[2]));
+            }
+        }
+
+        CullBoxesPush (&clusters->boxes, HMM_Mat4d (1.f),
+                       (boxMin + boxMax)*0.5f, (boxMax - boxMin)*0.5f);
+
+        // The widest normal sets the cone. Back facing when the view
+        // direction is within 90 - angle of the axis,
+        // dot > cos (90 - angle) = sin (angle)
+        hmm_vec3 axis;
+        float minDot = ClusterCone (normals.data (), order.data (), first, last, &axis);
+        float cutoff = (minDot > 0.f) ?
+            HMM_SquareRootF (1.f - minDot*minDot) : CLUSTER_CONE_DISABLED;
+
+        clusters->coneX[c] = axis.X;
+        clusters->coneY[c] = axis.Y;
+        clusters->coneZ[c] = axis.Z;
+        clusters->coneCutoff[c] = cutoff;
+    }
+
+    // Pad the lanes so the cone test reads nothing uninitialized
+    for (unsigned int c=count ; c<capacity ; c++)
+    {
+        clusters->coneX[c] = 0.f;
+        clusters->coneY[c] = 0.f;
+        clusters->coneZ[c] = 0.f;
+        clusters->coneCutoff[c] = CLUSTER_CONE_DISABLED;
+    }
+
+    // Nothing was drawn yet, the first cull always builds the runs
+    memset (clusters->lastVisible, 0xff, capacity);
+    clusters->dirty = 1;
+
+    clusters->milliseconds = ScanMeshMilliseconds (start);
+
+    printf ("Clusters %u for %u triangles, %.1f triangles on average, "
+            "%u to %u, normal grid %d, built in %.2f ms\n", count, triangleCount,
+            (float) triangleCount/(float) count, smallest, largest, normalGrid,
+            clusters->milliseconds);
+}
+
+// MARK: Cull
+
+// Model space view direction for an orthographic camera looking along
+// forward. Normals keep their angles only under a uniform scale, returns
+// false when the cone test would not be safe.
+static int
+ClusterLocalForward (hmm_mat4 m, hmm_vec3 forward, hmm_vec3 *localForward)
+{
+    float scale[3];
+    for (int c=0 ; c<3 ; c++)
+    {
+        scale[c] = m.Elements[c][0]*m.Elements[c][0] +
+                   m.Elements[c][1]*m.Elements[c][1] +
+                   m.Elements[c][2]*m.Elements[c][2];
+
+        // M^T forward, the inverse rotation up to scale
+        localForward->Elements[c] = m.Elements[c][0]*forward.X +
+                                    m.Elements[c][1]*forward.Y +
+                                    m.Elements[c][2]*forward.Z;
+    }
+    *localForward = HMM_NormalizeVec3 (*localForward);
+
+    return (fabsf (scale[0] - scale[1]) <= 1e-3f*scale[0] &&
+            fabsf (scale[0] - scale[2]) <= 1e-3f*scale[0]);
+}
+
+// Culls against frustum planes already moved to model space. forward is
+// the model space view direction of an orthographic camera, pass NULL to
+// skip the back face test. Clusters left are tested against occlusion with
+// the model matrix when it is not NULL. Returns the number of visible
+// clusters and marks the clusters dirty when the visible set changed.
+static unsigned int
+CullMeshClusters (mesh_clusters_t *clusters, frustum_t *localFrustum,
+                  hmm_vec3 *forward, occlusion_buffer_t *occlusion,
+                  hmm_mat4 model)
+{
+    unsigned char *visible = clusters->visible;
+    FrustumCullBoxes (localFrustum, &clusters->boxes, visible);
+
+    if (forward)
+    {
+        cull_lane_t fx = CullSet (-forward->X);
+        cull_lane_t fy = CullSet (-forward->Y);
+        cull_lane_t fz = CullSet (-forward->Z);
+
+        for (unsigned int i=0 ; i<clusters->count ; i+=CULL_LANES)
+        {
+            // cutoff - dot (axis, forward) < 0 means back facing
+            cull_lane_t d = CullLoad (clusters->coneCutoff + i);
+            d = CullMulAdd (CullLoad (clusters->coneX + i), fx, d);
+            d = CullMulAdd (CullLoad (clusters->coneY + i), fy, d);
+            d = CullMulAdd (CullLoad (clusters->coneZ + i), fz, d);
+
+            unsigned int mask = CullMask (CullNegative (d));
+            unsigned int lanes = HMM_MIN (CULL_LANES, clusters->count - i);
+            for (unsigned int k=0 ; k<lanes ; k++)
+            {
+                visible[i + k] &= ((mask >> k) & 1) ^ 1;
+            }
+        }
+    }
+
+    clusters->occluded = 0;
+    clusters->occludedTriangles = 0;
+    if (occlusion)
+    {
+        cull_boxes_t *boxes = &clusters->boxes;
+        for (unsigned int i=0 ; i<clusters->count ; i++)
+        {
+            if (visible[i] &&
+                !OcclusionTestBox (occlusion, model,
+                                   HMM_Vec3 (boxes->cx[i], boxes->cy[i], boxes->cz[i]),
+                                   HMM_Vec3 (boxes->ex[i], boxes->ey[i], boxes->ez[i])))
+            {
+                visible[i] = 0;
+                clusters->occluded++;
+                clusters->occludedTriangles += clusters->indexCount[i]/3;
+            }
+        }
+    }
+
+    unsigned int visibleCount = 0;
+    for (unsigned int i=0 ; i<clusters->count ; i++)
+    {
+        visibleCount += visible[i];
+    }
+
+    if (memcmp (visible, clusters->lastVisible, clusters->count) == 0)
+    {
+        return (visibleCount);
+    }
+    memcpy (clusters->lastVisible, visible, clusters->count);
+
+    // Neighbouring clusters are neighbouring index ranges
+    clusters->runs = 0;
+    clusters->visibleTriangles = 0;
+    for (unsigned int i=0 ; i<clusters->count ; i++)
+    {
+        if (!visible[i])
+        {
+            continue;
+        }
+
+        unsigned int run = clusters->runs;
+        if (run > 0 && clusters->runFirst[run - 1] + clusters->runCount[run - 1] ==
+            clusters->firstIndex[i])
+        {
+            clusters->runCount[run - 1] += clusters->indexCount[i];
+        }
+        else
+        {
+            clusters->runFirst[run] = clusters->firstIndex[i];
+            clusters->runCount[run] = clusters->indexCount[i];
+            clusters->runs++;
+        }
+        clusters->visibleTriangles += clusters->indexCount[i]/3;
+    }
+    clusters->dirty = 1;
+
+    return (visibleCount);
+}
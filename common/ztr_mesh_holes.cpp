@@ -0,0 +1,706 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_mesh_holes.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Load time hole filling for scans, following Liepa's "Filling Holes in
+// Meshes": boundary loops are triangulated with a minimum area dynamic
+// program (ear clipping by smallest angle for very large loops), refined by
+// centroid splits with Delaunay edge flips and faired with a membrane
+// (umbrella) operator. Every hole is processed on its own worker.
+//
+
+// MARK: Includes
+
+#include <stdint.h>
+#include <unordered_map>
+
+// MARK: Constants
+
+#define HOLE_MAX_EDGES_DEFAULT 2048
+#define HOLE_OPENING_FRACTION_DEFAULT 0.5f
+#define HOLE_FAIRING_ITERATIONS_DEFAULT 48
+
+// Loops longer than this use the O(n^2) ear clipper instead of the O(n^3)
+// minimum area triangulation
+#define HOLE_DP_MAX_EDGES 128
+
+#define HOLE_REFINE_PASSES 8
+#define HOLE_RELAX_PASSES 8
+#define HOLE_SPLIT_FACTOR 1.41421356f
+
+// MARK: Structs
+
+struct hole_fill_params_t
+{
+    int enabled;
+
+    // The longest loop is the scan opening and never filled. Loops at least
+    // this fraction of its perimeter are further openings, left alone too
+    float openingFraction;
+
+    // Longer loops are left open as well, bounding the triangulation cost
+    unsigned int maxHoleEdges;
+
+    int refine;
+    int fairingIterations;
+};
+
+// A hole patch in local vertex numbering, the first loopCount vertices are
+// the boundary loop in fill orientation, the rest are new vertices
+struct hole_patch_t
+{
+    std::vector<unsigned int> loop;
+
+    std::vector<float> positions;
+    std::vector<float> scale;
+    std::vector<unsigned int> triangles;
+};
+
+// Patch triangles sharing an edge, stored as index + 1 so zero means none
+struct hole_edge_t
+{
+    unsigned int t0;
+    unsigned int t1;
+};
+
+// MARK: Utility Functions
+
+inline void
+InitHoleFillParams (hole_fill_params_t *params)
+{
+    params->enabled = 1;
+    params->openingFraction = HOLE_OPENING_FRACTION_DEFAULT;
+    params->maxHoleEdges = HOLE_MAX_EDGES_DEFAULT;
+    params->refine = 1;
+    params->fairingIterations = HOLE_FAIRING_ITERATIONS_DEFAULT;
+}
+
+inline hmm_vec3
+HolePosition (hole_patch_t *patch, unsigned int v)
+{
+    float *p = patch->positions.data () + v*3;
+    return (HMM_Vec3 (p[0], p[1], p[2]));
+}
+
+inline float
+HoleTriangleArea (hole_patch_t *patch,
+                  unsigned int a, unsigned int b, unsigned int c)
+{
+    hmm_vec3 pa = HolePosition (patch, a);
+    hmm_vec3 e0 = HolePosition (patch, b) - pa;
+    hmm_vec3 e1 = HolePosition (patch, c) - pa;
+    return (0.5f*HMM_LengthVec3 (HMM_Cross (e0, e1)));
+}
+
+inline uint64_t
+HoleEdgeKey (unsigned int a, unsigned int b)
+{
+    return ((a < b) ? (((uint64_t) a << 32) | b) : (((uint64_t) b << 32) | a));
+}
+
+// Angle at c in the triangle (a, b, c)
+inline float
+HoleAngle (hole_patch_t *patch, unsigned int a, unsigned int b, unsigned int c)
+{
+    hmm_vec3 pc = HolePosition (patch, c);
+    hmm_vec3 e0 = HolePosition (patch, a) - pc;
+    hmm_vec3 e1 = HolePosition (patch, b) - pc;
+    float d = HMM_DotVec3 (e0, e1);
+    float l = HMM_LengthVec3 (e0)*HMM_LengthVec3 (e1);
+    return ((l > 0.f) ? acosf (HMM_Clamp (-1.f, d/l, 1.f)) : 0.f);
+}
+
+// MARK: Boundary detection
+
+inline float
+ScanMeshLoopPerimeter (scan_mesh_t *mesh, unsigned int *loop, unsigned int count)
+{
+    float perimeter = 0.f;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        unsigned int a = loop[i];
+        unsigned int b = loop[(i + 1)%count];
+        hmm_vec3 d = HMM_Vec3 (mesh->px[b] - mesh->px[a],
+                               mesh->py[b] - mesh->py[a],
+                               mesh->pz[b] - mesh->pz[a]);
+        perimeter += HMM_LengthVec3 (d);
+    }
+    return (perimeter);
+}
+
+// Collects the boundary loops to fill in fill orientation, i.e. reversed
+// with respect to the half edges of the adjacent triangles. The openings,
+// see hole_fill_params_t, are left out. Requires ScanMeshBuildAdjacency.
+static void
+ScanMeshFindBoundaryLoops (scan_mesh_t *mesh, hole_fill_params_t *params,
+                           std::vector<hole_patch_t> *holes)
+{
+    unsigned int halfEdgeCount = mesh->triangleCount*3;
+    unsigned char *isBoundary = (unsigned char *) malloc (halfEdgeCount + 1);
+
+    // A half edge a->b is on the boundary if no triangle has b->a
+    ParallelFor (mesh->triangleCount, 4096,
+                 [&] (unsigned int start, unsigned int end) {
+        for (unsigned int t=start ; t<end ; t++)
+        {
+            for (int e=0 ; e<3 ; e++)
+            {
+                unsigned int a = mesh->triangles[t*3 + e];
+                unsigned int b = mesh->triangles[t*3 + (e + 1)%3];
+
+                int twinFound = 0;
+                for (unsigned int i=mesh->triangleStart[b] ;
+                     i<mesh->triangleStart[b + 1] && !twinFound ; i++)
+                {
+                    unsigned int *other =
+                        mesh->triangles + mesh->vertexTriangles[i]*3;
+                    for (int k=0 ; k<3 ; k++)
+                    {
+                        if (other[k] == b && other[(k + 1)%3] == a)
+                        {
+                            twinFound = 1;
+                        }
+                    }
+                }
+
+                isBoundary[t*3 + e] = !twinFound;
+            }
+        }
+    });
+
+    // Boundary edges are few, a sorted edge list is enough for the walk
+    std::vector<uint64_t> edges;
+    for (unsigned int i=0 ; i<halfEdgeCount ; i++)
+    {
+        if (isBoundary[i])
+        {
+            unsigned int t = i/3;
+            unsigned int e = i%3;
+            uint64_t a = mesh->triangles[t*3 + e];
+            uint64_t b = mesh->triangles[t*3 + (e + 1)%3];
+            edges.push_back ((a << 32) | b);
+        }
+    }
+    free (isBoundary);
+
+    std::sort (edges.begin (), edges.end ());
+    std::vector<unsigned char> visited (edges.size (), 0);
+
+    std::vector<hole_patch_t> loops;
+    std::vector<float> perimeters;
+    float longest = 0.f;
+
+    for (size_t i=0 ; i<edges.size () ; i++)
+    {
+        if (visited[i])
+        {
+            continue;
+        }
+
+        unsigned int startVertex = (unsigned int) (edges[i] >> 32);
+        std::vector<unsigned int> loop;
+        loop.push_back (startVertex);
+        visited[i] = 1;
+
+        unsigned int current = (unsigned int) (edges[i] & 0xffffffff);
+        int closed = 0;
+
+        while (loop.size () <= edges.size ())
+        {
+            if (current == startVertex)
+            {
+                closed = 1;
+                break;
+            }
+            loop.push_back (current);
+
+            // Next unvisited boundary edge leaving the current vertex
+            size_t next = std::lower_bound (edges.begin (), edges.end (),
+                                            (uint64_t) current << 32) -
+                edges.begin ();
+            while (next < edges.size () &&
+                   (unsigned int) (edges[next] >> 32) == current &&
+                   visited[next])
+            {
+                next++;
+            }
+
+            if (next >= edges.size () ||
+                (unsigned int) (edges[next] >> 32) != current)
+            {
+                break;
+            }
+
+            visited[next] = 1;
+            current = (unsigned int) (edges[next] & 0xffffffff);
+        }
+
+        if (closed && loop.size () >= 3)
+        {
+            hole_patch_t hole;
+            hole.loop.assign (loop.rbegin (), loop.rend ());
+            loops.push_back (hole);
+
+            float perimeter = ScanMeshLoopPerimeter (mesh, loop.data (),
+                                                     (unsigned int) loop.size ());
+            perimeters.push_back (perimeter);
+            longest = fmaxf (longest, perimeter);
+        }
+    }
+
+    // The longest loop itself always compares as an opening
+    float openingPerimeter = fminf (params->openingFraction, 1.f)*longest;
+    for (size_t i=0 ; i<loops.size () ; i++)
+    {
+        if (perimeters[i] < openingPerimeter &&
+            loops[i].loop.size () <= params->maxHoleEdges)
+        {
+            holes->push_back (loops[i]);
+        }
+    }
+}
+
+// MARK: Triangulation
+
+static void
+HoleTriangulateMinArea (hole_patch_t *patch, unsigned int n)
+{
+    std::vector<float> weight (n*n, 0.f);
+    std::vector<unsigned int> split (n*n, 0);
+
+    for (unsigned int gap=2 ; gap<n ; gap++)
+    {
+        for (unsigned int i=0 ; i + gap<n ; i++)
+        {
+            unsigned int j = i + gap;
+            float best = FLT_MAX;
+            unsigned int bestM = i + 1;
+
+            for (unsigned int m=i + 1 ; m<j ; m++)
+            {
+                float w = weight[i*n + m] + weight[m*n + j] +
+                    HoleTriangleArea (patch, i, m, j);
+                if (w < best)
+                {
+                    best = w;
+                    bestM = m;
+                }
+            }
+
+            weight[i*n + j] = best;
+            split[i*n + j] = bestM;
+        }
+    }
+
+    std::vector<unsigned int> stack;
+    stack.push_back (0);
+    stack.push_back (n - 1);
+
+    while (!stack.empty ())
+    {
+        unsigned int j = stack.back (); stack.pop_back ();
+        unsigned int i = stack.back (); stack.pop_back ();
+
+        if (j - i < 2)
+        {
+            continue;
+        }
+
+        unsigned int m = split[i*n + j];
+        patch->triangles.push_back (i);
+        patch->triangles.push_back (m);
+        patch->triangles.push_back (j);
+
+        stack.push_back (i); stack.push_back (m);
+        stack.push_back (m); stack.push_back (j);
+    }
+}
+
+// Advancing front style ear clipping, always closes the smallest interior
+// angle first. Used for loops where the cubic program is too slow.
+static void
+HoleTriangulateEarClip (hole_patch_t *patch, unsigned int n)
+{
+    // Newell normal of the loop decides which turns are convex
+    hmm_vec3 normal = HMM_Vec3 (0.f, 0.f, 0.f);
+    for (unsigned int i=0 ; i<n ; i++)
+    {
+        hmm_vec3 a = HolePosition (patch, i);
+        hmm_vec3 b = HolePosition (patch, (i + 1)%n);
+        normal.X += (a.Y - b.Y)*(a.Z + b.Z);
+        normal.Y += (a.Z - b.Z)*(a.X + b.X);
+        normal.Z += (a.X - b.X)*(a.Y + b.Y);
+    }
+
+    std::vector<unsigned int> prev (n), next (n);
+    for (unsigned int i=0 ; i<n ; i++)
+    {
+        prev[i] = (i + n - 1)%n;
+        next[i] = (i + 1)%n;
+    }
+
+    std::vector<unsigned char> removed (n, 0);
+    unsigned int remaining = n;
+    unsigned int any = 0;
+
+    while (remaining > 3)
+    {
+        float bestAngle = FLT_MAX;
+        unsigned int best = any;
+
+        for (unsigned int v=0 ; v<n ; v++)
+        {
+            if (removed[v])
+            {
+                continue;
+            }
+
+            hmm_vec3 pv = HolePosition (patch, v);
+            hmm_vec3 e0 = pv - HolePosition (patch, prev[v]);
+            hmm_vec3 e1 = HolePosition (patch, next[v]) - pv;
+
+            float turn = atan2f (HMM_DotVec3 (HMM_Cross (e0, e1), normal)/
+                                 (HMM_LengthVec3 (normal) + FLT_MIN),
+                                 HMM_DotVec3 (e0, e1));
+            float interior = HMM_PI32 - turn;
+
+            if (interior < bestAngle)
+            {
+                bestAngle = interior;
+                best = v;
+            }
+        }
+
+        patch->triangles.push_back (prev[best]);
+        patch->triangles.push_back (best);
+        patch->triangles.push_back (next[best]);
+
+        next[prev[best]] = next[best];
+        prev[next[best]] = prev[best];
+        removed[best] = 1;
+        any = next[best];
+        remaining--;
+    }
+
+    patch->triangles.push_back (prev[any]);
+    patch->triangles.push_back (any);
+    patch->triangles.push_back (next[any]);
+}
+
+// MARK: Refinement and fairing
+
+// Flips interior patch edges that fail the Delaunay angle criterion
+static void
+HoleRelaxEdges (hole_patch_t *patch)
+{
+    for (int pass=0 ; pass<HOLE_RELAX_PASSES ; pass++)
+    {
+        std::unordered_map<uint64_t, hole_edge_t> edgeOwners;
+        std::vector<unsigned int> &tris = patch->triangles;
+        unsigned int triangleCount = (unsigned int) tris.size ()/3;
+
+        for (unsigned int t=0 ; t<triangleCount ; t++)
+        {
+            for (int e=0 ; e<3 ; e++)
+            {
+                hole_edge_t &edge =
+                    edgeOwners[HoleEdgeKey (tris[t*3 + e], tris[t*3 + (e + 1)%3])];
+                if (edge.t0 == 0)
+                {
+                    edge.t0 = t + 1;
+                }
+                else
+                {
+                    // A third owner makes the edge non-manifold, never flip it
+                    edge.t1 = (edge.t1 == 0) ? (t + 1) : edge.t0;
+                }
+            }
+        }
+
+        std::vector<unsigned char> touched (triangleCount, 0);
+        int flips = 0;
+
+        for (std::unordered_map<uint64_t, hole_edge_t>::iterator it =
+                 edgeOwners.begin () ; it != edgeOwners.end () ; it++)
+        {
+            unsigned int t0 = it->second.t0;
+            unsigned int t1 = it->second.t1;
+            if (t0 == 0 || t1 == 0 || t0 == t1)
+            {
+                continue;
+            }
+            t0--; t1--;
+
+            if (touched[t0] || touched[t1])
+            {
+                continue;
+            }
+
+            unsigned int a = (unsigned int) (it->first >> 32);
+            unsigned int b = (unsigned int) (it->first & 0xffffffff);
+
+            // Rotate both triangles so the shared edge comes first
+            unsigned int *p = &tris[t0*3];
+            unsigned int *q = &tris[t1*3];
+            int ep = 0, eq = 0;
+            while (!((p[ep] == a || p[ep] == b) &&
+                     (p[(ep + 1)%3] == a || p[(ep + 1)%3] == b)) && ep < 3) ep++;
+            while (!((q[eq] == a || q[eq] == b) &&
+                     (q[(eq + 1)%3] == a || q[(eq + 1)%3] == b)) && eq < 3) eq++;
+            if (ep == 3 || eq == 3)
+            {
+                continue;
+            }
+
+            unsigned int u = p[ep];
+            unsigned int w = p[(ep + 1)%3];
+            unsigned int c = p[(ep + 2)%3];
+            unsigned int d = q[(eq + 2)%3];
+
+            if (c == d || edgeOwners.count (HoleEdgeKey (c, d)))
+            {
+                continue;
+            }
+
+            if (HoleAngle (patch, u, w, c) + HoleAngle (patch, u, w, d) >
+                HMM_PI32 + 1e-4f)
+            {
+                // (u, w, c) + (w, u, d) becomes (c, u, d) + (d, w, c)
+                p[0] = c; p[1] = u; p[2] = d;
+                q[0] = d; q[1] = w; q[2] = c;
+                touched[t0] = 1;
+                touched[t1] = 1;
+                flips++;
+            }
+        }
+
+        if (flips == 0)
+        {
+            break;
+        }
+    }
+}
+
+// Centroid splits until the patch density matches the surrounding mesh
+static void
+HoleRefine (hole_patch_t *patch)
+{
+    for (int pass=0 ; pass<HOLE_REFINE_PASSES ; pass++)
+    {
+        std::vector<unsigned int> &tris = patch->triangles;
+        unsigned int triangleCount = (unsigned int) tris.size ()/3;
+        int splits = 0;
+
+        for (unsigned int t=0 ; t<triangleCount ; t++)
+        {
+            unsigned int v[3] = { tris[t*3 + 0], tris[t*3 + 1], tris[t*3 + 2] };
+
+            hmm_vec3 centroid =
+                (HolePosition (patch, v[0]) + HolePosition (patch, v[1]) +
+                 HolePosition (patch, v[2]))*(1.f/3.f);
+            float centroidScale =
+                (patch->scale[v[0]] + patch->scale[v[1]] +
+                 patch->scale[v[2]])*(1.f/3.f);
+
+            int split = 1;
+            for (int k=0 ; k<3 ; k++)
+            {
+                float d = HOLE_SPLIT_FACTOR*
+                    HMM_LengthVec3 (centroid - HolePosition (patch, v[k]));
+                if (d <= centroidScale || d <= patch->scale[v[k]])
+                {
+                    split = 0;
+                }
+            }
+
+            if (split)
+            {
+                unsigned int c = (unsigned int) patch->scale.size ();
+                patch->positions.push_back (centroid.X);
+                patch->positions.push_back (centroid.Y);
+                patch->positions.push_back (centroid.Z);
+                patch->scale.push_back (centroidScale);
+
+                tris[t*3 + 2] = c;
+                tris.push_back (v[1]); tris.push_back (v[2]); tris.push_back (c);
+                tris.push_back (v[2]); tris.push_back (v[0]); tris.push_back (c);
+                splits++;
+            }
+        }
+
+        HoleRelaxEdges (patch);
+
+        if (splits == 0)
+        {
+            break;
+        }
+    }
+}
+
+// Jacobi umbrella iterations on the new vertices, the loop stays fixed
+static void
+HoleFair (hole_patch_t *patch, unsigned int loopCount, int iterations)
+{
+    unsigned int vertexCount = (unsigned int) patch->scale.size ();
+    if (vertexCount == loopCount)
+    {
+        return;
+    }
+
+    std::vector<float> sum (vertexCount*3);
+    std::vector<float> count (vertexCount);
+    std::vector<unsigned int> &tris = patch->triangles;
+
+    for (int it=0 ; it<iterations ; it++)
+    {
+        std::fill (sum.begin (), sum.end (), 0.f);
+        std::fill (count.begin (), count.end (), 0.f);
+
+        for (size_t i=0 ; i<tris.size () ; i++)
+        {
+            unsigned int a = tris[i];
+            unsigned int b = tris[(i%3 == 2) ? (i - 2) : (i + 1)];
+
+            for (int k=0 ; k<3 ; k++)
+            {
+                sum[a*3 + k] += patch->positions[b*3 + k];
+                sum[b*3 + k] += patch->positions[a*3 + k];
+            }
+            count[a] += 1.f;
+            count[b] += 1.f;
+        }
+
+        for (unsigned int v=loopCount ; v<vertexCount ; v++)
+        {
+            if (count[v] > 0.f)
+            {
+                for (int k=0 ; k<3 ; k++)
+                {
+                    patch->positions[v*3 + k] = sum[v*3 + k]/count[v];
+                }
+            }
+        }
+    }
+}
+
+static void
+HoleFill (scan_mesh_t *mesh, hole_patch_t *patch, hole_fill_params_t *params)
+{
+    unsigned int n = (unsigned int) patch->loop.size ();
+
+    patch->positions.resize (n*3);
+    patch->scale.resize (n);
+    for (unsigned int i=0 ; i<n ; i++)
+    {
+        unsigned int v = patch->loop[i];
+        patch->positions[i*3 + 0] = mesh->px[v];
+        patch->positions[i*3 + 1] = mesh->py[v];
+        patch->positions[i*3 + 2] = mesh->pz[v];
+    }
+
+    // Scale attribute is the mean length of the two adjacent loop edges
+    for (unsigned int i=0 ; i<n ; i++)
+    {
+        hmm_vec3 p = HolePosition (patch, i);
+        float l0 = HMM_LengthVec3 (p - HolePosition (patch, (i + n - 1)%n));
+        float l1 = HMM_LengthVec3 (p - HolePosition (patch, (i + 1)%n));
+        patch->scale[i] = 0.5f*(l0 + l1);
+    }
+
+    if (n <= HOLE_DP_MAX_EDGES)
+    {
+        HoleTriangulateMinArea (patch, n);
+    }
+    else
+    {
+        HoleTriangulateEarClip (patch, n);
+    }
+
+    if (params->refine)
+    {
+        HoleRelaxEdges (patch);
+        HoleRefine (patch);
+        HoleFair (patch, n, params->fairingIterations);
+    }
+}
+
+// MARK: Functions
+
+// Detects and fills every boundary loop but the scan openings. The
+// adjacency is rebuilt and normals are computed for the new vertices only.
+static void
+FillScanMeshHoles (scan_mesh_t *mesh, hole_fill_params_t *params)
+{
+    if (!params->enabled || mesh->triangleCount == 0)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    std::vector<hole_patch_t> holes;
+    ScanMeshFindBoundaryLoops (mesh, params, &holes);
+
+    if (holes.empty ())
+    {
+        return;
+    }
+
+    ParallelFor ((unsigned int) holes.size (), 1,
+                 [&] (unsigned int first, unsigned int last) {
+        for (unsigned int i=first ; i<last ; i++)
+        {
+            HoleFill (mesh, &holes[i], params);
+        }
+    });
+
+    // Append the patches, new vertices are numbered after the mesh vertices
+    unsigned int newVertexCount = 0;
+    unsigned int newTriangleCount = 0;
+    for (size_t i=0 ; i<holes.size () ; i++)
+    {
+        newVertexCount += (unsigned int) (holes[i].scale.size () -
+                                          holes[i].loop.size ());
+        newTriangleCount += (unsigned int) holes[i].triangles.size ()/3;
+    }
+
+    unsigned int firstNewVertex = mesh->vertexCount;
+    ScanMeshReserve (mesh, mesh->vertexCount + newVertexCount,
+                     mesh->triangleCount + newTriangleCount);
+
+    for (size_t i=0 ; i<holes.size () ; i++)
+    {
+        hole_patch_t *patch = &holes[i];
+        unsigned int loopCount = (unsigned int) patch->loop.size ();
+        unsigned int base = mesh->vertexCount - loopCount;
+
+        for (unsigned int v=loopCount ; v<patch->scale.size () ; v++)
+        {
+            mesh->px[base + v] = patch->positions[v*3 + 0];
+            mesh->py[base + v] = patch->positions[v*3 + 1];
+            mesh->pz[base + v] = patch->positions[v*3 + 2];
+        }
+
+        for (size_t t=0 ; t<patch->triangles.size () ; t++)
+        {
+            unsigned int v = patch->triangles[t];
+            mesh->triangles[mesh->triangleCount*3 + t] =
+                (v < loopCount) ? patch->loop[v] : (base + v);
+        }
+
+        mesh->vertexCount += (unsigned int) patch->scale.size () - loopCount;
+        mesh->triangleCount += (unsigned int) patch->triangles.size ()/3;
+    }
+
+    ScanMeshBuildAdjacency (mesh);
+    ScanMeshComputeNormalsRange (mesh, mesh->px, mesh->py, mesh->pz,
+                                 firstNewVertex,
+                                 mesh->vertexCount - firstNewVertex);
+
+    printf ("Filled %u holes with %u triangles, %u vertices in %.2f ms\n",
+            (unsigned int) holes.size (), newTriangleCount, newVertexCount,
+            ScanMeshMilliseconds (start));
+}
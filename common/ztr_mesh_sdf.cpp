@@ -0,0 +1,694 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_mesh_sdf.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Narrow band sparse signed distance field. A dense top level grid maps
+// every 8x8x8 voxel block to a brick of 9x9x9 samples (the extra layer is
+// shared with the neighbour so trilinear lookups never leave a brick), blocks
+// without surface store no samples and only carry an inside/outside sign.
+// Queries are O(1): one top level lookup and one trilinear fetch.
+//
+
+// MARK: Constants
+
+#define SDF_BRICK_CELLS 8
+#define SDF_BRICK_SAMPLES (SDF_BRICK_CELLS + 1)
+#define SDF_BRICK_SIZE (SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES)
+
+#define SDF_EMPTY_BRICK 0xffffffffu
+
+// Auto voxel size is the bounding box diagonal over this
+#define SDF_AUTO_RESOLUTION 256.f
+#define SDF_BAND_VOXELS_DEFAULT 3.f
+#define SDF_MEMORY_BUDGET_DEFAULT (64u << 20)
+
+// Voxel size steps of 1.25 tried before giving up on the budget, about 35
+// times the first size. The band grows with the voxel, so a budget below
+// what the mesh needs at any size would never be met
+#define SDF_MAX_COARSEN_STEPS 16
+
+#define SDF_BENCHMARK_QUERIES (1 << 18)
+
+// MARK: Structs
+
+struct sdf_params_t
+{
+    // Off by default, the viewer itself makes no distance queries. Hosts
+    // that do turn it on before loading
+    int enabled;
+
+    // Times SDF_BENCHMARK_QUERIES random queries after every build
+    int benchmark;
+
+    // World units, zero picks SDF_AUTO_RESOLUTION voxels over the diagonal
+    float voxelSize;
+    float bandVoxels;
+
+    // The voxel size is coarsened until the bricks fit, the build fails
+    // when they still do not after SDF_MAX_COARSEN_STEPS
+    unsigned int memoryBudget;
+};
+
+struct sdf_t
+{
+    hmm_vec3 origin;
+    float voxelSize;
+    float invVoxelSize;
+    float band;
+
+    // Top level grid, one entry per brick sized block
+    int dims[3];
+    unsigned int *brickIndex;
+    signed char *blockSign;
+
+    unsigned int brickCount;
+    float *bricks;
+
+    // Build statistics
+    double buildMilliseconds;
+    unsigned int memoryBytes;
+};
+
+// MARK: Utility Functions
+
+inline void
+InitSdfParams (sdf_params_t *params)
+{
+    params->enabled = 0;
+    params->benchmark = 0;
+    params->voxelSize = 0.f;
+    params->bandVoxels = SDF_BAND_VOXELS_DEFAULT;
+    params->memoryBudget = SDF_MEMORY_BUDGET_DEFAULT;
+}
+
+static void
+FreeSdf (sdf_t *sdf)
+{
+    free (sdf->brickIndex);
+    free (sdf->blockSign);
+    free (sdf->bricks);
+    *sdf = {};
+}
+
+inline unsigned int
+SdfBlockIndex (sdf_t *sdf, int x, int y, int z)
+{
+    return ((unsigned int) ((z*sdf->dims[1] + y)*sdf->dims[0] + x));
+}
+
+// Closest point on triangle (a, b, c) to p, Ericson's Real-Time Collision
+// Detection 5.1.5. Returns the barycentric weights in uvw.
+static hmm_vec3
+SdfClosestPointTriangle (hmm_vec3 p, hmm_vec3 a, hmm_vec3 b, hmm_vec3 c,
+                         hmm_vec3 *uvw)
+{
+    hmm_vec3 ab = b - a;
+    hmm_vec3 ac = c - a;
+    hmm_vec3 ap = p - a;
+
+    float d1 = HMM_DotVec3 (ab, ap);
+    float d2 = HMM_DotVec3 (ac, ap);
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        *uvw = HMM_Vec3 (1.f, 0.f, 0.f);
+        return (a);
+    }
+
+    hmm_vec3 bp = p - b;
+    float d3 = HMM_DotVec3 (ab, bp);
+    float d4 = HMM_DotVec3 (ac, bp);
+    if (d3 >= 0.f && d4 <= d3)
+    {
+        *uvw = HMM_Vec3 (0.f, 1.f, 0.f);
+        return (b);
+    }
+
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        float v = d1/(d1 - d3);
+        *uvw = HMM_Vec3 (1.f - v, v, 0.f);
+        return (a + ab*v);
+    }
+
+    hmm_vec3 cp = p - c;
+    float d5 = HMM_DotVec3 (ab, cp);
+    float d6 = HMM_DotVec3 (ac, cp);
+    if (d6 >= 0.f && d5 <= d6)
+    {
+        *uvw = HMM_Vec3 (0.f, 0.f, 1.f);
+        return (c);
+    }
+
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        float w = d2/(d2 - d6);
+        *uvw = HMM_Vec3 (1.f - w, 0.f, w);
+        return (a + ac*w);
+    }
+
+    float va = d3*d6 - d5*d4;
+    if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+    {
+        float w = (d4 - d3)/((d4 - d3) + (d5 - d6));
+        *uvw = HMM_Vec3 (0.f, 1.f - w, w);
+        return (b + (c - b)*w);
+    }
+
+    float denom = 1.f/(va + vb + vc);
+    float v = vb*denom;
+    float w = vc*denom;
+    *uvw = HMM_Vec3 (1.f - v - w, v, w);
+    return (a + ab*v + ac*w);
+}
+
+// MARK: Queries
+
+// Signed distance at p, positive outside. Far from the surface the result is
+// clamped to +/- the band width.
+static float
+SdfDistance (sdf_t *sdf, hmm_vec3 p)
+{
+    hmm_vec3 g = (p - sdf->origin)*sdf->invVoxelSize;
+
+    int cx = (int) floorf (g.X);
+    int cy = (int) floorf (g.Y);
+    int cz = (int) floorf (g.Z);
+
+    int bx = cx/SDF_BRICK_CELLS;
+    int by = cy/SDF_BRICK_CELLS;
+    int bz = cz/SDF_BRICK_CELLS;
+
+    if (cx < 0 || cy < 0 || cz < 0 ||
+        bx >= sdf->dims[0] || by >= sdf->dims[1] || bz >= sdf->dims[2])
+    {
+        return (sdf->band);
+    }
+
+    unsigned int block = SdfBlockIndex (sdf, bx, by, bz);
+    unsigned int brick = sdf->brickIndex[block];
+    if (brick == SDF_EMPTY_BRICK)
+    {
+        return (sdf->blockSign[block]*sdf->band);
+    }
+
+    int lx = cx - bx*SDF_BRICK_CELLS;
+    int ly = cy - by*SDF_BRICK_CELLS;
+    int lz = cz - bz*SDF_BRICK_CELLS;
+    float fx = g.X - cx;
+    float fy = g.Y - cy;
+    float fz = g.Z - cz;
+
+    float *s = sdf->bricks + (size_t) brick*SDF_BRICK_SIZE +
+        (lz*SDF_BRICK_SAMPLES + ly)*SDF_BRICK_SAMPLES + lx;
+    const int sy = SDF_BRICK_SAMPLES;
+    const int sz = SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES;
+
+    float c00 = s[0] + (s[1] - s[0])*fx;
+    float c10 = s[sy] + (s[sy + 1] - s[sy])*fx;
+    float c01 = s[sz] + (s[sz + 1] - s[sz])*fx;
+    float c11 = s[sz + sy] + (s[sz + sy + 1] - s[sz + sy])*fx;
+
+    float c0 = c00 + (c10 - c00)*fy;
+    float c1 = c01 + (c11 - c01)*fy;
+
+    return (c0 + (c1 - c0)*fz);
+}
+
+// Gradient of the trilinear field, central differences across half a voxel
+inline hmm_vec3
+SdfGradient (sdf_t *sdf, hmm_vec3 p)
+{
+    float h = 0.5f*sdf->voxelSize;
+    float inv = 1.f/(2.f*h);
+
+    hmm_vec3 result;
+    result.X = (SdfDistance (sdf, p + HMM_Vec3 (h, 0.f, 0.f)) -
+                SdfDistance (sdf, p - HMM_Vec3 (h, 0.f, 0.f)))*inv;
+    result.Y = (SdfDistance (sdf, p + HMM_Vec3 (0.f, h, 0.f)) -
+                SdfDistance (sdf, p - HMM_Vec3 (0.f, h, 0.f)))*inv;
+    result.Z = (SdfDistance (sdf, p + HMM_Vec3 (0.f, 0.f, h)) -
+                SdfDistance (sdf, p - HMM_Vec3 (0.f, 0.f, h)))*inv;
+
+    return (result);
+}
+
+// MARK: Build
+
+// Marks the blocks touched by the band expanded triangle bounds and returns
+// how many there are. Block b owns the samples on [b, b + 1] blocks, both
+// faces included, hence the ceil - 1 on the lower bound.
+static unsigned int
+SdfMarkBlocks (sdf_t *sdf, scan_mesh_t *mesh, std::atomic<unsigned int> *counts)
+{
+    unsigned int blockCount = sdf->dims[0]*sdf->dims[1]*sdf->dims[2];
+    for (unsigned int i=0 ; i<blockCount ; i++)
+    {
+        counts[i].store (0, std::memory_order_relaxed);
+    }
+
+    float blockSize = sdf->voxelSize*SDF_BRICK_CELLS;
+
+    ParallelFor (mesh->triangleCount, 4096,
+                 [&] (unsigned int start, unsigned int end) {
+        for (unsigned int t=start ; t<end ; t++)
+        {
+            unsigned int *tri = mesh->triangles + t*3;
+            float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+            for (int k=0 ; k<3 ; k++)
+            {
+                float p[3] = { mesh->px[tri[k]], mesh->py[tri[k]], mesh->pz[tri[k]] };
+                for (int a=0 ; a<3 ; a++)
+                {
+                    lo[a] = (p[a] < lo[a]) ? p[a] : lo[a];
+                    hi[a] = (p[a] > hi[a]) ? p[a] : hi[a];
+                }
+            }
+
+            int b0[3], b1[3];
+            for (int a=0 ; a<3 ; a++)
+            {
+                b0[a] = (int) ceilf ((lo[a] - sdf->band - sdf->origin[a])/blockSize) - 1;
+                b1[a] = (int) floorf ((hi[a] + sdf->band - sdf->origin[a])/blockSize);
+                b0[a] = (b0[a] < 0) ? 0 : b0[a];
+                b1[a] = (b1[a] >= sdf->dims[a]) ? (sdf->dims[a] - 1) : b1[a];
+            }
+
+            for (int z=b0[2] ; z<=b1[2] ; z++)
+            for (int y=b0[1] ; y<=b1[1] ; y++)
+            for (int x=b0[0] ; x<=b1[0] ; x++)
+            {
+                counts[SdfBlockIndex (sdf, x, y, z)].fetch_add (
+                    1, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    unsigned int active = 0;
+    for (unsigned int i=0 ; i<blockCount ; i++)
+    {
+        active += (counts[i].load (std::memory_order_relaxed) > 0);
+    }
+
+    return (active);
+}
+
+static void
+SdfSetupGrid (sdf_t *sdf, hmm_vec3 lo, hmm_vec3 hi, float voxelSize)
+{
+    sdf->voxelSize = voxelSize;
+    sdf->invVoxelSize = 1.f/voxelSize;
+
+    // One empty block of padding keeps the outside flood fill connected
+    float blockSize = voxelSize*SDF_BRICK_CELLS;
+    hmm_vec3 pad = HMM_Vec3 (1.f, 1.f, 1.f)*(sdf->band + blockSize);
+    sdf->origin = lo - pad;
+
+    hmm_vec3 extent = (hi + pad) - sdf->origin;
+    for (int a=0 ; a<3 ; a++)
+    {
+        sdf->dims[a] = (int) ceilf (extent[a]/blockSize) + 1;
+    }
+}
+
+// Empty blocks reachable from the grid border are outside, the rest inside
+static void
+SdfFloodFillSigns (sdf_t *sdf)
+{
+    unsigned int blockCount = sdf->dims[0]*sdf->dims[1]*sdf->dims[2];
+    for (unsigned int i=0 ; i<blockCount ; i++)
+    {
+        sdf->blockSign[i] = -1;
+    }
+
+    std::vector<unsigned int> stack;
+    for (int z=0 ; z<sdf->dims[2] ; z++)
+    for (int y=0 ; y<sdf->dims[1] ; y++)
+    for (int x=0 ; x<sdf->dims[0] ; x++)
+    {
+        if (x == 0 || y == 0 || z == 0 || x == sdf->dims[0] - 1 ||
+            y == sdf->dims[1] - 1 || z == sdf->dims[2] - 1)
+        {
+            unsigned int block = SdfBlockIndex (sdf, x, y, z);
+            if (sdf->brickIndex[block] == SDF_EMPTY_BRICK)
+            {
+                sdf->blockSign[block] = 1;
+                stack.push_back (block);
+            }
+        }
+    }
+
+    while (!stack.empty ())
+    {
+        unsigned int block = stack.back ();
+        stack.pop_back ();
+
+        int x = block%sdf->dims[0];
+        int y = (block/sdf->dims[0])%sdf->dims[1];
+        int z = block/(sdf->dims[0]*sdf->dims[1]);
+
+        int offsets[6][3] = {
+            { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 },
+            { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 },
+        };
+
+        for (int i=0 ; i<6 ; i++)
+        {
+            int nx = x + offsets[i][0];
+            int ny = y + offsets[i][1];
+            int nz = z + offsets[i][2];
+            if (nx < 0 || ny < 0 || nz < 0 || nx >= sdf->dims[0] ||
+                ny >= sdf->dims[1] || nz >= sdf->dims[2])
+            {
+                continue;
+            }
+
+            unsigned int neighbour = SdfBlockIndex (sdf, nx, ny, nz);
+            if (sdf->brickIndex[neighbour] == SDF_EMPTY_BRICK &&
+                sdf->blockSign[neighbour] < 0)
+            {
+                sdf->blockSign[neighbour] = 1;
+                stack.push_back (neighbour);
+            }
+        }
+    }
+}
+
+// Builds the narrow band SDF of a closed scan mesh. Needs vertex normals,
+// their interpolation at the closest point gives the sign.
+static void
+BuildSdf (sdf_t *sdf, scan_mesh_t *mesh, sdf_params_t *params)
+{
+    *sdf = {};
+
+    if (!params->enabled || mesh->triangleCount == 0)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    hmm_vec3 lo = HMM_Vec3 (FLT_MAX, FLT_MAX, FLT_MAX);
+    hmm_vec3 hi = HMM_Vec3 (-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (unsigned int v=0 ; v<mesh->vertexCount ; v++)
+    {
+        lo = HMM_Vec3 (fminf (lo.X, mesh->px[v]), fminf (lo.Y, mesh->py[v]),
+                       fminf (lo.Z, mesh->pz[v]));
+        hi = HMM_Vec3 (fmaxf (hi.X, mesh->px[v]), fmaxf (hi.Y, mesh->py[v]),
+                       fmaxf (hi.Z, mesh->pz[v]));
+    }
+
+    float voxelSize = params->voxelSize;
+    if (voxelSize <= 0.f)
+    {
+        voxelSize = HMM_LengthVec3 (hi - lo)/SDF_AUTO_RESOLUTION;
+    }
+
+    // Coarsen until the bricks fit into the memory budget. Sizes are
+    // counted in size_t, large meshes overflow 32 bits
+    std::atomic<unsigned int> *counts = NULL;
+    unsigned int activeCount = 0;
+    unsigned int blockCount = 0;
+
+    int fits = 0;
+    for (int step=0 ; step<SDF_MAX_COARSEN_STEPS && !fits ; step++)
+    {
+        sdf->band = params->bandVoxels*voxelSize;
+        SdfSetupGrid (sdf, lo, hi, voxelSize);
+
+        // The top level grid alone may already be over the budget
+        size_t blocks = (size_t) sdf->dims[0]*sdf->dims[1]*sdf->dims[2];
+        size_t bytes = blocks*(sizeof (unsigned int) + sizeof (signed char));
+        if (bytes <= params->memoryBudget)
+        {
+            blockCount = (unsigned int) blocks;
+            delete[] counts;
+            counts = new std::atomic<unsigned int>[blockCount];
+            activeCount = SdfMarkBlocks (sdf, mesh, counts);
+            bytes += (size_t) activeCount*SDF_BRICK_SIZE*sizeof (float);
+            fits = (bytes <= params->memoryBudget);
+        }
+
+        if (!fits)
+        {
+            printf ("SDF voxel size %f needs %zu KB, coarsening\n",
+                    voxelSize, bytes >> 10);
+            voxelSize *= 1.25f;
+        }
+    }
+
+    if (!fits)
+    {
+        printf ("SDF does not fit in %u KB, not built\n", params->memoryBudget >> 10);
+        delete[] counts;
+        *sdf = {};
+        return;
+    }
+
+    // Per brick triangle lists (CSR), filled with atomic cursors
+    sdf->brickIndex = (unsigned int *) malloc (sizeof (unsigned int)*blockCount);
+    sdf->blockSign = (signed char *) malloc (blockCount);
+
+    std::vector<unsigned int> listStart (activeCount + 1, 0);
+    std::vector<unsigned int> brickBlock (activeCount);
+    for (unsigned int i=0 ; i<blockCount ; i++)
+    {
+        unsigned int count = counts[i].load (std::memory_order_relaxed);
+        if (count > 0)
+        {
+            brickBlock[sdf->brickCount] = i;
+            listStart[sdf->brickCount + 1] = listStart[sdf->brickCount] + count;
+            sdf->brickIndex[i] = sdf->brickCount++;
+        }
+        else
+        {
+            sdf->brickIndex[i] = SDF_EMPTY_BRICK;
+        }
+
+        // Reused as the fill cursor
+        counts[i].store (count > 0 ? listStart[sdf->brickIndex[i]] : 0,
+                         std::memory_order_relaxed);
+    }
+
+    std::vector<unsigned int> lists (listStart[activeCount] + 1);
+    float blockSize = sdf->voxelSize*SDF_BRICK_CELLS;
+
+    ParallelFor (mesh->triangleCount, 4096,
+                 [&] (unsigned int first, unsigned int last) {
+        for (unsigned int t=first ; t<last ; t++)
+        {
+            unsigned int *tri = mesh->triangles + t*3;
+            int b0[3], b1[3];
+
+            for (int a=0 ; a<3 ; a++)
+            {
+                const float *p = (a == 0) ? mesh->px : (a == 1) ? mesh->py : mesh->pz;
+                float l = fminf (p[tri[0]], fminf (p[tri[1]], p[tri[2]]));
+                float h = fmaxf (p[tri[0]], fmaxf (p[tri[1]], p[tri[2]]));
+                b0[a] = (int) ceilf ((l - sdf->band - sdf->origin[a])/blockSize) - 1;
+                b1[a] = (int) floorf ((h + sdf->band - sdf->origin[a])/blockSize);
+                b0[a] = (b0[a] < 0) ? 0 : b0[a];
+                b1[a] = (b1[a] >= sdf->dims[a]) ? (sdf->dims[a] - 1) : b1[a];
+            }
+
+            for (int z=b0[2] ; z<=b1[2] ; z++)
+            for (int y=b0[1] ; y<=b1[1] ; y++)
+            for (int x=b0[0] ; x<=b1[0] ; x++)
+            {
+                unsigned int slot = counts[SdfBlockIndex (sdf, x, y, z)].fetch_add (
+                    1, std::memory_order_relaxed);
+                lists[slot] = t;
+            }
+        }
+    });
+
+    delete[] counts;
+
+    // Brick samples, one brick per task. Each triangle only visits the
+    // samples inside its band expanded bounds.
+    sdf->bricks = (float *) malloc (sizeof (float)*SDF_BRICK_SIZE*
+                                    (sdf->brickCount + 1));
+
+    ParallelFor (sdf->brickCount, 4, [&] (unsigned int first, unsigned int last) {
+        float best[SDF_BRICK_SIZE];
+
+        for (unsigned int b=first ; b<last ; b++)
+        {
+            unsigned int block = brickBlock[b];
+            int brickCoords[3] = {
+                (int) (block%sdf->dims[0]),
+                (int) ((block/sdf->dims[0])%sdf->dims[1]),
+                (int) (block/(sdf->dims[0]*sdf->dims[1])),
+            };
+
+            hmm_vec3 brickOrigin = sdf->origin +
+                HMM_Vec3 ((float) brickCoords[0], (float) brickCoords[1],
+                          (float) brickCoords[2])*blockSize;
+
+            float *samples = sdf->bricks + (size_t) b*SDF_BRICK_SIZE;
+            for (int i=0 ; i<SDF_BRICK_SIZE ; i++)
+            {
+                best[i] = sdf->band*sdf->band;
+                samples[i] = FLT_MAX;
+            }
+
+            for (unsigned int i=listStart[b] ; i<listStart[b + 1] ; i++)
+            {
+                unsigned int *tri = mesh->triangles + lists[i]*3;
+                hmm_vec3 v[3];
+                for (int k=0 ; k<3 ; k++)
+                {
+                    v[k] = HMM_Vec3 (mesh->px[tri[k]], mesh->py[tri[k]],
+                                     mesh->pz[tri[k]]);
+                }
+
+                int s0[3], s1[3];
+                for (int a=0 ; a<3 ; a++)
+                {
+                    float l = fminf (v[0][a], fminf (v[1][a], v[2][a]));
+                    float h = fmaxf (v[0][a], fmaxf (v[1][a], v[2][a]));
+                    s0[a] = (int) ceilf ((l - sdf->band - brickOrigin[a])*
+                                         sdf->invVoxelSize);
+                    s1[a] = (int) floorf ((h + sdf->band - brickOrigin[a])*
+                                          sdf->invVoxelSize);
+                    s0[a] = (s0[a] < 0) ? 0 : s0[a];
+                    s1[a] = (s1[a] > SDF_BRICK_CELLS) ? SDF_BRICK_CELLS : s1[a];
+                }
+
+                for (int z=s0[2] ; z<=s1[2] ; z++)
+                for (int y=s0[1] ; y<=s1[1] ; y++)
+                for (int x=s0[0] ; x<=s1[0] ; x++)
+                {
+                    int index = (z*SDF_BRICK_SAMPLES + y)*SDF_BRICK_SAMPLES + x;
+                    hmm_vec3 p = brickOrigin +
+                        HMM_Vec3 ((float) x, (float) y, (float) z)*sdf->voxelSize;
+
+                    hmm_vec3 uvw;
+                    hmm_vec3 closest =
+                        SdfClosestPointTriangle (p, v[0], v[1], v[2], &uvw);
+                    hmm_vec3 d = p - closest;
+                    float d2 = HMM_DotVec3 (d, d);
+
+                    if (d2 < best[index])
+                    {
+                        hmm_vec3 n =
+                            HMM_Vec3 (mesh->nx[tri[0]], mesh->ny[tri[0]], mesh->nz[tri[0]])*uvw.X +
+                            HMM_Vec3 (mesh->nx[tri[1]], mesh->ny[tri[1]], mesh->nz[tri[1]])*uvw.Y +
+                            HMM_Vec3 (mesh->nx[tri[2]], mesh->ny[tri[2]], mesh->nz[tri[2]])*uvw.Z;
+
+                        best[index] = d2;
+                        samples[index] = (HMM_DotVec3 (d, n) < 0.f) ?
+                            -sqrtf (d2) : sqrtf (d2);
+                    }
+                }
+            }
+        }
+    });
+
+    SdfFloodFillSigns (sdf);
+
+    // Samples with no triangle within the band take the sign of the nearest
+    // sample that has one, multi source BFS over the brick
+    ParallelFor (sdf->brickCount, 16, [&] (unsigned int first, unsigned int last) {
+        unsigned short queue[SDF_BRICK_SIZE];
+
+        for (unsigned int b=first ; b<last ; b++)
+        {
+            float *samples = sdf->bricks + (size_t) b*SDF_BRICK_SIZE;
+            int head = 0, tail = 0;
+
+            for (int i=0 ; i<SDF_BRICK_SIZE ; i++)
+            {
+                if (samples[i] != FLT_MAX)
+                {
+                    queue[tail++] = (unsigned short) i;
+                }
+            }
+
+            if (tail == 0)
+            {
+                float sign = sdf->blockSign[brickBlock[b]];
+                for (int i=0 ; i<SDF_BRICK_SIZE ; i++)
+                {
+                    samples[i] = sign*sdf->band;
+                }
+                continue;
+            }
+
+            while (head < tail)
+            {
+                int i = queue[head++];
+                int x = i%SDF_BRICK_SAMPLES;
+                int y = (i/SDF_BRICK_SAMPLES)%SDF_BRICK_SAMPLES;
+                int z = i/(SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES);
+                float value = (samples[i] < 0.f) ? -sdf->band : sdf->band;
+
+                int neighbours[6] = {
+                    (x > 0) ? i - 1 : -1,
+                    (x < SDF_BRICK_SAMPLES - 1) ? i + 1 : -1,
+                    (y > 0) ? i - SDF_BRICK_SAMPLES : -1,
+                    (y < SDF_BRICK_SAMPLES - 1) ? i + SDF_BRICK_SAMPLES : -1,
+                    (z > 0) ? i - SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES : -1,
+                    (z < SDF_BRICK_SAMPLES - 1) ?
+                        i + SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES : -1,
+                };
+
+                for (int k=0 ; k<6 ; k++)
+                {
+                    if (neighbours[k] >= 0 && samples[neighbours[k]] == FLT_MAX)
+                    {
+                        samples[neighbours[k]] = value;
+                        queue[tail++] = (unsigned short) neighbours[k];
+                    }
+                }
+            }
+        }
+    });
+
+    sdf->memoryBytes =
+        sdf->brickCount*SDF_BRICK_SIZE*sizeof (float) +
+        blockCount*(sizeof (unsigned int) + sizeof (signed char));
+    sdf->buildMilliseconds = ScanMeshMilliseconds (start);
+
+    printf ("SDF %dx%dx%d blocks, %u bricks, voxel %f, %u KB, built in %.2f ms\n",
+            sdf->dims[0], sdf->dims[1], sdf->dims[2], sdf->brickCount,
+            sdf->voxelSize, sdf->memoryBytes >> 10, sdf->buildMilliseconds);
+    if (!params->benchmark)
+    {
+        return;
+    }
+
+    // Query throughput over random points in the bounds
+    std::chrono::high_resolution_clock::time_point queryStart =
+        std::chrono::high_resolution_clock::now ();
+    std::atomic<unsigned int> insideCount (0);
+    hmm_vec3 extent = hi - lo;
+
+    ParallelFor (SDF_BENCHMARK_QUERIES, 4096,
+                 [&] (unsigned int first, unsigned int last) {
+        unsigned int seed = first*2654435761u + 1;
+        unsigned int inside = 0;
+        for (unsigned int i=first ; i<last ; i++)
+        {
+            hmm_vec3 p;
+            for (int a=0 ; a<3 ; a++)
+            {
+                seed = seed*1664525u + 1013904223u;
+                p[a] = lo[a] + extent[a]*((seed >> 8)*(1.f/16777216.f));
+            }
+            inside += (SdfDistance (sdf, p) < 0.f);
+        }
+        insideCount.fetch_add (inside);
+    });
+
+    double queryMilliseconds = ScanMeshMilliseconds (queryStart);
+    printf ("SDF %.1f M queries/s (%.1f%% inside)\n",
+            SDF_BENCHMARK_QUERIES/(queryMilliseconds*1000.0),
+            100.0*insideCount.load ()/SDF_BENCHMARK_QUERIES);
+}
@@ -0,0 +1,240 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_mesh_smoothing.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Load time denoising of raw scans. Taubin lambda/mu smoothing removes high
+// frequency sensor noise without the shrinkage of plain Laplacian smoothing,
+// the bilateral mode moves vertices along their normal only and keeps
+// creases such as the toe and heel edges.
+//
+
+// MARK: Constants
+
+#define SMOOTH_TAUBIN_LAMBDA_DEFAULT 0.5f
+#define SMOOTH_TAUBIN_MU_DEFAULT -0.53f
+#define SMOOTH_ITERATIONS_DEFAULT 10
+
+// Relative to the mean edge length of the mesh
+#define SMOOTH_BILATERAL_SIGMA_C_DEFAULT 1.f
+
+#define SMOOTH_VERTEX_BATCH 2048
+
+// MARK: Enums
+
+enum smoothing_mode_t
+{
+    SmoothingMode_None,
+    SmoothingMode_Taubin,
+    SmoothingMode_Bilateral,
+};
+
+// MARK: Structs
+
+struct smoothing_params_t
+{
+    smoothing_mode_t mode;
+    int iterations;
+
+    float lambda;
+    float mu;
+
+    float sigmaC;
+};
+
+// MARK: Functions
+
+inline void
+InitSmoothingParams (smoothing_params_t *params)
+{
+    params->mode = SmoothingMode_None;
+    params->iterations = SMOOTH_ITERATIONS_DEFAULT;
+    params->lambda = SMOOTH_TAUBIN_LAMBDA_DEFAULT;
+    params->mu = SMOOTH_TAUBIN_MU_DEFAULT;
+    params->sigmaC = SMOOTH_BILATERAL_SIGMA_C_DEFAULT;
+}
+
+static float
+ScanMeshMeanEdgeLength (scan_mesh_t *mesh)
+{
+    double sum = 0.0;
+    unsigned int count = mesh->neighbourStart[mesh->vertexCount];
+
+    for (unsigned int v=0 ; v<mesh->vertexCount ; v++)
+    {
+        for (unsigned int i=mesh->neighbourStart[v] ;
+             i<mesh->neighbourStart[v + 1] ; i++)
+        {
+            unsigned int q = mesh->neighbours[i];
+            float dx = mesh->px[q] - mesh->px[v];
+            float dy = mesh->py[q] - mesh->py[v];
+            float dz = mesh->pz[q] - mesh->pz[v];
+            sum += sqrtf (dx*dx + dy*dy + dz*dz);
+        }
+    }
+
+    return ((count > 0) ? (float) (sum/count) : 0.f);
+}
+
+// One umbrella operator step, dst = src + factor*L(src)
+static void
+SmoothLaplacianStep (scan_mesh_t *mesh, float factor,
+                     const float *sx, const float *sy, const float *sz,
+                     float *dx, float *dy, float *dz)
+{
+    ParallelFor (mesh->vertexCount, SMOOTH_VERTEX_BATCH,
+                 [&] (unsigned int start, unsigned int end) {
+        for (unsigned int v=start ; v<end ; v++)
+        {
+            unsigned int first = mesh->neighbourStart[v];
+            unsigned int last = mesh->neighbourStart[v + 1];
+
+            if (first == last)
+            {
+                dx[v] = sx[v]; dy[v] = sy[v]; dz[v] = sz[v];
+                continue;
+            }
+
+            float cx = 0.f, cy = 0.f, cz = 0.f;
+            for (unsigned int i=first ; i<last ; i++)
+            {
+                unsigned int q = mesh->neighbours[i];
+                cx += sx[q]; cy += sy[q]; cz += sz[q];
+            }
+
+            float inv = 1.f/(float) (last - first);
+            dx[v] = sx[v] + factor*(cx*inv - sx[v]);
+            dy[v] = sy[v] + factor*(cy*inv - sy[v]);
+            dz[v] = sz[v] + factor*(cz*inv - sz[v]);
+        }
+    });
+}
+
+// Fleishman et al. bilateral mesh denoising over the one ring. The range
+// sigma adapts to the local offset spread, the spatial sigma is fixed.
+static void
+SmoothBilateralStep (scan_mesh_t *mesh, float sigmaC,
+                     const float *sx, const float *sy, const float *sz,
+                     float *dx, float *dy, float *dz)
+{
+    float invTwoSigmaC2 = 1.f/(2.f*sigmaC*sigmaC);
+
+    ParallelFor (mesh->vertexCount, SMOOTH_VERTEX_BATCH,
+                 [&] (unsigned int start, unsigned int end) {
+        for (unsigned int v=start ; v<end ; v++)
+        {
+            unsigned int first = mesh->neighbourStart[v];
+            unsigned int last = mesh->neighbourStart[v + 1];
+
+            float nx = mesh->nx[v], ny = mesh->ny[v], nz = mesh->nz[v];
+
+            // Offset spread along the normal sets the range sigma
+            float sumH = 0.f, sumH2 = 0.f;
+            for (unsigned int i=first ; i<last ; i++)
+            {
+                unsigned int q = mesh->neighbours[i];
+                float h = nx*(sx[q] - sx[v]) + ny*(sy[q] - sy[v]) +
+                    nz*(sz[q] - sz[v]);
+                sumH += h;
+                sumH2 += h*h;
+            }
+
+            float count = (float) (last - first);
+            float variance = (count > 0.f) ?
+                (sumH2/count - (sumH/count)*(sumH/count)) : 0.f;
+
+            if (variance <= 1e-12f)
+            {
+                dx[v] = sx[v]; dy[v] = sy[v]; dz[v] = sz[v];
+                continue;
+            }
+
+            float invTwoSigmaS2 = 1.f/(2.f*variance);
+
+            float sum = 0.f, normalizer = 0.f;
+            for (unsigned int i=first ; i<last ; i++)
+            {
+                unsigned int q = mesh->neighbours[i];
+                float ex = sx[q] - sx[v];
+                float ey = sy[q] - sy[v];
+                float ez = sz[q] - sz[v];
+
+                float t2 = ex*ex + ey*ey + ez*ez;
+                float h = nx*ex + ny*ey + nz*ez;
+
+                float w = expf (-t2*invTwoSigmaC2)*expf (-h*h*invTwoSigmaS2);
+                sum += w*h;
+                normalizer += w;
+            }
+
+            float offset = (normalizer > 0.f) ? (sum/normalizer) : 0.f;
+            dx[v] = sx[v] + nx*offset;
+            dy[v] = sy[v] + ny*offset;
+            dz[v] = sz[v] + nz*offset;
+        }
+    });
+}
+
+// Smooths positions in place and leaves updated normals in the mesh.
+// Requires ScanMeshBuildAdjacency.
+static void
+SmoothScanMesh (scan_mesh_t *mesh, smoothing_params_t *params)
+{
+    if (params->mode == SmoothingMode_None || params->iterations <= 0 ||
+        mesh->vertexCount == 0)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    // Double buffered, every step reads one set and writes the other
+    unsigned int vertexCount = mesh->vertexCount;
+    float *back = (float *) malloc (sizeof (float)*vertexCount*3);
+    float *bx = back;
+    float *by = back + vertexCount;
+    float *bz = back + vertexCount*2;
+
+    float *fx = mesh->px, *fy = mesh->py, *fz = mesh->pz;
+
+    if (params->mode == SmoothingMode_Taubin)
+    {
+        for (int i=0 ; i<params->iterations ; i++)
+        {
+            SmoothLaplacianStep (mesh, params->lambda, fx, fy, fz, bx, by, bz);
+            SmoothLaplacianStep (mesh, params->mu, bx, by, bz, fx, fy, fz);
+        }
+    }
+    else
+    {
+        float sigmaC = params->sigmaC*ScanMeshMeanEdgeLength (mesh);
+
+        for (int i=0 ; i<params->iterations ; i++)
+        {
+            ScanMeshComputeNormals (mesh, fx, fy, fz);
+            SmoothBilateralStep (mesh, sigmaC, fx, fy, fz, bx, by, bz);
+
+            float *t;
+            t = fx; fx = bx; bx = t;
+            t = fy; fy = by; by = t;
+            t = fz; fz = bz; bz = t;
+        }
+
+        // An odd iteration count leaves the result in the back buffer
+        if (fx != mesh->px)
+        {
+            memcpy (mesh->px, fx, sizeof (float)*vertexCount);
+            memcpy (mesh->py, fy, sizeof (float)*vertexCount);
+            memcpy (mesh->pz, fz, sizeof (float)*vertexCount);
+        }
+    }
+
+    free (back);
+
+    ScanMeshComputeNormals (mesh, mesh->px, mesh->py, mesh->pz);
+
+    printf ("Smoothed %u vertices, %d iterations in %.2f ms\n",
+            vertexCount, params->iterations, ScanMeshMilliseconds (start));
+}
@@ -0,0 +1,399 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_occlusion_cull.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Occlusion culling against a small depth buffer rasterized on the CPU.
+// Every frame the meshes, instances and clusters drawn in the last frame
+// are rasterized as occluders, nearest first and up to a triangle budget,
+// then reduced into a pyramid that keeps the farthest depth of each 2x2
+// block. A box is hidden when its nearest depth is behind the farthest
+// occluder depth over every texel it covers, which takes at most four
+// texel reads at the right level. Edge functions are evaluated four pixels
+// at a time on the same lanes as the frustum tests.
+//
+// Occluders are triangles that are drawn this frame, front facing and not
+// clipped by the near plane, so a hidden box is behind real geometry. The
+// texel rectangle of a box is grown by one texel to cover occluder edges
+// that the pixel centre sampling rounded outwards.
+//
+
+// MARK: Constants
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_MAX_HEIGHT 256
+#define OCCLUSION_MAX_LEVELS 10
+
+// Enough for a handful of nearby scans, occluders past it are still drawn
+#define OCCLUSION_TRIANGLE_BUDGET (1 << 14)
+
+// MARK: Structs
+
+// One mesh, or one instance of it, waiting to be rasterized
+struct occluder_t
+{
+    float depth;
+    unsigned int object;
+    unsigned int instance;
+};
+
+struct occlusion_buffer_t
+{
+    int enabled;
+    unsigned int triangleBudget;
+
+    // Level 0 holds the nearest occluder depth per texel in [0, 1], every
+    // level above the farthest depth of the 2x2 texels below it
+    int width;
+    int height;
+    int levels;
+    int levelWidth[OCCLUSION_MAX_LEVELS];
+    int levelHeight[OCCLUSION_MAX_LEVELS];
+    float *depth[OCCLUSION_MAX_LEVELS];
+    float *memory;
+
+    hmm_mat4 viewProjection;
+
+    // Occluders of the current frame and the triangles they sent to the
+    // rasterizer, back facing ones included
+    std::vector<occluder_t> occluders;
+    unsigned int triangles;
+};
+
+// MARK: Functions
+
+// Clip space position of p under m, written out so it stays in registers
+inline hmm_vec4
+OcclusionTransform (hmm_mat4 *m, float *p)
+{
+    hmm_vec4 c;
+    for (int r=0 ; r<4 ; r++)
+    {
+        c.Elements[r] = m->Elements[0][r]*p[0] + m->Elements[1][r]*p[1] +
+                        m->Elements[2][r]*p[2] + m->Elements[3][r];
+    }
+    return (c);
+}
+
+// View depth of the nearest point of a model space sphere, xyz centre and
+// w radius. Occluders are rasterized in this order, so a large mesh goes
+// before the small ones around its centre.
+inline float
+OccluderDepth (hmm_mat4 modelView, hmm_vec4 sphere)
+{
+    float scale = 0.f;
+    for (int c=0 ; c<3 ; c++)
+    {
+        scale = HMM_MAX (scale, modelView.Elements[c][0]*modelView.Elements[c][0] +
+                                modelView.Elements[c][1]*modelView.Elements[c][1] +
+                                modelView.Elements[c][2]*modelView.Elements[c][2]);
+    }
+    hmm_vec4 center = modelView*HMM_Vec4v (sphere.XYZ, 1.f);
+    return (-center.Z - sphere.W*HMM_SquareRootF (scale));
+}
+
+static void
+InitOcclusionBuffer (occlusion_buffer_t *buffer)
+{
+    buffer->enabled = 1;
+    buffer->triangleBudget = OCCLUSION_TRIANGLE_BUDGET;
+
+    // A full pyramid needs less than twice the base level
+    buffer->memory = (float *)
+        malloc (sizeof (float)*2*OCCLUSION_WIDTH*OCCLUSION_MAX_HEIGHT);
+    buffer->levels = 0;
+    buffer->triangles = 0;
+}
+
+static void
+FreeOcclusionBuffer (occlusion_buffer_t *buffer)
+{
+    free (buffer->memory);
+    buffer->memory = NULL;
+    buffer->levels = 0;
+    buffer->occluders.clear ();
+}
+
+// Clears the buffer for a new frame. ratio is height over width of the
+// viewport, the texels stay roughly square.
+static void
+OcclusionBegin (occlusion_buffer_t *buffer, hmm_mat4 viewProjection,
+                float ratio)
+{
+    int height = (int) (OCCLUSION_WIDTH*ratio + 0.5f);
+    buffer->width = OCCLUSION_WIDTH;
+    buffer->height = HMM_MAX (1, HMM_MIN (height, OCCLUSION_MAX_HEIGHT));
+    buffer->viewProjection = viewProjection;
+    buffer->triangles = 0;
+    buffer->occluders.clear ();
+
+    int w = buffer->width;
+    int h = buffer->height;
+    float *level = buffer->memory;
+    buffer->levels = 0;
+    while (buffer->levels < OCCLUSION_MAX_LEVELS)
+    {
+        buffer->levelWidth[buffer->levels] = w;
+        buffer->levelHeight[buffer->levels] = h;
+        buffer->depth[buffer->levels] = level;
+        buffer->levels++;
+        level += w*h;
+
+        if (w == 1 && h == 1)
+        {
+            break;
+        }
+        w = (w + 1)/2;
+        h = (h + 1)/2;
+    }
+
+    float *base = buffer->depth[0];
+    for (int i=0 ; i<buffer->width*buffer->height ; i++)
+    {
+        base[i] = 1.f;
+    }
+}
+
+// Rasterizes triangles first to first + count of an index list into level
+// 0, stopping when the frame's triangle budget is spent. positions are
+// model space with strideFloats floats per vertex.
+static void
+OcclusionRasterize (occlusion_buffer_t *buffer, hmm_mat4 model,
+                    float *positions, int strideFloats,
+                    GLuint *indices, unsigned int first, unsigned int count)
+{
+    hmm_mat4 m = buffer->viewProjection*model;
+    float width = (float) buffer->width;
+    float height = (float) buffer->height;
+    float *depth = buffer->depth[0];
+
+    float offsets[CULL_LANES];
+    for (int k=0 ; k<CULL_LANES ; k++)
+    {
+        offsets[k] = (float) k + 0.5f;
+    }
+    cull_lane_t laneOffsets = CullLoad (offsets);
+
+    for (unsigned int t=first ; t + 2 < first + count ; t+=3)
+    {
+        if (buffer->triangles >= buffer->triangleBudget)
+        {
+            return;
+        }
+        buffer->triangles++;
+
+        float x[3], y[3], z[3];
+        int clipped = 0;
+        for (int k=0 ; k<3 ; k++)
+        {
+            hmm_vec4 c = OcclusionTransform (&m, positions + indices[t + k]*strideFloats);
+
+            // Partly in front of the near plane, leave it out
+            if (c.W <= 0.f || c.Z < -c.W)
+            {
+                clipped = 1;
+                break;
+            }
+
+            float invW = 1.f/c.W;
+            x[k] = (c.X*invW*0.5f + 0.5f)*width;
+            y[k] = (c.Y*invW*0.5f + 0.5f)*height;
+            z[k] = c.Z*invW*0.5f + 0.5f;
+        }
+        if (clipped)
+        {
+            continue;
+        }
+
+        // Counter clockwise is front facing, the back faces are culled by GL
+        float area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+        if (!(area > 0.f))
+        {
+            continue;
+        }
+
+        int x0 = HMM_MAX (0, (int) floorf (HMM_MIN (x[0], HMM_MIN (x[1], x[2]))));
+        int y0 = HMM_MAX (0, (int) floorf (HMM_MIN (y[0], HMM_MIN (y[1], y[2]))));
+        int x1 = HMM_MIN (buffer->width - 1,
+                          (int) floorf (HMM_MAX (x[0], HMM_MAX (x[1], x[2]))));
+        int y1 = HMM_MIN (buffer->height - 1,
+                          (int) floorf (HMM_MAX (y[0], HMM_MAX (y[1], y[2]))));
+        if (x0 > x1 || y0 > y1)
+        {
+            continue;
+        }
+
+        // Edge i runs from vertex i to the next one and is positive inside
+        float a[3], b[3], c[3];
+        for (int e=0 ; e<3 ; e++)
+        {
+            int n = (e + 1)%3;
+            a[e] = y[e] - y[n];
+            b[e] = x[n] - x[e];
+            c[e] = -(a[e]*x[e] + b[e]*y[e]);
+        }
+
+        // Depth is linear in screen space
+        float invArea = 1.f/area;
+        float za = ((z[1] - z[0])*(y[2] - y[0]) - (z[2] - z[0])*(y[1] - y[0]))*invArea;
+        float zb = ((x[1] - x[0])*(z[2] - z[0]) - (x[2] - x[0])*(z[1] - z[0]))*invArea;
+        float zc = z[0] - za*x[0] - zb*y[0];
+
+        // Edges step incrementally, four pixels per step
+        cull_lane_t a0 = CullSet (a[0]);
+        cull_lane_t a1 = CullSet (a[1]);
+        cull_lane_t a2 = CullSet (a[2]);
+        cull_lane_t step0 = CullSet (a[0]*CULL_LANES);
+        cull_lane_t step1 = CullSet (a[1]*CULL_LANES);
+        cull_lane_t step2 = CullSet (a[2]*CULL_LANES);
+        cull_lane_t zStep = CullSet (za*CULL_LANES);
+        cull_lane_t zLanes = CullSet (za);
+
+        for (int py=y0 ; py<=y1 ; py++)
+        {
+            float centerY = (float) py + 0.5f;
+            float *row = depth + py*buffer->width;
+            float rowZ = zb*centerY + zc;
+
+            cull_lane_t e0 = CullMulAdd (a0, laneOffsets,
+                                         CullSet (a[0]*x0 + b[0]*centerY + c[0]));
+            cull_lane_t e1 = CullMulAdd (a1, laneOffsets,
+                                         CullSet (a[1]*x0 + b[1]*centerY + c[1]));
+            cull_lane_t e2 = CullMulAdd (a2, laneOffsets,
+                                         CullSet (a[2]*x0 + b[2]*centerY + c[2]));
+            cull_lane_t z = CullMulAdd (zLanes, laneOffsets,
+                                        CullSet (za*x0 + rowZ));
+
+            for (int px=x0 ; px<=x1 ; px+=CULL_LANES)
+            {
+                cull_lane_t outside = CullOr (CullNegative (e0), CullNegative (e1));
+                outside = CullOr (outside, CullNegative (e2));
+                e0 = CullAdd (e0, step0);
+                e1 = CullAdd (e1, step1);
+                e2 = CullAdd (e2, step2);
+
+                cull_lane_t laneZ = z;
+                z = CullAdd (z, zStep);
+
+                int lanes = HMM_MIN (CULL_LANES, x1 - px + 1);
+                unsigned int full = (1u << lanes) - 1;
+                unsigned int inside = ~CullMask (outside) & full;
+                float *texels = row + px;
+                if (inside == (1u << CULL_LANES) - 1)
+                {
+                    CullStore (texels, CullMin (CullLoad (texels), laneZ));
+                }
+                else if (inside != 0)
+                {
+                    float d[CULL_LANES];
+                    CullStore (d, laneZ);
+                    for (int k=0 ; k<lanes ; k++)
+                    {
+                        if (inside & (1u << k))
+                        {
+                            texels[k] = HMM_MIN (texels[k], d[k]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void
+OcclusionBuildPyramid (occlusion_buffer_t *buffer)
+{
+    for (int l=1 ; l<buffer->levels ; l++)
+    {
+        float *below = buffer->depth[l - 1];
+        float *level = buffer->depth[l];
+        int belowWidth = buffer->levelWidth[l - 1];
+        int belowHeight = buffer->levelHeight[l - 1];
+
+        for (int y=0 ; y<buffer->levelHeight[l] ; y++)
+        {
+            int y0 = 2*y;
+            int y1 = HMM_MIN (2*y + 1, belowHeight - 1);
+            for (int x=0 ; x<buffer->levelWidth[l] ; x++)
+            {
+                int x0 = 2*x;
+                int x1 = HMM_MIN (2*x + 1, belowWidth - 1);
+                float d = HMM_MAX (below[y0*belowWidth + x0],
+                                   below[y0*belowWidth + x1]);
+                d = HMM_MAX (d, below[y1*belowWidth + x0]);
+                d = HMM_MAX (d, below[y1*belowWidth + x1]);
+                level[y*buffer->levelWidth[l] + x] = d;
+            }
+        }
+    }
+}
+
+// Returns false when the model space box is hidden behind the occluders
+static int
+OcclusionTestBox (occlusion_buffer_t *buffer, hmm_mat4 model,
+                  hmm_vec3 center, hmm_vec3 extent)
+{
+    hmm_mat4 m = buffer->viewProjection*model;
+
+    float minX = FLT_MAX, minY = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (int i=0 ; i<8 ; i++)
+    {
+        hmm_vec3 corner = HMM_Vec3 (center.X + ((i & 1) ? extent.X : -extent.X),
+                                    center.Y + ((i & 2) ? extent.Y : -extent.Y),
+                                    center.Z + ((i & 4) ? extent.Z : -extent.Z));
+        hmm_vec4 c = m*HMM_Vec4v (corner, 1.f);
+
+        // Nothing is in front of a box crossing the near plane
+        if (c.W <= 0.f || c.Z < -c.W)
+        {
+            return (1);
+        }
+
+        float invW = 1.f/c.W;
+        float x = (c.X*invW*0.5f + 0.5f)*buffer->width;
+        float y = (c.Y*invW*0.5f + 0.5f)*buffer->height;
+        minX = HMM_MIN (minX, x);
+        minY = HMM_MIN (minY, y);
+        maxX = HMM_MAX (maxX, x);
+        maxY = HMM_MAX (maxY, y);
+        nearest = HMM_MIN (nearest, c.Z*invW*0.5f + 0.5f);
+    }
+
+    // One texel of margin around the covered texels
+    int x0 = HMM_MAX (0, (int) floorf (minX) - 1);
+    int y0 = HMM_MAX (0, (int) floorf (minY) - 1);
+    int x1 = HMM_MIN (buffer->width - 1, (int) floorf (maxX) + 1);
+    int y1 = HMM_MIN (buffer->height - 1, (int) floorf (maxY) + 1);
+    if (x0 > x1 || y0 > y1)
+    {
+        // Off screen, left to the frustum test
+        return (1);
+    }
+
+    // Coarsest level where the rectangle spans at most 2x2 texels
+    int level = 0;
+    while ((x1 - x0 > 1 || y1 - y0 > 1) && level < buffer->levels - 1)
+    {
+        x0 >>= 1;
+        y0 >>= 1;
+        x1 >>= 1;
+        y1 >>= 1;
+        level++;
+    }
+
+    float *depth = buffer->depth[level];
+    int levelWidth = buffer->levelWidth[level];
+    float farthest = 0.f;
+    for (int y=y0 ; y<=y1 ; y++)
+    {
+        for (int x=x0 ; x<=x1 ; x++)
+        {
+            farthest = HMM_MAX (farthest, depth[y*levelWidth + x]);
+        }
+    }
+
+    return (nearest <= farthest);
+}
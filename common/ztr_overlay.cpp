@@ -0,0 +1,282 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_overlay.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Immediate mode overlay geometry, measurement lines, picked points and
+// outlines that change every frame. Primitives are gathered into fixed size
+// batches during the frame and streamed into one large ring buffer, then
+// drawn with one call per primitive type. Each frame may use at most a
+// quarter of the ring when three frames are in flight, so the range being
+// written never overlaps one the GPU still reads, and the frame ring's
+// fences make an unsynchronized mapping safe. Nothing is allocated after
+// init, primitives past a full batch are dropped and counted.
+//
+
+// MARK: Constants
+
+// Vertices of each primitive type per frame
+#define OVERLAY_BATCH_VERTICES (1 << 13)
+
+#define OVERLAY_FRAME_VERTICES (OVERLAY_BATCH_VERTICES*OverlayPrimitive_Count)
+#define OVERLAY_RING_VERTICES (OVERLAY_FRAME_VERTICES*(FRAMES_IN_FLIGHT + 1))
+
+#define OVERLAY_ATTRIB_POSITION 0
+#define OVERLAY_ATTRIB_COLOR 1
+
+#define OVERLAY_POINT_SIZE_DEFAULT 6.f
+
+// MARK: Enums
+
+enum overlay_primitive_t
+{
+    OverlayPrimitive_Triangles,
+    OverlayPrimitive_Lines,
+    OverlayPrimitive_Points,
+
+    OverlayPrimitive_Count,
+};
+
+// MARK: Structs
+
+struct overlay_vertex_t
+{
+    hmm_vec3 position;
+    float size;
+    unsigned char color[4];
+};
+
+struct overlay_batch_t
+{
+    overlay_vertex_t *vertices;
+    unsigned int count;
+};
+
+struct overlay_t
+{
+    shader_t *shader;
+
+    GLuint vao;
+    GLuint buffer;
+
+    overlay_batch_t batches[OverlayPrimitive_Count];
+
+    // Next free vertex of the ring
+    unsigned int head;
+
+    // Vertices that did not fit their batch since init
+    unsigned int dropped;
+};
+
+// MARK: Globals
+
+static overlay_t g_overlay;
+
+static const GLenum g_overlayModes[OverlayPrimitive_Count] = {
+    GL_TRIANGLES,
+    GL_LINES,
+    GL_POINTS,
+};
+
+// MARK: Functions
+
+static void
+InitOverlay (overlay_t *overlay, shader_t *shader)
+{
+    *overlay = {};
+    overlay->shader = shader;
+
+    for (int p=0 ; p<OverlayPrimitive_Count ; p++)
+    {
+        overlay->batches[p].vertices = (overlay_vertex_t *)
+            malloc (sizeof (overlay_vertex_t)*OVERLAY_BATCH_VERTICES);
+    }
+
+    glGenBuffers (1, &overlay->buffer);
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, overlay->buffer);
+    glBufferData (GL_ARRAY_BUFFER, sizeof (overlay_vertex_t)*OVERLAY_RING_VERTICES,
+                  NULL, GL_STREAM_DRAW);
+
+    // Draws pick their range with the first vertex, the layout never changes
+    glGenVertexArrays (1, &overlay->vao);
+    GLStateBindVertexArray (&g_glState, overlay->vao);
+    glEnableVertexAttribArray (OVERLAY_ATTRIB_POSITION);
+    glVertexAttribPointer (OVERLAY_ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE,
+                           sizeof (overlay_vertex_t),
+                           (GLvoid *) offsetof (overlay_vertex_t, position));
+    glEnableVertexAttribArray (OVERLAY_ATTRIB_COLOR);
+    glVertexAttribPointer (OVERLAY_ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                           sizeof (overlay_vertex_t),
+                           (GLvoid *) offsetof (overlay_vertex_t, color));
+    GLStateBindVertexArray (&g_glState, 0);
+
+#ifdef GL_PROGRAM_POINT_SIZE
+    // Always on in ES, desktop GL ignores gl_PointSize without it
+    glEnable (GL_PROGRAM_POINT_SIZE);
+#endif
+}
+
+static void
+FreeOverlay (overlay_t *overlay)
+{
+    for (int p=0 ; p<OverlayPrimitive_Count ; p++)
+    {
+        free (overlay->batches[p].vertices);
+    }
+    if (overlay->buffer != 0)
+    {
+        GLStateForgetBuffer (&g_glState, overlay->buffer);
+        glDeleteBuffers (1, &overlay->buffer);
+        glDeleteVertexArrays (1, &overlay->vao);
+    }
+    *overlay = {};
+}
+
+// Returns count vertices to fill, or NULL when the batch is full
+static overlay_vertex_t *
+OverlayReserve (overlay_t *overlay, overlay_primitive_t primitive, unsigned int count)
+{
+    overlay_batch_t *batch = overlay->batches + primitive;
+    if (batch->vertices == NULL || batch->count + count > OVERLAY_BATCH_VERTICES)
+    {
+        if (overlay->dropped == 0)
+        {
+            printf ("Overlay batch %d full, dropping primitives\n", primitive);
+        }
+        overlay->dropped += count;
+        return (NULL);
+    }
+
+    overlay_vertex_t *vertices = batch->vertices + batch->count;
+    batch->count += count;
+    return (vertices);
+}
+
+inline void
+OverlaySetVertex (overlay_vertex_t *vertex, hmm_vec3 position, float size,
+                  hmm_vec4 color)
+{
+    vertex->position = position;
+    vertex->size = size;
+    for (int i=0 ; i<4 ; i++)
+    {
+        vertex->color[i] =
+            (unsigned char) (HMM_Clamp (0.f, color.Elements[i], 1.f)*255.f + 0.5f);
+    }
+}
+
+static void
+OverlayTriangle (overlay_t *overlay, hmm_vec3 a, hmm_vec3 b, hmm_vec3 c,
+                 hmm_vec4 color)
+{
+    overlay_vertex_t *vertices = OverlayReserve (overlay, OverlayPrimitive_Triangles, 3);
+    if (vertices != NULL)
+    {
+        OverlaySetVertex (vertices + 0, a, 0.f, color);
+        OverlaySetVertex (vertices + 1, b, 0.f, color);
+        OverlaySetVertex (vertices + 2, c, 0.f, color);
+    }
+}
+
+static void
+OverlayLine (overlay_t *overlay, hmm_vec3 a, hmm_vec3 b, hmm_vec4 color)
+{
+    overlay_vertex_t *vertices = OverlayReserve (overlay, OverlayPrimitive_Lines, 2);
+    if (vertices != NULL)
+    {
+        OverlaySetVertex (vertices + 0, a, 0.f, color);
+        OverlaySetVertex (vertices + 1, b, 0.f, color);
+    }
+}
+
+// Size in pixels
+static void
+OverlayPoint (overlay_t *overlay, hmm_vec3 position, float size, hmm_vec4 color)
+{
+    overlay_vertex_t *vertex = OverlayReserve (overlay, OverlayPrimitive_Points, 1);
+    if (vertex != NULL)
+    {
+        OverlaySetVertex (vertex, position, size, color);
+    }
+}
+
+// Consecutive points joined by lines, closed joins the last to the first
+static void
+OverlayPolyline (overlay_t *overlay, hmm_vec3 *points, unsigned int count,
+                 int closed, hmm_vec4 color)
+{
+    unsigned int segments = (count < 2) ? 0 : (closed ? count : count - 1);
+    overlay_vertex_t *vertices =
+        OverlayReserve (overlay, OverlayPrimitive_Lines, 2*segments);
+    if (vertices == NULL)
+    {
+        return;
+    }
+
+    for (unsigned int i=0 ; i<segments ; i++)
+    {
+        OverlaySetVertex (vertices + 2*i, points[i], 0.f, color);
+        OverlaySetVertex (vertices + 2*i + 1, points[(i + 1)%count], 0.f, color);
+    }
+}
+
+// Drops what was gathered, for frames that can not draw it
+inline void
+OverlayDiscard (overlay_t *overlay)
+{
+    for (int p=0 ; p<OverlayPrimitive_Count ; p++)
+    {
+        overlay->batches[p].count = 0;
+    }
+}
+
+// Streams the gathered batches into the ring and draws them on top of the
+// scene, depth tested without writing depth. Call after FrameRingBegin with
+// the overlay program ready
+static void
+OverlayDraw (overlay_t *overlay)
+{
+    unsigned int total = 0;
+    for (int p=0 ; p<OverlayPrimitive_Count ; p++)
+    {
+        total += overlay->batches[p].count;
+    }
+    if (total == 0)
+    {
+        return;
+    }
+
+    // A frame never straddles the end, the skipped tail is less than one
+    // frame so the spare quarter of the ring covers it
+    if (overlay->head + total > OVERLAY_RING_VERTICES)
+    {
+        overlay->head = 0;
+    }
+
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, overlay->buffer);
+    GLStateBindVertexArray (&g_glState, overlay->vao);
+    GLStateUseProgram (&g_glState, overlay->shader->program);
+    GLStateDepthMask (&g_glState, GL_FALSE);
+    GLStateDepthFunc (&g_glState, GL_LEQUAL);
+
+    for (int p=0 ; p<OverlayPrimitive_Count ; p++)
+    {
+        overlay_batch_t *batch = overlay->batches + p;
+        if (batch->count == 0)
+        {
+            continue;
+        }
+
+        FrameRingWrite (GL_ARRAY_BUFFER,
+                        sizeof (overlay_vertex_t)*overlay->head,
+                        sizeof (overlay_vertex_t)*batch->count,
+                        batch->vertices);
+        glDrawArrays (g_overlayModes[p], overlay->head, batch->count);
+
+        overlay->head += batch->count;
+        batch->count = 0;
+    }
+
+    GLStateDepthFunc (&g_glState, GL_LESS);
+}
@@ -0,0 +1,217 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_parallel.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Small persistent worker pool used by the mesh processing stages. Included
+// by ztr_platform_independent_layer.cpp (single translation unit build).
+//
+
+// MARK: Includes
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// MARK: Constants
+
+#define PARALLEL_MAX_WORKERS (1 << 5)
+
+// MARK: Structs
+
+#define PARALLEL_RANGE_FN(name) void name(void *data, unsigned int start, unsigned int end)
+typedef PARALLEL_RANGE_FN(parallel_range_fn);
+
+struct parallel_job_t
+{
+    parallel_range_fn *fn;
+    void *data;
+
+    unsigned int count;
+    unsigned int batchSize;
+    unsigned int batchCount;
+
+    std::atomic<unsigned int> nextBatch;
+    std::atomic<unsigned int> finishedWorkers;
+};
+
+struct parallel_pool_t
+{
+    std::thread workers[PARALLEL_MAX_WORKERS];
+    unsigned int workerCount;
+
+    // Serialises submitters, a busy pool makes the caller run inline
+    std::mutex submitMutex;
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    unsigned int generation;
+    int quit;
+
+    parallel_job_t job;
+};
+
+// MARK: Globals
+
+static parallel_pool_t *g_parallelPool;
+static std::once_flag g_parallelPoolOnce;
+static thread_local int g_parallelIsWorker;
+
+// Set while this thread runs the batches of a job it submitted, it already
+// holds submitMutex then
+static thread_local int g_parallelIsSubmitting;
+
+// MARK: Functions
+
+static void
+ParallelRunBatches (parallel_job_t *job)
+{
+    for (;;)
+    {
+        unsigned int batch = job->nextBatch.fetch_add (1);
+        if (batch >= job->batchCount)
+        {
+            break;
+        }
+
+        unsigned int start = batch*job->batchSize;
+        unsigned int end = start + job->batchSize;
+        if (end > job->count)
+        {
+            end = job->count;
+        }
+
+        job->fn (job->data, start, end);
+    }
+}
+
+static void
+ParallelWorkerMain (parallel_pool_t *pool)
+{
+    g_parallelIsWorker = 1;
+    unsigned int seenGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock (pool->wakeMutex);
+            pool->wakeCondition.wait (lock, [&] {
+                return (pool->quit || pool->generation != seenGeneration);
+            });
+
+            if (pool->quit)
+            {
+                break;
+            }
+            seenGeneration = pool->generation;
+        }
+
+        ParallelRunBatches (&pool->job);
+        pool->job.finishedWorkers.fetch_add (1);
+    }
+}
+
+static void
+ParallelInitPool (void)
+{
+    g_parallelPool = new parallel_pool_t ();
+    g_parallelPool->generation = 0;
+    g_parallelPool->quit = 0;
+
+    // The submitting thread participates, so one fewer worker than cores
+    unsigned int cores = std::thread::hardware_concurrency ();
+    unsigned int workerCount = (cores > 1) ? (cores - 1) : 0;
+    if (workerCount > PARALLEL_MAX_WORKERS)
+    {
+        workerCount = PARALLEL_MAX_WORKERS;
+    }
+
+    g_parallelPool->workerCount = workerCount;
+    for (unsigned int i=0 ; i<workerCount ; i++)
+    {
+        g_parallelPool->workers[i] =
+            std::thread (ParallelWorkerMain, g_parallelPool);
+    }
+}
+
+inline unsigned int
+ParallelWorkerCount (void)
+{
+    std::call_once (g_parallelPoolOnce, ParallelInitPool);
+    return (g_parallelPool->workerCount + 1);
+}
+
+// Calls fn over [0, count) split into batches of batchSize. Blocks until every
+// batch completed. Calls nested in a batch, on a worker or on the submitting
+// thread, and calls made while another thread submits run inline on the
+// caller.
+static void
+ParallelFor (unsigned int count, unsigned int batchSize,
+             parallel_range_fn *fn, void *data)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (batchSize == 0)
+    {
+        batchSize = 1;
+    }
+
+    std::call_once (g_parallelPoolOnce, ParallelInitPool);
+    parallel_pool_t *pool = g_parallelPool;
+
+    if (g_parallelIsWorker || g_parallelIsSubmitting || pool->workerCount == 0 ||
+        count <= batchSize || !pool->submitMutex.try_lock ())
+    {
+        fn (data, 0, count);
+        return;
+    }
+
+    parallel_job_t *job = &pool->job;
+    job->fn = fn;
+    job->data = data;
+    job->count = count;
+    job->batchSize = batchSize;
+    job->batchCount = (count + batchSize - 1)/batchSize;
+    job->nextBatch.store (0);
+    job->finishedWorkers.store (0);
+
+    {
+        std::lock_guard<std::mutex> lock (pool->wakeMutex);
+        pool->generation++;
+    }
+    pool->wakeCondition.notify_all ();
+
+    g_parallelIsSubmitting = 1;
+    ParallelRunBatches (job);
+    g_parallelIsSubmitting = 0;
+
+    // Every worker wakes once per generation, so waiting for all of them
+    // also guarantees none still touches the job when it is reused
+    while (job->finishedWorkers.load () < pool->workerCount)
+    {
+        std::this_thread::yield ();
+    }
+
+    pool->submitMutex.unlock ();
+}
+
+// Lambda convenience wrapper, body is called as body (start, end)
+template <typename F>
+static void
+ParallelFor (unsigned int count, unsigned int batchSize, F body)
+{
+    struct wrapper_t
+    {
+        static PARALLEL_RANGE_FN (Run)
+        {
+            (*(F *) data) (start, end);
+        }
+    };
+
+    ParallelFor (count, batchSize, wrapper_t::Run, (void *) &body);
+}
@@ -12,11 +12,18 @@
 // MARK: Platform specific OpenGl includes
 
 #if __ANDROID__
-    #include <GLES3/gl3.h>
+    // API level 21 and up ship ES 3.1, compute is used when the context has it
+    #include <GLES3/gl31.h>
+    #define ZTR_GL_COMPUTE 1
 
 #elif __EMSCRIPTEN__
     #include <GLES3/gl3.h>
 
+#elif __linux__
+    // Headless EGL, Mesa gives ES 3.1 even without a GPU
+    #include <GLES3/gl31.h>
+    #define ZTR_GL_COMPUTE 1
+
 #elif __APPLE__
     #include "TargetConditionals.h"
 
@@ -77,18 +84,71 @@ typedef struct ztr_file_t
 
 } ztr_file_t;
 
+// A frame read back by ztrCapture, RGBA with 8 bits per channel. Rows run
+// from the top of the image down, stride bytes apart, and the stride is
+// negative since GL keeps them bottom up
+typedef struct ztr_capture_t
+{
+    const unsigned char *pixels;
+    int width;
+    int height;
+    int stride;
+
+    // Given to ztrCapture
+    unsigned int tag;
+
+    // Readback slot the pixels are mapped from
+    int slot;
+
+} ztr_capture_t;
+
+// One copy of a mesh for ztrSetInstances. The transform is column major and
+// applied after the mesh's own, the color is RGBA with straight alpha
+typedef struct ztr_instance_t
+{
+    float model[16];
+    float color[4];
+
+} ztr_instance_t;
+
 
 // MARK: Platform call functions
 
 #define PLATFORM_OPEN_FILE(name) ztr_file_t name(const char *fileName)
 typedef PLATFORM_OPEN_FILE(platform_open_file);
 
+// Gives back a file from openFile once the layer is done with its data
+#define PLATFORM_CLOSE_FILE(name) void name(ztr_file_t *file)
+typedef PLATFORM_CLOSE_FILE(platform_close_file);
+
+// Files in the app's writable cache directory, the data of a read file is
+// allocated with malloc and freed by the caller. Writes return 0 on failure
+#define PLATFORM_READ_CACHE_FILE(name) ztr_file_t name(const char *fileName)
+typedef PLATFORM_READ_CACHE_FILE(platform_read_cache_file);
+
+#define PLATFORM_WRITE_CACHE_FILE(name) int name(const char *fileName, const void *data, unsigned int dataSize)
+typedef PLATFORM_WRITE_CACHE_FILE(platform_write_cache_file);
+
+// Seconds of a monotonic high resolution clock, the origin is arbitrary
+#define PLATFORM_GET_TIME(name) double name(void)
+typedef PLATFORM_GET_TIME(platform_get_time);
+
 // MARK: Platform call API
 
 typedef struct ztr_platform_api_t
 {
     platform_open_file *openFile;
 
+    // Optional, opened meshes stay in memory without it
+    platform_close_file *closeFile;
+
+    // Optional, the program binary cache stays off without them
+    platform_read_cache_file *readCacheFile;
+    platform_write_cache_file *writeCacheFile;
+
+    // Optional, without it every ztrDraw advances one fixed step of 1/60 s
+    platform_get_time *getTime;
+
 } ztr_platform_api_t;
 
 
@@ -97,15 +157,75 @@ typedef struct ztr_platform_api_t
 #define ZTR_INIT(name) void name(ztr_platform_api_t *platform)
 ZTR_INIT(ztrInit);
 
-#define ZTR_DRAW(name) void name(ztr_mem_t *mem, ztr_hid_t hid)
+// Flags returned by ztrDraw. Without ZTR_FRAME_DRAWN nothing changed and
+// the framebuffer was not touched, the platform can skip the swap. Without
+// ZTR_FRAME_ANIMATING the scene only changes on input or resize, so the
+// display link can be paused until then
+#define ZTR_FRAME_DRAWN (1 << 0)
+#define ZTR_FRAME_ANIMATING (1 << 1)
+
+#define ZTR_DRAW(name) int name(ztr_mem_t *mem, ztr_hid_t hid)
 ZTR_DRAW(ztrDraw);
 
-#define ZTR_LOAD(name) void name(ztr_platform_api_t *platform, char *leftPath, char *rightPath)
+// The next ztrDraw draws even if nothing changed, for platforms that swap
+// after every draw or lost the contents of their framebuffer
+#define ZTR_INVALIDATE(name) void name(void)
+ZTR_INVALIDATE(ztrInvalidate);
+
+// Replaces the meshes of the scene with the scans at the paths, which are
+// opened with openFile. rightPath may be NULL. Returns 0 when a scan could
+// not be read, the scene is then empty
+#define ZTR_LOAD(name) int name(ztr_platform_api_t *platform, const char *leftPath, const char *rightPath)
 ZTR_LOAD(ztrLoad);
 
+// Puts the camera at yaw and pitch in degrees with the given orthographic
+// scale, clamped to the ranges the viewer allows. Animations and inertia
+// stop, so the next ztrDraw draws exactly this pose at full resolution
+#define ZTR_SET_CAMERA(name) void name(float yaw, float pitch, float orthScale)
+ZTR_SET_CAMERA(ztrSetCamera);
+
+// Draws the mesh at index mesh, in load order, once per instance with a
+// single draw call. The instances are copied, a count of 0 goes back to
+// one plain copy. Any alpha below 1 draws the whole set translucent. Loading
+// new scans drops the instances. Returns 0 when there is no such mesh
+#define ZTR_SET_INSTANCES(name) int name(int mesh, const ztr_instance_t *instances, unsigned int count)
+ZTR_SET_INSTANCES(ztrSetInstances);
+
+// Draws iso-lines of dot (axis, position) on the meshes, spacing apart and
+// shifted by offset, in model units, width pixels wide in an RGB color.
+// axis and color may be NULL to keep the current ones. A spacing of 0 turns
+// the lines off
+#define ZTR_SET_CONTOUR(name) void name(const float *axis, float spacing, float offset, float width, const float *color)
+ZTR_SET_CONTOUR(ztrSetContour);
+
+// Draws the footprint of each mesh on the ground under it, the outline, a
+// filled convex hull and the main axis with the width across it. Footprints
+// are measured when scans load, so enabling also measures the scans loaded
+// from then on, the ones already loaded show nothing until loaded again
+#define ZTR_SET_FOOTPRINT_OVERLAY(name) void name(int enabled)
+ZTR_SET_FOOTPRINT_OVERLAY(ztrSetFootprintOverlay);
+
 #define ZTR_RESIZE(name) void name(ztr_platform_api_t *platform, int w, int h)
 ZTR_RESIZE(ztrResize);
 
+// Starts reading back the frame the last ztrDraw drew without waiting for
+// the GPU. Call it before presenting, a swapped back buffer has lost its
+// contents. Returns 0 when every readback slot is still pending or held
+#define ZTR_CAPTURE(name) int name(unsigned int tag)
+ZTR_CAPTURE(ztrCapture);
+
+// Hands out the oldest pending capture once its pixels have arrived. With
+// wait it blocks until then, otherwise it returns 0 while the GPU is still
+// copying. Returns 0 when nothing is pending. The pixels stay valid, also
+// on other threads, until the capture is released
+#define ZTR_FINISH_CAPTURE(name) int name(ztr_capture_t *capture, int wait)
+ZTR_FINISH_CAPTURE(ztrFinishCapture);
+
+// Gives the slot back, on the thread of the context. Every capture is
+// released before ztrFree
+#define ZTR_RELEASE_CAPTURE(name) void name(ztr_capture_t *capture)
+ZTR_RELEASE_CAPTURE(ztrReleaseCapture);
+
 #define ZTR_FREE(name) void name(void)
 ZTR_FREE(ztrFree);
 
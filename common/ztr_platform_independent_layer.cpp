@@ -26,11 +26,50 @@
 #define TINYOBJ_LOADER_C_IMPLEMENTATION
 #include "tinyobj_loader_c.h"
 
+// MARK: Mesh processing includes
+
+#include "ztr_parallel.cpp"
+#include "ztr_scan_mesh.cpp"
+#include "ztr_mesh_smoothing.cpp"
+#include "ztr_mesh_holes.cpp"
+#include "ztr_mesh_sdf.cpp"
+#include "ztr_footprint.cpp"
+
+// MARK: Renderer includes
+
+#include "ztr_render_queue.cpp"
+#include "ztr_frustum_cull.cpp"
+#include "ztr_occlusion_cull.cpp"
+#include "ztr_mesh_clusters.cpp"
+
 // MARK: Constants
 
 #define MAX_SHADERS (1 << 4)
 #define MAX_MESHES (1 << 6)
 
+#define SHADER_PREFIX_SIZE (1 << 9)
+
+#define OBJECT_VERTEX_SHADER "shaders/object_vert.glsl"
+#define OBJECT_FRAGMENT_SHADER "shaders/object_frag.glsl"
+#define OVERLAY_VERTEX_SHADER "shaders/overlay_vert.glsl"
+#define OVERLAY_FRAGMENT_SHADER "shaders/overlay_frag.glsl"
+
+// Vertex attribute locations, a mat4 takes four consecutive slots
+#define ATTRIB_POSITION 0
+#define ATTRIB_NORMAL 1
+#define ATTRIB_INSTANCE_MODEL 2
+#define ATTRIB_INSTANCE_COLOR 6
+
+// Uniform block binding points, shared by every program
+#define UBO_BINDING_FRAME 0
+#define UBO_BINDING_MESH 1
+
+// Frames recorded ahead of the GPU, buffers written every frame hold one
+// slice per frame, see ztr_frame_ring.cpp
+#define FRAMES_IN_FLIGHT 3
+
+#define RENDER_STATS_INTERVAL 600
+
 #define CAM_PITCH_MIN 15.f
 #define CAM_PITCH_MAX 88.f
 #define CAM_LOOKAT_CENTER (HMM_Vec3 (0.f, 0.45f, 0.f))
@@ -56,14 +95,96 @@
 
 #define SCENE_ANIMATION_STEP 0.007f
 
+// Animations, inertia and pinch zoom advance in fixed steps of this length,
+// the step sizes and decay factors above are per step
+#define SCENE_TICK (1.f/60.f)
+
+// Longer gaps, a stall or a paused display link, are not caught up
+#define SCENE_MAX_FRAME_TIME 0.25f
+
 #define MOUSE_SENSITIVITY 0.15f
 
+#define CONTOUR_SPACING_DEFAULT 0.01f
+#define CONTOUR_WIDTH_DEFAULT 1.5f
+#define CONTOUR_COLOR_DEFAULT (HMM_Vec3 (0.2f, 0.2f, 0.2f))
+
+// Footprint measurement overlay, lifted off the ground to stay in front of
+// the sole
+#define FOOTPRINT_OVERLAY_LIFT 0.002f
+#define FOOTPRINT_OVERLAY_OUTLINE_COLOR (HMM_Vec4 (0.2f, 0.2f, 0.2f, 1.f))
+#define FOOTPRINT_OVERLAY_HULL_COLOR (HMM_Vec4 (0.9f, 0.3f, 0.1f, 1.f))
+#define FOOTPRINT_OVERLAY_FILL_COLOR (HMM_Vec4 (0.9f, 0.3f, 0.1f, 0.25f))
+#define FOOTPRINT_OVERLAY_AXIS_COLOR (HMM_Vec4 (0.1f, 0.4f, 0.9f, 1.f))
+
 // MARK: Structs
 
 struct shader_t
 {
     GLuint program;
     GLenum elementType;
+
+    // Variant of a source pair, features the sources do not use are dropped
+    const char *vertexFileName;
+    const char *fragmentFileName;
+    unsigned int features;
+    unsigned long long key;
+
+    // Link issued and not checked yet, a variant that failed keeps program 0
+    int pending;
+    GLuint stages[2];
+
+    // Reflected once at link time
+    GLint objectColorLoc;
+    GLint lightColorLoc;
+    GLuint frameBlockIndex;
+    GLuint meshBlockIndex;
+};
+
+// std140 layout of FrameBlock in the object shaders
+struct frame_uniforms_t
+{
+    hmm_mat4 view;
+    hmm_mat4 projection;
+    hmm_vec4 lightPos;
+    hmm_vec4 cameraPos;
+
+    hmm_vec4 contourAxis;
+    hmm_vec4 contourParams;
+    hmm_vec4 contourColor;
+};
+
+// std140 layout of MeshBlock in the object shaders
+struct mesh_uniforms_t
+{
+    hmm_mat4 model;
+    hmm_mat4 rotate;
+};
+
+struct render_stats_t
+{
+    unsigned int glCalls;
+    unsigned int drawCalls;
+
+    // Binds and state changes issued and dropped by the state cache
+    unsigned int stateIssued;
+    unsigned int stateElided;
+
+    // Rejected by the frustum test before any draw was recorded
+    unsigned int meshesCulled;
+    unsigned int instancesCulled;
+
+    // Clusters dropped by the frustum and back face cone tests, triangles
+    // of everything culled so far
+    unsigned int clustersCulled;
+    unsigned int trianglesCulled;
+
+    // Hidden behind the last frame's visible set, and the triangles that
+    // were rasterized as occluders
+    unsigned int meshesOccluded;
+    unsigned int instancesOccluded;
+    unsigned int clustersOccluded;
+    unsigned int trianglesOccluded;
+    unsigned int occluderTriangles;
 };
 
 struct vertex_t
@@ -72,6 +193,13 @@ struct vertex_t
     hmm_vec3 normal;
 };
 
+// Per instance data, the transform is applied after the mesh model matrix
+struct instance_t
+{
+    hmm_mat4 model;
+    hmm_vec4 color;
+};
+
 struct tvertex_t
 {
     hmm_vec3 position;
@@ -95,18 +223,67 @@ struct mesh_t
     vertex_t *vertices;
     unsigned int verticesCount;
 
-    GLushort *indices;
+    GLuint *indices;
     unsigned int indicesCount;
 
     vertex_t *textures;
     unsigned int texturesCount;
 
-    // Rendering buffers
-    GLuint VAO, VBO, EBO;
+    // Vertex and index ranges in g_gpuArena
+    unsigned int allocation;
+
+    // Non instanced meshes draw only their visible clusters
+    mesh_clusters_t clusters;
 
     hmm_mat4 S, R, T;
     hmm_mat4 model;
     shader_t *shader;
+
+    // Model space bounds, the centre gives the sort depth. The sphere is
+    // xyz centre and w radius.
+    rec3_t bounds;
+    hmm_vec4 sphere;
+    render_pass_t pass;
+
+    // Drawn in the last frame, which makes it an occluder in this one
+    int drawn;
+
+    // Drawn with one instanced call when instanceCount > 0
+    instance_t *instances;
+    unsigned int instanceCount;
+    unsigned int instanceCapacity;
+    int instancesDirty;
+
+    // One buffer per frame in flight, instanceVBO is the one of the frame
+    // being recorded. A buffer that missed a change is uploaded again when
+    // its frame comes around
+    GLuint instanceVBOs[FRAMES_IN_FLIGHT];
+    GLsizeiptr instanceBufferSizes[FRAMES_IN_FLIGHT];
+    unsigned char instanceStale[FRAMES_IN_FLIGHT];
+    GLuint instanceVBO;
+
+    // Bounds of all instances in model space, the frustum result of the
+    // last upload and how many instances it left in the buffer
+    rec3_t instanceBounds;
+    unsigned char *instanceVisible;
+    unsigned int visibleInstanceCount;
+
+    // Distance queries against the mesh in model space
+    sdf_t sdf;
+
+    // Outline and hull on the ground plane for sizing
+    footprint_t footprint;
+};
+
+// Iso-lines on the object shader, see object_frag.glsl
+struct contour_t
+{
+    int enabled;
+    hmm_vec3 axis;
+    float spacing;
+    float offset;
+    float width;
+    hmm_vec3 color;
 };
 
 struct camera_t
@@ -124,6 +301,10 @@ struct camera_t
     float pitchAnimEnd;
     float pitchAnimAmount;
 
+    // Values at the start of the last fixed step, for interpolation
+    float prevPitch;
+    float prevYaw;
+    float prevOrthScale;
 };
 
 // Represents _internal_ input
@@ -142,6 +323,11 @@ struct scene_t
     int animatingIntroFade;
     int animatingResetCamera;
 
+    // Something besides the camera changed since the last drawn frame
+    int dirty;
+    hmm_vec3 drawnCamPos;
+    float drawnOrthScale;
+
     // Animation position
     float animT = 0.f;
     float animStep = 0.007f;
@@ -150,18 +336,64 @@ struct scene_t
     shader_t shaders[MAX_SHADERS];
     unsigned int shaderCount = 0;
     shader_t *objectShader;
+    const char *shadingVersionString;
 
     // Meshes
     mesh_t meshes[MAX_MESHES];
     int meshCount = 0;
 
+    // Load time mesh processing
+    smoothing_params_t smoothing;
+    hole_fill_params_t holeFilling;
+    sdf_params_t sdf;
+    footprint_params_t footprint;
+    cluster_params_t clusters;
+
+    // Height bands drawn by the object shader
+    contour_t contour;
+
+    // Footprint outline, hull and main axes drawn as overlay lines
+    int footprintOverlay;
+    shader_t *overlayShader;
+
+    // Draw packets of the current frame
+    render_queue_t renderQueue;
+
+    // Frustum culling scratch, instance arrays grow with the largest
+    // instanced mesh
+    cull_boxes_t meshBoxes;
+    unsigned char meshVisible[MAX_MESHES];
+    cull_spheres_t instanceSpheres;
+    unsigned char *instanceVisible;
+    instance_t *instanceStaging;
+    unsigned int instanceScratchCapacity;
+
+    // CPU depth pyramid of the occluders
+    occlusion_buffer_t occlusion;
+
+    // Uniform buffers with a slice per frame in flight, a frame block or
+    // MAX_MESHES mesh blocks
+    GLuint frameUBO;
+    GLuint meshUBO;
+    GLint frameUniformStride;
+    GLint meshUniformStride;
+    unsigned char *meshUniformStaging;
+
+    // Driver calls of the frame being recorded and of the last whole frame
+    render_stats_t frameStats;
+    render_stats_t lastFrameStats;
+    unsigned int frameIndex;
+
     // Platform values
     mouse_t mouse;
     hmm_vec2 screenDims;
 
-    // Frame timing
+    // Frame timing, in seconds of the platform clock
     double currentTime = 0;
     double lastTime = 0;
+
+    // Time not yet consumed by fixed steps
+    float tickTime = 0.f;
 };
 
 
@@ -184,6 +416,76 @@ static scene_t g_scene;
 ztr_platform_api_t *g_platform;
 
 
+// MARK: GL call counting
+
+// Entry points used every frame are counted in g_scene.frameStats
+#define GL_COUNTED(call) (g_scene.frameStats.glCalls++, call)
+
+#define glClear(...) GL_COUNTED (glClear (__VA_ARGS__))
+#define glClearColor(...) GL_COUNTED (glClearColor (__VA_ARGS__))
+#define glUseProgram(...) GL_COUNTED (glUseProgram (__VA_ARGS__))
+#define glGetUniformLocation(...) GL_COUNTED (glGetUniformLocation (__VA_ARGS__))
+#define glUniform1i(...) GL_COUNTED (glUniform1i (__VA_ARGS__))
+#define glUniform1f(...) GL_COUNTED (glUniform1f (__VA_ARGS__))
+#define glUniform3f(...) GL_COUNTED (glUniform3f (__VA_ARGS__))
+#define glUniformMatrix4fv(...) GL_COUNTED (glUniformMatrix4fv (__VA_ARGS__))
+#define glBindBuffer(...) GL_COUNTED (glBindBuffer (__VA_ARGS__))
+#define glBindBufferBase(...) GL_COUNTED (glBindBufferBase (__VA_ARGS__))
+#define glBindBufferRange(...) GL_COUNTED (glBindBufferRange (__VA_ARGS__))
+#define glBufferSubData(...) GL_COUNTED (glBufferSubData (__VA_ARGS__))
+#define glBindVertexArray(...) GL_COUNTED (glBindVertexArray (__VA_ARGS__))
+#define glDrawElements(...) \
+    (g_scene.frameStats.drawCalls++, GL_COUNTED (glDrawElements (__VA_ARGS__)))
+#define glDrawElementsInstanced(...) \
+    (g_scene.frameStats.drawCalls++, \
+     GL_COUNTED (glDrawElementsInstanced (__VA_ARGS__)))
+#define glBufferData(...) GL_COUNTED (glBufferData (__VA_ARGS__))
+#define glEnable(...) GL_COUNTED (glEnable (__VA_ARGS__))
+#define glDisable(...) GL_COUNTED (glDisable (__VA_ARGS__))
+#define glDepthFunc(...) GL_COUNTED (glDepthFunc (__VA_ARGS__))
+#define glDepthMask(...) GL_COUNTED (glDepthMask (__VA_ARGS__))
+#define glCullFace(...) GL_COUNTED (glCullFace (__VA_ARGS__))
+#define glBlendEquationSeparate(...) GL_COUNTED (glBlendEquationSeparate (__VA_ARGS__))
+#define glBlendFuncSeparate(...) GL_COUNTED (glBlendFuncSeparate (__VA_ARGS__))
+#define glActiveTexture(...) GL_COUNTED (glActiveTexture (__VA_ARGS__))
+#define glBindTexture(...) GL_COUNTED (glBindTexture (__VA_ARGS__))
+#define glVertexAttribPointer(...) GL_COUNTED (glVertexAttribPointer (__VA_ARGS__))
+#define glCopyBufferSubData(...) GL_COUNTED (glCopyBufferSubData (__VA_ARGS__))
+#define glDrawArrays(...) \
+    (g_scene.frameStats.drawCalls++, GL_COUNTED (glDrawArrays (__VA_ARGS__)))
+#define glViewport(...) GL_COUNTED (glViewport (__VA_ARGS__))
+#define glBindFramebuffer(...) GL_COUNTED (glBindFramebuffer (__VA_ARGS__))
+#define glBlitFramebuffer(...) GL_COUNTED (glBlitFramebuffer (__VA_ARGS__))
+#define glBeginQuery(...) GL_COUNTED (glBeginQuery (__VA_ARGS__))
+#define glEndQuery(...) GL_COUNTED (glEndQuery (__VA_ARGS__))
+#define glGetQueryObjectuiv(...) GL_COUNTED (glGetQueryObjectuiv (__VA_ARGS__))
+#define glFenceSync(...) GL_COUNTED (glFenceSync (__VA_ARGS__))
+#define glClientWaitSync(...) GL_COUNTED (glClientWaitSync (__VA_ARGS__))
+#define glDeleteSync(...) GL_COUNTED (glDeleteSync (__VA_ARGS__))
+#define glMapBufferRange(...) GL_COUNTED (glMapBufferRange (__VA_ARGS__))
+#define glUnmapBuffer(...) GL_COUNTED (glUnmapBuffer (__VA_ARGS__))
+#ifdef ZTR_GL_COMPUTE
+#define glUniform1ui(...) GL_COUNTED (glUniform1ui (__VA_ARGS__))
+#define glDispatchCompute(...) GL_COUNTED (glDispatchCompute (__VA_ARGS__))
+#define glMemoryBarrier(...) GL_COUNTED (glMemoryBarrier (__VA_ARGS__))
+#define glDrawElementsIndirect(...) \
+    (g_scene.frameStats.drawCalls++, \
+     GL_COUNTED (glDrawElementsIndirect (__VA_ARGS__)))
+#endif
+
+
+// The state cache issues its calls through the macros above
+#include "ztr_gl_state.cpp"
+#include "ztr_frame_ring.cpp"
+#include "ztr_gpu_arena.cpp"
+#include "ztr_gpu_cull.cpp"
+#include "ztr_program_cache.cpp"
+#include "ztr_shader_variants.cpp"
+#include "ztr_dynamic_resolution.cpp"
+#include "ztr_overlay.cpp"
+#include "ztr_capture.cpp"
+
+
 // MARK: Utility Functions
 
 inline void
@@ -201,6 +503,21 @@ InitCam (camera_t *cam)
 
     cam->pitchAnimEnd = CAM_PITCH_DEFAULT;
     cam->pitchAnimAmount = CAM_PITCH_ANIM_AMOUNT_DEFAULT;
+
+    cam->prevPitch = cam->pitch;
+    cam->prevYaw = cam->yaw;
+    cam->prevOrthScale = cam->orthScale;
+}
+
+inline void
+InitContour (contour_t *contour)
+{
+    contour->enabled = 0;
+    contour->axis = CAM_LOOKAT_UP;
+    contour->spacing = CONTOUR_SPACING_DEFAULT;
+    contour->offset = 0.f;
+    contour->width = CONTOUR_WIDTH_DEFAULT;
+    contour->color = CONTOUR_COLOR_DEFAULT;
 }
 
 inline void
@@ -209,6 +526,14 @@ InitScene (scene_t *scene)
     scene->animT = 0.f;
     scene->animStep = SCENE_ANIMATION_STEP;
     scene->animatingIntroFade = 0;
+
+    InitSmoothingParams (&scene->smoothing);
+    InitHoleFillParams (&scene->holeFilling);
+    InitSdfParams (&scene->sdf);
+    InitFootprintParams (&scene->footprint);
+    InitClusterParams (&scene->clusters);
+    InitContour (&scene->contour);
+    scene->footprintOverlay = 0;
 }
 
 inline void
@@ -251,6 +576,28 @@ Clamp (float x, float min, float max)
     return (res);
 }
 
+// Box enclosing the given one after m
+inline rec3_t
+TransformBounds (rec3_t bounds, hmm_mat4 m)
+{
+    hmm_vec3 center = (bounds.min + bounds.max)*0.5f;
+    hmm_vec3 extent = (bounds.max - bounds.min)*0.5f;
+
+    hmm_vec4 c = m*HMM_Vec4v (center, 1.f);
+    hmm_vec3 e;
+    for (int r=0 ; r<3 ; r++)
+    {
+        e.Elements[r] = fabsf (m.Elements[0][r])*extent.X +
+                        fabsf (m.Elements[1][r])*extent.Y +
+                        fabsf (m.Elements[2][r])*extent.Z;
+    }
+
+    rec3_t result;
+    result.min = c.XYZ - e;
+    result.max = c.XYZ + e;
+    return (result);
+}
+
 
 // t should be 0 to 1, returns curve value from B to C
 inline float
@@ -303,23 +650,38 @@ UpdateCamPos (camera_t *cam)
     cam->pos = HMM_NormalizeVec3 (dir)*cam->radius;
 }
 
-GLuint
-LoadShaders (shading_version_t shadingVersion,
-             char *vertexFileName, char *fragmentFileName)
+inline void
+SaveCamStep (camera_t *cam)
 {
-    // Create vertex and fragment shaders
-    GLuint vertexShaderID = glCreateShader (GL_VERTEX_SHADER);
-    GLuint fragmentShaderID = glCreateShader (GL_FRAGMENT_SHADER);
+    cam->prevPitch = cam->pitch;
+    cam->prevYaw = cam->yaw;
+    cam->prevOrthScale = cam->orthScale;
+}
 
-    ztr_file_t vertexShaderFile = g_platform->openFile (vertexFileName);
-    if (vertexShaderFile.data == NULL)
-        assert (!"Could not load vertex shader.\n");
+inline int
+CamStepSettled (camera_t *cam)
+{
+    return (cam->prevPitch == cam->pitch &&
+            cam->prevYaw == cam->yaw &&
+            cam->prevOrthScale == cam->orthScale);
+}
 
-    ztr_file_t fragmentShaderFile = g_platform->openFile (fragmentFileName);
-    if (fragmentShaderFile.data == NULL)
-        assert (!"Could not load fragment shader.\n");
+// Camera between the last two fixed steps, alpha 0 is the previous step
+inline camera_t
+InterpolateCam (camera_t *cam, float alpha)
+{
+    camera_t result = *cam;
+    result.pitch = HMM_Lerp (cam->prevPitch, alpha, cam->pitch);
+    result.yaw = HMM_Lerp (cam->prevYaw, alpha, cam->yaw);
+    result.orthScale = HMM_Lerp (cam->prevOrthScale, alpha, cam->orthScale);
+    UpdateCamPos (&result);
+    return (result);
+}
 
-    char *versionString = 0;
+inline const char *
+ShadingVersionString (shading_version_t shadingVersion)
+{
+    const char *versionString = 0;
 
     switch (shadingVersion)
     {
@@ -330,108 +692,270 @@ LoadShaders (shading_version_t shadingVersion,
 
         case ShadingLanguageVersion_GLES300:
             {
-                versionString = (char *) "#version 300 es\n";
+                versionString = "#version 300 es\n";
             } break;
 
         case ShadingLanguageVersion_GLES310:
             {
-                versionString = (char *) "#version 310 es\n";
+                versionString = "#version 310 es\n";
             } break;
 
         case ShadingLanguageVersion_GLES320:
             {
-                versionString = (char *) "#version 320 es\n";
+                versionString = "#version 320 es\n";
             } break;
 
         case ShadingLanguageVersion_GL410:
             {
-                versionString = (char *) "#version 410\n";
+                versionString = "#version 410\n";
             } break;
     }
 
-    int versionStringSize = (int) strlen (versionString);
+    return (versionString);
+}
 
-    int vertexShaderSourceSize =
-        vertexShaderFile.dataSize + versionStringSize;
-    char *vertexShaderSource = (char *) malloc (vertexShaderSourceSize + 1);
-    memcpy ((void *) vertexShaderSource,
-            (void *) versionString, versionStringSize);
-    memcpy ((void *) (vertexShaderSource + versionStringSize),
-            vertexShaderFile.data, vertexShaderFile.dataSize);
-    vertexShaderSource[vertexShaderSourceSize] = '\0';
+// Checks the link of a variant that was compiling, then reflects it and
+// sets the uniforms that stay constant
+static void
+FinishShader (shader_t *shader)
+{
+    GLuint programID = shader->program;
+    if (shader->pending)
+    {
+        shader->pending = 0;
+        if (!ShaderVariantLink (programID, shader->stages))
+        {
+            printf ("Could not link program : %s %s features 0x%x\n",
+                    shader->vertexFileName, shader->fragmentFileName,
+                    shader->features);
+            glDeleteProgram (programID);
+            shader->program = 0;
+            return;
+        }
+        ProgramCacheStore (&g_programCache, shader->key, programID);
+    }
 
-    int fragmentShaderSourceSize =
-        fragmentShaderFile.dataSize + versionStringSize;
-    char *fragmentShaderSource = (char *) malloc (fragmentShaderSourceSize + 1);
-    memcpy ((void *) fragmentShaderSource,
-            (void *) versionString, versionStringSize);
-    memcpy ((void *) (fragmentShaderSource + versionStringSize),
-            fragmentShaderFile.data, fragmentShaderFile.dataSize);
-    fragmentShaderSource[fragmentShaderSourceSize] = '\0';
+    // Locations and block bindings never change after linking
+    shader->program = programID;
+    shader->objectColorLoc = glGetUniformLocation (programID, "objectColor");
+    shader->lightColorLoc = glGetUniformLocation (programID, "lightColor");
 
-    GLint Result = GL_FALSE;
-    int infoLogLength;
+    shader->frameBlockIndex = glGetUniformBlockIndex (programID, "FrameBlock");
+    if (shader->frameBlockIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding (programID, shader->frameBlockIndex,
+                               UBO_BINDING_FRAME);
+    }
+
+    shader->meshBlockIndex = glGetUniformBlockIndex (programID, "MeshBlock");
+    if (shader->meshBlockIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding (programID, shader->meshBlockIndex,
+                               UBO_BINDING_MESH);
+    }
+
+    // 一回、シェーダーの色を設定する。インスタンス描画は色をインスタンスごとに持つ
+    GLStateUseProgram (&g_glState, programID);
+    glUniform3f (shader->objectColorLoc,
+                 255.f/255.99f, 174.f/255.99f, 82.f/255.99f);
+
+    // 照明の色を白に設定する
+    glUniform3f (shader->lightColorLoc, 1.0f, 1.0f, 1.0f);
+}
+
+// Returns the variant of a source pair for a feature mask, its compile is
+// started the first time it is asked for. Check ShaderReady before drawing
+static shader_t *
+RequestShader (scene_t *scene, const char *vertexFileName,
+               const char *fragmentFileName, unsigned int features)
+{
+    for (unsigned int i=0 ; i<scene->shaderCount ; i++)
+    {
+        shader_t *shader = scene->shaders + i;
+        if (shader->features == features &&
+            strcmp (shader->vertexFileName, vertexFileName) == 0 &&
+            strcmp (shader->fragmentFileName, fragmentFileName) == 0)
+        {
+            return (shader);
+        }
+    }
+
+    shader_variant_source_t source;
+    if (!ShaderVariantBuildSources (&source, scene->shadingVersionString,
+                                    vertexFileName, fragmentFileName, features))
+    {
+        assert (!"Could not load shader.\n");
+        return (NULL);
+    }
+
+    // Different masks can give the same source
+    for (unsigned int i=0 ; i<scene->shaderCount ; i++)
+    {
+        shader_t *shader = scene->shaders + i;
+        if (shader->key == source.key)
+        {
+            ShaderVariantFreeSources (&source);
+            return (shader);
+        }
+    }
+
+    assert (scene->shaderCount < MAX_SHADERS);
+    shader_t *shader = scene->shaders + scene->shaderCount++;
+    shader->elementType = GL_TRIANGLES;
+    shader->vertexFileName = vertexFileName;
+    shader->fragmentFileName = fragmentFileName;
+    shader->features = source.features;
+    shader->key = source.key;
+
+    shader->program = ProgramCacheLoad (&g_programCache, source.key);
+    if (shader->program != 0)
+    {
+        printf ("Loaded cached program : %s %s features 0x%x\n",
+                vertexFileName, fragmentFileName, shader->features);
+        shader->pending = 0;
+        FinishShader (shader);
+    }
+    else
+    {
+        printf ("Compiling program : %s %s features 0x%x\n",
+                vertexFileName, fragmentFileName, shader->features);
+        shader->program = ShaderVariantCompile (&source, shader->stages);
+        shader->pending = 1;
+    }
+
+    ShaderVariantFreeSources (&source);
+    return (shader);
+}
+
+// Never waits on a parallel compiler, a variant still compiling is skipped
+// for the frame
+inline int
+ShaderReady (shader_t *shader)
+{
+    if (shader->pending &&
+        ShaderVariantCompiled (&g_shaderCompiler, shader->program))
+    {
+        FinishShader (shader);
+    }
+    return (!shader->pending && shader->program != 0);
+}
 
-    // Compile Vertex Shader
-    printf ("Compiling shader : %s\n", vertexFileName);
-    glShaderSource (vertexShaderID, 1, (const GLchar **) &vertexShaderSource, NULL);
-    glCompileShader (vertexShaderID);
+inline int
+ShaderWait (shader_t *shader)
+{
+    if (shader->pending)
+    {
+        FinishShader (shader);
+    }
+    return (shader->program != 0);
+}
 
-    // Check Vertex Shader
-    glGetShaderiv (vertexShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv (vertexShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
+#ifdef ZTR_GL_COMPUTE
+// Compute programs need ES 3.1, returns 0 when compiling or linking fails
+static GLuint
+LoadComputeShader (shading_version_t shadingVersion, char *fileName)
+{
+    ztr_file_t file = g_platform->openFile (fileName);
+    if (file.data == NULL)
+    {
+        printf ("Could not load compute shader %s\n", fileName);
+        return (0);
+    }
 
-    if (infoLogLength > 0 ){
-        std::vector<char> vertexShaderErrorMessage (infoLogLength + 1);
-        glGetShaderInfoLog (vertexShaderID, infoLogLength,
-                            NULL, &vertexShaderErrorMessage[0]);
-        printf ("%s\n", &vertexShaderErrorMessage[0]);
+    const char *versionString = ShadingVersionString (shadingVersion);
+    int prefixSize = (int) strlen (versionString);
+    int sourceSize = file.dataSize + prefixSize;
+    char *source = (char *) malloc (sourceSize + 1);
+    memcpy (source, versionString, prefixSize);
+    memcpy (source + prefixSize, file.data, file.dataSize);
+    source[sourceSize] = '\0';
+
+    unsigned long long programKey =
+        ProgramCacheKey (&g_programCache, NULL, NULL, source);
+    GLuint programID = ProgramCacheLoad (&g_programCache, programKey);
+    if (programID != 0)
+    {
+        printf ("Loaded cached program : %s\n", fileName);
+        free (source);
+        return (programID);
     }
 
-    // Compile Fragment Shader
-    printf ("Compiling shader : %s\n", fragmentFileName);
-    glShaderSource (fragmentShaderID, 1, (const GLchar **)
-                    &fragmentShaderSource, NULL);
-    glCompileShader (fragmentShaderID);
+    GLint result = GL_FALSE;
+    int infoLogLength;
+
+    printf ("Compiling shader : %s\n", fileName);
+    GLuint shaderID = glCreateShader (GL_COMPUTE_SHADER);
+    glShaderSource (shaderID, 1, (const GLchar **) &source, NULL);
+    glCompileShader (shaderID);
+    free (source);
 
-    // Check Fragment Shader
-    glGetShaderiv (fragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv (fragmentShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
+    glGetShaderiv (shaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
     if (infoLogLength > 0)
     {
-        std::vector<char> fragmentShaderErrorMessage (infoLogLength + 1);
-        glGetShaderInfoLog (fragmentShaderID, infoLogLength,
-                            NULL, &fragmentShaderErrorMessage[0]);
-        printf ("%s\n", &fragmentShaderErrorMessage[0]);
+        std::vector<char> errorMessage (infoLogLength + 1);
+        glGetShaderInfoLog (shaderID, infoLogLength, NULL, &errorMessage[0]);
+        printf ("%s\n", &errorMessage[0]);
     }
 
-    // Link the program
     printf ("Linking program\n");
-    GLuint programID = glCreateProgram ();
-    glAttachShader (programID, vertexShaderID);
-    glAttachShader (programID, fragmentShaderID);
+    programID = glCreateProgram ();
+    glAttachShader (programID, shaderID);
+    glProgramParameteri (programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram (programID);
+    glDetachShader (programID, shaderID);
+    glDeleteShader (shaderID);
 
-    // Check the program
-    glGetProgramiv (programID, GL_LINK_STATUS, &Result);
+    glGetProgramiv (programID, GL_LINK_STATUS, &result);
     glGetProgramiv (programID, GL_INFO_LOG_LENGTH, &infoLogLength);
     if (infoLogLength > 0)
     {
-        std::vector<char> programErrorMessage (infoLogLength + 1);
-        glGetProgramInfoLog (programID, infoLogLength,
-                             NULL, &programErrorMessage[0]);
-        printf ("%s\n", &programErrorMessage[0]);
+        std::vector<char> errorMessage (infoLogLength + 1);
+        glGetProgramInfoLog (programID, infoLogLength, NULL, &errorMessage[0]);
+        printf ("%s\n", &errorMessage[0]);
+    }
+
+    if (result != GL_TRUE)
+    {
+        glDeleteProgram (programID);
+        programID = 0;
+    }
+    else
+    {
+        ProgramCacheStore (&g_programCache, programKey, programID);
     }
 
-    glDetachShader (programID, vertexShaderID);
-    glDetachShader (programID, fragmentShaderID);
-    glDeleteShader (vertexShaderID);
-    glDeleteShader (fragmentShaderID);
+    return (programID);
+}
+#endif
 
-    free ((void *) vertexShaderSource);
-    free ((void *) fragmentShaderSource);
+static void
+InitUniformBuffers (scene_t *scene)
+{
+    // Ranges bound with glBindBufferRange must start on this alignment
+    GLint alignment;
+    glGetIntegerv (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    scene->frameUniformStride =
+        FrameRingStride (sizeof (frame_uniforms_t), alignment);
+    scene->meshUniformStride =
+        FrameRingStride (sizeof (mesh_uniforms_t), alignment);
+
+    glGenBuffers (1, &scene->frameUBO);
+    GLStateBindBuffer (&g_glState, GL_UNIFORM_BUFFER, scene->frameUBO);
+    glBufferData (GL_UNIFORM_BUFFER,
+                  scene->frameUniformStride*FRAMES_IN_FLIGHT,
+                  NULL, GL_DYNAMIC_DRAW);
+
+    glGenBuffers (1, &scene->meshUBO);
+    GLStateBindBuffer (&g_glState, GL_UNIFORM_BUFFER, scene->meshUBO);
+    glBufferData (GL_UNIFORM_BUFFER,
+                  scene->meshUniformStride*MAX_MESHES*FRAMES_IN_FLIGHT,
+                  NULL, GL_DYNAMIC_DRAW);
+
+    GLStateBindBuffer (&g_glState, GL_UNIFORM_BUFFER, 0);
+    GL_CHECK_ERROR ();
 
-    return programID;
+    scene->meshUniformStaging =
+        (unsigned char *) malloc (scene->meshUniformStride*MAX_MESHES);
 }
 
 static mesh_t *
@@ -444,11 +968,11 @@ loadObj (const char *fileName)
     if (file.data != NULL)
     {
         // OBJ ファイル内容を読み込む
-        tinyobj_attrib_t attrib;
+        tinyobj_attrib_t attrib = {};
         tinyobj_shape_t* shapes = NULL;
-        size_t numShapes;
+        size_t numShapes = 0;
         tinyobj_material_t* materials = NULL;
-        size_t numMaterials;
+        size_t numMaterials = 0;
 
         unsigned int flags = 0;
 
@@ -465,374 +989,855 @@ loadObj (const char *fileName)
             printf ("A Tiny obj error occured.\n");
         }
 
+        // tinyobj は値をコピーするので、ファイルはもう要らない
+        if (g_platform->closeFile != NULL)
+        {
+            g_platform->closeFile (&file);
+        }
+        if (parseResult != TINYOBJ_SUCCESS)
+        {
+            tinyobj_attrib_free (&attrib);
+            return (NULL);
+        }
+
         assert (g_scene.meshCount < MAX_MESHES);
         mesh_t *mesh = g_scene.meshes + g_scene.meshCount++;
 
         mesh->indicesCount = 0;
-        mesh->indices =
-            (GLushort *) malloc (sizeof (GLushort)*attrib.num_faces);
-
         mesh->verticesCount = 0;
-        mesh->vertices =
-            (vertex_t *) malloc (sizeof (vertex_t)*attrib.num_faces);
 
-        // For now, we iterate every face and copy to a new vertex
-        for (int i=0 ; i<attrib.num_faces ;  i++)
+        mesh->sdf = {};
+        mesh->footprint = {};
+
+        if (g_scene.smoothing.mode != SmoothingMode_None ||
+            g_scene.holeFilling.enabled || g_scene.sdf.enabled ||
+            g_scene.footprint.enabled)
         {
-            tinyobj_vertex_index_t *sourceFace = attrib.faces + i;
+            // スキャンの穴を埋めて、ノイズを除去してから頂点を展開する
+            scan_mesh_t scan;
+            ScanMeshFromObj (&scan, &attrib);
+            ScanMeshBuildAdjacency (&scan);
+            if (attrib.num_normals == 0)
+            {
+                ScanMeshComputeNormals (&scan, scan.px, scan.py, scan.pz);
+            }
+
+            FillScanMeshHoles (&scan, &g_scene.holeFilling);
+            SmoothScanMesh (&scan, &g_scene.smoothing);
+
+            // 有効なら距離クエリ用の符号付き距離場を作る
+            BuildSdf (&mesh->sdf, &scan, &g_scene.sdf);
 
-            unsigned int destIndex = mesh->verticesCount;
-            vertex_t *destVertex = mesh->vertices + destIndex;
+            // 足裏の輪郭と凸包を計測用に取り出す
+            BuildFootprint (&mesh->footprint, &scan, &g_scene.footprint);
 
-            float *vertStart = attrib.vertices + sourceFace->v_idx*3;
-            destVertex->position =
-                HMM_Vec3 (vertStart[0], vertStart[1], vertStart[2]);
+            unsigned int cornerCount = scan.triangleCount*3;
+            mesh->indices =
+                (GLuint *) malloc (sizeof (GLuint)*cornerCount);
+            mesh->vertices =
+                (vertex_t *) malloc (sizeof (vertex_t)*cornerCount);
 
-            if (sourceFace->vn_idx != TINYOBJ_INVALID_INDEX)
+            for (unsigned int i=0 ; i<cornerCount ; i++)
             {
-                float *normStart = attrib.normals + sourceFace->vn_idx*3;
+                unsigned int v = scan.triangles[i];
+
+                vertex_t *destVertex = mesh->vertices + i;
+                destVertex->position =
+                    HMM_Vec3 (scan.px[v], scan.py[v], scan.pz[v]);
                 destVertex->normal =
-                    HMM_Vec3 (normStart[0], normStart[1], normStart[2]);
+                    HMM_Vec3 (scan.nx[v], scan.ny[v], scan.nz[v]);
+
+                mesh->indices[i] = (GLuint)i;
             }
 
-            mesh->indices[i] = (GLushort)i;
-            mesh->verticesCount++;
-            mesh->indicesCount++;
+            mesh->verticesCount = cornerCount;
+            mesh->indicesCount = cornerCount;
+
+            FreeScanMesh (&scan);
         }
+        else
+        {
+            mesh->indices =
+                (GLuint *) malloc (sizeof (GLuint)*attrib.num_faces);
+            mesh->vertices =
+                (vertex_t *) malloc (sizeof (vertex_t)*attrib.num_faces);
+
+            // For now, we iterate every face and copy to a new vertex
+            for (int i=0 ; i<attrib.num_faces ;  i++)
+            {
+                tinyobj_vertex_index_t *sourceFace = attrib.faces + i;
 
-        // VAO、VBO、EBO、を初期化する
-        glGenVertexArrays (1, &mesh->VAO);
-        glGenBuffers (1, &mesh->VBO);
-        glGenBuffers (1, &mesh->EBO);
+                unsigned int destIndex = mesh->verticesCount;
+                vertex_t *destVertex = mesh->vertices + destIndex;
 
-        // VAOを紐づけるとVBOとEBOを設定できる
-        glBindVertexArray (mesh->VAO);
+                float *vertStart = attrib.vertices + sourceFace->v_idx*3;
+                destVertex->position =
+                    HMM_Vec3 (vertStart[0], vertStart[1], vertStart[2]);
 
-        // VBOバファーメッシュのインデックスを割り当てる
-        glBindBuffer (GL_ARRAY_BUFFER, mesh->VBO);
-        glBufferData (GL_ARRAY_BUFFER,
-                      mesh->verticesCount*sizeof (vertex_t),
-                      mesh->vertices,
-                      GL_STATIC_DRAW);
+                if (sourceFace->vn_idx != TINYOBJ_INVALID_INDEX)
+                {
+                    float *normStart = attrib.normals + sourceFace->vn_idx*3;
+                    destVertex->normal =
+                        HMM_Vec3 (normStart[0], normStart[1], normStart[2]);
+                }
 
-        // EBOバファーメッシュのインデックスを割り当てる
-        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
-        glBufferData (GL_ELEMENT_ARRAY_BUFFER,
-                      mesh->indicesCount*sizeof (GLushort),
-                      mesh->indices,
-                      GL_STATIC_DRAW);
+                mesh->indices[i] = (GLuint)i;
+                mesh->verticesCount++;
+                mesh->indicesCount++;
+            }
+        }
 
-        // メモリ上の頂点構造体(vertex_t)のポジションの位置を指定する
-        glEnableVertexAttribArray (0);
-        glVertexAttribPointer (0,3, GL_FLOAT, GL_FALSE, sizeof (vertex_t),
-                               (GLvoid *) offsetof (vertex_t, position));
+        tinyobj_attrib_free (&attrib);
+        tinyobj_shapes_free (shapes, numShapes);
+        tinyobj_materials_free (materials, numMaterials);
 
-        // メモリ上の頂点構造体(vertex_t)のノーマルの位置を指定する
-        glEnableVertexAttribArray (1);
-        glVertexAttribPointer (1, 3, GL_FLOAT, GL_FALSE, sizeof (vertex_t),
-                               (GLvoid *) offsetof (vertex_t, normal));
+        // ソート用にモデル空間のバウンディングボックスを求める
+        mesh->bounds.min = HMM_Vec3 (FLT_MAX, FLT_MAX, FLT_MAX);
+        mesh->bounds.max = HMM_Vec3 (-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (unsigned int i=0 ; i<mesh->verticesCount ; i++)
+        {
+            hmm_vec3 p = mesh->vertices[i].position;
+            mesh->bounds.min = HMM_Vec3 (HMM_MIN (mesh->bounds.min.X, p.X),
+                                         HMM_MIN (mesh->bounds.min.Y, p.Y),
+                                         HMM_MIN (mesh->bounds.min.Z, p.Z));
+            mesh->bounds.max = HMM_Vec3 (HMM_MAX (mesh->bounds.max.X, p.X),
+                                         HMM_MAX (mesh->bounds.max.Y, p.Y),
+                                         HMM_MAX (mesh->bounds.max.Z, p.Z));
+        }
 
-        // glBindVertexArray に0を指定するとVAOを解放す
-        glBindVertexArray (0);
+        // 視錐台カリング用の境界球、中心はボックスの中心にする
+        hmm_vec3 center = (mesh->bounds.min + mesh->bounds.max)*0.5f;
+        float radiusSquared = 0.f;
+        for (unsigned int i=0 ; i<mesh->verticesCount ; i++)
+        {
+            hmm_vec3 d = mesh->vertices[i].position - center;
+            radiusSquared = HMM_MAX (radiusSquared, HMM_DotVec3 (d, d));
+        }
+        mesh->sphere = HMM_Vec4v (center, HMM_SquareRootF (radiusSquared));
+        mesh->pass = RenderPass_Opaque;
+        mesh->drawn = 0;
+
+        mesh->instances = NULL;
+        mesh->instanceCount = 0;
+        mesh->instanceCapacity = 0;
+        mesh->instancesDirty = 0;
+        for (int f=0 ; f<FRAMES_IN_FLIGHT ; f++)
+        {
+            mesh->instanceVBOs[f] = 0;
+            mesh->instanceBufferSizes[f] = 0;
+            mesh->instanceStale[f] = 0;
+        }
+        mesh->instanceVBO = 0;
+        mesh->instanceBounds = mesh->bounds;
+        mesh->instanceVisible = NULL;
+        mesh->visibleInstanceCount = 0;
+
+        // 三角形をクラスターごとに並べ替える
+        BuildMeshClusters (&mesh->clusters, &g_scene.clusters,
+                           &mesh->vertices[0].position.X,
+                           sizeof (vertex_t)/sizeof (float),
+                           mesh->indices, mesh->indicesCount);
+
+        // 頂点とインデックスを共有のGPUアリーナに書き込む
+        mesh->allocation = GpuArenaUpload (&g_gpuArena,
+                                           mesh->vertices, mesh->verticesCount,
+                                           mesh->indices, mesh->indicesCount);
+
+        // 見えるクラスターのインデックスを毎フレーム詰める領域
+        if (mesh->clusters.count > 0)
+        {
+            GpuArenaReserveStream (&g_gpuArena, mesh->allocation);
+        }
 
+        g_scene.dirty = 1;
         result = mesh;
     }
 
     return (result);
 }
 
-inline shading_version_t
-findShadingVersion (char *glShadingVersionString)
+static void
+FreeMesh (mesh_t *mesh)
 {
-    shading_version_t result = ShadingLanguageVersion_None;
-
-    if (strstr (glShadingVersionString, "3.00") != NULL)
+    if (mesh->indices)
     {
-        result = ShadingLanguageVersion_GLES300;
+        free (mesh->indices);
+        mesh->indices = NULL;
     }
-    else if (strstr (glShadingVersionString, "3.10") != NULL)
+    if (mesh->vertices)
     {
-        result = ShadingLanguageVersion_GLES310;
+        free (mesh->vertices);
+        mesh->vertices = NULL;
     }
-    else if (strstr (glShadingVersionString, "3.20") != NULL)
+
+    FreeSdf (&mesh->sdf);
+    FreeFootprint (&mesh->footprint);
+    FreeMeshClusters (&mesh->clusters);
+
+    GpuArenaRelease (&g_gpuArena, mesh->allocation);
+    mesh->allocation = GPU_ARENA_INVALID;
+
+    free (mesh->instances);
+    free (mesh->instanceVisible);
+    mesh->instances = NULL;
+    mesh->instanceVisible = NULL;
+    mesh->instanceCount = 0;
+    mesh->instanceCapacity = 0;
+
+    for (int f=0 ; f<FRAMES_IN_FLIGHT ; f++)
     {
-        result = ShadingLanguageVersion_GLES320;
+        if (mesh->instanceVBOs[f] != 0)
+        {
+            // A new buffer may get the same name, the VAO must not skip it
+            if (g_gpuArena.instancedSource == mesh->instanceVBOs[f])
+            {
+                g_gpuArena.instancedSource = 0;
+            }
+            GLStateForgetBuffer (&g_glState, mesh->instanceVBOs[f]);
+            glDeleteBuffers (1, &mesh->instanceVBOs[f]);
+            mesh->instanceVBOs[f] = 0;
+        }
     }
-    else if (strstr (glShadingVersionString, "4.10") != NULL)
+    mesh->instanceVBO = 0;
+}
+
+// Replaces the instances of a mesh, they are uploaded on the next draw. The
+// mesh switches to the instanced shader, a count of 0 goes back to a
+// single plain draw. A set with any translucent color is drawn in the
+// blended pass, after the opaque meshes and without writing depth.
+static void
+SetMeshInstances (mesh_t *mesh, instance_t *instances, unsigned int count)
+{
+    if (count > mesh->instanceCapacity)
     {
-        result = ShadingLanguageVersion_GL410;
+        mesh->instances =
+            (instance_t *) realloc (mesh->instances, sizeof (instance_t)*count);
+        mesh->instanceVisible =
+            (unsigned char *) realloc (mesh->instanceVisible, count);
+        mesh->instanceCapacity = count;
+    }
+
+    memcpy (mesh->instances, instances, sizeof (instance_t)*count);
+    memset (mesh->instanceVisible, 1, count);
+    mesh->instanceCount = count;
+    mesh->instancesDirty = 1;
+    g_scene.dirty = 1;
+
+    // The whole group is culled with one box before testing instances
+    if (count > 0)
+    {
+        mesh->instanceBounds = TransformBounds (mesh->bounds, instances[0].model);
+        for (unsigned int i=1 ; i<count ; i++)
+        {
+            rec3_t b = TransformBounds (mesh->bounds, instances[i].model);
+            mesh->instanceBounds.min =
+                HMM_Vec3 (HMM_MIN (mesh->instanceBounds.min.X, b.min.X),
+                          HMM_MIN (mesh->instanceBounds.min.Y, b.min.Y),
+                          HMM_MIN (mesh->instanceBounds.min.Z, b.min.Z));
+            mesh->instanceBounds.max =
+                HMM_Vec3 (HMM_MAX (mesh->instanceBounds.max.X, b.max.X),
+                          HMM_MAX (mesh->instanceBounds.max.Y, b.max.Y),
+                          HMM_MAX (mesh->instanceBounds.max.Z, b.max.Z));
+        }
     }
     else
     {
-        assert (!"Unsupported shading language.");
+        mesh->instanceBounds = mesh->bounds;
     }
 
-    return (result);
-}
+    mesh->pass = RenderPass_Opaque;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        if (instances[i].color.W < 1.f)
+        {
+            mesh->pass = RenderPass_Blended;
+            break;
+        }
+    }
 
-// MARK: Platform independent functions
+    // インスタンス描画のバリアントは最初に使う時にコンパイルを始める
+    mesh->shader = RequestShader (&g_scene, OBJECT_VERTEX_SHADER,
+                                  OBJECT_FRAGMENT_SHADER,
+                                  (count > 0) ? ShaderFeature_Instanced : 0);
+}
 
-ZTR_INIT (ztrInit)
+static void
+UploadMeshInstances (mesh_t *mesh, unsigned int frame)
 {
-    // プラットフォームAPIのポインターを保存する
-    g_platform = platform;
-    g_scene.shaderCount = 0;
+    // 属性はアリーナのインスタンス用VAOが描画時に指す
+    if (mesh->instanceVBOs[frame] == 0)
+    {
+        glGenBuffers (1, &mesh->instanceVBOs[frame]);
+    }
 
-    // ここでプラットフォームに依存しない初期化コードを書く
-    glGetString (GL_VERSION);
+    // 視錐台の中のインスタンスだけを詰めて送る
+    instance_t *staging = g_scene.instanceStaging;
+    unsigned int visibleCount = 0;
+    for (unsigned int i=0 ; i<mesh->instanceCount ; i++)
+    {
+        if (mesh->instanceVisible[i])
+        {
+            staging[visibleCount++] = mesh->instances[i];
+        }
+    }
+    mesh->visibleInstanceCount = visibleCount;
 
-    GLint major, minor;
-    glGetIntegerv (GL_MAJOR_VERSION, &major);
-    glGetIntegerv (GL_MINOR_VERSION, &minor);
-    printf ("GL version major: %d minor: %d\n", major, minor);
+    // Grows by reallocating, the GPU is done with this frame's buffer so
+    // same size updates are written in place without waiting
+    GLsizeiptr size = sizeof (instance_t)*visibleCount;
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, mesh->instanceVBOs[frame]);
+    if (size > mesh->instanceBufferSizes[frame])
+    {
+        glBufferData (GL_ARRAY_BUFFER, size, staging, GL_DYNAMIC_DRAW);
+        mesh->instanceBufferSizes[frame] = size;
+    }
+    else if (size > 0)
+    {
+        FrameRingWrite (GL_ARRAY_BUFFER, 0, size, staging);
+    }
+    GL_CHECK_ERROR ();
 
-    char *shadingVersionString =
-        (char *)glGetString (GL_SHADING_LANGUAGE_VERSION);
-    printf ("GL shading language version: %s\n", shadingVersionString);
-    shading_version_t shadingVersion =
-        findShadingVersion (shadingVersionString);
+    mesh->instanceStale[frame] = 0;
+}
 
-    assert (shadingVersion != ShadingLanguageVersion_None);
+// Tests every instance sphere against the frustum, and the boxes of those
+// inside against occlusion when it is not NULL. Marks the instance buffer
+// dirty when the visible set changed. Returns the number culled by the
+// frustum.
+static unsigned int
+CullMeshInstances (mesh_t *mesh, frustum_t *frustum,
+                   occlusion_buffer_t *occlusion)
+{
+    unsigned int count = mesh->instanceCount;
+    if (count > g_scene.instanceScratchCapacity)
+    {
+        g_scene.instanceVisible =
+            (unsigned char *) realloc (g_scene.instanceVisible, count);
+        g_scene.instanceStaging = (instance_t *)
+            realloc (g_scene.instanceStaging, sizeof (instance_t)*count);
+        g_scene.instanceScratchCapacity = count;
+    }
 
-    // OpenGL ESを設定する
-    GLint m_viewport[4];
-    glGetIntegerv (GL_VIEWPORT, m_viewport);
-    glEnable (GL_CULL_FACE);
-    glEnable (GL_BLEND);
-    glEnable (GL_DEPTH_TEST);
-    glDepthFunc (GL_LESS);
-    glBlendEquationSeparate (GL_FUNC_ADD, GL_FUNC_ADD);
-    glBlendFuncSeparate (GL_ONE, GL_ONE_MINUS_SRC_ALPHA,
-                         GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-    // シェーダープログラムをテキストファイルから読み込む
-    assert (g_scene.shaderCount < MAX_SHADERS);
-    g_scene.objectShader = g_scene.shaders + g_scene.shaderCount++;
-    g_scene.objectShader->program =
-        LoadShaders (shadingVersion,
-                     (char *) "shaders/object_vert.glsl",
-                     (char *) "shaders/object_frag.glsl");
-    g_scene.objectShader->elementType = GL_TRIANGLES;
-    glUseProgram (g_scene.objectShader->program);
-
-    // 一回、シェーダーの色を設定する
-    GLint objectColorLoc =
-        glGetUniformLocation (g_scene.objectShader->program, "objectColor");
-    glUniform3f (objectColorLoc, 255.f/255.99f, 174.f/255.99f, 82.f/255.99f);
-    GL_CHECK_ERROR ();
+    cull_spheres_t *spheres = &g_scene.instanceSpheres;
+    CullSpheresReset (spheres, count);
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        CullSpheresPush (spheres, mesh->model*mesh->instances[i].model,
+                         mesh->sphere.XYZ, mesh->sphere.W);
+    }
 
-    // 照明の色を白に設定する
-    GLint lightColorLoc =
-        glGetUniformLocation (g_scene.objectShader->program, "lightColor");
-    glUniform3f (lightColorLoc, 1.0f, 1.0f, 1.0f);
-    GL_CHECK_ERROR ();
+    unsigned char *visible = g_scene.instanceVisible;
+    unsigned int visibleCount = FrustumCullSpheres (frustum, spheres, visible);
 
-    hmm_vec3 lightPos = HMM_Vec3 (0.2,0,0.3);
-    GLint lightPosLoc =
-        glGetUniformLocation (g_scene.objectShader->program, "lightPos");
-    glUniform3f (lightPosLoc, lightPos.X, lightPos.Y, lightPos.Z);
-    GL_CHECK_ERROR ();
+    if (occlusion)
+    {
+        hmm_vec3 center = (mesh->bounds.min + mesh->bounds.max)*0.5f;
+        hmm_vec3 extent = (mesh->bounds.max - mesh->bounds.min)*0.5f;
+        unsigned int occluded = 0;
+        for (unsigned int i=0 ; i<count ; i++)
+        {
+            if (visible[i] &&
+                !OcclusionTestBox (occlusion, mesh->model*mesh->instances[i].model,
+                                   center, extent))
+            {
+                visible[i] = 0;
+                occluded++;
+            }
+        }
+        g_scene.frameStats.instancesOccluded += occluded;
+        g_scene.frameStats.trianglesOccluded += occluded*(mesh->indicesCount/3);
+    }
 
-    // すべての構造体の初期値を設定する関数を呼び出す
-    InitScene (&g_scene);
-    InitCam (&g_scene.camera);
-    InitMouse (&g_scene.mouse);
+    if (memcmp (visible, mesh->instanceVisible, count) != 0)
+    {
+        memcpy (mesh->instanceVisible, visible, count);
+        mesh->instancesDirty = 1;
+    }
 
-    // Stanford Bunny メッシュを読み込む
-    // loadObj 関数はメッシュのVAO、VBO、EBO、バッファを初期化する
-    // GPU上に頂点とインデックスのデータを保存する領域を確保している
-    mesh_t *bunnyMesh = loadObj ("bunny_vn.obj");
-    float S = 1.f;
-    bunnyMesh->S = HMM_Scale (HMM_Vec3 (S, S, S));
-    bunnyMesh->R = HMM_Rotate (0.f, HMM_Vec3 (1,0,0));
-    bunnyMesh->T = HMM_Translate (HMM_Vec3 (0,0,0));
-    bunnyMesh->shader = g_scene.objectShader;
+    g_scene.frameStats.trianglesCulled +=
+        (count - visibleCount)*(mesh->indicesCount/3);
 
-    g_scene.ready = 1;
-    g_scene.animatingIntroFade = 1;
+    return (count - visibleCount);
 }
 
-ZTR_FREE (ztrFree)
+// Culls the clusters of a mesh with the orthographic camera looking along
+// forward and rewrites its index stream slice for this frame when the
+// visible set changed or the slice is behind.
+// Returns false when nothing is left to draw.
+static int
+CullMeshDrawClusters (mesh_t *mesh, frustum_t *frustum, hmm_vec3 forward,
+                      occlusion_buffer_t *occlusion)
 {
-    if (g_scene.ready)
+    mesh_clusters_t *clusters = &mesh->clusters;
+    frustum_t local = FrustumToLocal (frustum, mesh->model);
+
+    hmm_vec3 localForward;
+    int uniform = ClusterLocalForward (mesh->model, forward, &localForward);
+
+    unsigned int visible =
+        CullMeshClusters (clusters, &local, uniform ? &localForward : NULL,
+                          occlusion, mesh->model);
+
+    if (clusters->dirty)
     {
-        for (int i=0 ; i<g_scene.meshCount ; i++)
+        GpuArenaStreamRanges (&g_gpuArena, mesh->allocation,
+                              clusters->runFirst, clusters->runCount,
+                              clusters->runs);
+        clusters->dirty = 0;
+    }
+    else
+    {
+        GpuArenaStreamRefresh (&g_gpuArena, mesh->allocation);
+    }
+
+    g_scene.frameStats.clustersCulled +=
+        clusters->count - visible - clusters->occluded;
+    g_scene.frameStats.trianglesCulled += clusters->triangleCount -
+        clusters->visibleTriangles - clusters->occludedTriangles;
+    g_scene.frameStats.clustersOccluded += clusters->occluded;
+    g_scene.frameStats.trianglesOccluded += clusters->occludedTriangles;
+
+    return (visible > 0);
+}
+
+inline int
+OccluderCompare (const void *a, const void *b)
+{
+    float da = ((occluder_t *) a)->depth;
+    float db = ((occluder_t *) b)->depth;
+    return ((da > db) - (da < db));
+}
+
+// Rasterizes what was drawn in the last frame and is still in the frustum,
+// nearest first so the budget goes to the occluders that hide the most.
+// Clustered meshes on the CPU path only send their visible clusters.
+static void
+RasterizeOccluders (occlusion_buffer_t *occlusion, hmm_mat4 view)
+{
+    for (int i=0 ; i<g_scene.meshCount ; i++)
+    {
+        mesh_t *mesh = g_scene.meshes + i;
+        if (!mesh->drawn || !g_scene.meshVisible[i] ||
+            mesh->pass != RenderPass_Opaque)
         {
-            mesh_t *mesh = g_scene.meshes + i;
+            continue;
+        }
+
+        if (mesh->instanceCount == 0)
+        {
+            occluder_t occluder = {
+                OccluderDepth (view*mesh->model, mesh->sphere), (unsigned int) i, 0
+            };
+            occlusion->occluders.push_back (occluder);
+            continue;
+        }
 
-            if (mesh->indices)
+        for (unsigned int k=0 ; k<mesh->instanceCount ; k++)
+        {
+            if (mesh->instanceVisible[k])
             {
-                free (mesh->indices);
-                mesh->indices = NULL;
+                hmm_mat4 modelView = view*mesh->model*mesh->instances[k].model;
+                occluder_t occluder = {
+                    OccluderDepth (modelView, mesh->sphere), (unsigned int) i, k
+                };
+                occlusion->occluders.push_back (occluder);
             }
-            if (mesh->vertices)
+        }
+    }
+
+    std::vector<occluder_t> &occluders = occlusion->occluders;
+    if (occluders.size () > 1)
+    {
+        qsort (occluders.data (), occluders.size (), sizeof (occluder_t),
+               OccluderCompare);
+    }
+
+    for (size_t o=0 ; o<occluders.size () ; o++)
+    {
+        if (occlusion->triangles >= occlusion->triangleBudget)
+        {
+            break;
+        }
+
+        mesh_t *mesh = g_scene.meshes + occluders[o].object;
+        float *positions = &mesh->vertices[0].position.X;
+        int stride = sizeof (vertex_t)/sizeof (float);
+        mesh_clusters_t *clusters = &mesh->clusters;
+
+        if (mesh->instanceCount > 0)
+        {
+            OcclusionRasterize (occlusion,
+                                mesh->model*mesh->instances[occluders[o].instance].model,
+                                positions, stride, mesh->indices,
+                                0, mesh->indicesCount);
+        }
+        else if (clusters->count > 0 && !g_gpuCull.enabled)
+        {
+            for (unsigned int r=0 ; r<clusters->runs ; r++)
             {
-                free (mesh->vertices);
-                mesh->vertices = NULL;
+                OcclusionRasterize (occlusion, mesh->model, positions, stride,
+                                    mesh->indices, clusters->runFirst[r],
+                                    clusters->runCount[r]);
             }
         }
+        else
+        {
+            OcclusionRasterize (occlusion, mesh->model, positions, stride,
+                                mesh->indices, 0, mesh->indicesCount);
+        }
+    }
+}
 
-        g_scene.meshCount = 0;
-        g_scene.ready = 0;
+inline shading_version_t
+findShadingVersion (char *glShadingVersionString)
+{
+    shading_version_t result = ShadingLanguageVersion_None;
+
+    if (strstr (glShadingVersionString, "3.00") != NULL)
+    {
+        result = ShadingLanguageVersion_GLES300;
     }
+    else if (strstr (glShadingVersionString, "3.10") != NULL)
+    {
+        result = ShadingLanguageVersion_GLES310;
+    }
+    else if (strstr (glShadingVersionString, "3.20") != NULL)
+    {
+        result = ShadingLanguageVersion_GLES320;
+    }
+    else if (strstr (glShadingVersionString, "4.10") != NULL)
+    {
+        result = ShadingLanguageVersion_GL410;
+    }
+    else
+    {
+        assert (!"Unsupported shading language.");
+    }
+
+    return (result);
 }
 
-ZTR_RESIZE (ztrResize)
+// Footprint coordinates are model space XZ
+inline hmm_vec3
+FootprintOverlayPoint (hmm_mat4 model, float y, hmm_vec2 p)
 {
-    g_scene.screenDims.X = w;
-    g_scene.screenDims.Y = h;
+    return ((model*HMM_Vec4 (p.X, y, p.Y, 1.f)).XYZ);
+}
 
-    glViewport (0, 0, w, h);
+// Outline loops and hull of the footprint on the ground under the mesh,
+// with the main axis and the width across it. The hull is filled
+// translucent, with both windings since the camera may look from below
+static void
+AddFootprintOverlay (overlay_t *overlay, mesh_t *mesh)
+{
+    footprint_t *footprint = &mesh->footprint;
+    if (footprint->hullCount == 0)
+    {
+        return;
+    }
+
+    float y = mesh->bounds.min.Y + FOOTPRINT_OVERLAY_LIFT;
+    hmm_mat4 model = mesh->model;
+
+    // Kept across frames so drawing does not allocate once it has grown
+    static std::vector<hmm_vec3> points;
+    for (unsigned int l=0 ; l<footprint->loopCount ; l++)
+    {
+        unsigned int first = footprint->loopStart[l];
+        unsigned int count = footprint->loopStart[l + 1] - first;
+        points.resize (count);
+        for (unsigned int i=0 ; i<count ; i++)
+        {
+            points[i] = FootprintOverlayPoint (model, y, footprint->outline[first + i]);
+        }
+        OverlayPolyline (overlay, points.data (), count, 1,
+                         FOOTPRINT_OVERLAY_OUTLINE_COLOR);
+    }
+
+    hmm_vec3 origin = FootprintOverlayPoint (model, y, footprint->hull[0]);
+    for (unsigned int i=1 ; i + 1<footprint->hullCount ; i++)
+    {
+        hmm_vec3 b = FootprintOverlayPoint (model, y, footprint->hull[i]);
+        hmm_vec3 c = FootprintOverlayPoint (model, y, footprint->hull[i + 1]);
+        OverlayTriangle (overlay, origin, b, c, FOOTPRINT_OVERLAY_FILL_COLOR);
+        OverlayTriangle (overlay, origin, c, b, FOOTPRINT_OVERLAY_FILL_COLOR);
+    }
+
+    hmm_vec2 axis = footprint->axis;
+    hmm_vec2 side = HMM_Vec2 (-axis.Y, axis.X);
+    float uMin = FLT_MAX, uMax = -FLT_MAX, vMin = FLT_MAX, vMax = -FLT_MAX;
+    for (unsigned int i=0 ; i<footprint->hullCount ; i++)
+    {
+        hmm_vec2 p = footprint->hull[i];
+        OverlayPoint (overlay, FootprintOverlayPoint (model, y, p),
+                      OVERLAY_POINT_SIZE_DEFAULT, FOOTPRINT_OVERLAY_HULL_COLOR);
+
+        float u = HMM_DotVec2 (p, axis);
+        float v = HMM_DotVec2 (p, side);
+        uMin = fminf (uMin, u); uMax = fmaxf (uMax, u);
+        vMin = fminf (vMin, v); vMax = fmaxf (vMax, v);
+    }
+
+    float uMid = 0.5f*(uMin + uMax);
+    float vMid = 0.5f*(vMin + vMax);
+    OverlayLine (overlay,
+                 FootprintOverlayPoint (model, y, axis*uMin + side*vMid),
+                 FootprintOverlayPoint (model, y, axis*uMax + side*vMid),
+                 FOOTPRINT_OVERLAY_AXIS_COLOR);
+    OverlayLine (overlay,
+                 FootprintOverlayPoint (model, y, axis*uMid + side*vMin),
+                 FootprintOverlayPoint (model, y, axis*uMid + side*vMax),
+                 FOOTPRINT_OVERLAY_AXIS_COLOR);
 }
 
-ZTR_DRAW (ztrDraw)
+// Drivers often finish compiling a program on its first draw, with the
+// state of that draw. One triangle per program into a 1x1 target with the
+// real blend, depth and vertex layout moves that cost out of the first
+// frame. Needs a mesh in the arena, nothing reaches the screen. Variants
+// still compiling in the background are waited for here
+static void
+WarmUpShaders (scene_t *scene)
 {
-    // 白色で塗りつぶす
-    glClearColor (1.f, 1.f, 1.f, 1.f);
-    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (scene->meshCount == 0)
+    {
+        return;
+    }
 
-    if (g_scene.ready)
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+
+    // Hosts that render into their own framebuffer keep it and its
+    // renderbuffer bound between frames
+    GLint framebuffer;
+    GLint renderbuffer;
+    GLint viewport[4];
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv (GL_RENDERBUFFER_BINDING, &renderbuffer);
+    glGetIntegerv (GL_VIEWPORT, viewport);
+
+    GLuint target;
+    GLuint renderbuffers[2];
+    glGenFramebuffers (1, &target);
+    glGenRenderbuffers (2, renderbuffers);
+    glBindFramebuffer (GL_FRAMEBUFFER, target);
+    glBindRenderbuffer (GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, 1, 1);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_RENDERBUFFER, renderbuffers[0]);
+    glBindRenderbuffer (GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, 1, 1);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                               GL_RENDERBUFFER, renderbuffers[1]);
+    glViewport (0, 0, 1, 1);
+
+    GLStateBindBufferBase (&g_glState, GL_UNIFORM_BUFFER, UBO_BINDING_FRAME,
+                           scene->frameUBO);
+    GLStateBindBufferRange (&g_glState, GL_UNIFORM_BUFFER, UBO_BINDING_MESH,
+                            scene->meshUBO, 0, sizeof (mesh_uniforms_t));
+
+    // One instance for the instanced program
+    instance_t instance;
+    instance.model = HMM_Mat4d (1.f);
+    instance.color = HMM_Vec4 (1.f, 1.f, 1.f, 1.f);
+    GLuint instanceBuffer;
+    glGenBuffers (1, &instanceBuffer);
+    GLStateBindBuffer (&g_glState, GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData (GL_ARRAY_BUFFER, sizeof (instance), &instance, GL_STATIC_DRAW);
+
+    gpu_allocation_t *allocation =
+        &g_gpuArena.allocations[scene->meshes[0].allocation];
+    GLvoid *firstIndex =
+        (GLvoid *) (sizeof (GLuint)*allocation->indices.offset);
+
+    for (unsigned int i=0 ; i<scene->shaderCount ; i++)
     {
-        camera_t *cam = &g_scene.camera;
+        shader_t *shader = scene->shaders + i;
+        if (!ShaderWait (shader))
+        {
+            continue;
+        }
+        GLStateUseProgram (&g_glState, shader->program);
 
-        mouse_t *mouse = &g_scene.mouse;
+        if (shader->features & ShaderFeature_Instanced)
+        {
+            GpuArenaBindInstances (&g_gpuArena, instanceBuffer);
+            glDrawElementsInstanced (shader->elementType, 3, GL_UNSIGNED_INT,
+                                     firstIndex, 1);
+        }
+        else
+        {
+            GLStateBindVertexArray (&g_glState, g_gpuArena.vao);
+            glDrawElements (shader->elementType, 3, GL_UNSIGNED_INT, firstIndex);
+        }
+        GL_CHECK_ERROR ();
+    }
+
+    // The instanced VAO must not keep pointing at the deleted buffer
+    GLStateForgetBuffer (&g_glState, instanceBuffer);
+    glDeleteBuffers (1, &instanceBuffer);
+    g_gpuArena.instancedSource = 0;
 
-        float animCurve = 1.f;
-        float fadeInAnimCurve = 1.f;
-        float labelPosAnimCurve = 1.f;
-        float fadeMeshOpacity = 0.f;
+    glBindFramebuffer (GL_FRAMEBUFFER, (GLuint) framebuffer);
+    glBindRenderbuffer (GL_RENDERBUFFER, (GLuint) renderbuffer);
+    glViewport (viewport[0], viewport[1], viewport[2], viewport[3]);
+    glDeleteRenderbuffers (2, renderbuffers);
+    glDeleteFramebuffers (1, &target);
 
-        // タッチ操作の変化でカメラの位置を計算する
-        if (g_scene.animatingIntroFade)
+    // Waits for the driver so the cost lands here and not in frame one
+    glFinish ();
+    GL_CHECK_ERROR ();
+
+    printf ("Warmed up %d programs in %.2f ms\n", scene->shaderCount,
+            ScanMeshMilliseconds (start));
+}
+
+// Input is applied once per call as it arrives. Animations, inertia and
+// pinch zoom advance once per fixed step, with the camera of the previous
+// step saved first so the drawn camera can be blended between the two
+static void
+UpdateCamera (scene_t *scene, ztr_hid_t hid, int ticks, float frameTime)
+{
+    camera_t *cam = &scene->camera;
+    mouse_t *mouse = &scene->mouse;
+
+    // タッチ操作の変化でカメラの位置を計算する
+    if (scene->animatingIntroFade)
+    {
+        // To prevent mouse "jumping" if down while animating
+        if (hid.mouseDown == 1)
         {
-            if (g_scene.animT < 1.f)
+            mouse->last.X = hid.mouseX;
+            mouse->last.Y = hid.mouseY;
+        }
+
+        for (int t=0 ; t<ticks && scene->animatingIntroFade ; t++)
+        {
+            SaveCamStep (cam);
+            if (scene->animT < 1.f)
             {
-                animCurve = cubicBezier (g_scene.animT);
-                fadeInAnimCurve = animCurve;
-                labelPosAnimCurve = animCurve;
+                float animCurve = cubicBezier (scene->animT);
 
                 cam->yaw =
                     cam->yawAnimEnd + cam->yawAnimAmount*(1.f - animCurve);
                 cam->pitch =
                     cam->pitchAnimEnd + cam->pitchAnimAmount*(1.f - animCurve);
 
-                fadeMeshOpacity = 1.f - animCurve;
-
-                g_scene.animT += g_scene.animStep;
+                scene->animT += scene->animStep;
             }
             else
             {
-                // To prevent mouse "jumping" if down while animating
-                if (hid.mouseDown == 1)
-                {
-                    mouse->last.X = hid.mouseX;
-                    mouse->last.Y = hid.mouseY;
-                }
-
-                g_scene.animatingIntroFade = 0;
-                g_scene.animT = 0.f;
+                scene->animatingIntroFade = 0;
+                scene->animT = 0.f;
             }
-
-            UpdateCamPos (cam);
         }
-        else if (hid.doubleTap == 1)
-        {
-            mouse->last.X = hid.mouseX;
-            mouse->last.Y = hid.mouseY;
+    }
+    else if (hid.doubleTap == 1)
+    {
+        mouse->last.X = hid.mouseX;
+        mouse->last.Y = hid.mouseY;
 
-            mouse->offset.X = 0;
-            mouse->offset.Y = 0;
+        mouse->offset.X = 0;
+        mouse->offset.Y = 0;
 
-            g_scene.animatingIntroFade = false;
+        scene->animatingIntroFade = false;
 
-            g_scene.animatingResetCamera = 1;
-            g_scene.animT = 0.f;
+        scene->animatingResetCamera = 1;
+        scene->animT = 0.f;
 
-            // Ensure we always rotate in the correct direction
-            float yawZeroed = cam->yaw - (CAM_YAW_BASE + 180);
-            float yawWhole = (((int) (yawZeroed/360.f))*360.f);
-            float yawFraction = (yawZeroed - yawWhole);
-            yawFraction += (yawFraction < 0.f ? 360.f : 0.f);
-            float yawAngle = yawFraction - 180.f;
+        // Ensure we always rotate in the correct direction
+        float yawZeroed = cam->yaw - (CAM_YAW_BASE + 180);
+        float yawWhole = (((int) (yawZeroed/360.f))*360.f);
+        float yawFraction = (yawZeroed - yawWhole);
+        yawFraction += (yawFraction < 0.f ? 360.f : 0.f);
+        float yawAngle = yawFraction - 180.f;
 
-            cam->yawAnimEnd = yawWhole + CAM_YAW_BASE;
-            cam->yawAnimAmount = yawAngle;
+        cam->yawAnimEnd = yawWhole + CAM_YAW_BASE;
+        cam->yawAnimAmount = yawAngle;
 
-            cam->pitchAnimEnd = CAM_PITCH_DEFAULT;
-            cam->pitchAnimAmount = cam->pitch - cam->pitchAnimEnd;
+        cam->pitchAnimEnd = CAM_PITCH_DEFAULT;
+        cam->pitchAnimAmount = cam->pitch - cam->pitchAnimEnd;
 
-            cam->orthScaleDiff = CAM_ORTH_SCALE_MAX - cam->orthScale;
-        }
-        else if (hid.pinchZoomTransition == 1)
+        cam->orthScaleDiff = CAM_ORTH_SCALE_MAX - cam->orthScale;
+    }
+    else if (hid.pinchZoomTransition == 1)
+    {
+        if (hid.pinchZoomActive)
         {
-            if (hid.pinchZoomActive)
-            {
-                g_scene.animatingIntroFade = false;
-                g_scene.animatingResetCamera = false;
-
-                mouse->offset.X = 0;
-                mouse->offset.Y = 0;
-            }
-            else
-            {
-                cam->orthScale = cam->orthScale*(1.f/hid.pinchZoomScale);
-                cam->orthScale = Clamp (cam->orthScale,
-                                        CAM_ORTH_SCALE_MIN, CAM_ORTH_SCALE_MAX);
-            }
+            scene->animatingIntroFade = false;
+            scene->animatingResetCamera = false;
 
+            mouse->offset.X = 0;
+            mouse->offset.Y = 0;
         }
-        else if (hid.pinchZoomActive == 1)
+        else
         {
             cam->orthScale = cam->orthScale*(1.f/hid.pinchZoomScale);
             cam->orthScale = Clamp (cam->orthScale,
                                     CAM_ORTH_SCALE_MIN, CAM_ORTH_SCALE_MAX);
-
         }
-        else if (hid.mouseDown == 1)
+        SaveCamStep (cam);
+    }
+    else if (hid.pinchZoomActive == 1)
+    {
+        for (int t=0 ; t<ticks ; t++)
+        {
+            SaveCamStep (cam);
+            cam->orthScale = cam->orthScale*(1.f/hid.pinchZoomScale);
+            cam->orthScale = Clamp (cam->orthScale,
+                                    CAM_ORTH_SCALE_MIN, CAM_ORTH_SCALE_MAX);
+        }
+    }
+    else if (hid.mouseDown == 1)
+    {
+        if (hid.mouseTransition == 1)
         {
-            if (hid.mouseTransition == 1)
-            {
-                mouse->last.X = hid.mouseX;
-                mouse->last.Y = hid.mouseY;
-
-                g_scene.animatingIntroFade = false;
-                g_scene.animatingResetCamera = false;
-            }
-
-            // Reversed since y-coordinates range from bottom to top
-            mouse->offset.X = hid.mouseX - mouse->last.X;
-            mouse->offset.Y = mouse->last.Y - hid.mouseY;
-
             mouse->last.X = hid.mouseX;
             mouse->last.Y = hid.mouseY;
 
-            mouse->offset.X *= MOUSE_SENSITIVITY;
-            mouse->offset.Y *= MOUSE_SENSITIVITY;
+            scene->animatingIntroFade = false;
+            scene->animatingResetCamera = false;
+        }
 
-            cam->yaw += mouse->offset.X;
-            cam->pitch += mouse->offset.Y;
+        // Reversed since y-coordinates range from bottom to top
+        mouse->offset.X = hid.mouseX - mouse->last.X;
+        mouse->offset.Y = mouse->last.Y - hid.mouseY;
 
-            if (cam->pitch < CAM_PITCH_MIN)
-            {
-                cam->pitch = CAM_PITCH_MIN;
-                mouse->offset.Y = 0.f;
-            }
-            else if (cam->pitch > CAM_PITCH_MAX)
-            {
-                cam->pitch = CAM_PITCH_MAX;
-                mouse->offset.Y = 0.f;
-            }
+        mouse->last.X = hid.mouseX;
+        mouse->last.Y = hid.mouseY;
 
-            UpdateCamPos (cam);
+        mouse->offset.X *= MOUSE_SENSITIVITY;
+        mouse->offset.Y *= MOUSE_SENSITIVITY;
+
+        cam->yaw += mouse->offset.X;
+        cam->pitch += mouse->offset.Y;
+
+        if (cam->pitch < CAM_PITCH_MIN)
+        {
+            cam->pitch = CAM_PITCH_MIN;
+            mouse->offset.Y = 0.f;
+        }
+        else if (cam->pitch > CAM_PITCH_MAX)
+        {
+            cam->pitch = CAM_PITCH_MAX;
+            mouse->offset.Y = 0.f;
         }
 
-        else if (g_scene.animatingResetCamera)
+        // The drag follows the finger right away, what is left for the
+        // inertia is the rotation per fixed step
+        SaveCamStep (cam);
+        if (frameTime > 0.f)
+        {
+            mouse->offset = mouse->offset*(SCENE_TICK/frameTime);
+        }
+    }
+    else if (scene->animatingResetCamera)
+    {
+        for (int t=0 ; t<ticks && scene->animatingResetCamera ; t++)
         {
-            if (g_scene.animT < 1.f)
+            SaveCamStep (cam);
+            if (scene->animT < 1.f)
             {
-                animCurve = cubicBezier (g_scene.animT);
-                fadeInAnimCurve = 1.f;
-                labelPosAnimCurve = 1.f;
+                float animCurve = cubicBezier (scene->animT);
 
                 cam->yaw =
                     cam->yawAnimEnd + cam->yawAnimAmount*(1.f - animCurve);
@@ -841,18 +1846,22 @@ ZTR_DRAW (ztrDraw)
                 cam->orthScale =
                     CAM_ORTH_SCALE_MAX - cam->orthScaleDiff*(1.f - animCurve);
 
-                g_scene.animT += g_scene.animStep;
+                scene->animT += scene->animStep;
             }
             else
             {
-                g_scene.animatingResetCamera = 0;
-                g_scene.animT = 0.f;
+                scene->animatingResetCamera = 0;
+                scene->animT = 0.f;
             }
-
-            UpdateCamPos (cam);
         }
-        else
+    }
+    else
+    {
+        // Decays by the same factor per step at any display rate
+        for (int t=0 ; t<ticks ; t++)
         {
+            SaveCamStep (cam);
+
             cam->yaw += mouse->offset.X;
             cam->pitch += mouse->offset.Y;
 
@@ -867,8 +1876,6 @@ ZTR_DRAW (ztrDraw)
                 mouse->offset.Y = 0.f;
             }
 
-            UpdateCamPos (cam);
-
             mouse->offset.X*=CAM_DECELLERATION_FACTOR;
             mouse->offset.Y*=CAM_DECELLERATION_FACTOR;
 
@@ -881,10 +1888,453 @@ ZTR_DRAW (ztrDraw)
                 mouse->offset.Y = 0.f;
             }
         }
+    }
+}
+
+// Stats of the previous frame, then clears for a new one. Frames that are
+// skipped because nothing changed never get here
+static void
+BeginFrame (void)
+{
+    // 前のフレームのドライバー呼び出し回数を保存する
+    g_scene.frameStats.stateIssued = g_glState.issued;
+    g_scene.frameStats.stateElided = g_glState.elided;
+    g_scene.lastFrameStats = g_scene.frameStats;
+    g_scene.frameStats = {};
+    GLStateResetCounters (&g_glState);
+
+#ifdef _DEBUG
+    if (g_scene.frameIndex%RENDER_STATS_INTERVAL == 1)
+    {
+        printf ("Frame %u: %u GL calls, %u draw calls, "
+                "%u state changes issued, %u elided, "
+                "%u meshes, %u instances and %u clusters (%u triangles) culled, "
+                "%u meshes, %u instances and %u clusters (%u triangles) "
+                "occluded by %u triangles\n",
+                g_scene.frameIndex - 1,
+                g_scene.lastFrameStats.glCalls,
+                g_scene.lastFrameStats.drawCalls,
+                g_scene.lastFrameStats.stateIssued,
+                g_scene.lastFrameStats.stateElided,
+                g_scene.lastFrameStats.meshesCulled,
+                g_scene.lastFrameStats.instancesCulled,
+                g_scene.lastFrameStats.clustersCulled,
+                g_scene.lastFrameStats.trianglesCulled,
+                g_scene.lastFrameStats.meshesOccluded,
+                g_scene.lastFrameStats.instancesOccluded,
+                g_scene.lastFrameStats.clustersOccluded,
+                g_scene.lastFrameStats.trianglesOccluded,
+                g_scene.lastFrameStats.occluderTriangles);
+    }
+#endif
+    g_scene.frameIndex++;
+
+    // 白色で塗りつぶす
+    // 半透明のパスの後でも深度バッファをクリアできるようにする
+    GLStateDepthMask (&g_glState, GL_TRUE);
+    glClearColor (1.f, 1.f, 1.f, 1.f);
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+// MARK: Platform independent functions
+
+ZTR_INIT (ztrInit)
+{
+    // プラットフォームAPIのポインターを保存する
+    g_platform = platform;
+    g_scene.shaderCount = 0;
+
+    // ここでプラットフォームに依存しない初期化コードを書く
+    glGetString (GL_VERSION);
+
+    GLint major, minor;
+    glGetIntegerv (GL_MAJOR_VERSION, &major);
+    glGetIntegerv (GL_MINOR_VERSION, &minor);
+    printf ("GL version major: %d minor: %d\n", major, minor);
+
+    char *shadingVersionString =
+        (char *)glGetString (GL_SHADING_LANGUAGE_VERSION);
+    printf ("GL shading language version: %s\n", shadingVersionString);
+    shading_version_t shadingVersion =
+        findShadingVersion (shadingVersionString);
+
+    assert (shadingVersion != ShadingLanguageVersion_None);
+
+    // OpenGL ESを設定する
+    // 新しいコンテキストなので、ステートキャッシュを空にする
+    GLStateInvalidate (&g_glState);
+
+    GLint m_viewport[4];
+    glGetIntegerv (GL_VIEWPORT, m_viewport);
+    GLStateEnable (&g_glState, GLStateCap_CullFace, 1);
+    GLStateEnable (&g_glState, GLStateCap_Blend, 1);
+    GLStateEnable (&g_glState, GLStateCap_DepthTest, 1);
+    GLStateDepthFunc (&g_glState, GL_LESS);
+    GLStateBlendEquationSeparate (&g_glState, GL_FUNC_ADD, GL_FUNC_ADD);
+    GLStateBlendFuncSeparate (&g_glState, GL_ONE, GL_ONE_MINUS_SRC_ALPHA,
+                              GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    // シェーダープログラムをテキストファイルから読み込む。
+    // 前回の起動でキャッシュしたバイナリがあれば、それを使う。
+    // バリアントは必要になった時にコンパイルし、ドライバーが対応していれば
+    // バックグラウンドでコンパイルされる
+    std::chrono::high_resolution_clock::time_point shaderStart =
+        std::chrono::high_resolution_clock::now ();
+    InitProgramCache (&g_programCache);
+    InitShaderCompiler (&g_shaderCompiler);
+    g_scene.shadingVersionString = ShadingVersionString (shadingVersion);
+
+    g_scene.objectShader = RequestShader (&g_scene, OBJECT_VERTEX_SHADER,
+                                          OBJECT_FRAGMENT_SHADER, 0);
+    g_scene.overlayShader = RequestShader (&g_scene, OVERLAY_VERTEX_SHADER,
+                                           OVERLAY_FRAGMENT_SHADER, 0);
+
+    // フレームとメッシュのユニフォームバッファを作る。
+    // 毎フレーム書き込むバッファはフレームごとの領域を持つ
+    InitFrameRing (&g_frameRing);
+    InitUniformBuffers (&g_scene);
+
+    // 計測の線や点は毎フレーム、大きなリングバッファに書いて描く
+    InitOverlay (&g_overlay, g_scene.overlayShader);
+
+    // 描いたフレームはピクセルパックバッファに非同期で読み出す
+    InitCaptureRing (&g_captureRing);
+
+    // すべてのメッシュが共有する頂点とインデックスのバッファを作る
+    InitGpuArena (&g_gpuArena);
+
+    // ES 3.1 ならクラスターの判定をコンピュートシェーダーで行う。
+    // 使えない場合はCPUで判定する
+    GLuint cullProgram = 0;
+#ifdef ZTR_GL_COMPUTE
+    if (shadingVersion == ShadingLanguageVersion_GLES310 ||
+        shadingVersion == ShadingLanguageVersion_GLES320)
+    {
+        cullProgram = LoadComputeShader (shadingVersion,
+                                         (char *) "shaders/cluster_cull_comp.glsl");
+    }
+#endif
+    InitGpuCull (&g_gpuCull, cullProgram);
+    printf ("Cluster culling on the %s\n", g_gpuCull.enabled ? "GPU" : "CPU");
+
+    // 描画時間に合わせて解像度を下げる。GPUの時間はタイマークエリで測り、
+    // 使えない場合はフェンスで測る
+    InitDynamicResolution (&g_dynamicResolution,
+                           shadingVersion == ShadingLanguageVersion_GL410);
+    printf ("Frame time from %s\n",
+            (g_dynamicResolution.timer == FrameTimer_Query) ?
+            "timer queries" : "fences");
+
+    printf ("Programs requested in %.2f ms, %s compiler, cache %s, "
+            "%d hits %d misses %d rejected\n",
+            ScanMeshMilliseconds (shaderStart),
+            g_shaderCompiler.parallel ? "parallel" : "serial",
+            g_programCache.enabled ? "on" : "off",
+            g_programCache.hits, g_programCache.misses, g_programCache.rejected);
+
+    // すべての構造体の初期値を設定する関数を呼び出す
+    InitScene (&g_scene);
+    InitCam (&g_scene.camera);
+    InitMouse (&g_scene.mouse);
+    InitOcclusionBuffer (&g_scene.occlusion);
+
+    // Stanford Bunny メッシュを読み込む
+    // loadObj 関数はメッシュの頂点とインデックスをGPUアリーナに割り当てる
+    mesh_t *bunnyMesh = loadObj ("bunny_vn.obj");
+    float S = 1.f;
+    bunnyMesh->S = HMM_Scale (HMM_Vec3 (S, S, S));
+    bunnyMesh->R = HMM_Rotate (0.f, HMM_Vec3 (1,0,0));
+    bunnyMesh->T = HMM_Translate (HMM_Vec3 (0,0,0));
+    bunnyMesh->shader = g_scene.objectShader;
+
+    PrintGpuArenaStats (&g_gpuArena);
+
+    // 最初のフレームでドライバーがコンパイルしないように、一回ずつ描いておく
+    WarmUpShaders (&g_scene);
+
+    g_scene.ready = 1;
+    g_scene.animatingIntroFade = 1;
+    g_scene.dirty = 1;
+
+    // 最初のフレームの経過時間は初期化の後から数える
+    g_scene.lastTime = (g_platform->getTime != NULL) ? g_platform->getTime () : 0.0;
+    g_scene.tickTime = 0.f;
+}
+
+ZTR_FREE (ztrFree)
+{
+    if (g_scene.ready)
+    {
+        for (int i=0 ; i<g_scene.meshCount ; i++)
+        {
+            FreeMesh (g_scene.meshes + i);
+        }
+
+        free (g_scene.meshUniformStaging);
+        g_scene.meshUniformStaging = NULL;
+        GLuint uniformBuffers[2] = { g_scene.frameUBO, g_scene.meshUBO };
+        for (int i=0 ; i<2 ; i++)
+        {
+            GLStateForgetBuffer (&g_glState, uniformBuffers[i]);
+        }
+        glDeleteBuffers (2, uniformBuffers);
+        g_scene.frameUBO = 0;
+        g_scene.meshUBO = 0;
+
+        FreeGpuArena (&g_gpuArena);
+
+        FreeGpuCull (&g_gpuCull);
+        FreeDynamicResolution (&g_dynamicResolution);
+        FreeFrameRing (&g_frameRing);
+        FreeOverlay (&g_overlay);
+        FreeCaptureRing (&g_captureRing);
+        FreeCullBoxes (&g_scene.meshBoxes);
+        FreeOcclusionBuffer (&g_scene.occlusion);
+        FreeCullSpheres (&g_scene.instanceSpheres);
+        free (g_scene.instanceVisible);
+        free (g_scene.instanceStaging);
+        g_scene.instanceVisible = NULL;
+        g_scene.instanceStaging = NULL;
+        g_scene.instanceScratchCapacity = 0;
+
+        g_scene.meshCount = 0;
+        g_scene.ready = 0;
+    }
+}
+
+ZTR_LOAD (ztrLoad)
+{
+    if (!g_scene.ready)
+    {
+        return (0);
+    }
+
+    // 今のメッシュを捨てて、頂点とインデックスの領域をアリーナに返す
+    for (int i=0 ; i<g_scene.meshCount ; i++)
+    {
+        FreeMesh (g_scene.meshes + i);
+    }
+    g_scene.meshCount = 0;
+    GpuCullInvalidate (&g_gpuCull);
+    g_scene.dirty = 1;
+
+    // 左右の足はスキャンの座標のまま置く
+    const char *paths[2] = { leftPath, rightPath };
+    for (int i=0 ; i<2 ; i++)
+    {
+        if (paths[i] == NULL)
+        {
+            continue;
+        }
+
+        mesh_t *mesh = loadObj (paths[i]);
+        if (mesh == NULL)
+        {
+            printf ("Could not load %s\n", paths[i]);
+            for (int m=0 ; m<g_scene.meshCount ; m++)
+            {
+                FreeMesh (g_scene.meshes + m);
+            }
+            g_scene.meshCount = 0;
+            return (0);
+        }
+
+        mesh->S = HMM_Scale (HMM_Vec3 (1.f, 1.f, 1.f));
+        mesh->R = HMM_Rotate (0.f, HMM_Vec3 (1,0,0));
+        mesh->T = HMM_Translate (HMM_Vec3 (0,0,0));
+        mesh->shader = g_scene.objectShader;
+    }
+
+    return (1);
+}
+
+ZTR_SET_CAMERA (ztrSetCamera)
+{
+    camera_t *cam = &g_scene.camera;
+
+    // 演出と慣性を止めて、指定の向きにすぐ合わせる
+    g_scene.animatingIntroFade = 0;
+    g_scene.animatingResetCamera = 0;
+    g_scene.animT = 0.f;
+    g_scene.mouse.offset = HMM_Vec2 (0.f, 0.f);
+
+    cam->yaw = yaw;
+    cam->pitch = Clamp (pitch, CAM_PITCH_MIN, CAM_PITCH_MAX);
+    cam->orthScale = Clamp (orthScale, CAM_ORTH_SCALE_MIN, CAM_ORTH_SCALE_MAX);
+    SaveCamStep (cam);
+    UpdateCamPos (cam);
+
+    g_scene.dirty = 1;
+}
+
+ZTR_SET_INSTANCES (ztrSetInstances)
+{
+    if (!g_scene.ready || mesh < 0 || mesh >= g_scene.meshCount)
+    {
+        return (0);
+    }
+
+    // 行列は列優先で、どちらも同じ並び
+    instance_t *copies = (instance_t *) malloc (sizeof (instance_t)*(count + 1));
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        memcpy (copies[i].model.Elements, instances[i].model, sizeof (instances[i].model));
+        copies[i].color = HMM_Vec4 (instances[i].color[0], instances[i].color[1],
+                                    instances[i].color[2], instances[i].color[3]);
+    }
+    SetMeshInstances (g_scene.meshes + mesh, copies, count);
+    free (copies);
+
+    return (1);
+}
+
+ZTR_SET_CONTOUR (ztrSetContour)
+{
+    contour_t *contour = &g_scene.contour;
+
+    // 軸は単位ベクトルにして、長さのない軸は今の軸のままにする
+    if (axis != NULL)
+    {
+        hmm_vec3 v = HMM_Vec3 (axis[0], axis[1], axis[2]);
+        float length = HMM_LengthVec3 (v);
+        if (length > 0.f)
+        {
+            contour->axis = v*(1.f/length);
+        }
+    }
+    if (color != NULL)
+    {
+        contour->color = HMM_Vec3 (color[0], color[1], color[2]);
+    }
+
+    contour->enabled = (spacing > 0.f);
+    if (contour->enabled)
+    {
+        contour->spacing = spacing;
+    }
+    contour->offset = offset;
+    contour->width = HMM_MAX (width, 0.f);
+
+    g_scene.dirty = 1;
+}
+
+ZTR_SET_FOOTPRINT_OVERLAY (ztrSetFootprintOverlay)
+{
+    // 足形は読み込み時に測るので、これから読み込むスキャンにも効く
+    g_scene.footprint.enabled = (enabled != 0);
+    g_scene.footprintOverlay = (enabled != 0);
+    g_scene.dirty = 1;
+}
+
+ZTR_RESIZE (ztrResize)
+{
+    g_scene.screenDims.X = w;
+    g_scene.screenDims.Y = h;
+    g_scene.dirty = 1;
+
+    glViewport (0, 0, w, h);
+}
+
+ZTR_INVALIDATE (ztrInvalidate)
+{
+    g_scene.dirty = 1;
+}
+
+ZTR_CAPTURE (ztrCapture)
+{
+    if (!g_scene.ready)
+    {
+        return (0);
+    }
+
+    // ztrDrawの後はプラットフォームのフレームバッファが結び付いている
+    return (CaptureRead (&g_captureRing, tag,
+                         (int) g_scene.screenDims.X, (int) g_scene.screenDims.Y));
+}
+
+ZTR_FINISH_CAPTURE (ztrFinishCapture)
+{
+    return (g_scene.ready && CaptureFinish (&g_captureRing, capture, wait));
+}
 
-        g_scene.currentTime = g_scene.lastTime + 1.f/60.f;
+ZTR_RELEASE_CAPTURE (ztrReleaseCapture)
+{
+    CaptureRelease (&g_captureRing, capture);
+}
+
+ZTR_DRAW (ztrDraw)
+{
+    int result = ZTR_FRAME_DRAWN;
+
+    if (g_scene.ready)
+    {
+        // 前の呼び出しからの時間を固定ステップに分ける。プラットフォームに
+        // 時計がなければ、一回の呼び出しを一ステップとする
+        float frameTime = SCENE_TICK;
+        int ticks = 1;
+        float alpha = 1.f;
+        if (g_platform->getTime != NULL)
+        {
+            g_scene.currentTime = g_platform->getTime ();
+            frameTime = (float) (g_scene.currentTime - g_scene.lastTime);
+            frameTime = Clamp (frameTime, 0.f, SCENE_MAX_FRAME_TIME);
+
+            g_scene.tickTime += frameTime;
+            ticks = (int) (g_scene.tickTime/SCENE_TICK);
+            g_scene.tickTime -= ticks*SCENE_TICK;
+            alpha = g_scene.tickTime/SCENE_TICK;
+        }
+        else
+        {
+            g_scene.currentTime = g_scene.lastTime + SCENE_TICK;
+        }
         g_scene.lastTime = g_scene.currentTime;
 
+        UpdateCamera (&g_scene, hid, ticks, frameTime);
+
+        // 描くカメラは最後の二つのステップの間を補間する
+        camera_t drawnCam = InterpolateCam (&g_scene.camera, alpha);
+        camera_t *cam = &drawnCam;
+        mouse_t *mouse = &g_scene.mouse;
+
+        // カメラもシーンも変わっていなければ描かずに、前のフレームを残す。
+        // アニメーション、慣性と補間の間は、プラットフォームに呼び続けてもらう
+        int animating = g_scene.animatingIntroFade ||
+                        g_scene.animatingResetCamera ||
+                        mouse->offset.X != 0.f || mouse->offset.Y != 0.f ||
+                        !CamStepSettled (&g_scene.camera);
+        if (animating)
+        {
+            result |= ZTR_FRAME_ANIMATING;
+        }
+
+        // 動いている間だけ解像度を下げる。止まったら元の解像度で描き直す
+        if (!animating && g_dynamicResolution.scale < 1.f)
+        {
+            g_scene.dirty = 1;
+        }
+
+        if (!g_scene.dirty &&
+            HMM_EqualsVec3 (cam->pos, g_scene.drawnCamPos) &&
+            cam->orthScale == g_scene.drawnOrthScale)
+        {
+            return (result & ~ZTR_FRAME_DRAWN);
+        }
+
+        g_scene.dirty = 0;
+        g_scene.drawnCamPos = cam->pos;
+        g_scene.drawnOrthScale = cam->orthScale;
+
+        // GPUがこのフレームのバッファを使い終わるまで待つ。待った時間は
+        // GPUが遅れている時間になる
+        FrameRingBegin (&g_frameRing);
+        unsigned int frameSlot = g_frameRing.current;
+
+        DynamicResolutionBegin (&g_dynamicResolution,
+                                (int) g_scene.screenDims.X,
+                                (int) g_scene.screenDims.Y, !animating);
+        BeginFrame ();
+
         // 射影行列とビュー行列を作成する
         float ratio = (float) g_scene.screenDims.Y/(float) g_scene.screenDims.X;
         float orth = cam->orthScale;
@@ -895,77 +2345,268 @@ ZTR_DRAW (ztrDraw)
                                     CAM_LOOKAT_CENTER,
                                     CAM_LOOKAT_UP);
 
-        // 射影行列とビュー行列をシェーダープログラムに渡す
-        for (int i=0 ; i<g_scene.shaderCount; i++)
+        // 射影行列、ビュー行列、照明と等高線をフレームのUBOにまとめて渡す
+        // 懐中電灯の効果のためカメラの位置を照明の位置にする
+        contour_t *contour = &g_scene.contour;
+        frame_uniforms_t frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.lightPos = HMM_Vec4v (cam->pos, 1.f);
+        frame.cameraPos = HMM_Vec4v (cam->pos, 1.f);
+        frame.contourAxis = HMM_Vec4v (contour->axis, (float) contour->enabled);
+        frame.contourParams = HMM_Vec4 (contour->spacing, contour->offset,
+                                        contour->width, 0.f);
+        frame.contourColor = HMM_Vec4v (contour->color, 1.f);
+
+        GLintptr frameOffset = frameSlot*g_scene.frameUniformStride;
+        GLStateBindBufferRange (&g_glState, GL_UNIFORM_BUFFER, UBO_BINDING_FRAME,
+                                g_scene.frameUBO, frameOffset,
+                                sizeof (frame_uniforms_t));
+        GLStateBindBuffer (&g_glState, GL_UNIFORM_BUFFER, g_scene.frameUBO);
+        FrameRingWrite (GL_UNIFORM_BUFFER, frameOffset,
+                        sizeof (frame_uniforms_t), &frame);
+        GL_CHECK_ERROR ();
+
+        // メッシュの位置、回転情報をリングの今のフレームの領域に書き込み、
+        // 描画パケットをキューに積む
+        GLint stride = g_scene.meshUniformStride;
+        GLintptr ringOffset = frameSlot*MAX_MESHES*stride;
+
+        render_queue_t *queue = &g_scene.renderQueue;
+        RenderQueueReset (queue);
+
+        // 視錐台の外のメッシュを4つずつまとめて判定する。インスタンスを
+        // 持つメッシュは全インスタンスを囲むボックスで判定する
+        frustum_t frustum = FrustumFromMatrix (projection*view);
+        hmm_vec3 forward = HMM_NormalizeVec3 (CAM_LOOKAT_CENTER - cam->pos);
+        cull_boxes_t *boxes = &g_scene.meshBoxes;
+        CullBoxesReset (boxes, g_scene.meshCount);
+
+        for (int i=0 ; i<g_scene.meshCount; i++)
+        {
+            mesh_t *mesh = g_scene.meshes + i;
+            mesh->model = mesh->T*mesh->R*mesh->S;
+
+            rec3_t *bounds = (mesh->instanceCount > 0) ?
+                &mesh->instanceBounds : &mesh->bounds;
+            CullBoxesPush (boxes, mesh->model,
+                           (bounds->min + bounds->max)*0.5f,
+                           (bounds->max - bounds->min)*0.5f);
+        }
+
+        unsigned int visibleMeshes =
+            FrustumCullBoxes (&frustum, boxes, g_scene.meshVisible);
+        g_scene.frameStats.meshesCulled = g_scene.meshCount - visibleMeshes;
+
+        // 前のフレームで描いたものを遮蔽物としてCPUで小さな深度バッファに描き、
+        // 深度ピラミッドを作る。残りのメッシュ、インスタンスとクラスターは
+        // ピラミッドで判定し、見えるものは同じフレームで描く
+        occlusion_buffer_t *occlusion = NULL;
+        if (g_scene.occlusion.enabled)
+        {
+            occlusion = &g_scene.occlusion;
+            OcclusionBegin (occlusion, projection*view, ratio);
+            RasterizeOccluders (occlusion, view);
+            OcclusionBuildPyramid (occlusion);
+            g_scene.frameStats.occluderTriangles = occlusion->triangles;
+        }
+
+        for (int i=0 ; i<g_scene.meshCount; i++)
         {
-            shader_t *shader = g_scene.shaders + i;
+            mesh_t *mesh = g_scene.meshes + i;
+            mesh->drawn = 0;
 
-            glUseProgram(shader->program);
+            // コンパイル中のバリアントは待たずに、このフレームでは描かない。
+            // 終わるまで次のフレームも描く
+            if (!ShaderReady (mesh->shader))
+            {
+                g_scene.meshVisible[i] = 0;
+                g_scene.dirty = 1;
+                result |= ZTR_FRAME_ANIMATING;
+                continue;
+            }
 
-            GLuint viewMatrixLoc =
-                glGetUniformLocation (shader->program, "view");
-            glUniformMatrix4fv (viewMatrixLoc,
-                                1,
-                                GL_FALSE,
-                                &view.Elements[0][0]);
+            unsigned int copies = HMM_MAX (mesh->instanceCount, 1u);
+            unsigned int triangles = copies*(mesh->indicesCount/3);
+            if (!g_scene.meshVisible[i])
+            {
+                g_scene.frameStats.trianglesCulled += triangles;
+                continue;
+            }
+
+            rec3_t *bounds = (mesh->instanceCount > 0) ?
+                &mesh->instanceBounds : &mesh->bounds;
+            if (occlusion &&
+                !OcclusionTestBox (occlusion, mesh->model,
+                                   (bounds->min + bounds->max)*0.5f,
+                                   (bounds->max - bounds->min)*0.5f))
+            {
+                g_scene.meshVisible[i] = 0;
+                g_scene.frameStats.meshesOccluded++;
+                g_scene.frameStats.trianglesOccluded += triangles;
+                continue;
+            }
+
+            mesh_uniforms_t *uniforms =
+                (mesh_uniforms_t *) (g_scene.meshUniformStaging + i*stride);
+            uniforms->model = mesh->model;
+            uniforms->rotate = mesh->R;
+
+            if (mesh->instanceCount > 0)
+            {
+                g_scene.frameStats.instancesCulled +=
+                    CullMeshInstances (mesh, &frustum, occlusion);
+
+                if (mesh->instancesDirty)
+                {
+                    memset (mesh->instanceStale, 1, FRAMES_IN_FLIGHT);
+                    mesh->instancesDirty = 0;
+                }
+                if (mesh->instanceStale[frameSlot])
+                {
+                    UploadMeshInstances (mesh, frameSlot);
+                }
+                mesh->instanceVBO = mesh->instanceVBOs[frameSlot];
+                if (mesh->visibleInstanceCount == 0)
+                {
+                    continue;
+                }
+            }
+            else if (mesh->clusters.count > 0 && !g_gpuCull.enabled)
+            {
+                if (!CullMeshDrawClusters (mesh, &frustum, forward, occlusion))
+                {
+                    continue;
+                }
+            }
+
+            // 不透明は手前から奥へ、半透明は奥から手前へ並べる
+            hmm_vec3 center = (mesh->bounds.min + mesh->bounds.max)*0.5f;
+            hmm_vec4 viewCenter = view*mesh->model*HMM_Vec4v (center, 1.f);
+            float depth = -viewCenter.Z;
+
+            // 同じ頂点ソースの描画をまとめる
+            unsigned int shaderIndex = (unsigned int) (mesh->shader - g_scene.shaders);
+            unsigned int source = (mesh->instanceCount > 0) ?
+                mesh->instanceVBO : g_gpuArena.vao;
+            uint64_t key = (mesh->pass == RenderPass_Opaque) ?
+                RenderKeyOpaque (shaderIndex, source, depth, CAM_FAR) :
+                RenderKeyBlended (shaderIndex, source, depth, CAM_FAR);
+            RenderQueuePush (queue, key, i);
+            mesh->drawn = 1;
+        }
+
+        RenderQueueSort (queue);
+
+        // GPUで判定する場合は、見えるクラスターのインデックスと描画コマンドを
+        // コンピュートシェーダーが書き込む
+        if (g_gpuCull.enabled)
+        {
+            GpuCullDispatch (&g_gpuCull, g_scene.meshes, g_scene.meshCount,
+                             g_scene.meshVisible, &frustum, forward, frameSlot);
             GL_CHECK_ERROR ();
+        }
 
-            GLuint projectionMatrixLoc =
-                glGetUniformLocation (shader->program, "projection");
-            glUniformMatrix4fv (projectionMatrixLoc,
-                                1,
-                                GL_FALSE,
-                                &projection.Elements[0][0]);
+        if (g_scene.meshCount > 0)
+        {
+            GLStateBindBuffer (&g_glState, GL_UNIFORM_BUFFER, g_scene.meshUBO);
+            FrameRingWrite (GL_UNIFORM_BUFFER, ringOffset,
+                            g_scene.meshCount*stride,
+                            g_scene.meshUniformStaging);
             GL_CHECK_ERROR ();
         }
 
-        // メッシュの位置、回転情報をシェーダープログラムに渡す
-        for (int i=0 ; i<g_scene.meshCount; i++)
+        for (unsigned int p=0 ; p<queue->count ; p++)
         {
+            draw_packet_t *packet = queue->packets + p;
+            unsigned int i = packet->index;
             mesh_t *mesh = g_scene.meshes + i;
 
             shader_t *shader = mesh->shader;
 
-            glUseProgram (shader->program);
+            // 半透明のパスは深度を書き込まない
+            GLStateDepthMask (&g_glState,
+                              RenderKeyPass (packet->key) == RenderPass_Opaque);
 
-            mesh->model = mesh->T*mesh->R*mesh->S;
+            GLStateUseProgram (&g_glState, shader->program);
 
-            GLuint rotateMatrixLoc =
-                glGetUniformLocation (shader->program, "rotate");
-            glUniformMatrix4fv (rotateMatrixLoc,
-                                1,
-                                GL_FALSE,
-                                &mesh->R.Elements[0][0]);
-
-            GLuint modelMatrixLoc =
-                glGetUniformLocation (shader->program, "model");
-            glUniformMatrix4fv (modelMatrixLoc,
-                                1,
-                                GL_FALSE,
-                                &mesh->model.Elements[0][0]);
-
-            // VAOを紐づける
-            glBindVertexArray (mesh->VAO);
-            GL_CHECK_ERROR ();
+            GLStateBindBufferRange (&g_glState, GL_UNIFORM_BUFFER, UBO_BINDING_MESH,
+                                    g_scene.meshUBO, ringOffset + i*stride,
+                                    sizeof (mesh_uniforms_t));
+
+            // インデックスはアリーナ内の絶対位置なので、範囲の先頭から描く。
+            // クラスターを持つメッシュは見える分だけを詰めた領域から描く
+            gpu_allocation_t *allocation =
+                &g_gpuArena.allocations[mesh->allocation];
+            gpu_range_t indices = allocation->indices;
+            if (mesh->instanceCount == 0 && mesh->clusters.count > 0)
+            {
+                indices.offset = GpuArenaStreamOffset (allocation, frameSlot);
+                indices.count = allocation->streamCount;
+            }
+            GLvoid *firstIndex = (GLvoid *) (sizeof (GLuint)*indices.offset);
 
             // シェーダープログラムを経由して、三角形を描く
-            glDrawElements (shader->elementType,
-                            mesh->indicesCount,
-                            GL_UNSIGNED_SHORT,
-                            0);
+            if (mesh->instanceCount > 0)
+            {
+                GpuArenaBindInstances (&g_gpuArena, mesh->instanceVBO);
+                GL_CHECK_ERROR ();
+
+                glDrawElementsInstanced (shader->elementType,
+                                         indices.count,
+                                         GL_UNSIGNED_INT,
+                                         firstIndex,
+                                         mesh->visibleInstanceCount);
+            }
+            else if (mesh->clusters.count > 0 && g_gpuCull.enabled)
+            {
+                GLStateBindVertexArray (&g_glState, g_gpuArena.vao);
+                GL_CHECK_ERROR ();
+
+                GpuCullDraw (&g_gpuCull, shader->elementType, i);
+            }
+            else
+            {
+                GLStateBindVertexArray (&g_glState, g_gpuArena.vao);
+                GL_CHECK_ERROR ();
+
+                glDrawElements (shader->elementType,
+                                indices.count,
+                                GL_UNSIGNED_INT,
+                                firstIndex);
+            }
             GL_CHECK_ERROR ();
+        }
 
-            glBindVertexArray (0);
+        // 計測の線と点をまとめて最後に描く
+        if (g_scene.footprintOverlay)
+        {
+            for (int i=0 ; i<g_scene.meshCount ; i++)
+            {
+                AddFootprintOverlay (&g_overlay, g_scene.meshes + i);
+            }
+        }
+        if (ShaderReady (g_overlay.shader))
+        {
+            OverlayDraw (&g_overlay);
             GL_CHECK_ERROR ();
         }
+        else
+        {
+            OverlayDiscard (&g_overlay);
+        }
 
-        // 懐中電灯の効果のためカメラの位置をシェーダープログラムに渡す
-        glUseProgram (g_scene.objectShader->program);
+        // 縮小して描いた場合はバックバッファに拡大する
+        DynamicResolutionEnd (&g_dynamicResolution);
         GL_CHECK_ERROR ();
 
-        GLint lightPosLoc =
-            glGetUniformLocation (g_scene.objectShader->program, "lightPos");
-        glUniform3f (lightPosLoc, cam->pos[0], cam->pos[1], cam->pos[2]);
-        GL_CHECK_ERROR ();
+        // 次にこのフレームのバッファに書く前に待つフェンスを置く
+        FrameRingEnd (&g_frameRing);
     }
+    else
+    {
+        BeginFrame ();
+    }
+
+    return (result);
 }
@@ -0,0 +1,213 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_program_cache.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Linked program binaries kept in the platform cache directory so later
+// launches skip compiling and linking. Entries are keyed by a hash of the
+// final shader sources together with GL_RENDERER and GL_VERSION, so a
+// driver update changes the key and an old entry is simply never read
+// again. A driver can still refuse a binary it wrote itself, the caller
+// then builds from source and stores the new binary over the old one.
+// Contexts that expose no binary formats, WebGL among them, and hosts
+// without cache file callbacks leave the cache disabled.
+//
+
+// MARK: Constants
+
+// "ZTRP"
+#define PROGRAM_CACHE_MAGIC 0x5052545au
+#define PROGRAM_CACHE_VERSION 1
+
+#define PROGRAM_CACHE_NAME_SIZE 64
+
+// FNV-1a 64 bit
+#define PROGRAM_CACHE_HASH_BASIS 0xcbf29ce484222325ull
+#define PROGRAM_CACHE_HASH_PRIME 0x100000001b3ull
+
+// MARK: Structs
+
+struct program_cache_header_t
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long key;
+    unsigned int format;
+    unsigned int length;
+};
+
+struct program_cache_t
+{
+    int enabled;
+
+    // GL_RENDERER and GL_VERSION, every key starts from here
+    unsigned long long driverHash;
+
+    // Programs since init, rejected entries also count as misses
+    int hits;
+    int misses;
+    int rejected;
+};
+
+// MARK: Globals
+
+static program_cache_t g_programCache;
+
+// MARK: Functions
+
+inline unsigned long long
+ProgramCacheHash (unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i=0 ; i<size ; i++)
+    {
+        hash = (hash ^ bytes[i])*PROGRAM_CACHE_HASH_PRIME;
+    }
+    return (hash);
+}
+
+// Hashes a string with its terminator so consecutive strings never run
+// into each other
+inline unsigned long long
+ProgramCacheHashString (unsigned long long hash, const char *string)
+{
+    if (string == NULL)
+    {
+        string = "";
+    }
+    return (ProgramCacheHash (hash, string, strlen (string) + 1));
+}
+
+static void
+InitProgramCache (program_cache_t *cache)
+{
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->rejected = 0;
+
+    GLint formatCount = 0;
+    glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    cache->enabled = formatCount > 0 &&
+                     g_platform->readCacheFile != NULL &&
+                     g_platform->writeCacheFile != NULL;
+
+    unsigned long long hash = PROGRAM_CACHE_HASH_BASIS;
+    hash = ProgramCacheHashString (hash, (const char *) glGetString (GL_RENDERER));
+    hash = ProgramCacheHashString (hash, (const char *) glGetString (GL_VERSION));
+    cache->driverHash = hash;
+}
+
+// Key of a program built from the given sources, pass NULL for stages the
+// program does not have
+static unsigned long long
+ProgramCacheKey (program_cache_t *cache, const char *vertexSource,
+                 const char *fragmentSource, const char *computeSource)
+{
+    unsigned long long hash = cache->driverHash;
+    hash = ProgramCacheHashString (hash, vertexSource);
+    hash = ProgramCacheHashString (hash, fragmentSource);
+    hash = ProgramCacheHashString (hash, computeSource);
+    return (hash);
+}
+
+inline void
+ProgramCacheFileName (char *name, unsigned long long key)
+{
+    snprintf (name, PROGRAM_CACHE_NAME_SIZE, "program_%016llx.bin", key);
+}
+
+// Returns a linked program, or 0 when there is no entry or the driver
+// refuses it
+static GLuint
+ProgramCacheLoad (program_cache_t *cache, unsigned long long key)
+{
+    if (!cache->enabled)
+    {
+        return (0);
+    }
+
+    char name[PROGRAM_CACHE_NAME_SIZE];
+    ProgramCacheFileName (name, key);
+
+    ztr_file_t file = g_platform->readCacheFile (name);
+    if (file.data == NULL)
+    {
+        cache->misses++;
+        return (0);
+    }
+
+    program_cache_header_t *header = (program_cache_header_t *) file.data;
+    if (file.dataSize < sizeof (program_cache_header_t) ||
+        header->magic != PROGRAM_CACHE_MAGIC ||
+        header->version != PROGRAM_CACHE_VERSION ||
+        header->key != key ||
+        header->length != file.dataSize - sizeof (program_cache_header_t))
+    {
+        printf ("Program cache entry %s is damaged\n", name);
+        free (file.data);
+        cache->rejected++;
+        cache->misses++;
+        return (0);
+    }
+
+    GLuint program = glCreateProgram ();
+    glProgramBinary (program, header->format, header + 1, header->length);
+    free (file.data);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv (program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        // A format the driver no longer accepts also raises an error
+        while (glGetError () != GL_NO_ERROR);
+
+        printf ("Program cache entry %s rejected by the driver\n", name);
+        glDeleteProgram (program);
+        cache->rejected++;
+        cache->misses++;
+        return (0);
+    }
+
+    cache->hits++;
+    return (program);
+}
+
+// The program should be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+static void
+ProgramCacheStore (program_cache_t *cache, unsigned long long key, GLuint program)
+{
+    if (!cache->enabled)
+    {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    unsigned int size = sizeof (program_cache_header_t) + (unsigned int) length;
+    program_cache_header_t *header = (program_cache_header_t *) malloc (size);
+
+    GLenum format = 0;
+    glGetProgramBinary (program, length, &length, &format, header + 1);
+
+    header->magic = PROGRAM_CACHE_MAGIC;
+    header->version = PROGRAM_CACHE_VERSION;
+    header->key = key;
+    header->format = format;
+    header->length = (unsigned int) length;
+
+    char name[PROGRAM_CACHE_NAME_SIZE];
+    ProgramCacheFileName (name, key);
+    if (!g_platform->writeCacheFile (name, header,
+                                     sizeof (program_cache_header_t) + header->length))
+    {
+        printf ("Could not write program cache entry %s\n", name);
+    }
+
+    free (header);
+}
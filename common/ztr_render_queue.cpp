@@ -0,0 +1,160 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_render_queue.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Per frame list of draw packets with packed 64 bit sort keys. Meshes are
+// submitted in any order, the queue is radix sorted and then executed so
+// draws sharing a shader and buffers end up next to each other.
+//
+// Key layout, most significant bits first:
+//
+//   opaque   | pass:2 | shader:8 | vao:16 | depth:24 front to back | 14 |
+//   blended  | pass:2 | depth:24 back to front | shader:8 | vao:16 | 14 |
+//
+
+// MARK: Includes
+
+#include <stdint.h>
+
+// MARK: Constants
+
+#define RENDER_QUEUE_MAX_PACKETS (1 << 8)
+
+#define RENDER_KEY_DEPTH_BITS 24
+#define RENDER_KEY_DEPTH_MAX ((1u << RENDER_KEY_DEPTH_BITS) - 1)
+
+// MARK: Enums
+
+// Passes run in this order
+enum render_pass_t
+{
+    RenderPass_Opaque,
+    RenderPass_Blended,
+
+    RenderPass_Count,
+};
+
+// MARK: Structs
+
+struct draw_packet_t
+{
+    uint64_t key;
+    unsigned int index;
+};
+
+struct render_queue_t
+{
+    draw_packet_t packets[RENDER_QUEUE_MAX_PACKETS];
+    draw_packet_t scratch[RENDER_QUEUE_MAX_PACKETS];
+    unsigned int count;
+};
+
+// MARK: Functions
+
+// Quantizes a view space distance in [0, far] to the key depth range
+inline uint64_t
+RenderKeyDepth (float depth, float far)
+{
+    float t = HMM_Clamp (0.f, depth/far, 1.f);
+    return ((uint64_t) (t*(float) RENDER_KEY_DEPTH_MAX));
+}
+
+inline uint64_t
+RenderKeyOpaque (unsigned int shader, unsigned int vao, float depth, float far)
+{
+    return (((uint64_t) RenderPass_Opaque << 62) |
+            ((uint64_t) (shader & 0xff) << 54) |
+            ((uint64_t) (vao & 0xffff) << 38) |
+            (RenderKeyDepth (depth, far) << 14));
+}
+
+inline uint64_t
+RenderKeyBlended (unsigned int shader, unsigned int vao, float depth, float far)
+{
+    uint64_t backToFront = RENDER_KEY_DEPTH_MAX - RenderKeyDepth (depth, far);
+    return (((uint64_t) RenderPass_Blended << 62) |
+            (backToFront << 38) |
+            ((uint64_t) (shader & 0xff) << 30) |
+            ((uint64_t) (vao & 0xffff) << 14));
+}
+
+inline render_pass_t
+RenderKeyPass (uint64_t key)
+{
+    return ((render_pass_t) (key >> 62));
+}
+
+inline void
+RenderQueueReset (render_queue_t *queue)
+{
+    queue->count = 0;
+}
+
+inline void
+RenderQueuePush (render_queue_t *queue, uint64_t key, unsigned int index)
+{
+    assert (queue->count < RENDER_QUEUE_MAX_PACKETS);
+
+    draw_packet_t *packet = queue->packets + queue->count++;
+    packet->key = key;
+    packet->index = index;
+}
+
+// LSD radix sort on bytes, stable, bytes that are equal in every key are
+// skipped so typical frames only pay for a few passes
+static void
+RenderQueueSort (render_queue_t *queue)
+{
+    unsigned int count = queue->count;
+    if (count < 2)
+    {
+        return;
+    }
+
+    uint64_t allOr = 0, allAnd = ~(uint64_t) 0;
+    for (unsigned int i=0 ; i<count ; i++)
+    {
+        allOr |= queue->packets[i].key;
+        allAnd &= queue->packets[i].key;
+    }
+    uint64_t varying = allOr ^ allAnd;
+
+    draw_packet_t *src = queue->packets;
+    draw_packet_t *dst = queue->scratch;
+
+    for (int shift=0 ; shift<64 ; shift+=8)
+    {
+        if (((varying >> shift) & 0xff) == 0)
+        {
+            continue;
+        }
+
+        unsigned int offsets[256] = {};
+        for (unsigned int i=0 ; i<count ; i++)
+        {
+            offsets[(src[i].key >> shift) & 0xff]++;
+        }
+
+        unsigned int sum = 0;
+        for (int b=0 ; b<256 ; b++)
+        {
+            unsigned int n = offsets[b];
+            offsets[b] = sum;
+            sum += n;
+        }
+
+        for (unsigned int i=0 ; i<count ; i++)
+        {
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+
+        draw_packet_t *t = src; src = dst; dst = t;
+    }
+
+    if (src != queue->packets)
+    {
+        memcpy (queue->packets, src, sizeof (draw_packet_t)*count);
+    }
+}
@@ -0,0 +1,292 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_scan_mesh.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Welded, structure of arrays mesh representation used by the load time
+// processing stages, built from the tinyobj attributes before the GPU upload.
+//
+
+// MARK: Includes
+
+#include <algorithm>
+#include <chrono>
+
+// MARK: Structs
+
+struct scan_mesh_t
+{
+    // Welded vertices, one entry per OBJ position (SoA)
+    unsigned int vertexCount;
+    unsigned int vertexCapacity;
+    float *px, *py, *pz;
+    float *nx, *ny, *nz;
+
+    // Three welded vertex indices per triangle
+    unsigned int triangleCount;
+    unsigned int triangleCapacity;
+    unsigned int *triangles;
+
+    // Vertex to neighbour vertex adjacency (CSR)
+    unsigned int *neighbourStart;
+    unsigned int *neighbours;
+
+    // Vertex to incident triangle adjacency (CSR)
+    unsigned int *triangleStart;
+    unsigned int *vertexTriangles;
+};
+
+// MARK: Utility Functions
+
+inline double
+ScanMeshMilliseconds (std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::high_resolution_clock::now () - start;
+    return (elapsed.count ());
+}
+
+static void
+ScanMeshReserve (scan_mesh_t *mesh,
+                 unsigned int vertexCapacity, unsigned int triangleCapacity)
+{
+    if (vertexCapacity > mesh->vertexCapacity)
+    {
+        float **streams[] = {
+            &mesh->px, &mesh->py, &mesh->pz,
+            &mesh->nx, &mesh->ny, &mesh->nz,
+        };
+        for (int i=0 ; i<6 ; i++)
+        {
+            *streams[i] = (float *) realloc (*streams[i],
+                                             sizeof (float)*vertexCapacity);
+        }
+        mesh->vertexCapacity = vertexCapacity;
+    }
+
+    if (triangleCapacity > mesh->triangleCapacity)
+    {
+        mesh->triangles =
+            (unsigned int *) realloc (mesh->triangles,
+                                      sizeof (unsigned int)*3*triangleCapacity);
+        mesh->triangleCapacity = triangleCapacity;
+    }
+}
+
+static void
+FreeScanMeshAdjacency (scan_mesh_t *mesh)
+{
+    free (mesh->neighbourStart);
+    free (mesh->neighbours);
+    free (mesh->triangleStart);
+    free (mesh->vertexTriangles);
+
+    mesh->neighbourStart = NULL;
+    mesh->neighbours = NULL;
+    mesh->triangleStart = NULL;
+    mesh->vertexTriangles = NULL;
+}
+
+static void
+FreeScanMesh (scan_mesh_t *mesh)
+{
+    FreeScanMeshAdjacency (mesh);
+
+    free (mesh->px); free (mesh->py); free (mesh->pz);
+    free (mesh->nx); free (mesh->ny); free (mesh->nz);
+    free (mesh->triangles);
+
+    *mesh = {};
+}
+
+// Welds by OBJ position index and fan triangulates polygons
+static void
+ScanMeshFromObj (scan_mesh_t *mesh, tinyobj_attrib_t *attrib)
+{
+    *mesh = {};
+
+    unsigned int triangleCount = 0;
+    for (unsigned int i=0 ; i<attrib->num_face_num_verts ; i++)
+    {
+        int faceVerts = attrib->face_num_verts[i];
+        triangleCount += (faceVerts > 2) ? (faceVerts - 2) : 0;
+    }
+
+    ScanMeshReserve (mesh, attrib->num_vertices, triangleCount);
+    mesh->vertexCount = attrib->num_vertices;
+
+    for (unsigned int i=0 ; i<attrib->num_vertices ; i++)
+    {
+        mesh->px[i] = attrib->vertices[i*3 + 0];
+        mesh->py[i] = attrib->vertices[i*3 + 1];
+        mesh->pz[i] = attrib->vertices[i*3 + 2];
+
+        mesh->nx[i] = 0.f;
+        mesh->ny[i] = 0.f;
+        mesh->nz[i] = 0.f;
+    }
+
+    unsigned int faceStart = 0;
+    for (unsigned int i=0 ; i<attrib->num_face_num_verts ; i++)
+    {
+        int faceVerts = attrib->face_num_verts[i];
+        tinyobj_vertex_index_t *face = attrib->faces + faceStart;
+
+        // Keep the authored normals, the last corner referencing wins
+        for (int k=0 ; k<faceVerts ; k++)
+        {
+            if (face[k].vn_idx != TINYOBJ_INVALID_INDEX)
+            {
+                float *normal = attrib->normals + face[k].vn_idx*3;
+                mesh->nx[face[k].v_idx] = normal[0];
+                mesh->ny[face[k].v_idx] = normal[1];
+                mesh->nz[face[k].v_idx] = normal[2];
+            }
+        }
+
+        for (int k=2 ; k<faceVerts ; k++)
+        {
+            unsigned int *tri = mesh->triangles + mesh->triangleCount*3;
+            tri[0] = face[0].v_idx;
+            tri[1] = face[k - 1].v_idx;
+            tri[2] = face[k].v_idx;
+            mesh->triangleCount++;
+        }
+
+        faceStart += faceVerts;
+    }
+}
+
+// Builds the vertex/vertex and vertex/triangle CSR tables. Must be called
+// again whenever triangles are added.
+static void
+ScanMeshBuildAdjacency (scan_mesh_t *mesh)
+{
+    FreeScanMeshAdjacency (mesh);
+
+    unsigned int vertexCount = mesh->vertexCount;
+    unsigned int triangleCount = mesh->triangleCount;
+
+    mesh->triangleStart =
+        (unsigned int *) calloc (vertexCount + 1, sizeof (unsigned int));
+    mesh->vertexTriangles =
+        (unsigned int *) malloc (sizeof (unsigned int)*triangleCount*3);
+
+    for (unsigned int i=0 ; i<triangleCount*3 ; i++)
+    {
+        mesh->triangleStart[mesh->triangles[i] + 1]++;
+    }
+    for (unsigned int i=0 ; i<vertexCount ; i++)
+    {
+        mesh->triangleStart[i + 1] += mesh->triangleStart[i];
+    }
+
+    unsigned int *cursor =
+        (unsigned int *) malloc (sizeof (unsigned int)*(vertexCount + 1));
+    memcpy (cursor, mesh->triangleStart,
+            sizeof (unsigned int)*(vertexCount + 1));
+    for (unsigned int i=0 ; i<triangleCount*3 ; i++)
+    {
+        mesh->vertexTriangles[cursor[mesh->triangles[i]]++] = i/3;
+    }
+
+    // Each incident triangle adds at most two neighbours, dedup afterwards
+    unsigned int *rawStart = mesh->triangleStart;
+    unsigned int *raw =
+        (unsigned int *) malloc (sizeof (unsigned int)*triangleCount*6);
+    unsigned int *counts =
+        (unsigned int *) malloc (sizeof (unsigned int)*vertexCount);
+
+    ParallelFor (vertexCount, 4096, [&] (unsigned int start, unsigned int end) {
+        for (unsigned int v=start ; v<end ; v++)
+        {
+            unsigned int *out = raw + rawStart[v]*2;
+            unsigned int n = 0;
+
+            for (unsigned int t=rawStart[v] ; t<rawStart[v + 1] ; t++)
+            {
+                unsigned int *tri = mesh->triangles + mesh->vertexTriangles[t]*3;
+                for (int k=0 ; k<3 ; k++)
+                {
+                    if (tri[k] != v)
+                    {
+                        out[n++] = tri[k];
+                    }
+                }
+            }
+
+            std::sort (out, out + n);
+            counts[v] = (unsigned int) (std::unique (out, out + n) - out);
+        }
+    });
+
+    mesh->neighbourStart =
+        (unsigned int *) malloc (sizeof (unsigned int)*(vertexCount + 1));
+    mesh->neighbourStart[0] = 0;
+    for (unsigned int i=0 ; i<vertexCount ; i++)
+    {
+        mesh->neighbourStart[i + 1] = mesh->neighbourStart[i] + counts[i];
+    }
+
+    mesh->neighbours = (unsigned int *)
+        malloc (sizeof (unsigned int)*(mesh->neighbourStart[vertexCount] + 1));
+
+    ParallelFor (vertexCount, 4096, [&] (unsigned int start, unsigned int end) {
+        for (unsigned int v=start ; v<end ; v++)
+        {
+            memcpy (mesh->neighbours + mesh->neighbourStart[v],
+                    raw + rawStart[v]*2, sizeof (unsigned int)*counts[v]);
+        }
+    });
+
+    free (counts);
+    free (raw);
+    free (cursor);
+}
+
+// Area weighted vertex normals from the vertex/triangle adjacency for the
+// vertices [first, first + count)
+static void
+ScanMeshComputeNormalsRange (scan_mesh_t *mesh,
+                             const float *px, const float *py, const float *pz,
+                             unsigned int first, unsigned int count)
+{
+    ParallelFor (count, 4096, [&] (unsigned int start, unsigned int end) {
+        for (unsigned int v=first + start ; v<first + end ; v++)
+        {
+            float nx = 0.f, ny = 0.f, nz = 0.f;
+
+            for (unsigned int t=mesh->triangleStart[v] ;
+                 t<mesh->triangleStart[v + 1] ; t++)
+            {
+                unsigned int *tri = mesh->triangles + mesh->vertexTriangles[t]*3;
+
+                float ax = px[tri[1]] - px[tri[0]];
+                float ay = py[tri[1]] - py[tri[0]];
+                float az = pz[tri[1]] - pz[tri[0]];
+                float bx = px[tri[2]] - px[tri[0]];
+                float by = py[tri[2]] - py[tri[0]];
+                float bz = pz[tri[2]] - pz[tri[0]];
+
+                nx += ay*bz - az*by;
+                ny += az*bx - ax*bz;
+                nz += ax*by - ay*bx;
+            }
+
+            float length = sqrtf (nx*nx + ny*ny + nz*nz);
+            float scale = (length > 0.f) ? (1.f/length) : 0.f;
+
+            mesh->nx[v] = nx*scale;
+            mesh->ny[v] = ny*scale;
+            mesh->nz[v] = nz*scale;
+        }
+    });
+}
+
+inline void
+ScanMeshComputeNormals (scan_mesh_t *mesh,
+                        const float *px, const float *py, const float *pz)
+{
+    ScanMeshComputeNormalsRange (mesh, px, py, pz, 0, mesh->vertexCount);
+}
@@ -0,0 +1,249 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_shader_variants.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Shader variants built from one vertex and fragment source pair by
+// defining a feature macro per bit of a feature mask. Features whose macro
+// appears in neither stage are dropped before hashing, so masks that only
+// differ in features the sources ignore end up with the same source and
+// the same program. Compiling is started here and finished later: with
+// GL_KHR_parallel_shader_compile the driver works on it in the background
+// and the caller polls for completion, otherwise the first poll waits.
+//
+
+// MARK: Constants
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// MARK: Enums
+
+enum shader_feature_t
+{
+    ShaderFeature_Instanced = (1 << 0),
+
+    ShaderFeature_Count = 1,
+};
+
+// MARK: Structs
+
+struct shader_variant_source_t
+{
+    char *vertex;
+    char *fragment;
+
+    // Requested features the sources actually use
+    unsigned int features;
+    unsigned long long key;
+};
+
+struct shader_compiler_t
+{
+    int parallel;
+};
+
+// MARK: Globals
+
+static shader_compiler_t g_shaderCompiler;
+
+// Indexed by the bit of a shader_feature_t
+static const char *g_shaderFeatureMacros[ShaderFeature_Count] = {
+    "INSTANCED",
+};
+
+// MARK: Functions
+
+static void
+InitShaderCompiler (shader_compiler_t *compiler)
+{
+    compiler->parallel = 0;
+
+    GLint extensionCount = 0;
+    glGetIntegerv (GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i=0 ; i<extensionCount ; i++)
+    {
+        const char *extension = (const char *) glGetStringi (GL_EXTENSIONS, i);
+        if (extension != NULL &&
+            (strcmp (extension, "GL_KHR_parallel_shader_compile") == 0 ||
+             strcmp (extension, "GL_ARB_parallel_shader_compile") == 0))
+        {
+            compiler->parallel = 1;
+        }
+    }
+}
+
+static char *
+ShaderVariantSource (const char *prefix, ztr_file_t *file)
+{
+    int prefixSize = (int) strlen (prefix);
+    int size = (int) file->dataSize + prefixSize;
+    char *source = (char *) malloc (size + 1);
+    memcpy (source, prefix, prefixSize);
+    memcpy (source + prefixSize, file->data, file->dataSize);
+    source[size] = '\0';
+    return (source);
+}
+
+inline int
+ShaderIdentifierChar (char c)
+{
+    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_');
+}
+
+// Names a feature used by a stage, the file data is not terminated. Only
+// whole identifiers count, INSTANCED does not match INSTANCED_COLOR
+static int
+ShaderVariantUses (ztr_file_t *file, const char *macro)
+{
+    const char *data = (const char *) file->data;
+    size_t size = file->dataSize;
+    size_t length = strlen (macro);
+    for (size_t i=0 ; i + length <= size ; i++)
+    {
+        if (memcmp (data + i, macro, length) == 0 &&
+            (i == 0 || !ShaderIdentifierChar (data[i - 1])) &&
+            (i + length == size || !ShaderIdentifierChar (data[i + length])))
+        {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+// Returns 0 when either stage can not be read
+static int
+ShaderVariantBuildSources (shader_variant_source_t *source,
+                           const char *versionString,
+                           const char *vertexFileName,
+                           const char *fragmentFileName,
+                           unsigned int features)
+{
+    ztr_file_t vertexFile = g_platform->openFile (vertexFileName);
+    ztr_file_t fragmentFile = g_platform->openFile (fragmentFileName);
+    if (vertexFile.data == NULL || fragmentFile.data == NULL)
+    {
+        printf ("Could not load shader %s %s\n", vertexFileName, fragmentFileName);
+        return (0);
+    }
+
+    // Variant defines go right after the version line, in bit order so a
+    // mask always gives the same text
+    char prefix[SHADER_PREFIX_SIZE];
+    int prefixSize = snprintf (prefix, sizeof (prefix), "%s", versionString);
+    source->features = 0;
+    for (int bit=0 ; bit<ShaderFeature_Count ; bit++)
+    {
+        const char *macro = g_shaderFeatureMacros[bit];
+        if ((features & (1u << bit)) &&
+            (ShaderVariantUses (&vertexFile, macro) ||
+             ShaderVariantUses (&fragmentFile, macro)))
+        {
+            prefixSize += snprintf (prefix + prefixSize, sizeof (prefix) - prefixSize,
+                                    "#define %s 1\n", macro);
+            source->features |= 1u << bit;
+        }
+    }
+    assert (prefixSize < SHADER_PREFIX_SIZE);
+
+    source->vertex = ShaderVariantSource (prefix, &vertexFile);
+    source->fragment = ShaderVariantSource (prefix, &fragmentFile);
+    source->key = ProgramCacheKey (&g_programCache, source->vertex,
+                                   source->fragment, NULL);
+    return (1);
+}
+
+inline void
+ShaderVariantFreeSources (shader_variant_source_t *source)
+{
+    free (source->vertex);
+    free (source->fragment);
+    source->vertex = NULL;
+    source->fragment = NULL;
+}
+
+// Issues compile and link without asking for any result, so a parallel
+// compiler is never waited on here
+static GLuint
+ShaderVariantCompile (shader_variant_source_t *source, GLuint *stages)
+{
+    stages[0] = glCreateShader (GL_VERTEX_SHADER);
+    stages[1] = glCreateShader (GL_FRAGMENT_SHADER);
+    glShaderSource (stages[0], 1, (const GLchar **) &source->vertex, NULL);
+    glShaderSource (stages[1], 1, (const GLchar **) &source->fragment, NULL);
+    glCompileShader (stages[0]);
+    glCompileShader (stages[1]);
+
+    GLuint program = glCreateProgram ();
+    glAttachShader (program, stages[0]);
+    glAttachShader (program, stages[1]);
+    glProgramParameteri (program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram (program);
+    return (program);
+}
+
+inline int
+ShaderVariantCompiled (shader_compiler_t *compiler, GLuint program)
+{
+    if (!compiler->parallel)
+    {
+        return (1);
+    }
+
+    GLint completed = GL_FALSE;
+    glGetProgramiv (program, GL_COMPLETION_STATUS_KHR, &completed);
+    return (completed == GL_TRUE);
+}
+
+static void
+ShaderVariantPrintLog (GLuint object, int isProgram)
+{
+    GLint infoLogLength = 0;
+    if (isProgram)
+    {
+        glGetProgramiv (object, GL_INFO_LOG_LENGTH, &infoLogLength);
+    }
+    else
+    {
+        glGetShaderiv (object, GL_INFO_LOG_LENGTH, &infoLogLength);
+    }
+
+    if (infoLogLength > 0)
+    {
+        std::vector<char> message (infoLogLength + 1);
+        if (isProgram)
+        {
+            glGetProgramInfoLog (object, infoLogLength, NULL, &message[0]);
+        }
+        else
+        {
+            glGetShaderInfoLog (object, infoLogLength, NULL, &message[0]);
+        }
+        printf ("%s\n", &message[0]);
+    }
+}
+
+// Waits for the link when it is still running, prints the logs and drops
+// the stages. Returns the link status
+static int
+ShaderVariantLink (GLuint program, GLuint *stages)
+{
+    ShaderVariantPrintLog (stages[0], 0);
+    ShaderVariantPrintLog (stages[1], 0);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv (program, GL_LINK_STATUS, &linked);
+    ShaderVariantPrintLog (program, 1);
+
+    for (int i=0 ; i<2 ; i++)
+    {
+        glDetachShader (program, stages[i]);
+        glDeleteShader (stages[i]);
+        stages[i] = 0;
+    }
+
+    return (linked == GL_TRUE);
+}
@@ -16,6 +16,7 @@
 #import <CoreText/CoreText.h>
 
 #include <sys/mman.h>
+#include <mach/mach_time.h>
 
 @interface RenderView ()
 {
@@ -67,6 +68,48 @@ PLATFORM_OPEN_FILE (openFile)
     return (result);
 }
 
+// The caches directory is private to the app and may be purged by the system
+static NSString *
+cacheFilePath (const char *fileName)
+{
+    NSString *directory =
+        NSSearchPathForDirectoriesInDomains (NSCachesDirectory,
+                                             NSUserDomainMask, YES).firstObject;
+    return [directory stringByAppendingPathComponent:
+                [NSString stringWithUTF8String:fileName]];
+}
+
+PLATFORM_READ_CACHE_FILE (readCacheFile)
+{
+    ztr_file_t result = {};
+
+    NSData *data = [NSData dataWithContentsOfFile:cacheFilePath (fileName)];
+    if (data.length > 0)
+    {
+        result.data = malloc (data.length);
+        memcpy (result.data, data.bytes, data.length);
+        result.dataSize = (unsigned int) data.length;
+    }
+
+    return (result);
+}
+
+PLATFORM_WRITE_CACHE_FILE (writeCacheFile)
+{
+    NSData *contents = [NSData dataWithBytes:data length:dataSize];
+    return ([contents writeToFile:cacheFilePath (fileName) atomically:YES] ? 1 : 0);
+}
+
+PLATFORM_GET_TIME (getTime)
+{
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+    {
+        mach_timebase_info (&timebase);
+    }
+    return ((double) mach_absolute_time ()*timebase.numer/timebase.denom*1e-9);
+}
+
 - (void) setup
 {
 
@@ -141,6 +184,9 @@ PLATFORM_OPEN_FILE (openFile)
     [self addGestureRecognizer:pinchGestureRecognizer];
 
     g_platform.openFile = openFile;
+    g_platform.readCacheFile = readCacheFile;
+    g_platform.writeCacheFile = writeCacheFile;
+    g_platform.getTime = getTime;
 
     ztrInit(&g_platform);
     ztrResize (0, backingWidth, backingHeight);
@@ -154,6 +200,8 @@ PLATFORM_OPEN_FILE (openFile)
 
 - (void) doubleTapAction:(NSIndexPath *)indexPath
 {
+    [self wakeDisplayLink];
+
     g_hid.doubleTap = 1;
 
     // Disable normal input
@@ -165,6 +213,8 @@ PLATFORM_OPEN_FILE (openFile)
 
 - (void) pinchZoomAction:(UIPinchGestureRecognizer *)recognizer
 {
+    [self wakeDisplayLink];
+
     switch (recognizer.state)
     {
         case UIGestureRecognizerStateBegan:
@@ -229,19 +279,32 @@ PLATFORM_OPEN_FILE (openFile)
 
     glBindFramebuffer(GL_FRAMEBUFFER, _defaultFBOName);
 
-    ztrDraw(0, g_hid);
+    int frame = ztrDraw(0, g_hid);
 
     g_hid.mouseTransition = 0;
     g_hid.doubleTap = 0;
     g_hid.pinchZoomTransition = 0;
 
-    glBindRenderbuffer(GL_RENDERBUFFER, _colorRenderbuffer);
+    // An unchanged frame is not presented, the layer keeps showing the last
+    // one. With nothing animating the display link sleeps until input
+    if (frame & ZTR_FRAME_DRAWN)
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, _colorRenderbuffer);
+
+        [_context presentRenderbuffer:GL_RENDERBUFFER];
+    }
 
-    [_context presentRenderbuffer:GL_RENDERBUFFER];
+    _displayLink.paused = !(frame & ZTR_FRAME_ANIMATING);
+}
+
+- (void) wakeDisplayLink
+{
+    _displayLink.paused = NO;
 }
 
 - (void) layoutSubviews
 {
+    ztrInvalidate();
     [self drawView:nil];
 }
 
@@ -292,6 +355,7 @@ UITouch *currentTouch = nil;
 - (void) touchesBegan:(NSSet<UITouch *> *)touches withEvent:(UIEvent *)event
 {
     [super touchesBegan:touches withEvent:event];
+    [self wakeDisplayLink];
 
     g_hid.mouseTransition = 1;
     g_hid.mouseDown = 1;
@@ -318,6 +382,7 @@ UITouch *currentTouch = nil;
 - (void) touchesMoved:(NSSet<UITouch *> *)touches withEvent:(UIEvent *)event
 {
     [super touchesMoved:touches withEvent:event];
+    [self wakeDisplayLink];
 
     CGFloat scale = UIScreen.mainScreen.scale;
 
@@ -339,6 +404,7 @@ UITouch *currentTouch = nil;
 - (void)touchesEnded:(NSSet<UITouch *> *)touches withEvent:(UIEvent *)event
 {
     [super touchesEnded:touches withEvent:event];
+    [self wakeDisplayLink];
 
     for(UITouch *touch in event.allTouches) {
 
@@ -0,0 +1,980 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// daemon.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Render service. Starting a renderer costs far more than a render: ztrInit
+// creates the context, links the programs and processes a mesh before the
+// first frame. The daemon pays that once per worker and then serves render
+// jobs from clients on a Unix socket, see ztr_daemon.h for the protocol.
+//
+// Each worker is a forked process with a warm context, since the layer
+// keeps one scene per process, and the mesh it has loaded is its entry of
+// the mesh cache. The parent queues the jobs and hands them out so the
+// cache hits: an idle worker first takes the oldest job for the mesh it
+// already has, a job whose mesh is loaded on a busy worker waits a little
+// for that worker, and only then does the least recently used idle worker
+// load the mesh. Workers read the pixels straight into a slot of the image
+// pool shared with the clients, so results are never copied.
+//
+
+#include "ztr_platform_abstraction_layer.h"
+#include "ztr_daemon.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "ztr_headless.cpp"
+
+// MARK: Constants
+
+#define DAEMON_WORKERS_DEFAULT 2
+#define DAEMON_SLOTS_DEFAULT 32
+#define DAEMON_MAX_SIZE_DEFAULT 1024
+
+#define DAEMON_MAX_WORKERS 32
+#define DAEMON_MAX_CLIENTS 64
+
+// Jobs past this are answered with DaemonStatus_Busy
+#define DAEMON_QUEUE_LIMIT 4096
+
+// Time a job waits for the busy worker that has its mesh before an idle
+// worker loads the mesh as well
+#define DAEMON_AFFINITY_MILLISECONDS 50
+
+// Jobs between two reports of the queue metrics
+#define DAEMON_REPORT_INTERVAL 1000
+
+// Workers that die this many times in a row without a good render are not
+// started again, so a broken context does not fork forever
+#define DAEMON_RESPAWN_LIMIT 8
+
+// MARK: Enums
+
+enum slot_state_t
+{
+    SlotState_Free,
+    SlotState_Rendering,
+
+    // Holds a result until its client releases it
+    SlotState_Held,
+};
+
+// MARK: Structs
+
+struct options_t
+{
+    const char *socketPath;
+    const char *resourcePath;
+    int workers;
+    int slots;
+    int maxSize;
+    int verbose;
+};
+
+struct daemon_job_t
+{
+    daemon_request_t request;
+
+    // Socket of the client, -1 once it disconnected
+    int client;
+
+    std::chrono::high_resolution_clock::time_point received;
+    float waitMilliseconds;
+};
+
+// Worker to parent, the job goes the other way as a daemon_request_t with
+// its slot filled in
+struct worker_result_t
+{
+    int status;
+
+    // Set when the job had to load its mesh
+    float loadMilliseconds;
+    float renderMilliseconds;
+};
+
+struct daemon_worker_t
+{
+    pid_t pid;
+    int socket;
+    int alive;
+
+    // Deaths since the last good render
+    int failures;
+
+    int busy;
+    daemon_job_t job;
+
+    // Loaded mesh, the worker's entry of the mesh cache
+    char meshPath[DAEMON_PATH_SIZE];
+    unsigned long long lastUsed;
+};
+
+// Since the last report
+struct daemon_stats_t
+{
+    std::chrono::high_resolution_clock::time_point start;
+
+    // From the request arriving to the result being sent, and the queued
+    // part of it
+    std::vector<float> latencies;
+    std::vector<float> waits;
+
+    unsigned int jobs;
+    unsigned int failed;
+    unsigned int rejected;
+    unsigned int hits;
+    unsigned int loads;
+    float loadTotal;
+
+    // Jobs already queued when a request arrives
+    unsigned long long depthTotal;
+    unsigned int depthSamples;
+    unsigned int depthMax;
+};
+
+struct daemon_t
+{
+    options_t options;
+    int listenSocket;
+
+    // Image pool shared with the workers and every client
+    int poolFile;
+    unsigned char *pool;
+    unsigned int slotSize;
+    std::vector<unsigned char> slotStates;
+    std::vector<int> slotOwners;
+
+    std::vector<int> clients;
+    std::deque<daemon_job_t> queue;
+
+    daemon_worker_t workers[DAEMON_MAX_WORKERS];
+    int workerCount;
+    unsigned long long dispatches;
+
+    daemon_stats_t stats;
+};
+
+// MARK: Globals
+
+static volatile sig_atomic_t g_stop;
+
+static ztr_platform_api_t g_platform;
+static headless_t g_headless;
+static daemon_t g_daemon;
+
+// MARK: Worker
+
+// Renders jobs until the parent closes the socket
+static int
+RunWorker (daemon_t *daemon, int worker, int socket)
+{
+    // The parent handles Ctrl-C and then closes the socket
+    signal (SIGINT, SIG_IGN);
+    signal (SIGTERM, SIG_IGN);
+    if (!daemon->options.verbose)
+    {
+        freopen ("/dev/null", "w", stdout);
+    }
+
+    HeadlessSetPaths (daemon->options.resourcePath);
+    HeadlessPlatform (&g_platform);
+    if (!HeadlessCreate (&g_headless, daemon->options.maxSize, daemon->options.maxSize))
+    {
+        fprintf (stderr, "Worker %d has no context\n", worker);
+        return (1);
+    }
+    ztrInit (&g_platform);
+    ztrResize (&g_platform, g_headless.width, g_headless.height);
+
+    char meshPath[DAEMON_PATH_SIZE] = "";
+    daemon_request_t request;
+    for (;;)
+    {
+        ssize_t size = recv (socket, &request, sizeof (request), 0);
+        if (size < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (size != (ssize_t) sizeof (request))
+        {
+            break;
+        }
+
+        worker_result_t result = {};
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now ();
+        if (strcmp (meshPath, request.meshPath) != 0)
+        {
+            int loaded = ztrLoad (&g_platform, request.meshPath, NULL);
+            memcpy (meshPath, loaded ? request.meshPath : "", loaded ? DAEMON_PATH_SIZE : 1);
+            result.loadMilliseconds = Milliseconds (start);
+            result.status = loaded ? DaemonStatus_Ok : DaemonStatus_LoadFailed;
+        }
+
+        if (result.status == DaemonStatus_Ok)
+        {
+            start = std::chrono::high_resolution_clock::now ();
+            if (request.width != g_headless.width || request.height != g_headless.height)
+            {
+                HeadlessResize (&g_headless, request.width, request.height);
+                ztrResize (&g_platform, request.width, request.height);
+            }
+            HeadlessDrawPose (request.yaw, request.pitch, request.orthScale);
+            HeadlessReadPixels (&g_headless,
+                                daemon->pool + (size_t) request.slot*daemon->slotSize);
+            result.renderMilliseconds = Milliseconds (start);
+            if (glGetError () != GL_NO_ERROR)
+            {
+                result.status = DaemonStatus_RenderFailed;
+            }
+        }
+
+        send (socket, &result, sizeof (result), MSG_NOSIGNAL);
+    }
+
+    ztrFree ();
+    HeadlessDestroy (&g_headless);
+    return (0);
+}
+
+// Forks a worker into the given entry, returns 0 when that failed. The
+// child keeps only its own end of its socket
+static int
+DaemonSpawnWorker (daemon_t *daemon, daemon_worker_t *worker)
+{
+    int sockets[2];
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0)
+    {
+        return (0);
+    }
+
+    // Workers inherit the pool mapping, contexts are made after the fork
+    fflush (stdout);
+    int index = (int) (worker - daemon->workers);
+    pid_t pid = fork ();
+    if (pid == 0)
+    {
+        close (sockets[0]);
+        for (int i=0 ; i<DAEMON_MAX_WORKERS ; i++)
+        {
+            if (daemon->workers[i].alive)
+            {
+                close (daemon->workers[i].socket);
+            }
+        }
+        for (size_t c=0 ; c<daemon->clients.size () ; c++)
+        {
+            close (daemon->clients[c]);
+        }
+        if (daemon->listenSocket >= 0)
+        {
+            close (daemon->listenSocket);
+        }
+        int status = RunWorker (daemon, index, sockets[1]);
+        fflush (stdout);
+        _exit (status);
+    }
+    close (sockets[1]);
+    if (pid < 0)
+    {
+        close (sockets[0]);
+        return (0);
+    }
+
+    *worker = {};
+    worker->pid = pid;
+    worker->socket = sockets[0];
+    worker->alive = 1;
+    return (1);
+}
+
+// MARK: Metrics
+
+inline float
+Percentile (std::vector<float> &sorted, int percent)
+{
+    return (sorted[(sorted.size () - 1)*percent/100]);
+}
+
+static void
+DaemonReport (daemon_t *daemon)
+{
+    daemon_stats_t *stats = &daemon->stats;
+    if (stats->latencies.empty ())
+    {
+        return;
+    }
+
+    float seconds = Milliseconds (stats->start)*0.001f;
+    std::sort (stats->latencies.begin (), stats->latencies.end ());
+    std::sort (stats->waits.begin (), stats->waits.end ());
+    printf ("%u jobs in %.1f s, %.1f jobs/s, latency p50 %.2f p95 %.2f p99 %.2f "
+            "max %.2f ms, queued p50 %.2f p95 %.2f ms\n",
+            stats->jobs, seconds, stats->jobs/std::max (seconds, 1e-3f),
+            Percentile (stats->latencies, 50), Percentile (stats->latencies, 95),
+            Percentile (stats->latencies, 99), stats->latencies.back (),
+            Percentile (stats->waits, 50), Percentile (stats->waits, 95));
+    printf ("Queue depth %.2f average %u max, mesh cache %u hits %u loads of "
+            "%.2f ms, %u failed %u rejected\n",
+            (stats->depthSamples > 0) ?
+            (float) stats->depthTotal/stats->depthSamples : 0.f, stats->depthMax,
+            stats->hits, stats->loads,
+            (stats->loads > 0) ? stats->loadTotal/stats->loads : 0.f,
+            stats->failed, stats->rejected);
+    fflush (stdout);
+
+    *stats = {};
+    stats->start = std::chrono::high_resolution_clock::now ();
+}
+
+// MARK: Clients
+
+inline void
+DaemonRespond (int client, daemon_response_t *response)
+{
+    // A client that went away is noticed when its socket is polled
+    send (client, response, sizeof (*response), MSG_NOSIGNAL);
+}
+
+// The pool's file descriptor rides along with the first message
+static void
+DaemonSendHello (daemon_t *daemon, int client)
+{
+    daemon_response_t response = {};
+    response.type = DaemonMessage_Hello;
+    response.slotCount = (unsigned int) daemon->slotStates.size ();
+    response.slotSize = daemon->slotSize;
+    response.maxSize = daemon->options.maxSize;
+
+    struct iovec data = { &response, sizeof (response) };
+    char control[CMSG_SPACE (sizeof (int))] = {};
+    struct msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof (control);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR (&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (header), &daemon->poolFile, sizeof (int));
+
+    sendmsg (client, &message, MSG_NOSIGNAL);
+}
+
+static void
+DaemonAccept (daemon_t *daemon)
+{
+    int client = accept (daemon->listenSocket, NULL, NULL);
+    if (client < 0)
+    {
+        return;
+    }
+    if (daemon->clients.size () >= DAEMON_MAX_CLIENTS)
+    {
+        close (client);
+        return;
+    }
+
+    daemon->clients.push_back (client);
+    DaemonSendHello (daemon, client);
+}
+
+// Drops the client's queued jobs and slots, jobs being rendered finish
+// and free their slot
+static void
+DaemonDisconnect (daemon_t *daemon, size_t index)
+{
+    int client = daemon->clients[index];
+    close (client);
+    daemon->clients.erase (daemon->clients.begin () + index);
+
+    for (size_t j=daemon->queue.size () ; j>0 ; j--)
+    {
+        if (daemon->queue[j - 1].client == client)
+        {
+            daemon->queue.erase (daemon->queue.begin () + (j - 1));
+        }
+    }
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        if (daemon->workers[w].busy && daemon->workers[w].job.client == client)
+        {
+            daemon->workers[w].job.client = -1;
+        }
+    }
+    for (size_t s=0 ; s<daemon->slotStates.size () ; s++)
+    {
+        if (daemon->slotOwners[s] == client)
+        {
+            daemon->slotOwners[s] = -1;
+            if (daemon->slotStates[s] == SlotState_Held)
+            {
+                daemon->slotStates[s] = SlotState_Free;
+            }
+        }
+    }
+}
+
+// Returns 0 when the client is gone
+static int
+DaemonReceive (daemon_t *daemon, int client)
+{
+    daemon_request_t request;
+    ssize_t size = recv (client, &request, sizeof (request), 0);
+    if (size < 0 && errno == EINTR)
+    {
+        return (1);
+    }
+    if (size <= 0)
+    {
+        return (0);
+    }
+
+    if (size == (ssize_t) sizeof (request) && request.type == DaemonMessage_Release)
+    {
+        unsigned int slot = request.slot;
+        if (slot < daemon->slotStates.size () &&
+            daemon->slotStates[slot] == SlotState_Held &&
+            daemon->slotOwners[slot] == client)
+        {
+            daemon->slotStates[slot] = SlotState_Free;
+            daemon->slotOwners[slot] = -1;
+        }
+        return (1);
+    }
+
+    daemon_response_t response = {};
+    response.type = DaemonMessage_Result;
+    response.id = request.id;
+
+    request.meshPath[DAEMON_PATH_SIZE - 1] = '\0';
+    int maxSize = daemon->options.maxSize;
+    if (size != (ssize_t) sizeof (request) || request.type != DaemonMessage_Render ||
+        request.width <= 0 || request.width > maxSize ||
+        request.height <= 0 || request.height > maxSize ||
+        request.meshPath[0] != '/')
+    {
+        response.status = DaemonStatus_BadRequest;
+        DaemonRespond (client, &response);
+        return (1);
+    }
+
+    daemon_stats_t *stats = &daemon->stats;
+    unsigned int depth = (unsigned int) daemon->queue.size ();
+    stats->depthTotal += depth;
+    stats->depthSamples++;
+    stats->depthMax = std::max (stats->depthMax, depth);
+
+    if (depth >= DAEMON_QUEUE_LIMIT)
+    {
+        stats->rejected++;
+        response.status = DaemonStatus_Busy;
+        DaemonRespond (client, &response);
+        return (1);
+    }
+
+    daemon_job_t job;
+    job.request = request;
+    job.client = client;
+    job.received = std::chrono::high_resolution_clock::now ();
+    job.waitMilliseconds = 0.f;
+    daemon->queue.push_back (job);
+    return (1);
+}
+
+// MARK: Scheduling
+
+inline int
+DaemonFreeSlot (daemon_t *daemon)
+{
+    for (size_t s=0 ; s<daemon->slotStates.size () ; s++)
+    {
+        if (daemon->slotStates[s] == SlotState_Free)
+        {
+            return ((int) s);
+        }
+    }
+    return (-1);
+}
+
+// Loaded on a worker that is rendering
+static int
+DaemonMeshBusy (daemon_t *daemon, const char *meshPath)
+{
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        daemon_worker_t *worker = daemon->workers + w;
+        if (worker->alive && worker->busy && strcmp (worker->meshPath, meshPath) == 0)
+        {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+// Idle worker that was used least recently, NULL when all are busy
+static daemon_worker_t *
+DaemonIdleWorker (daemon_t *daemon)
+{
+    daemon_worker_t *result = NULL;
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        daemon_worker_t *worker = daemon->workers + w;
+        if (worker->alive && !worker->busy &&
+            (result == NULL || worker->lastUsed < result->lastUsed))
+        {
+            result = worker;
+        }
+    }
+    return (result);
+}
+
+// Answers the worker's job and frees it for the next
+static void
+DaemonFinish (daemon_t *daemon, daemon_worker_t *worker, worker_result_t *result)
+{
+    daemon_job_t *job = &worker->job;
+    unsigned int slot = job->request.slot;
+    worker->busy = 0;
+
+    daemon_stats_t *stats = &daemon->stats;
+    if (result->loadMilliseconds > 0.f)
+    {
+        stats->loads++;
+        stats->loadTotal += result->loadMilliseconds;
+    }
+    else
+    {
+        stats->hits++;
+    }
+    if (result->status == DaemonStatus_LoadFailed)
+    {
+        worker->meshPath[0] = '\0';
+    }
+    if (result->status == DaemonStatus_Ok)
+    {
+        worker->failures = 0;
+    }
+
+    daemon_response_t response = {};
+    response.type = DaemonMessage_Result;
+    response.id = job->request.id;
+    response.status = result->status;
+    response.slot = slot;
+    response.width = job->request.width;
+    response.height = job->request.height;
+    response.waitMilliseconds = job->waitMilliseconds;
+    response.renderMilliseconds = result->renderMilliseconds;
+
+    if (job->client >= 0 && result->status == DaemonStatus_Ok)
+    {
+        daemon->slotStates[slot] = SlotState_Held;
+    }
+    else
+    {
+        daemon->slotStates[slot] = SlotState_Free;
+        daemon->slotOwners[slot] = -1;
+    }
+    if (job->client >= 0)
+    {
+        DaemonRespond (job->client, &response);
+    }
+
+    stats->jobs++;
+    stats->failed += (result->status != DaemonStatus_Ok);
+    stats->latencies.push_back (Milliseconds (job->received));
+    stats->waits.push_back (job->waitMilliseconds);
+    if (stats->jobs == DAEMON_REPORT_INTERVAL)
+    {
+        DaemonReport (daemon);
+    }
+}
+
+// A worker that died takes its mesh with it, its job fails. The process is
+// reaped and a fresh worker takes its place with an empty mesh cache
+static void
+DaemonLoseWorker (daemon_t *daemon, daemon_worker_t *worker)
+{
+    worker->alive = 0;
+    close (worker->socket);
+    worker->socket = -1;
+    if (worker->busy)
+    {
+        worker_result_t result = {};
+        result.status = DaemonStatus_RenderFailed;
+        DaemonFinish (daemon, worker, &result);
+    }
+
+    // Killed in case only its socket broke
+    kill (worker->pid, SIGKILL);
+    waitpid (worker->pid, NULL, 0);
+    printf ("Worker %d exited\n", (int) worker->pid);
+    worker->pid = 0;
+
+    int failures = worker->failures + 1;
+    if (g_stop || failures >= DAEMON_RESPAWN_LIMIT)
+    {
+        return;
+    }
+    if (DaemonSpawnWorker (daemon, worker))
+    {
+        worker->failures = failures;
+        printf ("Worker %d started\n", (int) worker->pid);
+    }
+}
+
+// Returns 0 when the worker is gone, the job is then queued again
+static int
+DaemonSend (daemon_t *daemon, daemon_worker_t *worker, size_t index, int slot)
+{
+    daemon_job_t job = daemon->queue[index];
+    daemon->queue.erase (daemon->queue.begin () + index);
+
+    job.request.slot = (unsigned int) slot;
+    job.waitMilliseconds = Milliseconds (job.received);
+    if (send (worker->socket, &job.request, sizeof (job.request), MSG_NOSIGNAL) !=
+        (ssize_t) sizeof (job.request))
+    {
+        daemon->queue.push_front (job);
+        DaemonLoseWorker (daemon, worker);
+        return (0);
+    }
+
+    daemon->slotStates[slot] = SlotState_Rendering;
+    daemon->slotOwners[slot] = job.client;
+    worker->busy = 1;
+    worker->job = job;
+    worker->lastUsed = ++daemon->dispatches;
+    memcpy (worker->meshPath, job.request.meshPath, DAEMON_PATH_SIZE);
+    return (1);
+}
+
+static void
+DaemonDispatch (daemon_t *daemon)
+{
+    // Hits first, an idle worker takes the oldest job for its mesh
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        daemon_worker_t *worker = daemon->workers + w;
+        if (!worker->alive || worker->busy || worker->meshPath[0] == '\0')
+        {
+            continue;
+        }
+        for (size_t j=0 ; j<daemon->queue.size () ; j++)
+        {
+            if (strcmp (daemon->queue[j].request.meshPath, worker->meshPath) == 0)
+            {
+                int slot = DaemonFreeSlot (daemon);
+                if (slot >= 0)
+                {
+                    DaemonSend (daemon, worker, j, slot);
+                }
+                break;
+            }
+        }
+    }
+
+    // Then loads, skipping jobs that can still wait for their busy worker
+    for (;;)
+    {
+        daemon_worker_t *worker = DaemonIdleWorker (daemon);
+        int slot = DaemonFreeSlot (daemon);
+        if (worker == NULL || slot < 0)
+        {
+            break;
+        }
+
+        size_t j = 0;
+        while (j < daemon->queue.size () &&
+               Milliseconds (daemon->queue[j].received) < DAEMON_AFFINITY_MILLISECONDS &&
+               DaemonMeshBusy (daemon, daemon->queue[j].request.meshPath))
+        {
+            j++;
+        }
+        if (j == daemon->queue.size ())
+        {
+            break;
+        }
+        DaemonSend (daemon, worker, j, slot);
+    }
+}
+
+// MARK: Main
+
+static void
+Stop (int)
+{
+    g_stop = 1;
+}
+
+static void
+PrintUsage (const char *program)
+{
+    printf ("Usage: %s [--socket path] [--workers N] [--slots N] [--max-size pixels] "
+            "[--res dir] [--verbose]\n", program);
+}
+
+// Returns 0 on an unknown or incomplete argument
+static int
+ParseOptions (options_t *options, int argc, char **argv)
+{
+    *options = {};
+    options->socketPath = DAEMON_SOCKET_DEFAULT;
+    options->workers = DAEMON_WORKERS_DEFAULT;
+    options->slots = DAEMON_SLOTS_DEFAULT;
+    options->maxSize = DAEMON_MAX_SIZE_DEFAULT;
+
+    for (int i=1 ; i<argc ; i++)
+    {
+        const char *argument = argv[i];
+        if (strcmp (argument, "--verbose") == 0)
+        {
+            options->verbose = 1;
+            continue;
+        }
+
+        const char *value = (i + 1 < argc) ? argv[++i] : NULL;
+        if (value == NULL)
+        {
+            return (0);
+        }
+
+        if (strcmp (argument, "--socket") == 0)
+        {
+            options->socketPath = value;
+        }
+        else if (strcmp (argument, "--workers") == 0)
+        {
+            options->workers = atoi (value);
+        }
+        else if (strcmp (argument, "--slots") == 0)
+        {
+            options->slots = atoi (value);
+        }
+        else if (strcmp (argument, "--max-size") == 0)
+        {
+            options->maxSize = atoi (value);
+        }
+        else if (strcmp (argument, "--res") == 0)
+        {
+            options->resourcePath = value;
+        }
+        else
+        {
+            return (0);
+        }
+    }
+
+    options->workers = std::max (1, std::min (options->workers, DAEMON_MAX_WORKERS));
+    return (options->slots > 0 && options->maxSize > 0 &&
+            strlen (options->socketPath) < sizeof (((struct sockaddr_un *) 0)->sun_path));
+}
+
+// Returns 0 when the pool, the socket or every worker failed
+static int
+DaemonStart (daemon_t *daemon)
+{
+    options_t *options = &daemon->options;
+
+    daemon->slotSize = (unsigned int) options->maxSize*options->maxSize*4;
+    size_t poolSize = (size_t) daemon->slotSize*options->slots;
+    daemon->poolFile = memfd_create ("ztr-daemon-pool", MFD_CLOEXEC);
+    if (daemon->poolFile < 0 || ftruncate (daemon->poolFile, poolSize) != 0)
+    {
+        printf ("Could not create a %zu byte image pool\n", poolSize);
+        return (0);
+    }
+    daemon->pool = (unsigned char *) mmap (NULL, poolSize, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED, daemon->poolFile, 0);
+    if (daemon->pool == MAP_FAILED)
+    {
+        printf ("Could not map the image pool\n");
+        return (0);
+    }
+    daemon->slotStates.assign (options->slots, SlotState_Free);
+    daemon->slotOwners.assign (options->slots, -1);
+
+    for (int w=0 ; w<options->workers ; w++)
+    {
+        if (!DaemonSpawnWorker (daemon, daemon->workers + daemon->workerCount))
+        {
+            break;
+        }
+        daemon->workerCount++;
+    }
+    if (daemon->workerCount == 0)
+    {
+        printf ("Could not start any worker\n");
+        return (0);
+    }
+
+    // A socket file left by a daemon that did not exit cleanly is replaced
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, options->socketPath);
+    unlink (options->socketPath);
+    daemon->listenSocket = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (daemon->listenSocket < 0 ||
+        bind (daemon->listenSocket, (struct sockaddr *) &address, sizeof (address)) != 0 ||
+        listen (daemon->listenSocket, DAEMON_MAX_CLIENTS) != 0)
+    {
+        printf ("Could not listen on %s\n", options->socketPath);
+        return (0);
+    }
+
+    printf ("Listening on %s with %d workers, %d slots of up to %dx%d\n",
+            options->socketPath, daemon->workerCount, options->slots,
+            options->maxSize, options->maxSize);
+    fflush (stdout);
+    return (1);
+}
+
+static void
+DaemonStop (daemon_t *daemon)
+{
+    DaemonReport (daemon);
+
+    for (size_t c=0 ; c<daemon->clients.size () ; c++)
+    {
+        close (daemon->clients[c]);
+    }
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        if (daemon->workers[w].socket >= 0)
+        {
+            close (daemon->workers[w].socket);
+        }
+    }
+    for (int w=0 ; w<daemon->workerCount ; w++)
+    {
+        if (daemon->workers[w].pid > 0)
+        {
+            waitpid (daemon->workers[w].pid, NULL, 0);
+        }
+    }
+
+    if (daemon->listenSocket > 0)
+    {
+        close (daemon->listenSocket);
+        unlink (daemon->options.socketPath);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    daemon_t *daemon = &g_daemon;
+    if (!ParseOptions (&daemon->options, argc, argv))
+    {
+        PrintUsage (argv[0]);
+        return (1);
+    }
+
+    // No SA_RESTART, so the signal wakes poll
+    struct sigaction action = {};
+    action.sa_handler = Stop;
+    sigaction (SIGINT, &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    signal (SIGPIPE, SIG_IGN);
+
+    daemon->listenSocket = -1;
+    if (!DaemonStart (daemon))
+    {
+        DaemonStop (daemon);
+        return (1);
+    }
+    daemon->stats.start = std::chrono::high_resolution_clock::now ();
+
+    std::vector<struct pollfd> fds;
+    while (!g_stop)
+    {
+        // Listening socket, then the workers, then the clients
+        fds.clear ();
+        struct pollfd listen = { daemon->listenSocket, POLLIN, 0 };
+        fds.push_back (listen);
+        int alive = 0;
+        for (int w=0 ; w<daemon->workerCount ; w++)
+        {
+            struct pollfd worker = { daemon->workers[w].socket,
+                                     (short) (daemon->workers[w].alive ? POLLIN : 0), 0 };
+            fds.push_back (worker);
+            alive += daemon->workers[w].alive;
+        }
+        for (size_t c=0 ; c<daemon->clients.size () ; c++)
+        {
+            struct pollfd client = { daemon->clients[c], POLLIN, 0 };
+            fds.push_back (client);
+        }
+        if (alive == 0)
+        {
+            printf ("No workers left\n");
+            break;
+        }
+
+        // Jobs held back for a busy worker's mesh are looked at again soon
+        int timeout = -1;
+        if (!daemon->queue.empty () && DaemonIdleWorker (daemon) != NULL &&
+            DaemonFreeSlot (daemon) >= 0)
+        {
+            timeout = DAEMON_AFFINITY_MILLISECONDS/2;
+        }
+        if (poll (&fds[0], fds.size (), timeout) < 0)
+        {
+            continue;
+        }
+
+        for (int w=0 ; w<daemon->workerCount ; w++)
+        {
+            daemon_worker_t *worker = daemon->workers + w;
+            if (!worker->alive || !(fds[1 + w].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+
+            worker_result_t result;
+            ssize_t size = recv (worker->socket, &result, sizeof (result), 0);
+            if (size == (ssize_t) sizeof (result) && worker->busy)
+            {
+                DaemonFinish (daemon, worker, &result);
+            }
+            else if (size == 0 || (size < 0 && errno != EINTR))
+            {
+                DaemonLoseWorker (daemon, worker);
+            }
+        }
+
+        // Backwards, a client that left is removed from the list
+        size_t clientBase = 1 + daemon->workerCount;
+        for (size_t c=daemon->clients.size () ; c>0 ; c--)
+        {
+            if ((fds[clientBase + c - 1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                !DaemonReceive (daemon, daemon->clients[c - 1]))
+            {
+                DaemonDisconnect (daemon, c - 1);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            DaemonAccept (daemon);
+        }
+
+        DaemonDispatch (daemon);
+    }
+
+    DaemonStop (daemon);
+    return (0);
+}
@@ -0,0 +1,356 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// daemon_client.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Stand-in for a server talking to ztr-daemon, and its load test. Keeps a
+// number of random renders in flight, checks every image in the shared pool
+// and releases its slot, then prints throughput and latency as seen from
+// the client. Needs no GL, all rendering happens in the daemon.
+//
+
+#include "ztr_daemon.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// MARK: Constants
+
+#define CLIENT_MAX_MESHES 16
+
+// MARK: Structs
+
+struct options_t
+{
+    const char *socketPath;
+    int requests;
+    int concurrency;
+    int width;
+    int height;
+    unsigned int seed;
+
+    // First good image is written here
+    const char *outputPath;
+
+    std::vector<std::string> meshPaths;
+};
+
+// MARK: Functions
+
+inline float
+Milliseconds (std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<float, std::milli> duration =
+        std::chrono::high_resolution_clock::now () - start;
+    return (duration.count ());
+}
+
+inline float
+Percentile (std::vector<float> &sorted, int percent)
+{
+    return (sorted.empty () ? 0.f : sorted[(sorted.size () - 1)*percent/100]);
+}
+
+inline float
+RandomRange (float min, float max)
+{
+    return (min + (max - min)*(float) rand ()/RAND_MAX);
+}
+
+static void
+PrintUsage (const char *program)
+{
+    printf ("Usage: %s --mesh model.obj [--mesh ...] [--socket path] [--requests N] "
+            "[--concurrency N] [--width W] [--height H] [--out first.ppm] [--seed N]\n",
+            program);
+}
+
+// Returns 0 on an unknown or incomplete argument
+static int
+ParseOptions (options_t *options, int argc, char **argv)
+{
+    options->socketPath = DAEMON_SOCKET_DEFAULT;
+    options->requests = 100;
+    options->concurrency = 4;
+    options->width = 256;
+    options->height = 256;
+    options->seed = 1;
+    options->outputPath = NULL;
+
+    char directory[PATH_MAX];
+    if (getcwd (directory, sizeof (directory)) == NULL)
+    {
+        return (0);
+    }
+
+    for (int i=1 ; i<argc ; i++)
+    {
+        const char *argument = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (value == NULL)
+        {
+            return (0);
+        }
+
+        if (strcmp (argument, "--mesh") == 0)
+        {
+            // The daemon does not share the working directory
+            std::string path = (value[0] == '/') ? value : std::string (directory) + "/" + value;
+            if (options->meshPaths.size () >= CLIENT_MAX_MESHES ||
+                path.size () >= DAEMON_PATH_SIZE)
+            {
+                return (0);
+            }
+            options->meshPaths.push_back (path);
+        }
+        else if (strcmp (argument, "--socket") == 0)
+        {
+            options->socketPath = value;
+        }
+        else if (strcmp (argument, "--requests") == 0)
+        {
+            options->requests = atoi (value);
+        }
+        else if (strcmp (argument, "--concurrency") == 0)
+        {
+            options->concurrency = atoi (value);
+        }
+        else if (strcmp (argument, "--width") == 0)
+        {
+            options->width = atoi (value);
+        }
+        else if (strcmp (argument, "--height") == 0)
+        {
+            options->height = atoi (value);
+        }
+        else if (strcmp (argument, "--out") == 0)
+        {
+            options->outputPath = value;
+        }
+        else if (strcmp (argument, "--seed") == 0)
+        {
+            options->seed = (unsigned int) atoi (value);
+        }
+        else
+        {
+            return (0);
+        }
+        i++;
+    }
+
+    return (!options->meshPaths.empty () && options->requests > 0 &&
+            options->concurrency > 0 && options->width > 0 && options->height > 0 &&
+            strlen (options->socketPath) < sizeof (((struct sockaddr_un *) 0)->sun_path));
+}
+
+// Returns the socket, the pool is mapped from the descriptor in the hello
+static int
+Connect (const char *socketPath, daemon_response_t *hello, unsigned char **pool)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, socketPath);
+    int result = socket (AF_UNIX, SOCK_SEQPACKET, 0);
+    if (result < 0 || connect (result, (struct sockaddr *) &address, sizeof (address)) != 0)
+    {
+        printf ("Could not connect to %s: %s\n", socketPath, strerror (errno));
+        return (-1);
+    }
+
+    struct iovec data = { hello, sizeof (*hello) };
+    char control[CMSG_SPACE (sizeof (int))] = {};
+    struct msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof (control);
+
+    struct cmsghdr *header = NULL;
+    if (recvmsg (result, &message, 0) == (ssize_t) sizeof (*hello) &&
+        hello->type == DaemonMessage_Hello)
+    {
+        header = CMSG_FIRSTHDR (&message);
+    }
+    if (header == NULL || header->cmsg_type != SCM_RIGHTS)
+    {
+        printf ("No image pool from the daemon\n");
+        close (result);
+        return (-1);
+    }
+
+    int poolFile;
+    memcpy (&poolFile, CMSG_DATA (header), sizeof (int));
+    *pool = (unsigned char *) mmap (NULL, (size_t) hello->slotCount*hello->slotSize,
+                                    PROT_READ, MAP_SHARED, poolFile, 0);
+    close (poolFile);
+    if (*pool == MAP_FAILED)
+    {
+        printf ("Could not map the image pool\n");
+        close (result);
+        return (-1);
+    }
+    return (result);
+}
+
+// An empty image means the mesh never reached the screen
+static int
+CountCovered (const unsigned char *rgba, int width, int height)
+{
+    int result = 0;
+    for (int i=0 ; i<width*height ; i++)
+    {
+        const unsigned char *pixel = rgba + i*4;
+        result += (pixel[0] < 250 || pixel[1] < 250 || pixel[2] < 250);
+    }
+    return (result);
+}
+
+static int
+WritePPM (const char *path, const unsigned char *rgba, int width, int height)
+{
+    FILE *file = fopen (path, "wb");
+    if (file == NULL)
+    {
+        printf ("Could not write %s\n", path);
+        return (0);
+    }
+
+    fprintf (file, "P6\n%d %d\n255\n", width, height);
+    for (int i=0 ; i<width*height ; i++)
+    {
+        fwrite (rgba + i*4, 1, 3, file);
+    }
+    return (fclose (file) == 0);
+}
+
+int
+main (int argc, char **argv)
+{
+    options_t options;
+    if (!ParseOptions (&options, argc, argv))
+    {
+        PrintUsage (argv[0]);
+        return (1);
+    }
+    srand (options.seed);
+
+    daemon_response_t hello;
+    unsigned char *pool = NULL;
+    int server = Connect (options.socketPath, &hello, &pool);
+    if (server < 0)
+    {
+        return (1);
+    }
+    if (options.width > hello.maxSize || options.height > hello.maxSize)
+    {
+        printf ("The daemon renders up to %dx%d\n", hello.maxSize, hello.maxSize);
+        return (1);
+    }
+
+    std::vector<std::chrono::high_resolution_clock::time_point> sent (options.requests);
+    std::vector<float> latencies;
+    std::vector<float> waits;
+    std::vector<float> renders;
+    int sentCount = 0;
+    int doneCount = 0;
+    int failed = 0;
+    int busy = 0;
+    int empty = 0;
+    int written = (options.outputPath == NULL);
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+    while (doneCount < options.requests)
+    {
+        while (sentCount < options.requests && sentCount - doneCount < options.concurrency)
+        {
+            daemon_request_t request = {};
+            request.type = DaemonMessage_Render;
+            request.id = (unsigned int) sentCount;
+            request.width = options.width;
+            request.height = options.height;
+            request.yaw = RandomRange (0.f, 360.f);
+            request.pitch = RandomRange (15.f, 88.f);
+            request.orthScale = RandomRange (0.4f, 0.75f);
+            const std::string &mesh = options.meshPaths[rand () % options.meshPaths.size ()];
+            memcpy (request.meshPath, mesh.c_str (), mesh.size () + 1);
+
+            sent[sentCount++] = std::chrono::high_resolution_clock::now ();
+            if (send (server, &request, sizeof (request), MSG_NOSIGNAL) != (ssize_t) sizeof (request))
+            {
+                printf ("Lost the daemon\n");
+                return (1);
+            }
+        }
+
+        daemon_response_t response;
+        ssize_t size = recv (server, &response, sizeof (response), 0);
+        if (size < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (size != (ssize_t) sizeof (response) || response.id >= (unsigned int) sentCount)
+        {
+            printf ("Lost the daemon\n");
+            return (1);
+        }
+        doneCount++;
+        latencies.push_back (Milliseconds (sent[response.id]));
+
+        if (response.status != DaemonStatus_Ok)
+        {
+            busy += (response.status == DaemonStatus_Busy);
+            failed += (response.status != DaemonStatus_Busy);
+            continue;
+        }
+        waits.push_back (response.waitMilliseconds);
+        renders.push_back (response.renderMilliseconds);
+
+        const unsigned char *pixels = pool + (size_t) response.slot*hello.slotSize;
+        if (CountCovered (pixels, response.width, response.height) == 0)
+        {
+            empty++;
+        }
+        else if (!written)
+        {
+            written = WritePPM (options.outputPath, pixels, response.width, response.height);
+            printf ("Wrote %s\n", options.outputPath);
+        }
+
+        daemon_request_t release = {};
+        release.type = DaemonMessage_Release;
+        release.id = response.id;
+        release.slot = response.slot;
+        send (server, &release, sizeof (release), MSG_NOSIGNAL);
+    }
+
+    float seconds = Milliseconds (start)*0.001f;
+    std::sort (latencies.begin (), latencies.end ());
+    std::sort (waits.begin (), waits.end ());
+    std::sort (renders.begin (), renders.end ());
+    printf ("%d renders at %dx%d with %d in flight in %.2f s, %.1f renders/s\n",
+            doneCount, options.width, options.height, options.concurrency, seconds,
+            doneCount/seconds);
+    printf ("Latency p50 %.2f p95 %.2f p99 %.2f max %.2f ms, queued p50 %.2f ms, "
+            "render p50 %.2f ms\n",
+            Percentile (latencies, 50), Percentile (latencies, 95),
+            Percentile (latencies, 99), Percentile (latencies, 100),
+            Percentile (waits, 50), Percentile (renders, 50));
+    printf ("%d failed, %d busy, %d empty\n", failed, busy, empty);
+
+    close (server);
+    return (failed > 0 || busy > 0 || empty > 0);
+}
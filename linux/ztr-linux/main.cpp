@@ -0,0 +1,471 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// main.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Renders the scene without a display and writes the image to a file, for
+// servers, CI and benchmarks. By default the intro animation is played to
+// its end and the still frame is saved. With --frames every frame is drawn
+// from scratch and timed, the first ones are left out of the statistics
+// while shaders and buffers warm up. With --sequence every drawn frame is
+// captured as well and written as a numbered image, the frames of a video.
+// Frames are read back asynchronously and encoded on other threads, the
+// format follows the extension of the path. With --instances the mesh is
+// replaced by a grid of smaller copies drawn with one instanced call, and
+// with --contour height lines are drawn that far apart. --footprint loads a
+// scan in place of the default one and draws its footprint on the ground.
+//
+
+#include "ztr_platform_abstraction_layer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "ztr_headless.cpp"
+#include "ztr_encoder.cpp"
+
+// MARK: Constants
+
+#define DEFAULT_WIDTH 1024
+#define DEFAULT_HEIGHT 768
+
+// Frames drawn before the intro animation is given up on
+#define MAX_INTRO_FRAMES 1000
+
+#define BENCHMARK_WARM_UP_FRAMES 10
+
+// Height lines in pixels
+#define CONTOUR_WIDTH 1.5f
+
+// Width and depth of the instance grid, about the size of the bunny
+#define INSTANCE_GRID_SIZE 1.2f
+
+// MARK: Structs
+
+struct options_t
+{
+    int width;
+    int height;
+
+    // 0 plays the intro to its end
+    int frames;
+
+    const char *outputPath;
+    const char *resourcePath;
+
+    // printf pattern of the frame number, NULL captures the last frame only
+    const char *sequencePath;
+
+    // Deflate level or JPEG quality, 0 for the default
+    int quality;
+
+    // 0 uses one per core
+    int encoders;
+
+    // Copies of the mesh in a grid, 0 draws it once
+    int instances;
+    float instanceAlpha;
+
+    // Spacing of height lines, 0 draws none
+    float contour;
+
+    // Scan loaded with its footprint drawn, relative to the resources
+    const char *footprintPath;
+};
+
+struct capture_stats_t
+{
+    unsigned int captured;
+    unsigned int written;
+    float encodeTotal;
+};
+
+// MARK: Globals
+
+static ztr_platform_api_t g_platform;
+static headless_t g_headless;
+static encoder_t g_encoder;
+static capture_stats_t g_captureStats;
+
+// Output of every capture, indexed by its tag
+static std::vector<std::string> g_capturePaths;
+
+// MARK: Functions
+
+static void
+PrintUsage (const char *program)
+{
+    printf ("Usage: %s [--width W] [--height H] [--frames N] [--out image.png] "
+            "[--sequence frames/%%05d.png] [--quality N] [--encoders N] [--instances N] [--instance-alpha A] [--contour spacing] [--footprint scan.obj] [--res dir]\n"
+            "Images are written as .png, .ppm%s\n", program,
+#ifdef ZTR_ENCODER_JPEG
+            " or .jpg"
+#else
+            ""
+#endif
+            );
+}
+
+// Returns 0 on an unknown or incomplete argument
+static int
+ParseOptions (options_t *options, int argc, char **argv)
+{
+    *options = {};
+    options->width = DEFAULT_WIDTH;
+    options->height = DEFAULT_HEIGHT;
+    options->outputPath = "ztr.ppm";
+    options->instanceAlpha = 1.f;
+
+    for (int i=1 ; i<argc ; i++)
+    {
+        const char *argument = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (value == NULL)
+        {
+            return (0);
+        }
+
+        if (strcmp (argument, "--width") == 0)
+        {
+            options->width = atoi (value);
+        }
+        else if (strcmp (argument, "--height") == 0)
+        {
+            options->height = atoi (value);
+        }
+        else if (strcmp (argument, "--frames") == 0)
+        {
+            options->frames = atoi (value);
+        }
+        else if (strcmp (argument, "--out") == 0)
+        {
+            options->outputPath = value;
+        }
+        else if (strcmp (argument, "--res") == 0)
+        {
+            options->resourcePath = value;
+        }
+        else if (strcmp (argument, "--sequence") == 0)
+        {
+            options->sequencePath = value;
+        }
+        else if (strcmp (argument, "--quality") == 0)
+        {
+            options->quality = atoi (value);
+        }
+        else if (strcmp (argument, "--encoders") == 0)
+        {
+            options->encoders = atoi (value);
+        }
+        else if (strcmp (argument, "--instances") == 0)
+        {
+            options->instances = atoi (value);
+        }
+        else if (strcmp (argument, "--instance-alpha") == 0)
+        {
+            options->instanceAlpha = (float) atof (value);
+        }
+        else if (strcmp (argument, "--contour") == 0)
+        {
+            options->contour = (float) atof (value);
+        }
+        else if (strcmp (argument, "--footprint") == 0)
+        {
+            options->footprintPath = value;
+        }
+        else
+        {
+            return (0);
+        }
+        i++;
+    }
+
+    return (options->width > 0 && options->height > 0 && options->frames >= 0 &&
+            options->encoders >= 0 && options->instances >= 0 &&
+            options->instanceAlpha >= 0.f && options->instanceAlpha <= 1.f &&
+            options->contour >= 0.f &&
+            EncoderFormat (options->outputPath) >= 0 &&
+            (options->sequencePath == NULL ||
+             (strchr (options->sequencePath, '%') != NULL &&
+              EncoderFormat (options->sequencePath) >= 0)));
+}
+
+static void
+SubmitCapture (ztr_capture_t *capture, int quality)
+{
+    const char *path = g_capturePaths[capture->tag].c_str ();
+    if (!EncoderSubmit (&g_encoder, capture, path,
+                        (image_format_t) EncoderFormat (path), quality))
+    {
+        ztrReleaseCapture (capture);
+    }
+}
+
+static void
+ReleaseEncoded (encode_result_t *encoded)
+{
+    ztrReleaseCapture (&encoded->capture);
+    g_captureStats.written += encoded->written;
+    g_captureStats.encodeTotal += encoded->milliseconds;
+}
+
+// Hands arrived readbacks to the encoder and releases the written ones.
+// With wait it blocks until one of the two happened. Returns 0 when there
+// was nothing to do
+static int
+PumpCaptures (int quality, int wait)
+{
+    int result = 0;
+    ztr_capture_t capture;
+    while (ztrFinishCapture (&capture, 0))
+    {
+        SubmitCapture (&capture, quality);
+        result = 1;
+    }
+    encode_result_t encoded;
+    while (EncoderCollect (&g_encoder, &encoded, 0))
+    {
+        ReleaseEncoded (&encoded);
+        result = 1;
+    }
+
+    // The oldest readback is due before any image the encoder still has
+    if (wait && !result)
+    {
+        if (ztrFinishCapture (&capture, 1))
+        {
+            SubmitCapture (&capture, quality);
+            result = 1;
+        }
+        else if (EncoderCollect (&g_encoder, &encoded, 1))
+        {
+            ReleaseEncoded (&encoded);
+            result = 1;
+        }
+    }
+    return (result);
+}
+
+// Queues the readback of the frame just drawn, waiting for a slot when the
+// encoder is behind
+static void
+CaptureFrame (const char *path, int quality)
+{
+    unsigned int tag = (unsigned int) g_capturePaths.size ();
+    g_capturePaths.push_back (path);
+    while (!ztrCapture (tag))
+    {
+        if (!PumpCaptures (quality, 1))
+        {
+            printf ("Could not capture %s\n", path);
+            return;
+        }
+    }
+    g_captureStats.captured++;
+    PumpCaptures (quality, 0);
+}
+
+// Numbered frame of the sequence, when there is one
+static void
+CaptureSequenceFrame (options_t *options, int frame)
+{
+    if (options->sequencePath != NULL)
+    {
+        char path[ENCODER_PATH_SIZE];
+        snprintf (path, sizeof (path), options->sequencePath, frame);
+        CaptureFrame (path, options->quality);
+    }
+}
+
+// Tiles the first mesh with count copies, scaled down to cover about the
+// area of the original on the ground, shaded from one corner to the other
+static int
+SetInstanceGrid (int count, float alpha)
+{
+    int side = 1;
+    while (side*side < count)
+    {
+        side++;
+    }
+
+    std::vector<ztr_instance_t> instances (count);
+    float scale = 1.f/side;
+    for (int i=0 ; i<count ; i++)
+    {
+        int column = i%side;
+        int row = i/side;
+        ztr_instance_t *instance = &instances[i];
+        *instance = {};
+        instance->model[0] = scale;
+        instance->model[5] = scale;
+        instance->model[10] = scale;
+        instance->model[12] = INSTANCE_GRID_SIZE*((column + 0.5f)*scale - 0.5f);
+        instance->model[14] = INSTANCE_GRID_SIZE*((row + 0.5f)*scale - 0.5f);
+        instance->model[15] = 1.f;
+        instance->color[0] = 0.3f + 0.7f*column/side;
+        instance->color[1] = 0.5f;
+        instance->color[2] = 0.3f + 0.7f*row/side;
+        instance->color[3] = alpha;
+    }
+    return (ztrSetInstances (0, instances.data (), (unsigned int) count));
+}
+
+// Draws until the intro animation is over and nothing moves any more
+static int
+DrawStill (options_t *options)
+{
+    ztr_hid_t hid = {};
+    int frames = 0;
+    int frame = ZTR_FRAME_ANIMATING;
+    while ((frame & ZTR_FRAME_ANIMATING) && frames < MAX_INTRO_FRAMES)
+    {
+        frame = ztrDraw (0, hid);
+        if (frame & ZTR_FRAME_DRAWN)
+        {
+            CaptureSequenceFrame (options, frames);
+        }
+        frames++;
+    }
+
+    // The settled frame may have been skipped as unchanged, the scale of
+    // the dynamic resolution is back to full for this one
+    ztrInvalidate ();
+    ztrDraw (0, hid);
+    CaptureSequenceFrame (options, frames);
+    CaptureFrame (options->outputPath, options->quality);
+    return (frames + 1);
+}
+
+// Every frame is drawn in full and waited for, so the time is the whole
+// frame on the CPU and the GPU
+static void
+DrawBenchmark (options_t *options)
+{
+    int frameCount = options->frames;
+    ztr_hid_t hid = {};
+    std::vector<float> times;
+    times.reserve (frameCount);
+
+    for (int i=0 ; i<frameCount + BENCHMARK_WARM_UP_FRAMES ; i++)
+    {
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now ();
+        ztrInvalidate ();
+        ztrDraw (0, hid);
+        CaptureSequenceFrame (options, i);
+        glFinish ();
+        if (i >= BENCHMARK_WARM_UP_FRAMES)
+        {
+            times.push_back (Milliseconds (start));
+        }
+    }
+
+    if (times.empty ())
+    {
+        return;
+    }
+
+    float total = 0.f;
+    for (size_t i=0 ; i<times.size () ; i++)
+    {
+        total += times[i];
+    }
+    std::sort (times.begin (), times.end ());
+    size_t last = times.size () - 1;
+    printf ("%d frames at %dx%d: %.2f ms average, %.2f ms p50, %.2f ms p95, "
+            "%.2f ms p99, %.2f ms max, %.1f fps\n",
+            frameCount, g_headless.width, g_headless.height,
+            total/times.size (), times[last*50/100], times[last*95/100],
+            times[last*99/100], times[last], 1000.f*times.size ()/total);
+
+    // The last frame is the image
+    CaptureFrame (options->outputPath, options->quality);
+}
+
+int
+main (int argc, char **argv)
+{
+    options_t options;
+    if (!ParseOptions (&options, argc, argv))
+    {
+        PrintUsage (argv[0]);
+        return (1);
+    }
+
+    HeadlessSetPaths (options.resourcePath);
+    HeadlessPlatform (&g_platform);
+    if (!HeadlessCreate (&g_headless, options.width, options.height))
+    {
+        return (1);
+    }
+    InitEncoder (&g_encoder, options.encoders);
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+    ztrInit (&g_platform);
+    ztrResize (&g_platform, options.width, options.height);
+    printf ("Initialized in %.2f ms\n", Milliseconds (start));
+
+    if (options.contour > 0.f)
+    {
+        static const float up[3] = { 0.f, 1.f, 0.f };
+        static const float color[3] = { 0.2f, 0.2f, 0.2f };
+        ztrSetContour (up, options.contour, 0.f, CONTOUR_WIDTH, color);
+    }
+
+    // Loading drops the instances, so the scan comes first
+    if (options.footprintPath != NULL)
+    {
+        ztrSetFootprintOverlay (1);
+        if (!ztrLoad (&g_platform, options.footprintPath, NULL))
+        {
+            printf ("Could not load %s\n", options.footprintPath);
+        }
+    }
+
+    if (options.instances > 0 &&
+        !SetInstanceGrid (options.instances, options.instanceAlpha))
+    {
+        printf ("Could not set instances\n");
+    }
+
+    if (options.frames > 0)
+    {
+        DrawBenchmark (&options);
+    }
+    else
+    {
+        start = std::chrono::high_resolution_clock::now ();
+        int frames = DrawStill (&options);
+        printf ("Still frame after %d frames in %.2f ms\n", frames, Milliseconds (start));
+    }
+
+    int result = 0;
+    GLenum error = glGetError ();
+    if (error != GL_NO_ERROR)
+    {
+        printf ("GL error 0x%x\n", error);
+        result = 1;
+    }
+
+    // Every capture is written and released before the renderer goes
+    start = std::chrono::high_resolution_clock::now ();
+    while (PumpCaptures (options.quality, 1))
+    {
+    }
+    printf ("Wrote %u of %u images, %.2f ms encoding on average with %u threads, "
+            "%.2f ms waiting at the end\n",
+            g_captureStats.written, g_captureStats.captured,
+            g_captureStats.encodeTotal/std::max (g_captureStats.captured, 1u),
+            g_encoder.threadCount, Milliseconds (start));
+    FreeEncoder (&g_encoder);
+    if (g_captureStats.written != g_captureStats.captured)
+    {
+        result = 1;
+    }
+
+    ztrFree ();
+    HeadlessDestroy (&g_headless);
+    return (result);
+}
@@ -0,0 +1,643 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// thumbnails.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Batch thumbnail renderer. Reads a manifest with one render per line:
+//
+//   # mesh             yaw    pitch  orthScale  [output]
+//   scans/0001_l.obj   44     48     0.7
+//   scans/0001_l.obj   134    30     0.6        0001_side.png
+//
+// and renders every line with N workers. The renderer keeps its state in
+// globals, one scene and one context per process, so each worker is a
+// forked process with its own headless context rather than a thread. The
+// parent parses the manifest while the workers render: consecutive lines
+// of the same mesh become one batch, handed to whichever worker asks first
+// through a shared packet socket, so a mesh is loaded once per batch.
+// Manifests sorted by mesh get the most out of it. Results come back on a
+// second socket and the parent prints the throughput at the end. Within a
+// worker the next pose is drawn while the last ones are read back and
+// encoded by its encoder threads.
+//
+
+#include "ztr_platform_abstraction_layer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "ztr_headless.cpp"
+#include "ztr_encoder.cpp"
+
+// MARK: Constants
+
+#define THUMBNAIL_WIDTH_DEFAULT 256
+#define THUMBNAIL_HEIGHT_DEFAULT 256
+
+#define THUMBNAIL_PATH_SIZE 512
+#define THUMBNAIL_BATCH_POSES 16
+#define THUMBNAIL_MAX_WORKERS 64
+
+// MARK: Structs
+
+struct options_t
+{
+    int width;
+    int height;
+    int workers;
+    int verbose;
+
+    // Threads per worker, and the deflate level or JPEG quality
+    int encoders;
+    int quality;
+    const char *format;
+
+    const char *manifestPath;
+    const char *outputPath;
+    const char *resourcePath;
+};
+
+struct thumbnail_pose_t
+{
+    float yaw;
+    float pitch;
+    float orthScale;
+
+    // Manifest line, names the render in results and errors
+    unsigned int line;
+    char outputPath[THUMBNAIL_PATH_SIZE];
+};
+
+// One packet on the job socket, only the used poses are sent
+struct thumbnail_batch_t
+{
+    char meshPath[THUMBNAIL_PATH_SIZE];
+    unsigned int count;
+    thumbnail_pose_t poses[THUMBNAIL_BATCH_POSES];
+};
+
+struct thumbnail_result_t
+{
+    unsigned int line;
+    int worker;
+    int ok;
+
+    // Load time of the mesh on the first pose of a batch that loaded one
+    float loadMilliseconds;
+    float renderMilliseconds;
+    float writeMilliseconds;
+};
+
+struct manifest_t
+{
+    FILE *file;
+    unsigned int line;
+    unsigned int skipped;
+    const char *outputPath;
+    const char *format;
+    char directory[THUMBNAIL_PATH_SIZE];
+
+    // Line read past the end of the last batch, it starts the next one
+    int hasPending;
+    char pendingMesh[THUMBNAIL_PATH_SIZE];
+    thumbnail_pose_t pending;
+};
+
+// MARK: Globals
+
+static ztr_platform_api_t g_platform;
+static headless_t g_headless;
+
+// MARK: Manifest
+
+// Mesh file name without directory and extension
+static void
+MeshBaseName (const char *meshPath, char *name, size_t nameSize)
+{
+    const char *slash = strrchr (meshPath, '/');
+    const char *start = (slash != NULL) ? slash + 1 : meshPath;
+    const char *dot = strrchr (start, '.');
+    size_t length = (dot != NULL) ? (size_t) (dot - start) : strlen (start);
+    length = std::min (length, nameSize - 1);
+    memcpy (name, start, length);
+    name[length] = '\0';
+}
+
+// Reads lines up to the next render. Returns 0 at the end of the manifest
+static int
+ManifestNextPose (manifest_t *manifest, char *meshPath, thumbnail_pose_t *pose)
+{
+    char line[4*THUMBNAIL_PATH_SIZE];
+    while (fgets (line, sizeof (line), manifest->file) != NULL)
+    {
+        manifest->line++;
+
+        const char *start = line;
+        while (*start == ' ' || *start == '\t')
+        {
+            start++;
+        }
+        if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0')
+        {
+            continue;
+        }
+
+        char mesh[THUMBNAIL_PATH_SIZE];
+        char output[THUMBNAIL_PATH_SIZE] = "";
+        *pose = {};
+        int fields = sscanf (start, "%511s %f %f %f %511s", mesh, &pose->yaw,
+                             &pose->pitch, &pose->orthScale, output);
+        if (fields < 4)
+        {
+            printf ("Manifest line %u: expected mesh yaw pitch orthScale [output]\n",
+                    manifest->line);
+            manifest->skipped++;
+            continue;
+        }
+        pose->line = manifest->line;
+
+        // openFile looks relative names up in the resource directory
+        int length = (mesh[0] == '/') ?
+            snprintf (meshPath, THUMBNAIL_PATH_SIZE, "%s", mesh) :
+            snprintf (meshPath, THUMBNAIL_PATH_SIZE, "%s/%s", manifest->directory, mesh);
+        if (fields == 5)
+        {
+            length = std::max (length, snprintf (pose->outputPath, THUMBNAIL_PATH_SIZE,
+                                                 "%s", output));
+        }
+        else
+        {
+            char name[THUMBNAIL_PATH_SIZE];
+            MeshBaseName (mesh, name, sizeof (name));
+            length = std::max (length, snprintf (pose->outputPath, THUMBNAIL_PATH_SIZE,
+                                                 "%s/%s_%u.%s", manifest->outputPath,
+                                                 name, manifest->line, manifest->format));
+        }
+        if (length >= THUMBNAIL_PATH_SIZE)
+        {
+            printf ("Manifest line %u: path too long\n", manifest->line);
+            manifest->skipped++;
+            continue;
+        }
+        if (EncoderFormat (pose->outputPath) < 0)
+        {
+            printf ("Manifest line %u: unknown image format\n", manifest->line);
+            manifest->skipped++;
+            continue;
+        }
+
+        return (1);
+    }
+
+    return (0);
+}
+
+// Consecutive renders of one mesh, up to THUMBNAIL_BATCH_POSES. Returns 0
+// when the manifest is done
+static int
+ManifestNextBatch (manifest_t *manifest, thumbnail_batch_t *batch)
+{
+    batch->count = 0;
+    if (!manifest->hasPending &&
+        !ManifestNextPose (manifest, manifest->pendingMesh, &manifest->pending))
+    {
+        return (0);
+    }
+
+    memcpy (batch->meshPath, manifest->pendingMesh, THUMBNAIL_PATH_SIZE);
+    batch->poses[batch->count++] = manifest->pending;
+    manifest->hasPending = 0;
+
+    while (batch->count < THUMBNAIL_BATCH_POSES)
+    {
+        if (!ManifestNextPose (manifest, manifest->pendingMesh, &manifest->pending))
+        {
+            break;
+        }
+        if (strcmp (manifest->pendingMesh, batch->meshPath) != 0)
+        {
+            manifest->hasPending = 1;
+            break;
+        }
+        batch->poses[batch->count++] = manifest->pending;
+    }
+
+    return (1);
+}
+
+// MARK: Worker
+
+// Hands arrived readbacks of the batch to the encoder and reports written
+// ones. With wait it blocks until one of the two happened. Returns 0 when
+// there was nothing to do
+static int
+PumpCaptures (encoder_t *encoder, thumbnail_batch_t *batch, thumbnail_result_t *results,
+              int resultSocket, options_t *options, int wait)
+{
+    int result = 0;
+    for (int pass=0 ; pass<=wait && !result ; pass++)
+    {
+        ztr_capture_t capture;
+        if (ztrFinishCapture (&capture, pass))
+        {
+            const char *path = batch->poses[capture.tag].outputPath;
+            if (!EncoderSubmit (encoder, &capture, path,
+                                (image_format_t) EncoderFormat (path), options->quality))
+            {
+                ztrReleaseCapture (&capture);
+                send (resultSocket, results + capture.tag, sizeof (*results), MSG_NOSIGNAL);
+            }
+            result = 1;
+            continue;
+        }
+
+        encode_result_t encoded;
+        if (EncoderCollect (encoder, &encoded, pass))
+        {
+            ztrReleaseCapture (&encoded.capture);
+            thumbnail_result_t *written = results + encoded.capture.tag;
+            written->ok = encoded.written;
+            written->writeMilliseconds = encoded.milliseconds;
+            send (resultSocket, written, sizeof (*written), MSG_NOSIGNAL);
+            result = 1;
+        }
+    }
+    return (result);
+}
+
+// Renders batches until the parent closes the job socket
+static int
+RunWorker (int worker, int jobSocket, int resultSocket, options_t *options)
+{
+    // Every worker prints the same start up report
+    if (!options->verbose)
+    {
+        freopen ("/dev/null", "w", stdout);
+    }
+
+    HeadlessSetPaths (options->resourcePath);
+    HeadlessPlatform (&g_platform);
+    if (!HeadlessCreate (&g_headless, options->width, options->height))
+    {
+        fprintf (stderr, "Worker %d has no context\n", worker);
+        return (1);
+    }
+
+    ztrInit (&g_platform);
+    ztrResize (&g_platform, options->width, options->height);
+
+    encoder_t *encoder = new encoder_t ();
+    InitEncoder (encoder, options->encoders);
+    thumbnail_result_t results[THUMBNAIL_BATCH_POSES];
+
+    char loadedMesh[THUMBNAIL_PATH_SIZE] = "";
+    int loaded = 0;
+
+    thumbnail_batch_t batch;
+    for (;;)
+    {
+        ssize_t size = recv (jobSocket, &batch, sizeof (batch), 0);
+        if (size < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (size < (ssize_t) offsetof (thumbnail_batch_t, poses))
+        {
+            break;
+        }
+
+        float loadMilliseconds = 0.f;
+        if (!loaded || strcmp (loadedMesh, batch.meshPath) != 0)
+        {
+            std::chrono::high_resolution_clock::time_point start =
+                std::chrono::high_resolution_clock::now ();
+            loaded = ztrLoad (&g_platform, batch.meshPath, NULL);
+            memcpy (loadedMesh, batch.meshPath, THUMBNAIL_PATH_SIZE);
+            loadMilliseconds = Milliseconds (start);
+            if (!loaded)
+            {
+                fprintf (stderr, "Could not load %s\n", batch.meshPath);
+            }
+        }
+
+        for (unsigned int p=0 ; p<batch.count ; p++)
+        {
+            thumbnail_pose_t *pose = batch.poses + p;
+            thumbnail_result_t *result = results + p;
+            *result = {};
+            result->line = pose->line;
+            result->worker = worker;
+            result->loadMilliseconds = loadMilliseconds;
+            loadMilliseconds = 0.f;
+
+            if (!loaded)
+            {
+                send (resultSocket, result, sizeof (*result), MSG_NOSIGNAL);
+                continue;
+            }
+
+            // The capture waits for a slot when the encoder is behind
+            std::chrono::high_resolution_clock::time_point start =
+                std::chrono::high_resolution_clock::now ();
+            HeadlessDrawPose (pose->yaw, pose->pitch, pose->orthScale);
+            int captured;
+            while (!(captured = ztrCapture (p)) &&
+                   PumpCaptures (encoder, &batch, results, resultSocket, options, 1))
+            {
+            }
+            result->renderMilliseconds = Milliseconds (start);
+            if (!captured)
+            {
+                send (resultSocket, result, sizeof (*result), MSG_NOSIGNAL);
+            }
+            while (PumpCaptures (encoder, &batch, results, resultSocket, options, 0))
+            {
+            }
+        }
+
+        // Captures point into this batch, it is done before the next one
+        while (PumpCaptures (encoder, &batch, results, resultSocket, options, 1))
+        {
+        }
+    }
+
+    FreeEncoder (encoder);
+    delete encoder;
+    ztrFree ();
+    HeadlessDestroy (&g_headless);
+    return (0);
+}
+
+// MARK: Main
+
+static void
+PrintUsage (const char *program)
+{
+    printf ("Usage: %s --manifest renders.txt [--workers N] [--width W] "
+            "[--height H] [--out dir] [--format png|jpg|ppm] [--quality N] "
+            "[--encoders N] [--res dir] [--verbose]\n"
+            "Manifest lines: mesh yaw pitch orthScale [output], '-' reads stdin\n",
+            program);
+}
+
+// Returns 0 on an unknown or incomplete argument
+static int
+ParseOptions (options_t *options, int argc, char **argv)
+{
+    *options = {};
+    options->width = THUMBNAIL_WIDTH_DEFAULT;
+    options->height = THUMBNAIL_HEIGHT_DEFAULT;
+    options->workers = (int) sysconf (_SC_NPROCESSORS_ONLN);
+    options->outputPath = "thumbnails";
+    options->format = "ppm";
+    options->encoders = 1;
+
+    for (int i=1 ; i<argc ; i++)
+    {
+        const char *argument = argv[i];
+        if (strcmp (argument, "--verbose") == 0)
+        {
+            options->verbose = 1;
+            continue;
+        }
+
+        const char *value = (i + 1 < argc) ? argv[++i] : NULL;
+        if (value == NULL)
+        {
+            return (0);
+        }
+
+        if (strcmp (argument, "--manifest") == 0)
+        {
+            options->manifestPath = value;
+        }
+        else if (strcmp (argument, "--workers") == 0)
+        {
+            options->workers = atoi (value);
+        }
+        else if (strcmp (argument, "--width") == 0)
+        {
+            options->width = atoi (value);
+        }
+        else if (strcmp (argument, "--height") == 0)
+        {
+            options->height = atoi (value);
+        }
+        else if (strcmp (argument, "--out") == 0)
+        {
+            options->outputPath = value;
+        }
+        else if (strcmp (argument, "--res") == 0)
+        {
+            options->resourcePath = value;
+        }
+        else if (strcmp (argument, "--format") == 0)
+        {
+            options->format = value;
+        }
+        else if (strcmp (argument, "--quality") == 0)
+        {
+            options->quality = atoi (value);
+        }
+        else if (strcmp (argument, "--encoders") == 0)
+        {
+            options->encoders = atoi (value);
+        }
+        else
+        {
+            return (0);
+        }
+    }
+
+    options->workers = std::max (1, std::min (options->workers, THUMBNAIL_MAX_WORKERS));
+    std::string format = std::string (".") + options->format;
+    return (options->manifestPath != NULL &&
+            options->width > 0 && options->height > 0 && options->encoders > 0 &&
+            EncoderFormat (format.c_str ()) >= 0);
+}
+
+int
+main (int argc, char **argv)
+{
+    options_t options;
+    if (!ParseOptions (&options, argc, argv))
+    {
+        PrintUsage (argv[0]);
+        return (1);
+    }
+
+    manifest_t manifest = {};
+    manifest.outputPath = options.outputPath;
+    manifest.format = options.format;
+    manifest.file = (strcmp (options.manifestPath, "-") == 0) ?
+        stdin : fopen (options.manifestPath, "r");
+    if (manifest.file == NULL || getcwd (manifest.directory, sizeof (manifest.directory)) == NULL)
+    {
+        printf ("Could not open %s\n", options.manifestPath);
+        return (1);
+    }
+    if (mkdir (options.outputPath, 0755) != 0 && errno != EEXIST)
+    {
+        printf ("Could not create %s\n", options.outputPath);
+        return (1);
+    }
+
+    int jobSockets[2];
+    int resultSockets[2];
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, jobSockets) != 0 ||
+        socketpair (AF_UNIX, SOCK_SEQPACKET, 0, resultSockets) != 0)
+    {
+        printf ("Could not create the worker sockets\n");
+        return (1);
+    }
+
+    // Contexts are created after the fork, EGL state does not survive one
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now ();
+    fflush (stdout);
+    std::vector<pid_t> workers;
+    for (int w=0 ; w<options.workers ; w++)
+    {
+        pid_t pid = fork ();
+        if (pid == 0)
+        {
+            close (jobSockets[0]);
+            close (resultSockets[0]);
+            int status = RunWorker (w, jobSockets[1], resultSockets[1], &options);
+            fflush (stdout);
+            _exit (status);
+        }
+        if (pid > 0)
+        {
+            workers.push_back (pid);
+        }
+    }
+    close (jobSockets[1]);
+    close (resultSockets[1]);
+
+    // Batches are parsed as the job socket has room, so parsing runs while
+    // the workers render. The result socket ends once every worker is gone
+    std::vector<thumbnail_result_t> results;
+    std::chrono::high_resolution_clock::time_point firstResult = start;
+    unsigned int sent = 0;
+    int parsing = !workers.empty ();
+    if (!parsing)
+    {
+        shutdown (jobSockets[0], SHUT_WR);
+    }
+    for (;;)
+    {
+        struct pollfd fds[2] = {
+            { jobSockets[0], (short) (parsing ? POLLOUT : 0), 0 },
+            { resultSockets[0], POLLIN, 0 },
+        };
+        if (poll (fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (parsing && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+        {
+            thumbnail_batch_t batch;
+            int more = ManifestNextBatch (&manifest, &batch);
+            size_t size = offsetof (thumbnail_batch_t, poses) +
+                          sizeof (thumbnail_pose_t)*batch.count;
+            if (more && send (jobSockets[0], &batch, size, MSG_NOSIGNAL) == (ssize_t) size)
+            {
+                sent += batch.count;
+            }
+            else
+            {
+                // Done, or every worker is gone
+                parsing = 0;
+                shutdown (jobSockets[0], SHUT_WR);
+            }
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            thumbnail_result_t result;
+            ssize_t size = recv (resultSockets[0], &result, sizeof (result), 0);
+            if (size == (ssize_t) sizeof (result))
+            {
+                if (results.empty ())
+                {
+                    firstResult = std::chrono::high_resolution_clock::now ();
+                }
+                results.push_back (result);
+                if (!result.ok)
+                {
+                    printf ("Manifest line %u failed\n", result.line);
+                }
+            }
+            else if (size == 0 || (size < 0 && errno != EINTR))
+            {
+                break;
+            }
+        }
+    }
+    float seconds = Milliseconds (start)*0.001f;
+    float steadySeconds = Milliseconds (firstResult)*0.001f;
+
+    int failedWorkers = 0;
+    for (size_t w=0 ; w<workers.size () ; w++)
+    {
+        int status = 0;
+        waitpid (workers[w], &status, 0);
+        failedWorkers += !(WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    }
+    if (manifest.file != stdin)
+    {
+        fclose (manifest.file);
+    }
+
+    unsigned int rendered = 0;
+    unsigned int loads = 0;
+    float renderTotal = 0.f;
+    float writeTotal = 0.f;
+    float loadTotal = 0.f;
+    for (size_t i=0 ; i<results.size () ; i++)
+    {
+        thumbnail_result_t *result = &results[i];
+        rendered += result->ok;
+        renderTotal += result->renderMilliseconds;
+        writeTotal += result->writeMilliseconds;
+        if (result->loadMilliseconds > 0.f)
+        {
+            loads++;
+            loadTotal += result->loadMilliseconds;
+        }
+    }
+
+    // Start up is the worker's ztrInit, the steady rate leaves it out
+    printf ("%u of %u renders at %dx%d in %.2f s with %d workers, %.1f renders/s, "
+            "%.1f renders/s after start up\n",
+            rendered, sent, options.width, options.height, seconds,
+            (int) workers.size (), rendered/std::max (seconds, 1e-3f),
+            (results.size () > 1) ?
+            (results.size () - 1)/std::max (steadySeconds, 1e-3f) : 0.f);
+    if (!results.empty ())
+    {
+        printf ("Per render %.2f ms drawing, %.2f ms reading back and encoding, "
+                "%u mesh loads of %.2f ms\n",
+                renderTotal/results.size (), writeTotal/results.size (),
+                loads, (loads > 0) ? loadTotal/loads : 0.f);
+    }
+    if (manifest.skipped > 0 || failedWorkers > 0 || sent != results.size ())
+    {
+        printf ("%u manifest lines skipped, %d workers failed, %u renders lost\n",
+                manifest.skipped, failedWorkers, sent - (unsigned int) results.size ());
+    }
+
+    return ((rendered == sent && manifest.skipped == 0 && failedWorkers == 0) ? 0 : 1);
+}
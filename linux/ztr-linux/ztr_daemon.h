@@ -0,0 +1,91 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_daemon.h
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Messages between the render daemon and its clients. They are fixed size
+// packets on a SOCK_SEQPACKET Unix socket, so every send is one message.
+//
+// Right after connecting the client receives DaemonMessage_Hello with the
+// file descriptor of the image pool attached. The pool is slotCount slots
+// of slotSize bytes shared between the daemon and all clients. A finished
+// render is a DaemonMessage_Result naming the slot that holds its top down
+// RGBA pixels, written there by the GPU readback and never copied. The
+// slot belongs to the client until it sends DaemonMessage_Release.
+//
+
+#ifndef ZTR_DAEMON_H
+#define ZTR_DAEMON_H
+
+// MARK: Constants
+
+#define DAEMON_SOCKET_DEFAULT "/tmp/ztr-daemon.sock"
+#define DAEMON_PATH_SIZE 512
+
+// MARK: Enums
+
+enum daemon_message_t
+{
+    DaemonMessage_Hello,
+    DaemonMessage_Render,
+    DaemonMessage_Release,
+    DaemonMessage_Result,
+};
+
+enum daemon_status_t
+{
+    DaemonStatus_Ok,
+
+    // Size out of range, no mesh or an unknown message
+    DaemonStatus_BadRequest,
+
+    // Queue full, try again later
+    DaemonStatus_Busy,
+
+    DaemonStatus_LoadFailed,
+    DaemonStatus_RenderFailed,
+};
+
+// MARK: Structs
+
+// Client to daemon. Render uses everything, Release only the slot
+struct daemon_request_t
+{
+    unsigned int type;
+    unsigned int id;
+    unsigned int slot;
+
+    int width;
+    int height;
+    float yaw;
+    float pitch;
+    float orthScale;
+
+    // Absolute, the daemon does not share the client's working directory
+    char meshPath[DAEMON_PATH_SIZE];
+};
+
+// Daemon to client
+struct daemon_response_t
+{
+    unsigned int type;
+    unsigned int id;
+    int status;
+
+    // Result, the slot is only valid with DaemonStatus_Ok
+    unsigned int slot;
+    int width;
+    int height;
+
+    // Queued until a worker took the job, then rendering and reading back
+    float waitMilliseconds;
+    float renderMilliseconds;
+
+    // Hello, the size of the pool and the largest image it holds
+    unsigned int slotCount;
+    unsigned int slotSize;
+    int maxSize;
+};
+
+#endif
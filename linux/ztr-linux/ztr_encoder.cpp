@@ -0,0 +1,655 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_encoder.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Image encoding off the render thread. Captures from ztrFinishCapture are
+// handed to a pool of threads together with a path and written as PNG,
+// JPEG or PPM straight from the mapped readback buffer, the render thread
+// only collects finished ones to release their slots. A PNG is split into
+// bands of rows that are filtered and deflated on different threads and
+// then joined into one stream, so a single large screenshot is encoded in
+// parallel as well as many small thumbnails. Row filters are picked per
+// row among none, sub and up with SSE2 or NEON where available. Included
+// after ztr_headless.cpp.
+//
+
+// MARK: Includes
+
+#include <zlib.h>
+
+#ifdef ZTR_ENCODER_JPEG
+#include <jpeglib.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ZTR_ENCODER_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ZTR_ENCODER_NEON 1
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <strings.h>
+
+// MARK: Constants
+
+#define ENCODER_MAX_THREADS 32
+#define ENCODER_PATH_SIZE 512
+
+// Filtered PNG data deflated by one task. Every band starts a new deflate
+// block without the history of the previous one, which costs a fraction
+// of a percent at this size
+#define ENCODER_PNG_BAND_BYTES (256*1024)
+
+#define ENCODER_PNG_LEVEL_DEFAULT 6
+#define ENCODER_JPEG_QUALITY_DEFAULT 90
+
+// MARK: Enums
+
+enum image_format_t
+{
+    ImageFormat_PPM,
+    ImageFormat_PNG,
+    ImageFormat_JPEG,
+};
+
+enum png_filter_t
+{
+    PngFilter_None,
+    PngFilter_Sub,
+    PngFilter_Up,
+};
+
+// MARK: Structs
+
+struct encode_band_t
+{
+    std::vector<unsigned char> deflated;
+
+    // Of the filtered bytes, combined into the checksum of the stream
+    uLong adler;
+    uLong size;
+};
+
+struct encode_job_t
+{
+    ztr_capture_t capture;
+    image_format_t format;
+
+    // Deflate level of a PNG or quality of a JPEG, 0 for the default
+    int quality;
+    char path[ENCODER_PATH_SIZE];
+
+    std::chrono::high_resolution_clock::time_point submitted;
+    float milliseconds;
+
+    std::vector<encode_band_t> bands;
+    unsigned int bandRows;
+
+    // The task that finishes the last band writes the file
+    std::atomic<unsigned int> bandsLeft;
+    std::atomic<int> failed;
+};
+
+struct encode_task_t
+{
+    encode_job_t *job;
+    unsigned int band;
+};
+
+struct encode_result_t
+{
+    // To be released with ztrReleaseCapture
+    ztr_capture_t capture;
+
+    int written;
+
+    // From submitting to the file being closed
+    float milliseconds;
+};
+
+struct encoder_t
+{
+    std::thread threads[ENCODER_MAX_THREADS];
+    unsigned int threadCount;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::deque<encode_task_t> tasks;
+    std::deque<encode_job_t *> done;
+
+    // Submitted and not collected yet
+    unsigned int pending;
+    int quit;
+};
+
+// MARK: PNG
+
+// Sum of the bytes taken as signed, the usual estimate of how well a
+// filtered row compresses
+static unsigned int
+PngRowCost (const unsigned char *bytes, unsigned int count)
+{
+    unsigned int result = 0;
+    unsigned int i = 0;
+#if defined(ZTR_ENCODER_SSE)
+    __m128i zero = _mm_setzero_si128 ();
+    __m128i sum = zero;
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        __m128i value = _mm_loadu_si128 ((const __m128i *) (bytes + i));
+        __m128i magnitude = _mm_min_epu8 (value, _mm_sub_epi8 (zero, value));
+        sum = _mm_add_epi64 (sum, _mm_sad_epu8 (magnitude, zero));
+    }
+    result = (unsigned int) (_mm_cvtsi128_si32 (sum) +
+                             _mm_cvtsi128_si32 (_mm_srli_si128 (sum, 8)));
+#elif defined(ZTR_ENCODER_NEON)
+    uint32x4_t sum = vdupq_n_u32 (0);
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        uint8x16_t value = vld1q_u8 (bytes + i);
+        uint8x16_t magnitude =
+            vminq_u8 (value, vreinterpretq_u8_s8 (vnegq_s8 (vreinterpretq_s8_u8 (value))));
+        sum = vpadalq_u16 (sum, vpaddlq_u8 (magnitude));
+    }
+    result = vgetq_lane_u32 (sum, 0) + vgetq_lane_u32 (sum, 1) +
+             vgetq_lane_u32 (sum, 2) + vgetq_lane_u32 (sum, 3);
+#endif
+    for ( ; i<count ; i++)
+    {
+        result += (bytes[i] < 128) ? bytes[i] : 256 - bytes[i];
+    }
+    return (result);
+}
+
+// Difference to the byte a pixel to the left, or to the byte above
+static void
+PngSubtract (unsigned char *out, const unsigned char *row, const unsigned char *reference,
+             unsigned int count)
+{
+    unsigned int i = 0;
+#if defined(ZTR_ENCODER_SSE)
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (row + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (reference + i));
+        _mm_storeu_si128 ((__m128i *) (out + i), _mm_sub_epi8 (a, b));
+    }
+#elif defined(ZTR_ENCODER_NEON)
+    for ( ; i + 16 <= count ; i += 16)
+    {
+        vst1q_u8 (out + i, vsubq_u8 (vld1q_u8 (row + i), vld1q_u8 (reference + i)));
+    }
+#endif
+    for ( ; i<count ; i++)
+    {
+        out[i] = (unsigned char) (row[i] - reference[i]);
+    }
+}
+
+// Writes the filter byte and the row filtered the way that is estimated to
+// compress best. candidates holds two rows of scratch
+static void
+PngFilterRow (unsigned char *out, const unsigned char *row, const unsigned char *above,
+              unsigned int rowBytes, unsigned char *candidates)
+{
+    const int bpp = 3;
+    unsigned char *sub = candidates;
+    unsigned char *up = candidates + rowBytes;
+
+    memcpy (sub, row, bpp);
+    PngSubtract (sub + bpp, row + bpp, row, rowBytes - bpp);
+
+    png_filter_t filter = PngFilter_None;
+    const unsigned char *best = row;
+    unsigned int bestCost = PngRowCost (row, rowBytes);
+    unsigned int cost = PngRowCost (sub, rowBytes);
+    if (cost < bestCost)
+    {
+        filter = PngFilter_Sub;
+        best = sub;
+        bestCost = cost;
+    }
+    if (above != NULL)
+    {
+        PngSubtract (up, row, above, rowBytes);
+        if (PngRowCost (up, rowBytes) < bestCost)
+        {
+            filter = PngFilter_Up;
+            best = up;
+        }
+    }
+
+    out[0] = (unsigned char) filter;
+    memcpy (out + 1, best, rowBytes);
+}
+
+// Alpha is dropped, the renderer draws opaque frames
+inline void
+RGBAToRGB (unsigned char *out, const unsigned char *rgba, int width)
+{
+    for (int x=0 ; x<width ; x++)
+    {
+        out[x*3 + 0] = rgba[x*4 + 0];
+        out[x*3 + 1] = rgba[x*4 + 1];
+        out[x*3 + 2] = rgba[x*4 + 2];
+    }
+}
+
+// Filters and deflates the band's rows. All but the last band end on a
+// byte boundary without the final block, so the bands join into one stream
+static int
+EncodePNGBand (encode_job_t *job, unsigned int band)
+{
+    ztr_capture_t *capture = &job->capture;
+    unsigned int rowBytes = capture->width*3;
+    int first = band*job->bandRows;
+    int last = std::min (first + (int) job->bandRows, capture->height);
+
+    std::vector<unsigned char> filtered ((size_t) (last - first)*(rowBytes + 1));
+    std::vector<unsigned char> rows (rowBytes*4);
+    unsigned char *row = &rows[0];
+    unsigned char *above = row + rowBytes;
+    unsigned char *candidates = above + rowBytes;
+    if (first > 0)
+    {
+        RGBAToRGB (above, capture->pixels + (ptrdiff_t) (first - 1)*capture->stride,
+                   capture->width);
+    }
+    for (int y=first ; y<last ; y++)
+    {
+        RGBAToRGB (row, capture->pixels + (ptrdiff_t) y*capture->stride, capture->width);
+        PngFilterRow (&filtered[(size_t) (y - first)*(rowBytes + 1)], row,
+                      (y > 0) ? above : NULL, rowBytes, candidates);
+        std::swap (row, above);
+    }
+
+    encode_band_t *result = &job->bands[band];
+    result->size = (uLong) filtered.size ();
+    result->adler = adler32 (adler32 (0, NULL, 0), &filtered[0], (uInt) filtered.size ());
+
+    z_stream stream = {};
+    int level = (job->quality > 0) ? std::min (job->quality, 9) : ENCODER_PNG_LEVEL_DEFAULT;
+    if (deflateInit2 (&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return (0);
+    }
+
+    // The sync flush adds an empty stored block to the bound
+    result->deflated.resize (deflateBound (&stream, result->size) + 64);
+    stream.next_in = &filtered[0];
+    stream.avail_in = (uInt) filtered.size ();
+    stream.next_out = &result->deflated[0];
+    stream.avail_out = (uInt) result->deflated.size ();
+    int finish = (band + 1 == job->bands.size ());
+    int status = deflate (&stream, finish ? Z_FINISH : Z_SYNC_FLUSH);
+    int ok = finish ? (status == Z_STREAM_END) : (status == Z_OK && stream.avail_in == 0);
+    result->deflated.resize (stream.total_out);
+    deflateEnd (&stream);
+    return (ok);
+}
+
+inline void
+PutBigEndian (unsigned char *out, uLong value)
+{
+    out[0] = (unsigned char) (value >> 24);
+    out[1] = (unsigned char) (value >> 16);
+    out[2] = (unsigned char) (value >> 8);
+    out[3] = (unsigned char) value;
+}
+
+// Length, type, data and the CRC of type and data
+static void
+WritePNGChunk (FILE *file, const char *type, const unsigned char *data, uLong size)
+{
+    unsigned char header[8];
+    PutBigEndian (header, size);
+    memcpy (header + 4, type, 4);
+    fwrite (header, 1, 8, file);
+
+    // Empty chunks like IEND pass no data, and a NULL buffer would also
+    // restart the CRC
+    uLong crc = crc32 (0, header + 4, 4);
+    if (size > 0)
+    {
+        fwrite (data, 1, size, file);
+        crc = crc32 (crc, data, (uInt) size);
+    }
+    unsigned char trailer[4];
+    PutBigEndian (trailer, crc);
+    fwrite (trailer, 1, 4, file);
+}
+
+// Joins the deflated bands into the image data of one zlib stream
+static int
+WritePNG (encode_job_t *job)
+{
+    FILE *file = fopen (job->path, "wb");
+    if (file == NULL)
+    {
+        return (0);
+    }
+
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    fwrite (signature, 1, 8, file);
+
+    // 8 bit RGB, deflate, adaptive filters, not interlaced
+    unsigned char header[13] = {};
+    PutBigEndian (header, (uLong) job->capture.width);
+    PutBigEndian (header + 4, (uLong) job->capture.height);
+    header[8] = 8;
+    header[9] = 2;
+    WritePNGChunk (file, "IHDR", header, sizeof (header));
+
+    // zlib header, default compression with a 32K window
+    static const unsigned char streamHeader[2] = { 0x78, 0x9c };
+    uLong size = sizeof (streamHeader) + 4;
+    uLong adler = adler32 (0, NULL, 0);
+    for (size_t i=0 ; i<job->bands.size () ; i++)
+    {
+        encode_band_t *band = &job->bands[i];
+        size += (uLong) band->deflated.size ();
+        adler = adler32_combine (adler, band->adler, (z_off_t) band->size);
+    }
+
+    unsigned char chunk[8];
+    PutBigEndian (chunk, size);
+    memcpy (chunk + 4, "IDAT", 4);
+    fwrite (chunk, 1, 8, file);
+    uLong crc = crc32 (0, chunk + 4, 4);
+    fwrite (streamHeader, 1, sizeof (streamHeader), file);
+    crc = crc32 (crc, streamHeader, sizeof (streamHeader));
+    for (size_t i=0 ; i<job->bands.size () ; i++)
+    {
+        encode_band_t *band = &job->bands[i];
+        fwrite (&band->deflated[0], 1, band->deflated.size (), file);
+        crc = crc32 (crc, &band->deflated[0], (uInt) band->deflated.size ());
+    }
+    unsigned char trailer[8];
+    PutBigEndian (trailer, adler);
+    crc = crc32 (crc, trailer, 4);
+    PutBigEndian (trailer + 4, crc);
+    fwrite (trailer, 1, 8, file);
+
+    WritePNGChunk (file, "IEND", NULL, 0);
+    return (fclose (file) == 0);
+}
+
+// MARK: JPEG and PPM
+
+#ifdef ZTR_ENCODER_JPEG
+static int
+WriteJPEG (encode_job_t *job)
+{
+    FILE *file = fopen (job->path, "wb");
+    if (file == NULL)
+    {
+        return (0);
+    }
+
+    ztr_capture_t *capture = &job->capture;
+    struct jpeg_compress_struct compress;
+    struct jpeg_error_mgr error;
+    compress.err = jpeg_std_error (&error);
+    jpeg_create_compress (&compress);
+    jpeg_stdio_dest (&compress, file);
+    compress.image_width = capture->width;
+    compress.image_height = capture->height;
+
+    // libjpeg-turbo reads RGBA as it is, plain libjpeg gets RGB rows
+#ifdef JCS_EXTENSIONS
+    compress.input_components = 4;
+    compress.in_color_space = JCS_EXT_RGBX;
+#else
+    compress.input_components = 3;
+    compress.in_color_space = JCS_RGB;
+    std::vector<unsigned char> rgb (capture->width*3);
+#endif
+    jpeg_set_defaults (&compress);
+    jpeg_set_quality (&compress, (job->quality > 0) ? std::min (job->quality, 100) :
+                      ENCODER_JPEG_QUALITY_DEFAULT, TRUE);
+    jpeg_start_compress (&compress, TRUE);
+
+    while (compress.next_scanline < compress.image_height)
+    {
+        const unsigned char *pixels =
+            capture->pixels + (ptrdiff_t) compress.next_scanline*capture->stride;
+#ifdef JCS_EXTENSIONS
+        JSAMPROW row = (JSAMPROW) pixels;
+#else
+        RGBAToRGB (&rgb[0], pixels, capture->width);
+        JSAMPROW row = &rgb[0];
+#endif
+        jpeg_write_scanlines (&compress, &row, 1);
+    }
+
+    jpeg_finish_compress (&compress);
+    jpeg_destroy_compress (&compress);
+    return (fclose (file) == 0);
+}
+#endif
+
+static int
+WriteCapturePPM (encode_job_t *job)
+{
+    FILE *file = fopen (job->path, "wb");
+    if (file == NULL)
+    {
+        return (0);
+    }
+
+    ztr_capture_t *capture = &job->capture;
+    std::vector<unsigned char> rgb (capture->width*3);
+    fprintf (file, "P6\n%d %d\n255\n", capture->width, capture->height);
+    for (int y=0 ; y<capture->height ; y++)
+    {
+        RGBAToRGB (&rgb[0], capture->pixels + (ptrdiff_t) y*capture->stride, capture->width);
+        fwrite (&rgb[0], 1, rgb.size (), file);
+    }
+    return (fclose (file) == 0);
+}
+
+// MARK: Pool
+
+static void
+EncoderThread (encoder_t *encoder)
+{
+    for (;;)
+    {
+        encode_task_t task;
+        {
+            std::unique_lock<std::mutex> lock (encoder->mutex);
+            while (encoder->tasks.empty () && !encoder->quit)
+            {
+                encoder->wake.wait (lock);
+            }
+            if (encoder->tasks.empty ())
+            {
+                return;
+            }
+            task = encoder->tasks.front ();
+            encoder->tasks.pop_front ();
+        }
+
+        encode_job_t *job = task.job;
+        int ok = 1;
+        if (job->format == ImageFormat_PNG)
+        {
+            ok = EncodePNGBand (job, task.band);
+        }
+#ifdef ZTR_ENCODER_JPEG
+        else if (job->format == ImageFormat_JPEG)
+        {
+            ok = WriteJPEG (job);
+        }
+#endif
+        else
+        {
+            ok = WriteCapturePPM (job);
+        }
+        if (!ok)
+        {
+            job->failed = 1;
+        }
+        if (job->bandsLeft.fetch_sub (1) != 1)
+        {
+            continue;
+        }
+
+        if (job->format == ImageFormat_PNG && !job->failed && !WritePNG (job))
+        {
+            job->failed = 1;
+        }
+        if (job->failed)
+        {
+            printf ("Could not write %s\n", job->path);
+        }
+        job->bands.clear ();
+        job->milliseconds = Milliseconds (job->submitted);
+
+        std::lock_guard<std::mutex> lock (encoder->mutex);
+        encoder->done.push_back (job);
+        encoder->finished.notify_all ();
+    }
+}
+
+// 0 threads uses one per core
+static void
+InitEncoder (encoder_t *encoder, unsigned int threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max (1u, std::thread::hardware_concurrency ());
+    }
+    encoder->threadCount = std::min (threadCount, (unsigned int) ENCODER_MAX_THREADS);
+    encoder->pending = 0;
+    encoder->quit = 0;
+    for (unsigned int i=0 ; i<encoder->threadCount ; i++)
+    {
+        encoder->threads[i] = std::thread (EncoderThread, encoder);
+    }
+}
+
+// Finishes the queued images, collect them before to release their captures
+static void
+FreeEncoder (encoder_t *encoder)
+{
+    {
+        std::lock_guard<std::mutex> lock (encoder->mutex);
+        encoder->quit = 1;
+        encoder->wake.notify_all ();
+    }
+    for (unsigned int i=0 ; i<encoder->threadCount ; i++)
+    {
+        encoder->threads[i].join ();
+    }
+    encoder->threadCount = 0;
+
+    while (!encoder->done.empty ())
+    {
+        delete encoder->done.front ();
+        encoder->done.pop_front ();
+    }
+}
+
+// From the extension of the path, -1 when it is none of the formats
+static int
+EncoderFormat (const char *path)
+{
+    const char *extension = strrchr (path, '.');
+    if (extension == NULL)
+    {
+        return (-1);
+    }
+    if (strcasecmp (extension, ".png") == 0)
+    {
+        return (ImageFormat_PNG);
+    }
+#ifdef ZTR_ENCODER_JPEG
+    if (strcasecmp (extension, ".jpg") == 0 || strcasecmp (extension, ".jpeg") == 0)
+    {
+        return (ImageFormat_JPEG);
+    }
+#endif
+    if (strcasecmp (extension, ".ppm") == 0)
+    {
+        return (ImageFormat_PPM);
+    }
+    return (-1);
+}
+
+// Queues the capture to be written to the path. It stays mapped until the
+// result is collected, returns 0 when the path does not fit
+static int
+EncoderSubmit (encoder_t *encoder, const ztr_capture_t *capture, const char *path,
+               image_format_t format, int quality)
+{
+    if (strlen (path) >= ENCODER_PATH_SIZE)
+    {
+        return (0);
+    }
+
+    encode_job_t *job = new encode_job_t ();
+    job->capture = *capture;
+    job->format = format;
+    job->quality = quality;
+    strcpy (job->path, path);
+    job->submitted = std::chrono::high_resolution_clock::now ();
+    job->failed = 0;
+
+    unsigned int bandCount = 1;
+    if (format == ImageFormat_PNG)
+    {
+        unsigned int rowBytes = capture->width*3 + 1;
+        job->bandRows = std::max (1u, ENCODER_PNG_BAND_BYTES/rowBytes);
+        bandCount = (capture->height + job->bandRows - 1)/job->bandRows;
+        job->bands.resize (bandCount);
+    }
+    job->bandsLeft = bandCount;
+
+    std::lock_guard<std::mutex> lock (encoder->mutex);
+    for (unsigned int i=0 ; i<bandCount ; i++)
+    {
+        encode_task_t task = { job, i };
+        encoder->tasks.push_back (task);
+    }
+    encoder->pending++;
+    encoder->wake.notify_all ();
+    return (1);
+}
+
+// Takes an image in the order they finished. With wait it blocks while any
+// is pending. Returns 0 when there is none
+static int
+EncoderCollect (encoder_t *encoder, encode_result_t *result, int wait)
+{
+    std::unique_lock<std::mutex> lock (encoder->mutex);
+    while (wait && encoder->done.empty () && encoder->pending > 0)
+    {
+        encoder->finished.wait (lock);
+    }
+    if (encoder->done.empty ())
+    {
+        return (0);
+    }
+
+    encode_job_t *job = encoder->done.front ();
+    encoder->done.pop_front ();
+    encoder->pending--;
+    lock.unlock ();
+
+    result->capture = job->capture;
+    result->written = !job->failed;
+    result->milliseconds = job->milliseconds;
+    delete job;
+    return (1);
+}
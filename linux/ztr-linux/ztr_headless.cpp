@@ -0,0 +1,488 @@
+//
+// See LICENSE.txt for this sample’s licensing information.
+//
+// ztr_headless.cpp
+// ZOZO Technologies Cross Platform Renderer Example
+//
+// Headless Linux platform layer. The context comes from EGL without any
+// window system: Mesa's surfaceless platform when the driver has it, the
+// default display with a 1x1 pbuffer otherwise, so the same code runs on a
+// GPU server, in a container with llvmpipe or on a desktop. The renderer
+// draws into a framebuffer object owned here and the result is read back
+// into memory, nothing is ever presented.
+//
+
+// MARK: Includes
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <chrono>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// MARK: Constants
+
+#ifndef ZTR_RESOURCE_DIR
+#define ZTR_RESOURCE_DIR "res"
+#endif
+
+// Frames drawn for one pose while shader variants are still compiling
+#define HEADLESS_MAX_POSE_FRAMES 100
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// MARK: Structs
+
+struct headless_t
+{
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+
+    int width;
+    int height;
+
+    // ES minor version of the context
+    int minor;
+};
+
+// MARK: Globals
+
+static std::string g_resourcePath = ZTR_RESOURCE_DIR;
+static std::string g_cachePath;
+
+// MARK: Platform functions
+
+// Resources are mapped until closeFile, absolute paths are taken as they
+// are so meshes can come from anywhere
+PLATFORM_OPEN_FILE(openFile)
+{
+    assert (fileName != NULL);
+    ztr_file_t result = {};
+
+    std::string path = (fileName[0] == '/') ?
+        std::string (fileName) : g_resourcePath + "/" + fileName;
+    int handle = open (path.c_str (), O_RDONLY);
+    if (handle < 0)
+    {
+        printf ("Could not open %s\n", path.c_str ());
+        return (result);
+    }
+
+    struct stat status;
+    if (fstat (handle, &status) == 0 && status.st_size > 0)
+    {
+        void *data = mmap (NULL, status.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+        if (data != MAP_FAILED)
+        {
+            result.data = data;
+            result.dataSize = (unsigned int) status.st_size;
+        }
+    }
+    close (handle);
+
+    return (result);
+}
+
+PLATFORM_CLOSE_FILE(closeFile)
+{
+    if (file->data != NULL)
+    {
+        munmap (file->data, file->dataSize);
+    }
+    *file = {};
+}
+
+PLATFORM_READ_CACHE_FILE(readCacheFile)
+{
+    assert (fileName != NULL);
+    ztr_file_t result = {};
+
+    std::string path = g_cachePath + "/" + fileName;
+    FILE *file = fopen (path.c_str (), "rb");
+    if (file != NULL)
+    {
+        fseek (file, 0, SEEK_END);
+        long size = ftell (file);
+        fseek (file, 0, SEEK_SET);
+
+        void *data = malloc (size);
+        if (size > 0 && fread (data, 1, size, file) == (size_t) size)
+        {
+            result.data = data;
+            result.dataSize = (unsigned int) size;
+        }
+        else
+        {
+            free (data);
+        }
+        fclose (file);
+    }
+
+    return (result);
+}
+
+PLATFORM_WRITE_CACHE_FILE(writeCacheFile)
+{
+    assert (fileName != NULL);
+
+    // Written next to the entry and renamed so readers never see half a
+    // file, other processes may share the cache
+    std::string path = g_cachePath + "/" + fileName;
+    char temporarySuffix[32];
+    snprintf (temporarySuffix, sizeof (temporarySuffix), ".%d.tmp", (int) getpid ());
+    std::string temporaryPath = path + temporarySuffix;
+    FILE *file = fopen (temporaryPath.c_str (), "wb");
+    if (file == NULL)
+    {
+        return (0);
+    }
+
+    int written = fwrite (data, 1, dataSize, file) == dataSize;
+    written = (fclose (file) == 0) && written;
+    if (!written || rename (temporaryPath.c_str (), path.c_str ()) != 0)
+    {
+        remove (temporaryPath.c_str ());
+        return (0);
+    }
+
+    return (1);
+}
+
+PLATFORM_GET_TIME(getTime)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((double) now.tv_sec + (double) now.tv_nsec*1e-9);
+}
+
+// MARK: Functions
+
+// $XDG_CACHE_HOME/ztr or ~/.cache/ztr, empty when neither can be made
+static void
+HeadlessSetPaths (const char *resourcePath)
+{
+    if (resourcePath != NULL)
+    {
+        g_resourcePath = resourcePath;
+    }
+
+    const char *cacheHome = getenv ("XDG_CACHE_HOME");
+    const char *home = getenv ("HOME");
+    std::string base;
+    if (cacheHome != NULL && cacheHome[0] != '\0')
+    {
+        base = cacheHome;
+    }
+    else if (home != NULL && home[0] != '\0')
+    {
+        base = std::string (home) + "/.cache";
+    }
+
+    g_cachePath.clear ();
+    if (!base.empty ())
+    {
+        std::string path = base + "/ztr";
+        mkdir (base.c_str (), 0755);
+        if (mkdir (path.c_str (), 0755) == 0 || errno == EEXIST)
+        {
+            g_cachePath = path;
+        }
+    }
+}
+
+// Fills the platform API. The clock is left out on purpose: every ztrDraw
+// then advances one fixed step, so the same frame count gives the same
+// image on any machine. Hosts that want real time set getTime themselves
+static void
+HeadlessPlatform (ztr_platform_api_t *platform)
+{
+    *platform = {};
+    platform->openFile = openFile;
+    platform->closeFile = closeFile;
+    if (!g_cachePath.empty ())
+    {
+        platform->readCacheFile = readCacheFile;
+        platform->writeCacheFile = writeCacheFile;
+    }
+}
+
+static EGLDisplay
+HeadlessDisplay (int *surfaceless)
+{
+    *surfaceless = 0;
+
+    const char *extensions = eglQueryString (EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress ("eglGetPlatformDisplayEXT");
+    if (extensions != NULL && getPlatformDisplay != NULL &&
+        strstr (extensions, "EGL_MESA_platform_surfaceless") != NULL)
+    {
+        EGLDisplay display = getPlatformDisplay (EGL_PLATFORM_SURFACELESS_MESA,
+                                                 EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY && eglInitialize (display, NULL, NULL))
+        {
+            *surfaceless = 1;
+            return (display);
+        }
+    }
+
+    EGLDisplay display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize (display, NULL, NULL))
+    {
+        return (display);
+    }
+
+    return (EGL_NO_DISPLAY);
+}
+
+static void
+HeadlessDestroy (headless_t *headless)
+{
+    if (headless->display == EGL_NO_DISPLAY)
+    {
+        return;
+    }
+
+    if (headless->framebuffer != 0)
+    {
+        glDeleteFramebuffers (1, &headless->framebuffer);
+        glDeleteRenderbuffers (1, &headless->color);
+        glDeleteRenderbuffers (1, &headless->depth);
+    }
+
+    eglMakeCurrent (headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (headless->surface != EGL_NO_SURFACE)
+    {
+        eglDestroySurface (headless->display, headless->surface);
+    }
+    if (headless->context != EGL_NO_CONTEXT)
+    {
+        eglDestroyContext (headless->display, headless->context);
+    }
+    eglTerminate (headless->display);
+
+    *headless = {};
+}
+
+static int
+HeadlessCreateTargets (headless_t *headless, int width, int height)
+{
+    headless->width = width;
+    headless->height = height;
+
+    if (headless->framebuffer == 0)
+    {
+        glGenFramebuffers (1, &headless->framebuffer);
+        glGenRenderbuffers (1, &headless->color);
+        glGenRenderbuffers (1, &headless->depth);
+    }
+
+    glBindRenderbuffer (GL_RENDERBUFFER, headless->color);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer (GL_RENDERBUFFER, headless->depth);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer (GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer (GL_FRAMEBUFFER, headless->framebuffer);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_RENDERBUFFER, headless->color);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                               GL_RENDERBUFFER, headless->depth);
+
+    GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        printf ("Headless framebuffer %dx%d incomplete: 0x%x\n", width, height, status);
+        return (0);
+    }
+
+    return (1);
+}
+
+// Creates the context, makes it current and binds a width x height
+// framebuffer. Returns 0 when no ES 3 context could be made
+static int
+HeadlessCreate (headless_t *headless, int width, int height)
+{
+    *headless = {};
+
+    int surfaceless = 0;
+    headless->display = HeadlessDisplay (&surfaceless);
+    if (headless->display == EGL_NO_DISPLAY)
+    {
+        printf ("No EGL display\n");
+        return (0);
+    }
+    eglBindAPI (EGL_OPENGL_ES_API);
+
+    EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig (headless->display, configAttributes, &config, 1, &configCount) ||
+        configCount == 0)
+    {
+        printf ("No EGL config for ES 3\n");
+        HeadlessDestroy (headless);
+        return (0);
+    }
+
+    // Newest first, the cluster cull runs on the GPU from 3.1
+    for (int minor=2 ; minor>=0 && headless->context == EGL_NO_CONTEXT ; minor--)
+    {
+        EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, minor,
+            EGL_NONE,
+        };
+        headless->context = eglCreateContext (headless->display, config,
+                                              EGL_NO_CONTEXT, contextAttributes);
+        headless->minor = minor;
+    }
+    if (headless->context == EGL_NO_CONTEXT)
+    {
+        printf ("No ES 3 context\n");
+        HeadlessDestroy (headless);
+        return (0);
+    }
+
+    // Without surfaceless contexts a tiny pbuffer stands in for the window
+    headless->surface = EGL_NO_SURFACE;
+    if (!surfaceless)
+    {
+        EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        headless->surface = eglCreatePbufferSurface (headless->display, config,
+                                                     surfaceAttributes);
+    }
+    if (!eglMakeCurrent (headless->display, headless->surface, headless->surface,
+                         headless->context))
+    {
+        printf ("Could not make the context current: 0x%x\n", eglGetError ());
+        HeadlessDestroy (headless);
+        return (0);
+    }
+
+    printf ("Headless ES 3.%d on %s, %s\n", headless->minor,
+            (const char *) glGetString (GL_RENDERER),
+            surfaceless ? "surfaceless" : "pbuffer");
+
+    if (!HeadlessCreateTargets (headless, width, height))
+    {
+        HeadlessDestroy (headless);
+        return (0);
+    }
+
+    return (1);
+}
+
+// New storage for the framebuffer, the renderer is told with ztrResize
+static int
+HeadlessResize (headless_t *headless, int width, int height)
+{
+    if (width == headless->width && height == headless->height)
+    {
+        glBindFramebuffer (GL_FRAMEBUFFER, headless->framebuffer);
+        return (1);
+    }
+    return (HeadlessCreateTargets (headless, width, height));
+}
+
+// Tightly packed RGBA rows, top row first
+static void
+HeadlessReadPixels (headless_t *headless, unsigned char *pixels)
+{
+    int width = headless->width;
+    int height = headless->height;
+    size_t rowSize = (size_t) width*4;
+
+    glBindFramebuffer (GL_FRAMEBUFFER, headless->framebuffer);
+    glPixelStorei (GL_PACK_ALIGNMENT, 1);
+    glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    // GL starts at the bottom row
+    std::vector<unsigned char> row (rowSize);
+    for (int y=0 ; y<height/2 ; y++)
+    {
+        unsigned char *top = pixels + y*rowSize;
+        unsigned char *bottom = pixels + (height - 1 - y)*rowSize;
+        memcpy (&row[0], top, rowSize);
+        memcpy (top, bottom, rowSize);
+        memcpy (bottom, &row[0], rowSize);
+    }
+}
+
+// Puts the camera at a pose and draws until no shader variant is pending,
+// one frame otherwise. Thumbnails and render jobs start from here
+static void
+HeadlessDrawPose (float yaw, float pitch, float orthScale)
+{
+    ztr_hid_t hid = {};
+    ztrSetCamera (yaw, pitch, orthScale);
+
+    int frames = 1;
+    int frame = ztrDraw (0, hid);
+    while ((frame & ZTR_FRAME_ANIMATING) && frames < HEADLESS_MAX_POSE_FRAMES)
+    {
+        frame = ztrDraw (0, hid);
+        frames++;
+    }
+}
+
+inline float
+Milliseconds (std::chrono::high_resolution_clock::time_point start)
+{
+    std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::high_resolution_clock::now () - start;
+    return (elapsed.count ());
+}
+
+// Binary PPM of top down RGBA pixels, alpha is dropped. Returns 0 on failure
+static int
+WritePPM (const char *path, const unsigned char *pixels, int width, int height)
+{
+    FILE *file = fopen (path, "wb");
+    if (file == NULL)
+    {
+        printf ("Could not write %s\n", path);
+        return (0);
+    }
+
+    fprintf (file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row ((size_t) width*3);
+    int written = 1;
+    for (int y=0 ; y<height && written ; y++)
+    {
+        const unsigned char *source = pixels + (size_t) y*width*4;
+        for (int x=0 ; x<width ; x++)
+        {
+            row[x*3 + 0] = source[x*4 + 0];
+            row[x*3 + 1] = source[x*4 + 1];
+            row[x*3 + 2] = source[x*4 + 2];
+        }
+        written = fwrite (&row[0], 1, row.size (), file) == row.size ();
+    }
+
+    return ((fclose (file) == 0) && written);
+}
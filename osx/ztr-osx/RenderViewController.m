@@ -6,6 +6,7 @@
 //
 
 #include <sys/mman.h>
+#include <mach/mach_time.h>
 
 #import "RenderViewController.h"
 #import "ztr_platform_abstraction_layer.h"
@@ -96,6 +97,55 @@ PLATFORM_OPEN_FILE (openFile)
     return (result);
 }
 
+// Caches of a non sandboxed app are shared, so entries go in a directory
+// named after the bundle
+static NSString *
+cacheFilePath (const char *fileName)
+{
+    NSString *directory =
+        NSSearchPathForDirectoriesInDomains (NSCachesDirectory,
+                                             NSUserDomainMask, YES).firstObject;
+    directory = [directory stringByAppendingPathComponent:
+                     [[NSBundle mainBundle] bundleIdentifier]];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:nil];
+    return [directory stringByAppendingPathComponent:
+                [NSString stringWithUTF8String:fileName]];
+}
+
+PLATFORM_READ_CACHE_FILE (readCacheFile)
+{
+    ztr_file_t result = {};
+
+    NSData *data = [NSData dataWithContentsOfFile:cacheFilePath (fileName)];
+    if (data.length > 0)
+    {
+        result.data = malloc (data.length);
+        memcpy (result.data, data.bytes, data.length);
+        result.dataSize = (unsigned int) data.length;
+    }
+
+    return (result);
+}
+
+PLATFORM_WRITE_CACHE_FILE (writeCacheFile)
+{
+    NSData *contents = [NSData dataWithBytes:data length:dataSize];
+    return ([contents writeToFile:cacheFilePath (fileName) atomically:YES] ? 1 : 0);
+}
+
+PLATFORM_GET_TIME (getTime)
+{
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+    {
+        mach_timebase_info (&timebase);
+    }
+    return ((double) mach_absolute_time ()*timebase.numer/timebase.denom*1e-9);
+}
+
 - (void) prepareOpenGL
 {
     [super prepareOpenGL];
@@ -119,6 +169,9 @@ PLATFORM_OPEN_FILE (openFile)
                                                object:[self window]];
 
     g_platform.openFile = openFile;
+    g_platform.readCacheFile = readCacheFile;
+    g_platform.writeCacheFile = writeCacheFile;
+    g_platform.getTime = getTime;
     ztrInit(&g_platform);
 }
 
@@ -136,6 +189,8 @@ PLATFORM_OPEN_FILE (openFile)
 
 - (void) drawRect: (NSRect) theRect
 {
+    // The system asks for the whole view, not only for changes
+    ztrInvalidate();
 	[self drawView];
 }
 
@@ -145,11 +200,15 @@ PLATFORM_OPEN_FILE (openFile)
 
 	CGLLockContext([[self openGLContext] CGLContextObj]);
 
-    ztrDraw(0, g_hid);
+    int frame = ztrDraw(0, g_hid);
 
     g_hid.mouseTransition = 0;
 
-	CGLFlushDrawable([[self openGLContext] CGLContextObj]);
+    // Nothing changed, the window keeps the last flushed frame
+    if (frame & ZTR_FRAME_DRAWN)
+    {
+        CGLFlushDrawable([[self openGLContext] CGLContextObj]);
+    }
 	CGLUnlockContext([[self openGLContext] CGLContextObj]);
 }
 
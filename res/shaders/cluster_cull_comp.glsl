@@ -0,0 +1,123 @@
+precision highp float;
+precision highp int;
+
+// One work group per cluster. The first invocation tests the mesh and the
+// cluster and reserves room in the draw command of the mesh, then the
+// whole group copies the cluster's indices into the mesh stream.
+#define GROUP_SIZE 64u
+
+layout (local_size_x = 64) in;
+
+// Must match gpu_cull_mesh_t
+struct CullMesh
+{
+    // Frustum planes in model space
+    vec4 planes[6];
+    // xyz model space view direction, w is 1 when the cone test applies
+    vec4 forward;
+    vec4 boxCenter;
+    vec4 boxExtent;
+    // x first index, y stream offset, z enabled
+    uvec4 ranges;
+};
+
+// Must match gpu_cull_cluster_t
+struct CullCluster
+{
+    vec4 center;
+    vec4 extent;
+    // xyz axis, w cutoff
+    vec4 cone;
+    // x first index relative to the mesh, y index count, z mesh
+    uvec4 range;
+};
+
+layout (std430, binding = 0) readonly buffer MeshBuffer
+{
+    CullMesh meshes[];
+};
+
+layout (std430, binding = 1) readonly buffer ClusterBuffer
+{
+    CullCluster clusters[];
+};
+
+// DrawElementsIndirectCommand per mesh, five words each
+layout (std430, binding = 2) buffer CommandBuffer
+{
+    uint commands[];
+};
+
+// The arena index buffer, sources and streams never overlap
+layout (std430, binding = 3) buffer IndexBuffer
+{
+    uint indices[];
+};
+
+uniform uint clusterCount;
+
+shared uint destination;
+shared uint visible;
+
+bool
+boxVisible (CullMesh mesh, vec3 center, vec3 extent)
+{
+    for (int i=0 ; i<6 ; i++)
+    {
+        vec4 plane = mesh.planes[i];
+        float d = dot (plane.xyz, center) + dot (abs (plane.xyz), extent) + plane.w;
+        if (d < 0.0)
+        {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+void
+main ()
+{
+    // Groups past the last cluster still reach the barrier, a barrier after
+    // a return in main does not compile on conforming drivers
+    uint index = gl_WorkGroupID.x + gl_WorkGroupID.y*gl_NumWorkGroups.x;
+    bool inRange = index < clusterCount;
+
+    CullCluster cluster;
+    CullMesh mesh;
+    if (inRange)
+    {
+        cluster = clusters[index];
+        mesh = meshes[cluster.range.z];
+    }
+
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        bool pass = inRange && mesh.ranges.z != 0u &&
+                    boxVisible (mesh, mesh.boxCenter.xyz, mesh.boxExtent.xyz) &&
+                    boxVisible (mesh, cluster.center.xyz, cluster.extent.xyz);
+
+        // Back facing when the whole normal cone points along the view
+        if (pass && mesh.forward.w != 0.0)
+        {
+            pass = dot (cluster.cone.xyz, mesh.forward.xyz) <= cluster.cone.w;
+        }
+
+        visible = pass ? 1u : 0u;
+        if (pass)
+        {
+            destination = atomicAdd (commands[cluster.range.z*5u], cluster.range.y);
+        }
+    }
+
+    barrier ();
+
+    if (visible != 0u)
+    {
+        uint source = mesh.ranges.x + cluster.range.x;
+        uint dest = mesh.ranges.y + destination;
+        for (uint i=gl_LocalInvocationIndex ; i<cluster.range.y ; i+=GROUP_SIZE)
+        {
+            indices[dest + i] = indices[source + i];
+        }
+    }
+}
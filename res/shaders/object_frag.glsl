@@ -6,10 +6,41 @@ out vec4 color;
 uniform vec3 objectColor;
 uniform vec3 lightColor;
 
-uniform vec3 lightPos;
+// Per frame data, std140, must match frame_uniforms_t and the block in
+// object_vert.glsl
+layout (std140) uniform FrameBlock
+{
+    highp mat4 view;
+    highp mat4 projection;
+    highp vec4 lightPos;
+    highp vec4 cameraPos;
+
+    // xyz axis, w enabled
+    highp vec4 contourAxis;
+    // x spacing, y offset, z width in pixels
+    highp vec4 contourParams;
+    highp vec4 contourColor;
+};
 
 in vec3 fragNormal;
-in vec3 fragPos;
+in highp vec3 fragPos;
+
+#ifdef INSTANCED
+in vec4 fragColor;
+#endif
+
+float contourLine()
+{
+    // Keep the band position in highp, mediump runs out of bits at a few
+    // hundred bands
+    highp float band =
+        (dot(contourAxis.xyz, fragPos) - contourParams.y)/contourParams.x;
+    highp float bandDistance = abs(fract(band - 0.5) - 0.5);
+
+    // Screen space derivative keeps the line width constant in pixels
+    float pixels = bandDistance/max(fwidth(band), 1e-6);
+    return 1.0 - clamp(pixels - 0.5*contourParams.z + 0.5, 0.0, 1.0);
+}
 
 void main()
 {
@@ -17,13 +48,28 @@ void main()
     vec3 ambient = ambientStrength*lightColor;
 
     vec3 norm = normalize(fragNormal);
-    vec3 lightDir = normalize(lightPos - fragPos);
+    vec3 lightDir = normalize(lightPos.xyz - fragPos);
 
     float diff = max(dot(fragNormal, lightDir), 0.0);
     vec3 diffuse = diff * lightColor;
 
-    vec3 result = (lightColor*0.8f + diffuse*0.55f)*objectColor;
+#ifdef INSTANCED
+    vec3 baseColor = fragColor.rgb;
+    float alpha = fragColor.a;
+#else
+    vec3 baseColor = objectColor;
+    float alpha = 1.0f;
+#endif
+
+    vec3 result = (lightColor*0.8f + diffuse*0.55f)*baseColor;
+
+    // Iso-lines of dot(contourAxis, fragPos)
+    if (contourAxis.w != 0.0)
+    {
+        result = mix(result, contourColor.rgb, contourLine());
+    }
 
-    color = vec4(result, 1.0f);
+    // Blending expects premultiplied alpha
+    color = vec4(result*alpha, alpha);
 }
 
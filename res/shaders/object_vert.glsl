@@ -5,20 +5,57 @@ precision mediump float;
 #if __VERSION__ >= 140
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 inNormal;
+
+#ifdef INSTANCED
+// Per instance transform after the mesh model matrix, and color
+layout (location = 2) in highp mat4 instanceModel;
+layout (location = 6) in vec4 instanceColor;
+#endif
 #endif
 
-uniform mat4 rotate;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per frame data, std140, must match frame_uniforms_t and the block in
+// object_frag.glsl
+layout (std140) uniform FrameBlock
+{
+    highp mat4 view;
+    highp mat4 projection;
+    highp vec4 lightPos;
+    highp vec4 cameraPos;
+
+    // xyz axis, w enabled
+    highp vec4 contourAxis;
+    // x spacing, y offset, z width in pixels
+    highp vec4 contourParams;
+    highp vec4 contourColor;
+};
+
+// Per mesh data from the uniform ring, must match mesh_uniforms_t
+layout (std140) uniform MeshBlock
+{
+    highp mat4 model;
+    highp mat4 rotate;
+};
 
 out vec3 fragNormal;
-out vec3 fragPos;
+out highp vec3 fragPos;
+
+#ifdef INSTANCED
+out vec4 fragColor;
+#endif
 
 void main()
 {
-    gl_Position = projection*view*model*vec4(position, 1.0f);
+#ifdef INSTANCED
+    highp mat4 world = model*instanceModel;
+    vec3 normal = mat3(instanceModel)*inNormal;
+    fragColor = instanceColor;
+#else
+    highp mat4 world = model;
+    vec3 normal = inNormal;
+#endif
+
+    gl_Position = projection*view*world*vec4(position, 1.0f);
 
-    fragPos = vec3 (model*vec4(position, 1.0f));
-    fragNormal = normalize(vec3 (rotate*vec4(inNormal, 1.0f)));
+    fragPos = vec3 (world*vec4(position, 1.0f));
+    fragNormal = normalize(vec3 (rotate*vec4(normal, 1.0f)));
 }
@@ -0,0 +1,13 @@
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+out vec4 color;
+
+in vec4 fragColor;
+
+void main()
+{
+    // Blending expects premultiplied alpha
+    color = vec4(fragColor.rgb*fragColor.a, fragColor.a);
+}
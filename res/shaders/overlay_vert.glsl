@@ -0,0 +1,34 @@
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+#if __VERSION__ >= 140
+// xyz world position, w point size in pixels
+layout (location = 0) in highp vec4 position;
+layout (location = 1) in vec4 inColor;
+#endif
+
+// Per frame data, std140, must match frame_uniforms_t and the block in
+// object_vert.glsl
+layout (std140) uniform FrameBlock
+{
+    highp mat4 view;
+    highp mat4 projection;
+    highp vec4 lightPos;
+    highp vec4 cameraPos;
+
+    // xyz axis, w enabled
+    highp vec4 contourAxis;
+    // x spacing, y offset, z width in pixels
+    highp vec4 contourParams;
+    highp vec4 contourColor;
+};
+
+out vec4 fragColor;
+
+void main()
+{
+    gl_Position = projection*view*vec4(position.xyz, 1.0f);
+    gl_PointSize = position.w;
+    fragColor = inColor;
+}